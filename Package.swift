@@ -131,6 +131,23 @@ let package = Package(
             ]
         ),
 
+        // MARK: - Benchmarks
+
+        .executableTarget(
+            name: "StandardCyborgFusionBenchmark",
+            dependencies: ["StandardCyborgFusion"],
+            path: "StandardCyborgFusion/Benchmark",
+            cxxSettings: [
+                .unsafeFlags(["-Os", "-fno-math-errno"]),
+                .headerSearchPath("../Sources/StandardCyborgFusion/Algorithm"),
+                .headerSearchPath("../Sources/StandardCyborgFusion/DataStructures"),
+                .headerSearchPath("../Sources/StandardCyborgFusion/Helpers"),
+                .headerSearchPath("../Sources/StandardCyborgFusion/IO"),
+                .headerSearchPath("../Sources/StandardCyborgFusion/Private"),
+                .headerSearchPath("../Sources/include/StandardCyborgFusion"),
+            ]
+        ),
+
         // MARK: - Tests
 
         .testTarget(
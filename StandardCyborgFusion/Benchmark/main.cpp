@@ -0,0 +1,238 @@
+//
+//  main.cpp
+//  StandardCyborgFusionBenchmark
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+//  Replays a directory of recorded raw frame PLYs through OfflineReconstructor and
+//  reports per-frame latency percentiles, a breakdown by pipeline stage, throughput and
+//  peak surfel count.
+//
+//  Usage: StandardCyborgFusionBenchmark [frames directory] [--repeat N] [--threads N] [--projective] [--pyramid] [--motion-model] [--max-surfels N] [--skip-redundant F] [--output path.ply]
+//
+
+#import <algorithm>
+#import <chrono>
+#import <cstdio>
+#import <cstdlib>
+#import <cstring>
+#import <memory>
+#import <string>
+#import <thread>
+#import <vector>
+
+#import <standard_cyborg/util/TaskScheduler.hpp>
+
+#import "CpuDepthProcessor.hpp"
+#import "CpuSurfelIndexMap.hpp"
+#import "OfflineReconstructor.hpp"
+
+// Relative to the repository root. A 90 frame ear-to-ear scan, long enough for ICP and
+// culling to dominate the way they do in a real scan.
+static const char* kDefaultFramesDirectory = "StandardCyborgFusion/Tests/StandardCyborgFusionTests/Data/sven-ear-to-ear-lo-res/DepthFrames";
+
+struct _Stage {
+    const char* name;
+    double PBFAssimilatedFrameMetadata::*duration;
+};
+
+static const _Stage kStages[] = {
+    { "Depth processing", &PBFAssimilatedFrameMetadata::depthProcessingDuration },
+    { "ICP downsampling", &PBFAssimilatedFrameMetadata::icpSourceDownsamplingDuration },
+    { "ICP target update", &PBFAssimilatedFrameMetadata::icpTargetUpdateDuration },
+    { "ICP", &PBFAssimilatedFrameMetadata::icpDuration },
+    { "Index map draw", &PBFAssimilatedFrameMetadata::surfelIndexMapDrawDuration },
+    { "Fusion", &PBFAssimilatedFrameMetadata::fusionDuration },
+    { "Culling", &PBFAssimilatedFrameMetadata::cullingDuration },
+};
+
+static const size_t kStageCount = sizeof(kStages) / sizeof(kStages[0]);
+
+static double _percentile(const std::vector<double>& sortedValues, double fraction)
+{
+    if (sortedValues.empty()) { return 0; }
+
+    size_t index = (size_t)(fraction * (sortedValues.size() - 1) + 0.5);
+
+    return sortedValues[std::min(index, sortedValues.size() - 1)];
+}
+
+static void _printUsage(const char* executable)
+{
+    fprintf(stderr, "Usage: %s [frames directory] [--repeat N] [--threads N] [--projective] [--pyramid] [--motion-model] [--max-surfels N] [--skip-redundant F] [--output path.ply]\n", executable);
+    fprintf(stderr, "  frames directory    Directory of frame-*.ply raw frames (default: %s)\n", kDefaultFramesDirectory);
+    fprintf(stderr, "  --repeat N          Replay the sequence N times into a fresh model (default: 1)\n");
+    fprintf(stderr, "  --threads N         Worker threads for the shared task scheduler (default: hardware concurrency)\n");
+    fprintf(stderr, "  --projective        Use projective data association for ICP instead of a kd-tree\n");
+    fprintf(stderr, "  --pyramid           Align coarse depth pyramid levels before the full resolution ICP stage\n");
+    fprintf(stderr, "  --motion-model      Start ICP from a pose extrapolated from the last two merged frames\n");
+    fprintf(stderr, "  --max-surfels N     Keep the model within N surfels, merging and evicting past that\n");
+    fprintf(stderr, "  --skip-redundant F  Skip frames that barely moved and would add less than fraction F new surfels\n");
+    fprintf(stderr, "  --output path       Write the final point cloud to a PLY file\n");
+}
+
+int main(int argc, const char* argv[])
+{
+    std::string framesDirectory = kDefaultFramesDirectory;
+    std::string outputPath;
+    int repeatCount = 1;
+    int threadCount = standard_cyborg::util::TaskScheduler::defaultWorkerCount();
+    bool useProjectiveICP = false;
+    bool usePyramidICP = false;
+    bool useMotionModel = false;
+    size_t maxSurfelCount = 0;
+    float redundantFrameMaxNovelty = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        bool hasValue = i + 1 < argc;
+
+        if (strcmp(argv[i], "--repeat") == 0 && hasValue) {
+            repeatCount = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+            threadCount = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--projective") == 0) {
+            useProjectiveICP = true;
+        } else if (strcmp(argv[i], "--pyramid") == 0) {
+            usePyramidICP = true;
+        } else if (strcmp(argv[i], "--motion-model") == 0) {
+            useMotionModel = true;
+        } else if (strcmp(argv[i], "--max-surfels") == 0 && hasValue) {
+            maxSurfelCount = (size_t)std::max(0L, atol(argv[++i]));
+        } else if (strcmp(argv[i], "--skip-redundant") == 0 && hasValue) {
+            redundantFrameMaxNovelty = std::max(0.0f, (float)atof(argv[++i]));
+        } else if (strcmp(argv[i], "--output") == 0 && hasValue) {
+            outputPath = argv[++i];
+        } else if (argv[i][0] == '-') {
+            _printUsage(argv[0]);
+            return EXIT_FAILURE;
+        } else {
+            framesDirectory = argv[i];
+        }
+    }
+
+    // Everything in the pipeline runs on the shared scheduler, so this has to happen before anything uses it
+    if (!standard_cyborg::util::TaskScheduler::setSharedWorkerCount(threadCount)) {
+        fprintf(stderr, "The shared task scheduler was already created; unable to use %d threads\n", threadCount);
+        return EXIT_FAILURE;
+    }
+
+    std::vector<std::string> framePaths = OfflineReconstructor::findRawFramePaths(framesDirectory);
+    if (framePaths.empty()) {
+        fprintf(stderr, "No frame-*.ply raw frames found in %s\n", framesDirectory.c_str());
+        return EXIT_FAILURE;
+    }
+
+    // Read everything up front so that disk access isn't part of the measurement
+    std::vector<std::unique_ptr<RawFrame>> rawFrames;
+    for (const std::string& path : framePaths) {
+        std::unique_ptr<RawFrame> rawFrame = OfflineReconstructor::readRawFrame(path);
+        if (rawFrame == nullptr) {
+            fprintf(stderr, "Unable to read raw frame %s\n", path.c_str());
+            return EXIT_FAILURE;
+        }
+        rawFrames.push_back(std::move(rawFrame));
+    }
+
+    ICPConfiguration icpConfig;
+    icpConfig.threadCount = threadCount;
+    if (useProjectiveICP) {
+        icpConfig.correspondenceMode = ICPCorrespondenceMode::Projective;
+    }
+    if (usePyramidICP) {
+        icpConfig.coarseLevels = {
+            { 16, 4, 1e-3 },
+            { 8, 3, 1e-3 },
+        };
+    }
+
+    PBFConfiguration pbfConfig;
+    if (useMotionModel) {
+        pbfConfig.motionModelFrameCount = 2;
+    }
+    pbfConfig.maxSurfelCount = maxSurfelCount;
+    pbfConfig.redundantFrameMaxNovelty = redundantFrameMaxNovelty;
+
+    OfflineReconstructor reconstructor(std::make_shared<CpuDepthProcessor>(threadCount),
+                                       std::make_shared<CpuSurfelIndexMap>(threadCount),
+                                       pbfConfig,
+                                       icpConfig);
+
+    std::vector<double> frameLatencies;
+    frameLatencies.reserve(rawFrames.size() * repeatCount);
+    size_t peakSurfelCount = 0;
+    size_t mergedFrameCount = 0;
+    size_t icpIterationCount = 0;
+    size_t evictedSurfelCount = 0;
+    std::vector<std::vector<double>> stageDurations(kStageCount);
+
+    auto startTime = std::chrono::steady_clock::now();
+    for (int repeat = 0; repeat < repeatCount; ++repeat) {
+        reconstructor.reset();
+
+        for (const std::unique_ptr<RawFrame>& rawFrame : rawFrames) {
+            double processingSeconds = 0;
+            PBFAssimilatedFrameMetadata metadata = reconstructor.assimilate(*rawFrame, &processingSeconds);
+
+            frameLatencies.push_back(processingSeconds);
+            if (metadata.isMerged) { ++mergedFrameCount; }
+            icpIterationCount += metadata.icpIterationCount;
+            evictedSurfelCount += metadata.evictedSurfelCount;
+
+            for (size_t stage = 0; stage < kStageCount; ++stage) {
+                double duration = metadata.*kStages[stage].duration;
+                if (duration > 0) { stageDurations[stage].push_back(duration); }
+            }
+        }
+
+        peakSurfelCount = std::max(peakSurfelCount, reconstructor.getPeakSurfelCount());
+    }
+    double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    PBFFinalStatistics finalStatistics = reconstructor.finish();
+
+    if (!outputPath.empty() && !reconstructor.writePointCloudToPLYFile(outputPath)) {
+        fprintf(stderr, "Unable to write point cloud to %s\n", outputPath.c_str());
+        return EXIT_FAILURE;
+    }
+
+    // Stage shares are of the time spent processing frames, which leaves out resetting between repeats
+    double totalSeconds = 0;
+    for (double latency : frameLatencies) { totalSeconds += latency; }
+
+    std::vector<double> sortedLatencies(frameLatencies);
+    std::sort(sortedLatencies.begin(), sortedLatencies.end());
+
+    printf("Frames directory:   %s\n", framesDirectory.c_str());
+    printf("Frames:             %zu x %d repeats (%zu merged)\n", rawFrames.size(), repeatCount, mergedFrameCount);
+    printf("Threads:            %d\n", standard_cyborg::util::TaskScheduler::shared().getWorkerCount());
+    printf("ICP correspondence: %s\n", useProjectiveICP ? "projective" : "nearest neighbor");
+    printf("ICP coarse levels:  %zu\n", icpConfig.coarseLevels.size());
+    printf("ICP motion model:   %s\n", useMotionModel ? "constant velocity" : "none");
+    printf("ICP iterations:     %.2f per frame\n", (double)icpIterationCount / std::max(frameLatencies.size(), (size_t)1));
+    printf("Latency p50:        %.2f ms\n", 1000.0 * _percentile(sortedLatencies, 0.50));
+    printf("Latency p90:        %.2f ms\n", 1000.0 * _percentile(sortedLatencies, 0.90));
+    printf("Latency p99:        %.2f ms\n", 1000.0 * _percentile(sortedLatencies, 0.99));
+    printf("Latency max:        %.2f ms\n", 1000.0 * sortedLatencies.back());
+    printf("Throughput:         %.2f frames/sec (%.2f s wall clock)\n", frameLatencies.size() / std::max(wallSeconds, 1e-9), wallSeconds);
+    printf("Stages:             %-18s %8s %8s %8s\n", "", "p50 ms", "p90 ms", "share");
+    for (size_t stage = 0; stage < kStageCount; ++stage) {
+        std::vector<double>& durations = stageDurations[stage];
+        std::sort(durations.begin(), durations.end());
+
+        double stageSeconds = 0;
+        for (double duration : durations) { stageSeconds += duration; }
+
+        printf("                    %-18s %8.2f %8.2f %7.1f%%\n",
+               kStages[stage].name,
+               1000.0 * _percentile(durations, 0.50),
+               1000.0 * _percentile(durations, 0.90),
+               100.0 * stageSeconds / std::max(totalSeconds, 1e-9));
+    }
+    printf("Peak surfels:       %zu\n", peakSurfelCount);
+    printf("Final surfels:      %zu\n", reconstructor.getModel().getSurfelStore().size());
+    printf("Evicted surfels:    %zu\n", evictedSurfelCount);
+    printf("Failed frames:      %d\n", finalStatistics.failedFrameCount);
+    printf("Skipped frames:     %d\n", finalStatistics.skippedFrameCount);
+
+    return EXIT_SUCCESS;
+}
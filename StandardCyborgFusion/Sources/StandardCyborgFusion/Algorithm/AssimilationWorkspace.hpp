@@ -0,0 +1,137 @@
+//
+//  AssimilationWorkspace.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <memory>
+#import <vector>
+
+#import <standard_cyborg/math/Vec3.hpp>
+
+#if defined(__APPLE__)
+#import <TargetConditionals.h>
+#endif
+
+using namespace standard_cyborg;
+
+/** The correspondence for each source vertex, as a structure of arrays so that the normal
+ *  equations can be accumulated in branch-free, vectorizable loops. Vertices without a match
+ *  have a zero mask, a zero normal and a target equal to the source, so they add nothing.
+ */
+struct ICPCorrespondences {
+    std::vector<float> sourceX, sourceY, sourceZ;
+    std::vector<float> targetX, targetY, targetZ;
+    std::vector<float> normalX, normalY, normalZ;
+    std::vector<float> squaredErrors;
+    std::vector<float> matchMask;
+
+    size_t matchCount = 0;
+    double sumSquaredError = 0;
+
+    ICPCorrespondences() {}
+
+    ICPCorrespondences(size_t count) { resize(count); }
+
+    /** Sizes every array for `count` source vertices. Their contents are left for set() to
+     *  overwrite, and shrinking keeps the capacity for the next, possibly larger, source. */
+    void resize(size_t count)
+    {
+        for (std::vector<float>* array : { &sourceX, &sourceY, &sourceZ,
+                                           &targetX, &targetY, &targetZ,
+                                           &normalX, &normalY, &normalZ,
+                                           &squaredErrors, &matchMask }) {
+            array->resize(count);
+        }
+
+        matchCount = 0;
+        sumSquaredError = 0;
+    }
+
+    inline void set(size_t i, const math::Vec3& source, const math::Vec3& target, const math::Vec3& normal, bool isMatch)
+    {
+        sourceX[i] = source.x;
+        sourceY[i] = source.y;
+        sourceZ[i] = source.z;
+
+        if (isMatch) {
+            targetX[i] = target.x;
+            targetY[i] = target.y;
+            targetZ[i] = target.z;
+            normalX[i] = normal.x;
+            normalY[i] = normal.y;
+            normalZ[i] = normal.z;
+            squaredErrors[i] = math::Vec3::squaredDistanceBetween(source, target);
+            matchMask[i] = 1;
+        } else {
+            targetX[i] = source.x;
+            targetY[i] = source.y;
+            targetZ[i] = source.z;
+            normalX[i] = normalY[i] = normalZ[i] = 0;
+            squaredErrors[i] = 0;
+            matchMask[i] = 0;
+        }
+    }
+
+#if DEBUG && TARGET_OS_MAC
+    std::shared_ptr<std::vector<math::Vec3>> copyTargetVertices() const
+    {
+        auto vertices = std::make_shared<std::vector<math::Vec3>>(targetX.size());
+        for (size_t i = 0; i < targetX.size(); ++i) {
+            (*vertices)[i] = math::Vec3(targetX[i], targetY[i], targetZ[i]);
+        }
+        return vertices;
+    }
+#endif
+};
+
+/** The sums of a correspondence pass over a chunk of the source vertices */
+struct ICPCorrespondenceSums {
+    double squaredError = 0;
+    size_t matchCount = 0;
+};
+
+/** The upper triangle of JᵀJ and the vector Jᵀr of the point-to-plane normal equations, row-major */
+struct ICPNormalEquationSums {
+    /** The number of distinct terms in the symmetric 6x6 matrix of the normal equations */
+    static const int upperTriangleCount = 21;
+
+    float JtJ[upperTriangleCount] = {};
+    float Jtr[6] = {};
+
+    ICPNormalEquationSums operator+(const ICPNormalEquationSums& other) const
+    {
+        ICPNormalEquationSums sum;
+        for (int k = 0; k < upperTriangleCount; ++k) { sum.JtJ[k] = JtJ[k] + other.JtJ[k]; }
+        for (int k = 0; k < 6; ++k) { sum.Jtr[k] = Jtr[k] + other.Jtr[k]; }
+        return sum;
+    }
+};
+
+/** One entry per chunk for each of ICP's parallel passes over the source vertices. With more
+ *  than one thread, the passes reduce their chunks through these, so that they don't allocate. */
+struct ICPPartialSums {
+    std::vector<ICPCorrespondenceSums> correspondences;
+    std::vector<ICPNormalEquationSums> normalEquations;
+    std::vector<double> squaredErrors;
+};
+
+/** Scratch buffers for the temporaries of assimilating a frame. PBFModel keeps one between
+ *  frames, so the buffers keep their capacity, and once they've grown to fit the largest
+ *  frame, ICP and the source downsampling don't allocate any more, on any number of threads.
+ *
+ *  That's as far as it goes, though: the rest of assimilating a frame, such as updating the ICP
+ *  target, drawing the surfel index map and fusing, still allocates a little every frame.
+ */
+struct AssimilationWorkspace {
+    /** The source cloud for a stage of ICP, in the model's frame of reference. ICP moves it
+     *  in place as it goes. The normals are only needed for projective correspondences. */
+    std::vector<math::Vec3> sourceVertices;
+    std::vector<math::Vec3> sourceNormals;
+
+    ICPCorrespondences icpCorrespondences;
+    ICPPartialSums icpPartialSums;
+};
@@ -0,0 +1,520 @@
+//
+//  CpuDepthProcessor.cpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <algorithm>
+#import <cassert>
+#import <cmath>
+#import <functional>
+
+#import <standard_cyborg/util/TaskScheduler.hpp>
+
+#import "CpuDepthProcessor.hpp"
+#import "FiniteMath.hpp"
+#import "Stopwatch.hpp"
+
+#if defined(__clang__)
+#define VECTORIZE_LOOP _Pragma("clang loop vectorize(enable) interleave(enable)")
+#else
+#define VECTORIZE_LOOP
+#endif
+
+namespace {
+
+// The SmoothDepthKernel uniform sets, each of which is run twice
+static const int kSmoothingPassCount = 8;
+static const float kSmoothingPassMinValidNeighbors[kSmoothingPassCount] = { 1, 1, 1, 1, 7, 7, 7, 7 };
+static const float kSmoothingEdgeDiffusion = 1.0f;
+static const float kSmoothingDepthThreshold = 0.003f; // meters
+
+static const int kWeightsRadius = 6;
+
+// Ring-buffered stages: confidence initialization, then each smoothing pass
+static const int kRingStageCount = 1 + kSmoothingPassCount;
+static const int kRingRowCount = 3;
+
+static const int kMinRowsPerBand = 32;
+
+struct FrameContext {
+    const RawFrame* rawFrame;
+    ProcessedFrame* frame;
+    int width;
+    int height;
+    bool smoothPoints;
+    float intrinsicMatrixInverse[9];
+    float viewMatrixInverse[12];
+    float opticalImageSize[2];
+    float resolution[2];
+    const float* raysX;
+    const float* raysY;
+    const float* raysZ;
+};
+
+/** Runs `body` for each index in [0, count) on the shared scheduler, one index per task */
+static void _parallelFor(size_t count, const std::function<void(size_t)>& body)
+{
+    standard_cyborg::util::TaskScheduler::shared().parallelFor(0, count, 1, [&](size_t begin, size_t end) {
+        for (size_t index = begin; index < end; ++index) {
+            body(index);
+        }
+    });
+}
+
+static inline float _smoothstep(float edge0, float edge1, float x)
+{
+    float t = std::min(std::max((x - edge0) / (edge1 - edge0), 0.0f), 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+// Rows are padded with one element on each side so the inner loops never branch on x.
+// Depth padding is zero; confidence padding clamps to the edge.
+static inline void _padClamped(float* row, int width)
+{
+    row[0] = row[1];
+    row[width + 1] = row[width];
+}
+
+static inline void _accumulate(float depth0, bool bad, float depth, float confidence, float weight,
+                               float& depthSum, float& confidenceSum, float& count)
+{
+    bool include = bad ? (depth > 0.0f) : (std::abs(depth0 - depth) < kSmoothingDepthThreshold);
+    depthSum += include ? weight * depth : 0.0f;
+    confidenceSum += include ? weight * confidence : 0.0f;
+    count += include ? weight : 0.0f;
+}
+
+/** Port of initializeDepthConfidence in InitializeDepthConfidenceKernel.metal */
+static void _initializeConfidenceRow(const float* depthN, const float* depth0, const float* depthS,
+                                     float* confidencesOut, int width)
+{
+    VECTORIZE_LOOP
+    for (int i = 1; i <= width; ++i) {
+        float d = depth0[i];
+        float dN = depthN[i];
+        float dS = depthS[i];
+        float dE = depth0[i + 1];
+        float dW = depth0[i - 1];
+
+        float minDepth = std::min(std::min(std::min(std::min(d, dN), dS), dE), dW);
+        float maxDepth = std::max(std::max(std::max(std::max(d, dN), dS), dE), dW);
+        confidencesOut[i] = _smoothstep(0.03f, 0.01f, maxDepth - minDepth);
+    }
+
+    // -ffast-math lets the compiler assume there are no NaNs, so nothing above can be relied on
+    // to handle them. A NaN depth anywhere in the stencil leaves the pixel with no confidence.
+    for (int i = 1; i <= width; ++i) {
+        bool isFinite = isFiniteFloat(depth0[i - 1]) && isFiniteFloat(depth0[i]) && isFiniteFloat(depth0[i + 1])
+            && isFiniteFloat(depthN[i]) && isFiniteFloat(depthS[i]);
+        if (!isFinite) { confidencesOut[i] = 0.0f; }
+    }
+
+    _padClamped(confidencesOut, width);
+}
+
+/** Port of smoothDepth in SmoothDepthKernel.metal */
+static void _smoothRow(const float* depthN, const float* depth0, const float* depthS,
+                       const float* confidenceN, const float* confidence0, const float* confidenceS,
+                       float* depthOut, float* confidenceOut,
+                       int width, float minValidNeighborsBeforeBleed)
+{
+    VECTORIZE_LOOP
+    for (int i = 1; i <= width; ++i) {
+        float d0 = depth0[i];
+        float c0 = confidence0[i];
+        bool bad = d0 < 0.0f;
+
+        float depthSum = bad ? 0.0f : 4.0f * d0;
+        float confidenceSum = bad ? 0.0f : 4.0f * c0;
+        float count = bad ? 0.0f : 4.0f;
+
+        // Same order as the Metal kernel so the sums round the same way
+        _accumulate(d0, bad, depth0[i + 1], confidence0[i + 1], 2.0f, depthSum, confidenceSum, count);
+        _accumulate(d0, bad, depth0[i - 1], confidence0[i - 1], 2.0f, depthSum, confidenceSum, count);
+        _accumulate(d0, bad, depthN[i], confidenceN[i], 2.0f, depthSum, confidenceSum, count);
+        _accumulate(d0, bad, depthS[i], confidenceS[i], 2.0f, depthSum, confidenceSum, count);
+        _accumulate(d0, bad, depthN[i + 1], confidenceN[i + 1], 1.0f, depthSum, confidenceSum, count);
+        _accumulate(d0, bad, depthN[i - 1], confidenceN[i - 1], 1.0f, depthSum, confidenceSum, count);
+        _accumulate(d0, bad, depthS[i + 1], confidenceS[i + 1], 1.0f, depthSum, confidenceSum, count);
+        _accumulate(d0, bad, depthS[i - 1], confidenceS[i - 1], 1.0f, depthSum, confidenceSum, count);
+
+        bool bleed = bad && count < minValidNeighborsBeforeBleed;
+        float averageConfidence = bleed ? 0.0f : confidenceSum / count;
+
+        depthOut[i] = bleed ? -1.0f : depthSum / count;
+        confidenceOut[i] = c0 + (averageConfidence - c0) * kSmoothingEdgeDiffusion;
+    }
+
+    depthOut[0] = 0;
+    depthOut[width + 1] = 0;
+    _padClamped(confidenceOut, width);
+}
+
+static inline void _unproject(const FrameContext& context, float x, float y, float depth,
+                              float& outX, float& outY, float& outZ)
+{
+    const float* K = context.intrinsicMatrixInverse;
+    const float* V = context.viewMatrixInverse;
+
+    float px = -depth * (K[0] * x + K[1] * y + K[2]);
+    float py = -depth * (K[3] * x + K[4] * y + K[5]);
+    float pz = -depth * (K[6] * x + K[7] * y + K[8]);
+
+    outX = V[0] * px + V[1] * py + V[2]  * pz + V[3];
+    outY = V[4] * px + V[5] * py + V[6]  * pz + V[7];
+    outZ = V[8] * px + V[9] * py + V[10] * pz + V[11];
+}
+
+/** Port of computePoints in ComputePointsKernel.metal */
+static void _computePointsRow(const FrameContext& context, int y, const float* depths)
+{
+    const int width = context.width;
+    const size_t rowOffset = (size_t)y * width;
+    const float* raysX = context.raysX + rowOffset;
+    const float* raysY = context.raysY + rowOffset;
+    const float* raysZ = context.raysZ + rowOffset;
+    const float* V = context.viewMatrixInverse;
+    math::Vec3* positions = context.frame->positions.data() + rowOffset;
+
+    VECTORIZE_LOOP
+    for (int x = 0; x < width; ++x) {
+        float depth = depths[x + 1];
+        float px = -depth * raysX[x];
+        float py = -depth * raysY[x];
+        float pz = -depth * raysZ[x];
+
+        positions[x].x = V[0] * px + V[1] * py + V[2]  * pz + V[3];
+        positions[x].y = V[4] * px + V[5] * py + V[6]  * pz + V[7];
+        positions[x].z = V[8] * px + V[9] * py + V[10] * pz + V[11];
+    }
+}
+
+/** Port of computeNormals in ComputeNormalsKernel.metal */
+static void _computeNormalsRow(const FrameContext& context, int y,
+                               const float* depthN, const float* depth0, const float* depthS)
+{
+    const int width = context.width;
+    const size_t rowOffset = (size_t)y * width;
+    const float resolutionX = context.resolution[0];
+    const float resolutionY = context.resolution[1];
+    const float sizeX = context.opticalImageSize[0];
+    const float sizeY = context.opticalImageSize[1];
+
+    math::Vec3* normals = context.frame->normals.data() + rowOffset;
+    float* surfelSizes = context.frame->surfelSizes.data() + rowOffset;
+
+    const float uvY = (float)y * resolutionY;
+    const float xy0Y = (1.0f - uvY) * sizeY;
+    const float xyNY = (1.0f - (uvY + resolutionY)) * sizeY;
+    const float xySY = (1.0f - (uvY - resolutionY)) * sizeY;
+
+    VECTORIZE_LOOP
+    for (int x = 0; x < width; ++x) {
+        const int i = x + 1;
+        float uvX = (float)x * resolutionX;
+
+        // As in the Metal kernel, we don't apply lens calibration to the positions because it
+        // wouldn't make any appreciable difference in the resulting normals
+        float x0, y0, z0, xE, yE, zE, xW, yW, zW, xN, yN, zN, xS, yS, zS;
+        _unproject(context, uvX * sizeX, xy0Y, depth0[i], x0, y0, z0);
+        _unproject(context, (uvX + resolutionX) * sizeX, xy0Y, depth0[i + 1], xE, yE, zE);
+        _unproject(context, (uvX - resolutionX) * sizeX, xy0Y, depth0[i - 1], xW, yW, zW);
+        _unproject(context, uvX * sizeX, xyNY, depthN[i], xN, yN, zN);
+        _unproject(context, uvX * sizeX, xySY, depthS[i], xS, yS, zS);
+
+        float ax = xN - xS, ay = yN - yS, az = zN - zS;
+        float bx = xE - xW, by = yE - yW, bz = zE - zW;
+        float nx = ay * bz - az * by;
+        float ny = az * bx - ax * bz;
+        float nz = ax * by - ay * bx;
+        float inverseLength = 1.0f / std::sqrt(nx * nx + ny * ny + nz * nz);
+        nx *= inverseLength;
+        ny *= inverseLength;
+        nz *= inverseLength;
+
+        // Scale the normal based on a few factors
+        float length0 = std::sqrt(x0 * x0 + y0 * y0 + z0 * z0);
+        float growth = std::min(3.0f, length0 / std::abs(x0 * nx + y0 * ny + z0 * nz));
+        float pixelSizeAtDepth = depth0[i] * resolutionX;
+
+        normals[x].x = nx;
+        normals[x].y = ny;
+        normals[x].z = nz;
+        surfelSizes[x] = 0.707f * pixelSizeAtDepth * growth;
+    }
+}
+
+/** Port of computeWeights in ComputeWeightsKernel.metal. Offsets below zero wrap around
+ *  as unsigned integers before being clamped, as they do in the kernel. */
+static void _computeWeightsRow(const FrameContext& context, int y)
+{
+    const int width = context.width;
+    const int height = context.height;
+    const math::Vec3* normals = context.frame->normals.data();
+    float* weights = context.frame->weights.data() + (size_t)y * width;
+
+    const math::Vec3* rowN = normals + (size_t)std::min(y + kWeightsRadius, height - 1) * width;
+    const math::Vec3* rowS = normals + (size_t)(y >= kWeightsRadius ? y - kWeightsRadius : height - 1) * width;
+    const math::Vec3* row0 = normals + (size_t)y * width;
+
+    const float inverseWidth = 1.0f / (float)width;
+    const float offsetY = ((float)y - 0.5f * (float)height) * (1.0f / (float)height);
+
+    for (int x = 0; x < width; ++x) {
+        const math::Vec3& normalN = rowN[x];
+        const math::Vec3& normalS = rowS[x];
+        const math::Vec3& normalE = row0[std::min(x + kWeightsRadius, width - 1)];
+        const math::Vec3& normalW = row0[x >= kWeightsRadius ? x - kWeightsRadius : width - 1];
+
+        // Weighting toward the center. A strength of 4.0 leads to zero weight at the corners
+        float offsetX = ((float)x - 0.5f * (float)width) * inverseWidth;
+        float centerFocus = 1.0f - 4.0f * (offsetX * offsetX + offsetY * offsetY);
+        centerFocus = std::min(std::max(centerFocus, 0.0f), 1.0f);
+
+        float flatness = 0.5f * (normalN.x * normalS.x + normalN.y * normalS.y + normalN.z * normalS.z
+                                 + normalE.x * normalW.x + normalE.y * normalW.y + normalE.z * normalW.z);
+        flatness = flatness * flatness;
+        const float featureStrength = 0.8f;
+        float featureWeighting = std::min(std::max(1.0f - featureStrength * flatness, 0.0f), 1.0f);
+
+        weights[x] = centerFocus * featureWeighting;
+    }
+}
+
+/** Sweeps the rows [rowBegin, rowEnd) through every pass up to points and normals.
+ *  Stage s produces rows with a halo of (kRingStageCount - s) rows on either side,
+ *  which is exactly what the next stage needs to produce its own. */
+static void _sweepBand(const FrameContext& context, CpuDepthProcessor::BandWorkspace& workspace, int rowBegin, int rowEnd)
+{
+    const int width = context.width;
+    const int height = context.height;
+    const size_t stride = (size_t)width + 2;
+    const int lastStage = kRingStageCount - 1;
+
+    int stageBegin[kRingStageCount];
+    int stageEnd[kRingStageCount];
+    int stageNext[kRingStageCount];
+    for (int stage = 0; stage < kRingStageCount; ++stage) {
+        int halo = kRingStageCount - stage;
+        stageBegin[stage] = std::max(0, rowBegin - halo);
+        stageEnd[stage] = std::min(height, rowEnd + halo);
+        stageNext[stage] = stageBegin[stage];
+    }
+
+    // Copy the raw depths this band touches into padded rows, with zero rows outside the frame
+    const int rawBegin = stageBegin[0] - 1;
+    const int rawEnd = stageEnd[0] + 1;
+    workspace.rawDepthRows.assign((size_t)(rawEnd - rawBegin) * stride, 0.0f);
+    for (int y = std::max(rawBegin, 0); y < std::min(rawEnd, height); ++y) {
+        const float* source = context.rawFrame->depths.data() + (size_t)y * width;
+        std::copy(source, source + width, workspace.rawDepthRows.data() + (size_t)(y - rawBegin) * stride + 1);
+    }
+
+    workspace.ringDepths.resize((size_t)(kRingStageCount * kRingRowCount + 1) * stride);
+    workspace.ringConfidences.resize((size_t)(kRingStageCount * kRingRowCount) * stride);
+
+    float* zeroRow = workspace.ringDepths.data() + (size_t)(kRingStageCount * kRingRowCount) * stride;
+    std::fill(zeroRow, zeroRow + stride, 0.0f);
+
+    auto rawDepthRow = [&](int y) -> const float* {
+        return workspace.rawDepthRows.data() + (size_t)(y - rawBegin) * stride;
+    };
+    auto ringDepthRow = [&](int stage, int y) -> float* {
+        return workspace.ringDepths.data() + (size_t)(stage * kRingRowCount + y % kRingRowCount) * stride;
+    };
+    auto ringConfidenceRow = [&](int stage, int y) -> float* {
+        return workspace.ringConfidences.data() + (size_t)(stage * kRingRowCount + y % kRingRowCount) * stride;
+    };
+
+    // Depth reads outside the frame see zero, like an out-of-bounds Metal texture read
+    auto stageDepthRow = [&](int stage, int y) -> const float* {
+        if (stage < 1) { return rawDepthRow(y); }
+        if (y < 0 || y >= height) { return zeroRow; }
+        return ringDepthRow(stage, y);
+    };
+    // Confidence reads clamp to the edge of the frame
+    auto stageConfidenceRow = [&](int stage, int y) -> const float* {
+        return ringConfidenceRow(stage, std::min(std::max(y, 0), height - 1));
+    };
+
+    auto computeStageRow = [&](int stage, int y) {
+        if (stage == 0) {
+            _initializeConfidenceRow(rawDepthRow(y + 1), rawDepthRow(y), rawDepthRow(y - 1),
+                                     ringConfidenceRow(0, y), width);
+        } else {
+            int input = stage - 1;
+            _smoothRow(stageDepthRow(input, y + 1), stageDepthRow(input, y), stageDepthRow(input, y - 1),
+                       stageConfidenceRow(input, y + 1), stageConfidenceRow(input, y), stageConfidenceRow(input, y - 1),
+                       ringDepthRow(stage, y), ringConfidenceRow(stage, y),
+                       width, kSmoothingPassMinValidNeighbors[stage - 1]);
+        }
+    };
+
+    auto finishRow = [&](int y) {
+        const float* smoothedConfidences = ringConfidenceRow(lastStage, y);
+        std::copy(smoothedConfidences + 1, smoothedConfidences + 1 + width,
+                  context.frame->inputConfidences.data() + (size_t)y * width);
+
+        _computePointsRow(context, y, context.smoothPoints ? stageDepthRow(lastStage, y) : rawDepthRow(y));
+        _computeNormalsRow(context, y, stageDepthRow(lastStage, y + 1), stageDepthRow(lastStage, y), stageDepthRow(lastStage, y - 1));
+    };
+
+    // A stage may compute its next row once its input has the row below it, and
+    // as long as that doesn't overwrite a ring row its consumer still needs
+    int nextFinishedRow = rowBegin;
+    while (nextFinishedRow < rowEnd) {
+        bool progressed = false;
+
+        for (int stage = 0; stage < kRingStageCount; ++stage) {
+            int y = stageNext[stage];
+            if (y >= stageEnd[stage]) { continue; }
+            if (stage > 0 && stageNext[stage - 1] <= std::min(y + 1, height - 1)) { continue; }
+
+            int consumerNext = stage < lastStage ? stageNext[stage + 1] : nextFinishedRow;
+            int consumerEnd = stage < lastStage ? stageEnd[stage + 1] : rowEnd;
+            if (consumerNext < consumerEnd && y >= consumerNext + kRingRowCount - 1) { continue; }
+
+            computeStageRow(stage, y);
+            ++stageNext[stage];
+            progressed = true;
+        }
+
+        if (stageNext[lastStage] > std::min(nextFinishedRow + 1, height - 1)) {
+            finishRow(nextFinishedRow);
+            ++nextFinishedRow;
+            progressed = true;
+        }
+
+        assert(progressed);
+        if (!progressed) { break; }
+    }
+}
+
+} // namespace
+
+bool CpuDepthProcessor::RayCacheKey::operator==(const RayCacheKey& other) const
+{
+    return width == other.width
+        && height == other.height
+        && std::equal(intrinsicMatrixInverse, intrinsicMatrixInverse + 9, other.intrinsicMatrixInverse)
+        && std::equal(lensCalibration.constants, lensCalibration.constants + 4, other.lensCalibration.constants)
+        && std::equal(lensCalibration.opticalImageSize, lensCalibration.opticalImageSize + 2, other.lensCalibration.opticalImageSize)
+        && std::equal(lensCalibration.opticalImageCenter, lensCalibration.opticalImageCenter + 2, other.lensCalibration.opticalImageCenter)
+        && lensCalibration.maxRadius == other.lensCalibration.maxRadius;
+}
+
+CpuDepthProcessor::CpuDepthProcessor(int threadCount) :
+    _threadCount(std::max(threadCount, 1))
+{
+}
+
+void CpuDepthProcessor::computeFrameValues(ProcessedFrame& frame,
+                                           const RawFrame& rawFrame,
+                                           bool smoothPoints)
+{
+    Stopwatch stopwatch;
+    const sc3d::PerspectiveCamera& camera = rawFrame.camera;
+    const int width = (int)rawFrame.width;
+    const int height = (int)rawFrame.height;
+
+    size_t pointCount = (size_t)width * (size_t)height;
+    assert(pointCount == rawFrame.depths.size());
+    assert(pointCount == frame.positions.size());
+    if (pointCount == 0) { return; }
+
+    _updateRays(rawFrame);
+
+    FrameContext context;
+    context.rawFrame = &rawFrame;
+    context.frame = &frame;
+    context.width = width;
+    context.height = height;
+    context.smoothPoints = smoothPoints;
+
+    const math::Mat3x3& K = camera.getIntrinsicMatrixInverse();
+    const float intrinsicMatrixInverse[9] = { K.m00, K.m01, K.m02, K.m10, K.m11, K.m12, K.m20, K.m21, K.m22 };
+    std::copy(intrinsicMatrixInverse, intrinsicMatrixInverse + 9, context.intrinsicMatrixInverse);
+
+    const math::Mat3x4 V = camera.getViewMatrixInverse();
+    const float viewMatrixInverse[12] = { V.m00, V.m01, V.m02, V.m03, V.m10, V.m11, V.m12, V.m13, V.m20, V.m21, V.m22, V.m23 };
+    std::copy(viewMatrixInverse, viewMatrixInverse + 12, context.viewMatrixInverse);
+
+    context.opticalImageSize[0] = camera.getIntrinsicMatrixReferenceSize().x;
+    context.opticalImageSize[1] = camera.getIntrinsicMatrixReferenceSize().y;
+    context.resolution[0] = 1.0f / width;
+    context.resolution[1] = 1.0f / height;
+    context.raysX = _raysX.data();
+    context.raysY = _raysY.data();
+    context.raysZ = _raysZ.data();
+
+    // Each band recomputes a halo of rows around it, so don't make them too thin
+    const int bandCount = std::max(1, std::min(_threadCount, height / kMinRowsPerBand));
+    const int rowsPerBand = (height + bandCount - 1) / bandCount;
+    _bandWorkspaces.resize(bandCount);
+
+    _parallelFor(bandCount, [&](size_t band) {
+        int rowBegin = (int)band * rowsPerBand;
+        int rowEnd = std::min(height, rowBegin + rowsPerBand);
+        if (rowBegin < rowEnd) {
+            _sweepBand(context, _bandWorkspaces[band], rowBegin, rowEnd);
+        }
+    });
+
+    // Weights look six rows away, so they wait until all of the normals are done
+    _parallelFor(bandCount, [&](size_t band) {
+        int rowBegin = (int)band * rowsPerBand;
+        int rowEnd = std::min(height, rowBegin + rowsPerBand);
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            _computeWeightsRow(context, y);
+        }
+    });
+
+    frame.depthProcessingDuration = stopwatch.elapsedSeconds();
+}
+
+// MARK: - Private
+
+void CpuDepthProcessor::_updateRays(const RawFrame& rawFrame)
+{
+    const sc3d::PerspectiveCamera& camera = rawFrame.camera;
+    const math::Mat3x3& K = camera.getIntrinsicMatrixInverse();
+
+    RayCacheKey key;
+    key.width = rawFrame.width;
+    key.height = rawFrame.height;
+    const float intrinsicMatrixInverse[9] = { K.m00, K.m01, K.m02, K.m10, K.m11, K.m12, K.m20, K.m21, K.m22 };
+    std::copy(intrinsicMatrixInverse, intrinsicMatrixInverse + 9, key.intrinsicMatrixInverse);
+    key.lensCalibration = LensCalibration::forward(camera);
+
+    size_t pointCount = rawFrame.width * rawFrame.height;
+    if (key == _rayCacheKey && _raysX.size() == pointCount) { return; }
+
+    _rayCacheKey = key;
+    _raysX.resize(pointCount);
+    _raysY.resize(pointCount);
+    _raysZ.resize(pointCount);
+
+    const float width = (float)rawFrame.width;
+    const float height = (float)rawFrame.height;
+    const float* sizes = key.lensCalibration.opticalImageSize;
+
+    for (size_t y = 0; y < rawFrame.height; ++y) {
+        for (size_t x = 0; x < rawFrame.width; ++x) {
+            // Texel-centered NDC coordinates in the range [-1, 1] x [-1, 1]
+            float ndcX = ((float)x + 0.5f) / width * 2.0f - 1.0f;
+            float ndcY = ((float)y + 0.5f) / height * 2.0f - 1.0f;
+            key.lensCalibration.apply(ndcX, ndcY);
+
+            // Convert back to reference dimension coordinates, flipped upside down
+            float referenceX = (0.5f + 0.5f * ndcX) * sizes[0];
+            float referenceY = sizes[1] - (0.5f + 0.5f * ndcY) * sizes[1];
+
+            size_t index = y * rawFrame.width + x;
+            _raysX[index] = K.m00 * referenceX + K.m01 * referenceY + K.m02;
+            _raysY[index] = K.m10 * referenceX + K.m11 * referenceY + K.m12;
+            _raysZ[index] = K.m20 * referenceX + K.m21 * referenceY + K.m22;
+        }
+    }
+}
@@ -0,0 +1,71 @@
+//
+//  CpuDepthProcessor.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <thread>
+#import <vector>
+
+#import "DepthProcessor.hpp"
+#import "LensCalibration.hpp"
+#import "ProcessedFrame.hpp"
+#import "RawFrame.hpp"
+
+/** Computes ProcessedFrame values on the CPU, for use where Metal is unavailable.
+ *
+ *  This is a port of the MetalDepthProcessor kernels (InitializeDepthConfidence,
+ *  SmoothDepth, ComputePoints, ComputeNormals and ComputeWeights). Each Metal pass
+ *  makes a full trip through memory. Here the passes are fused instead:
+ *
+ *  - The frame is split into horizontal bands, which are processed in parallel.
+ *  - Within a band, a single row sweep pushes every row through confidence
+ *    initialization, all eight smoothing passes, points and normals. Each pass
+ *    keeps only a three-row ring buffer, so the working set stays in cache.
+ *  - A second sweep computes the weights, since they need normals six rows away.
+ *
+ *  Inner loops are branch-free over padded rows so the compiler can vectorize them.
+ *
+ *  Interior pixels match the Metal kernels. At the image border, depth reads
+ *  outside the frame return zero, as Metal texture reads do. Confidence reads
+ *  clamp to the edge.
+ */
+class CpuDepthProcessor: public DepthProcessor {
+public:
+    /** Work runs on the shared TaskScheduler, split into pieces for about `threadCount` threads */
+    CpuDepthProcessor(int threadCount = (int)std::thread::hardware_concurrency());
+
+    virtual void computeFrameValues(ProcessedFrame &frameOut,
+                                    const RawFrame &rawFrame,
+                                    bool smoothPoints = false);
+
+    struct BandWorkspace {
+        std::vector<float> rawDepthRows;
+        std::vector<float> ringDepths;
+        std::vector<float> ringConfidences;
+    };
+
+private:
+    struct RayCacheKey {
+        size_t width = 0;
+        size_t height = 0;
+        float intrinsicMatrixInverse[9] = {0};
+        LensCalibration lensCalibration;
+
+        bool operator==(const RayCacheKey& other) const;
+    };
+
+    int _threadCount;
+
+    // Unprojection rays (inverse intrinsics applied to lens-calibrated pixel centers).
+    // These only depend on the camera intrinsics, so they're reused until those change.
+    RayCacheKey _rayCacheKey;
+    std::vector<float> _raysX, _raysY, _raysZ;
+
+    std::vector<BandWorkspace> _bandWorkspaces;
+
+    void _updateRays(const RawFrame& rawFrame);
+};
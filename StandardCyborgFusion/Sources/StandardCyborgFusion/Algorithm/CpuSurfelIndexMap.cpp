@@ -0,0 +1,455 @@
+//
+//  CpuSurfelIndexMap.cpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <algorithm>
+#import <cmath>
+#import <functional>
+
+#import <standard_cyborg/util/DataUtils.hpp>
+#import <standard_cyborg/util/TaskScheduler.hpp>
+
+#import "CpuSurfelIndexMap.hpp"
+#import "FiniteMath.hpp"
+#import "PBFDefinitions.h"
+
+using namespace Eigen;
+
+namespace {
+
+struct SplatVertex {
+    float x;
+    float y;
+    float z;
+};
+
+static const float INV_RT3 = 0.57735026919f;
+
+// The same hexagon as MetalSurfelIndexMap::_createVertexBuffer, drawn as a triangle strip
+static const float kHexVertices[6][2] = {
+    { -2.0f * INV_RT3,  0.0f },
+    {        -INV_RT3, -1.0f },
+    {        -INV_RT3,  1.0f },
+    {         INV_RT3, -1.0f },
+    {         INV_RT3,  1.0f },
+    {  2.0f * INV_RT3,  0.0f },
+};
+
+// Triangle strip order, with every other triangle flipped so they all share a winding
+static const int kStripTriangles[4][3] = {
+    { 0, 1, 2 },
+    { 2, 1, 3 },
+    { 2, 3, 4 },
+    { 4, 3, 5 },
+};
+
+// Splats reaching further than this outside the view, in normalized device coordinates, are
+// dropped, which keeps window coordinates well within int range
+static const float kMaxClipCoordinate = 1e4f;
+
+// Surfels per binning work item
+static const size_t kMinSurfelsPerChunk = 4096;
+
+/** Runs `body` for each index in [0, count) on the shared scheduler, one index per task, or
+ *  in order on the calling thread when there's only one thread to split the work for */
+static void _parallelFor(int threadCount, size_t count, const std::function<void(size_t)>& body)
+{
+    if (threadCount <= 1) {
+        for (size_t index = 0; index < count; ++index) {
+            body(index);
+        }
+        return;
+    }
+
+    standard_cyborg::util::TaskScheduler::shared().parallelFor(0, count, 1, [&](size_t begin, size_t end) {
+        for (size_t index = begin; index < end; ++index) {
+            body(index);
+        }
+    });
+}
+
+// The fields a splat is built from, read from either surfel records or a SurfelStore
+struct SurfelRecords {
+    const Surfel* surfels;
+
+    const Vector3f& position(size_t index) const { return surfels[index].position; }
+    const Vector3f& normal(size_t index) const { return surfels[index].normal; }
+    float surfelSize(size_t index) const { return surfels[index].surfelSize; }
+    bool isRemoved(size_t) const { return false; }
+};
+
+struct SurfelArrays {
+    const Vector3f* positions;
+    const Vector3f* normals;
+    const float* surfelSizes;
+    const uint8_t* tombstones;
+
+    const Vector3f& position(size_t index) const { return positions[index]; }
+    const Vector3f& normal(size_t index) const { return normals[index]; }
+    float surfelSize(size_t index) const { return surfelSizes[index]; }
+    bool isRemoved(size_t index) const { return tombstones[index] != 0; }
+};
+
+/** Mirrors SurfelIndexMapVertex in SurfelIndexMap.metal, followed by the viewport transform.
+ *  Returns false if the splat can't produce any fragments. */
+template <typename SurfelSource>
+static bool _projectSplat(const SurfelSource& surfels, size_t index, const CpuSurfelIndexMap::SplatUniforms& uniforms, SplatVertex vertices[6])
+{
+    const Vector3f& position = surfels.position(index);
+    const Vector3f& normal = surfels.normal(index);
+
+    // Add a small offset to basically ensure it's never singular
+    Vector3f tangent = Vector3f(-normal.z(), 1e-10f, normal.x()).normalized();
+    Vector3f bitangent = normal.cross(tangent);
+    float scale = surfels.surfelSize(index) * uniforms.surfelAliasingSafetyFactor;
+
+    bool allNearClipped = true;
+    bool allFarClipped = true;
+
+    for (int i = 0; i < 6; ++i) {
+        Vector3f p = position + (kHexVertices[i][0] * tangent + kHexVertices[i][1] * bitangent) * scale;
+        Vector4f projected = uniforms.projectionViewMatrix * Vector4f(p.x(), p.y(), p.z(), 1.0f);
+
+        // Behind the eye; the GPU would clip these rather than divide by them
+        if (!(projected.w() > 0.0f)) { return false; }
+        projected /= projected.w();
+
+        float x = projected.x();
+        float y = projected.y();
+        if (uniforms.applyLensCalibration) {
+            uniforms.lensCalibration.apply(x, y);
+        }
+
+        // NaNs would otherwise reach the (int) casts when rasterizing, and -ffast-math may
+        // drop any check for them made with float comparisons
+        if (!isFiniteFloat(x) || !isFiniteFloat(y) || !isFiniteFloat(projected.z())) { return false; }
+
+        bool isInRange = x >= -kMaxClipCoordinate && x <= kMaxClipCoordinate
+            && y >= -kMaxClipCoordinate && y <= kMaxClipCoordinate
+            && projected.z() >= -kMaxClipCoordinate && projected.z() <= kMaxClipCoordinate;
+        if (!isInRange) { return false; }
+
+        // Window coordinates have their origin at the top left, as with a Metal viewport
+        vertices[i].x = (0.5f + 0.5f * x) * uniforms.frameWidth;
+        vertices[i].y = (0.5f - 0.5f * y) * uniforms.frameHeight;
+        vertices[i].z = projected.z();
+
+        allNearClipped &= projected.z() < 0.0f;
+        allFarClipped &= projected.z() >= 1.0f;
+    }
+
+    return !allNearClipped && !allFarClipped;
+}
+
+static inline float _edgeFunction(const SplatVertex& a, const SplatVertex& b, float x, float y)
+{
+    return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+}
+
+// For triangles with a positive _edgeFunction area, samples exactly on a top or left edge
+// are owned by that triangle so that samples on shared edges are never drawn twice
+static inline bool _isTopLeftEdge(const SplatVertex& a, const SplatVertex& b)
+{
+    float dx = b.x - a.x;
+    float dy = b.y - a.y;
+    return dy < 0 || (dy == 0 && dx > 0);
+}
+
+static inline bool _isFrontFacing(const SplatVertex& a, const SplatVertex& b, const SplatVertex& c)
+{
+    // Counter-clockwise in normalized device coordinates, which is clockwise once
+    // the viewport transform has flipped y
+    return _edgeFunction(a, b, c.x, c.y) < 0;
+}
+
+} // namespace
+
+CpuSurfelIndexMap::CpuSurfelIndexMap(int threadCount) :
+    _threadCount(std::max(threadCount, 1)),
+    _lastViewProjectionMatrix(Matrix4f::Identity())
+{
+}
+
+bool CpuSurfelIndexMap::draw(const std::vector<Surfel>& surfels,
+                             const Matrix4f& modelMatrix,
+                             const RawFrame& rawFrame,
+                             std::vector<uint32_t>& indexLookups)
+{
+    SplatUniforms uniforms = _drawUniforms(modelMatrix, rawFrame);
+    _render(SurfelRecords { surfels.data() }, surfels.size(), uniforms, indexLookups);
+
+    return true;
+}
+
+bool CpuSurfelIndexMap::draw(const SurfelStore& surfels,
+                             const Matrix4f& modelMatrix,
+                             const RawFrame& rawFrame,
+                             std::vector<uint32_t>& indexLookups)
+{
+    SplatUniforms uniforms = _drawUniforms(modelMatrix, rawFrame);
+    _render(SurfelArrays { surfels.positions.data(), surfels.normals.data(), surfels.surfelSizes.data(), surfels.tombstones.data() }, surfels.size(), uniforms, indexLookups);
+
+    return true;
+}
+
+bool CpuSurfelIndexMap::drawForColor(const Surfel* surfels,
+                                     size_t surfelCount,
+                                     Matrix4f viewProjectionMatrix,
+                                     size_t frameWidth,
+                                     size_t frameHeight,
+                                     std::vector<uint32_t>& indexLookups)
+{
+    if (surfelCount == 0 || frameWidth == 0 || frameHeight == 0) { return true; }
+
+    SplatUniforms uniforms = _drawForColorUniforms(viewProjectionMatrix, frameWidth, frameHeight);
+    _render(SurfelRecords { surfels }, surfelCount, uniforms, indexLookups);
+
+    return true;
+}
+
+void CpuSurfelIndexMap::lookUpForColor(const Surfel* surfels,
+                                       size_t surfelCount,
+                                       Matrix4f viewProjectionMatrix,
+                                       size_t frameWidth,
+                                       size_t frameHeight,
+                                       const std::vector<uint32_t>& pixelIndices,
+                                       std::vector<uint32_t>& indexLookups,
+                                       uint32_t* surfelIndicesOut)
+{
+    std::fill(surfelIndicesOut, surfelIndicesOut + pixelIndices.size(), EMPTY_SURFEL_INDEX);
+    if (surfelCount == 0 || frameWidth == 0 || frameHeight == 0 || pixelIndices.empty()) { return; }
+
+    const size_t tilesX = (frameWidth + TileSize - 1) / TileSize;
+    const size_t tilesY = (frameHeight + TileSize - 1) / TileSize;
+    _tileMask.assign(tilesX * tilesY, 0);
+    for (uint32_t pixelIndex : pixelIndices) {
+        _tileMask[(pixelIndex / frameWidth / TileSize) * tilesX + (pixelIndex % frameWidth) / TileSize] = 1;
+    }
+
+    SplatUniforms uniforms = _drawForColorUniforms(viewProjectionMatrix, frameWidth, frameHeight);
+    _render(SurfelRecords { surfels }, surfelCount, uniforms, indexLookups, _tileMask.data());
+
+    for (size_t i = 0; i < pixelIndices.size(); ++i) {
+        surfelIndicesOut[i] = indexLookups[pixelIndices[i]];
+    }
+}
+
+Matrix4f CpuSurfelIndexMap::getViewProjectionMatrix()
+{
+    return _lastViewProjectionMatrix;
+}
+
+// MARK: - Private
+
+CpuSurfelIndexMap::SplatUniforms CpuSurfelIndexMap::_drawUniforms(const Matrix4f& modelMatrix, const RawFrame& rawFrame)
+{
+    const sc3d::PerspectiveCamera& camera = rawFrame.camera;
+
+    SplatUniforms uniforms;
+    uniforms.projectionViewMatrix = toMatrix4f(camera.getProjectionViewMatrix()) * modelMatrix;
+    uniforms.lensCalibration = LensCalibration::inverse(camera);
+    uniforms.applyLensCalibration = true;
+    uniforms.surfelAliasingSafetyFactor = 1.3;
+    uniforms.frameWidth = rawFrame.width;
+    uniforms.frameHeight = rawFrame.height;
+
+    _lastViewProjectionMatrix = uniforms.projectionViewMatrix;
+
+    return uniforms;
+}
+
+CpuSurfelIndexMap::SplatUniforms CpuSurfelIndexMap::_drawForColorUniforms(const Matrix4f& viewProjectionMatrix, size_t frameWidth, size_t frameHeight)
+{
+    // Matches SurfelIndexMapForColorVertex, which skips the lens calibration
+    // and uses a fixed safety factor
+    SplatUniforms uniforms;
+    uniforms.projectionViewMatrix = viewProjectionMatrix;
+    uniforms.applyLensCalibration = false;
+    uniforms.surfelAliasingSafetyFactor = 1.3;
+    uniforms.frameWidth = (int)frameWidth;
+    uniforms.frameHeight = (int)frameHeight;
+
+    return uniforms;
+}
+
+template <typename SurfelSource>
+void CpuSurfelIndexMap::_render(const SurfelSource& surfels, size_t surfelCount, const SplatUniforms& uniforms, std::vector<uint32_t>& indexLookups,
+                                const uint8_t* tileMask)
+{
+    const int width = uniforms.frameWidth;
+    const int height = uniforms.frameHeight;
+    const size_t pixelCount = (size_t)width * (size_t)height;
+
+    if (indexLookups.size() < pixelCount) { indexLookups.resize(pixelCount); }
+    std::fill(indexLookups.begin(), indexLookups.begin() + pixelCount, EMPTY_SURFEL_INDEX);
+
+    if (surfelCount == 0 || pixelCount == 0) { return; }
+
+    const int tilesX = (width + TileSize - 1) / TileSize;
+    const int tilesY = (height + TileSize - 1) / TileSize;
+    const size_t tileCount = (size_t)tilesX * (size_t)tilesY;
+
+    const size_t chunkSize = std::max(kMinSurfelsPerChunk, (surfelCount + 4 * _threadCount - 1) / (4 * _threadCount));
+    const size_t chunkCount = (surfelCount + chunkSize - 1) / chunkSize;
+
+    _surfelTileRanges.resize(surfelCount);
+    _chunkTileCounts.assign(chunkCount * tileCount, 0);
+
+    // Pass 1: find the tiles each surfel touches and count them up per chunk
+    _parallelFor(_threadCount, chunkCount, [&](size_t chunk) {
+        uint32_t* tileCounts = _chunkTileCounts.data() + chunk * tileCount;
+        size_t end = std::min(surfelCount, (chunk + 1) * chunkSize);
+
+        for (size_t index = chunk * chunkSize; index < end; ++index) {
+            TileRange& range = _surfelTileRanges[index];
+            range = { 1, 1, 0, 0 };
+            if (surfels.isRemoved(index)) { continue; }
+
+            SplatVertex vertices[6];
+            if (!_projectSplat(surfels, index, uniforms, vertices)) { continue; }
+
+            bool anyFrontFacing = false;
+            for (int t = 0; t < 4 && !anyFrontFacing; ++t) {
+                const int* tri = kStripTriangles[t];
+                anyFrontFacing = _isFrontFacing(vertices[tri[0]], vertices[tri[1]], vertices[tri[2]]);
+            }
+            if (!anyFrontFacing) { continue; }
+
+            float minX = vertices[0].x, maxX = vertices[0].x;
+            float minY = vertices[0].y, maxY = vertices[0].y;
+            for (int i = 1; i < 6; ++i) {
+                minX = std::min(minX, vertices[i].x);
+                maxX = std::max(maxX, vertices[i].x);
+                minY = std::min(minY, vertices[i].y);
+                maxY = std::max(maxY, vertices[i].y);
+            }
+
+            // Range of pixels whose centers might be covered
+            int x0 = std::max(0, (int)std::ceil(std::max(minX - 0.5f, -1.0f)));
+            int x1 = std::min(width - 1, (int)std::floor(std::min(maxX - 0.5f, (float)width)));
+            int y0 = std::max(0, (int)std::ceil(std::max(minY - 0.5f, -1.0f)));
+            int y1 = std::min(height - 1, (int)std::floor(std::min(maxY - 0.5f, (float)height)));
+            if (x0 > x1 || y0 > y1) { continue; }
+
+            range = { (uint16_t)(x0 / TileSize), (uint16_t)(y0 / TileSize), (uint16_t)(x1 / TileSize), (uint16_t)(y1 / TileSize) };
+
+            for (int ty = range.minY; ty <= range.maxY; ++ty) {
+                for (int tx = range.minX; tx <= range.maxX; ++tx) {
+                    if (tileMask && !tileMask[ty * tilesX + tx]) { continue; }
+                    ++tileCounts[ty * tilesX + tx];
+                }
+            }
+        }
+    });
+
+    // Turn the counts into offsets. Within a tile, chunks are laid out in order so that
+    // each tile's list of surfels ends up sorted by surfel index.
+    _tileStarts.resize(tileCount + 1);
+    uint32_t runningCount = 0;
+    for (size_t tile = 0; tile < tileCount; ++tile) {
+        _tileStarts[tile] = runningCount;
+        for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+            uint32_t& count = _chunkTileCounts[chunk * tileCount + tile];
+            uint32_t chunkCountInTile = count;
+            count = runningCount;
+            runningCount += chunkCountInTile;
+        }
+    }
+    _tileStarts[tileCount] = runningCount;
+    _tileSurfelIndices.resize(runningCount);
+
+    // Pass 2: scatter surfel indices into their tiles
+    _parallelFor(_threadCount, chunkCount, [&](size_t chunk) {
+        uint32_t* tileCursors = _chunkTileCounts.data() + chunk * tileCount;
+        size_t end = std::min(surfelCount, (chunk + 1) * chunkSize);
+
+        for (size_t index = chunk * chunkSize; index < end; ++index) {
+            const TileRange& range = _surfelTileRanges[index];
+
+            for (int ty = range.minY; ty <= range.maxY; ++ty) {
+                for (int tx = range.minX; tx <= range.maxX; ++tx) {
+                    if (tileMask && !tileMask[ty * tilesX + tx]) { continue; }
+                    _tileSurfelIndices[tileCursors[ty * tilesX + tx]++] = (uint32_t)index;
+                }
+            }
+        }
+    });
+
+    // Pass 3: rasterize each tile against its own depth buffer
+    _parallelFor(_threadCount, tileCount, [&](size_t tile) {
+        uint32_t tileBegin = _tileStarts[tile];
+        uint32_t tileEnd = _tileStarts[tile + 1];
+        if (tileBegin == tileEnd) { return; }
+
+        const int tileX0 = (int)(tile % tilesX) * TileSize;
+        const int tileY0 = (int)(tile / tilesX) * TileSize;
+        const int tileX1 = std::min(tileX0 + TileSize, width) - 1;
+        const int tileY1 = std::min(tileY0 + TileSize, height) - 1;
+
+        float depths[TileSize * TileSize];
+        std::fill(depths, depths + TileSize * TileSize, 1.0f);
+
+        for (uint32_t i = tileBegin; i < tileEnd; ++i) {
+            uint32_t surfelIndex = _tileSurfelIndices[i];
+
+            SplatVertex vertices[6];
+            _projectSplat(surfels, surfelIndex, uniforms, vertices);
+
+            for (int t = 0; t < 4; ++t) {
+                const int* tri = kStripTriangles[t];
+                const SplatVertex& a = vertices[tri[0]];
+                SplatVertex b = vertices[tri[1]];
+                SplatVertex c = vertices[tri[2]];
+
+                if (!_isFrontFacing(a, b, c)) { continue; }
+
+                // Swap to a positive area so that all edge functions are non-negative inside
+                std::swap(b, c);
+                float area = _edgeFunction(a, b, c.x, c.y);
+                if (!(area > 0)) { continue; }
+                float inverseArea = 1.0f / area;
+
+                bool topLeftA = _isTopLeftEdge(b, c);
+                bool topLeftB = _isTopLeftEdge(c, a);
+                bool topLeftC = _isTopLeftEdge(a, b);
+
+                float minX = std::min(a.x, std::min(b.x, c.x));
+                float maxX = std::max(a.x, std::max(b.x, c.x));
+                float minY = std::min(a.y, std::min(b.y, c.y));
+                float maxY = std::max(a.y, std::max(b.y, c.y));
+
+                int x0 = std::max(tileX0, (int)std::ceil(std::max(minX - 0.5f, -1.0f)));
+                int x1 = std::min(tileX1, (int)std::floor(std::min(maxX - 0.5f, (float)width)));
+                int y0 = std::max(tileY0, (int)std::ceil(std::max(minY - 0.5f, -1.0f)));
+                int y1 = std::min(tileY1, (int)std::floor(std::min(maxY - 0.5f, (float)height)));
+
+                for (int y = y0; y <= y1; ++y) {
+                    float sampleY = y + 0.5f;
+                    float* depthRow = depths + (y - tileY0) * TileSize - tileX0;
+                    uint32_t* indexRow = indexLookups.data() + (size_t)y * width;
+
+                    for (int x = x0; x <= x1; ++x) {
+                        float sampleX = x + 0.5f;
+                        float weightA = _edgeFunction(b, c, sampleX, sampleY);
+                        float weightB = _edgeFunction(c, a, sampleX, sampleY);
+                        float weightC = _edgeFunction(a, b, sampleX, sampleY);
+
+                        if (weightA < 0 || weightB < 0 || weightC < 0) { continue; }
+                        if ((weightA == 0 && !topLeftA) || (weightB == 0 && !topLeftB) || (weightC == 0 && !topLeftC)) { continue; }
+
+                        float z = (weightA * a.z + weightB * b.z + weightC * c.z) * inverseArea;
+
+                        // Fragments outside the clip volume are discarded; the rest must pass a less-than test
+                        if (z < 0.0f || !(z < depthRow[x])) { continue; }
+
+                        depthRow[x] = z;
+                        indexRow[x] = surfelIndex;
+                    }
+                }
+            }
+        }
+    });
+}
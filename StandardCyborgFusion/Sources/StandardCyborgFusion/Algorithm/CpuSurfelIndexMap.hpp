@@ -0,0 +1,99 @@
+//
+//  CpuSurfelIndexMap.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <thread>
+#import <vector>
+
+#import "LensCalibration.hpp"
+#import "SurfelIndexMap.hpp"
+
+/** Renders the surfel index map on the CPU, for use where Metal is unavailable
+ *  (headless reconstruction, servers, tests).
+ *
+ *  Output matches MetalSurfelIndexMap: each surfel is splatted as the same hexagon,
+ *  scaled by the surfel aliasing safety factor, run through the inverse lens
+ *  calibration (for `draw`), back-face culled and depth tested with a less-than
+ *  comparison. Surfels are binned into screen tiles which are rasterized in parallel.
+ *  Within a tile, surfels are visited in index order, so ties resolve the same way
+ *  every time.
+ */
+class CpuSurfelIndexMap: public SurfelIndexMap {
+public:
+    /** Work runs on the shared TaskScheduler, split into pieces for about `threadCount` threads.
+     *  With a single thread, it all runs on the calling thread instead, which suits callers
+     *  that already draw several maps at once as tasks of their own. */
+    CpuSurfelIndexMap(int threadCount = (int)std::thread::hardware_concurrency());
+
+    virtual bool draw(const std::vector<Surfel>& surfels,
+                      const Eigen::Matrix4f& modelMatrix,
+                      const RawFrame& rawFrame,
+                      std::vector<uint32_t>& indexLookups);
+
+    /** Reads positions, normals and sizes straight from the arrays, without packing them */
+    virtual bool draw(const SurfelStore& surfels,
+                      const Eigen::Matrix4f& modelMatrix,
+                      const RawFrame& rawFrame,
+                      std::vector<uint32_t>& indexLookups);
+
+    virtual bool drawForColor(const Surfel* surfels,
+                              size_t surfelCount,
+                              Eigen::Matrix4f viewProjectionMatrix,
+                              size_t frameWidth,
+                              size_t frameHeight,
+                              std::vector<uint32_t>& indexLookups);
+
+    /** Finds the surfel drawForColor would draw at each of `pixelIndices`, or EMPTY_SURFEL_INDEX,
+     *  but only bins and rasterizes the tiles those pixels fall in. `indexLookups` is left holding
+     *  the index map for just those tiles. */
+    void lookUpForColor(const Surfel* surfels,
+                        size_t surfelCount,
+                        Eigen::Matrix4f viewProjectionMatrix,
+                        size_t frameWidth,
+                        size_t frameHeight,
+                        const std::vector<uint32_t>& pixelIndices,
+                        std::vector<uint32_t>& indexLookups,
+                        uint32_t* surfelIndicesOut);
+
+    virtual Eigen::Matrix4f getViewProjectionMatrix();
+
+    /** Size in pixels of the square screen tiles surfels are binned into */
+    static const int TileSize = 32;
+
+    struct SplatUniforms {
+        Eigen::Matrix4f projectionViewMatrix;
+        LensCalibration lensCalibration;
+        bool applyLensCalibration;
+        float surfelAliasingSafetyFactor;
+        int frameWidth;
+        int frameHeight;
+    };
+
+private:
+    struct TileRange {
+        uint16_t minX, minY, maxX, maxY;
+    };
+
+    int _threadCount;
+    Eigen::Matrix4f _lastViewProjectionMatrix;
+
+    // Scratch space, retained between draws to avoid reallocating every frame
+    std::vector<TileRange> _surfelTileRanges;
+    std::vector<uint32_t> _chunkTileCounts;
+    std::vector<uint32_t> _tileStarts;
+    std::vector<uint32_t> _tileSurfelIndices;
+    std::vector<uint8_t> _tileMask;
+
+    SplatUniforms _drawUniforms(const Eigen::Matrix4f& modelMatrix, const RawFrame& rawFrame);
+    SplatUniforms _drawForColorUniforms(const Eigen::Matrix4f& viewProjectionMatrix, size_t frameWidth, size_t frameHeight);
+
+    /** Tiles with a zero in `tileMask` are skipped and left empty. A null mask draws them all. */
+    template <typename SurfelSource>
+    void _render(const SurfelSource& surfels, size_t surfelCount, const SplatUniforms& uniforms, std::vector<uint32_t>& indexLookups,
+                 const uint8_t* tileMask = nullptr);
+};
@@ -5,14 +5,15 @@
 //  Created by Aaron Thompson on 7/10/18.
 //
 
-#include <dispatch/dispatch.h>
-
 #include <standard_cyborg/util/DataUtils.hpp>
 #include <standard_cyborg/util/DebugHelpers.hpp>
+#include <standard_cyborg/util/TaskScheduler.hpp>
 
+#include "AssimilationWorkspace.hpp"
 #include "GeometryHelpers.hpp"
-#include "ThreadPool.hpp"
 #include "ICP.hpp"
+#include "ICPIncrementalTarget.hpp"
+#include "ICPProjectiveTarget.hpp"
 
 #include "EigenHelpers.hpp"
 #pragma clang diagnostic push
@@ -22,250 +23,251 @@
 
 using namespace standard_cyborg;
 
-struct _ICPCorrespondence {
-    const std::vector<math::Vec3>& sourceVertices;
+// Fewer correspondences than this can't constrain all six degrees of freedom
+static const size_t kMinCorrespondenceCount = 6;
+
+// Source vertices are processed in blocks of this many, with a separate accumulator per lane,
+// so the lanes are independent and the compiler can vectorize across them without having to
+// reassociate floating point sums
+static const size_t kLaneCount = 8;
+
+static const int kUpperTriangleCount = ICPNormalEquationSums::upperTriangleCount;
+
+// Finds correspondences by searching the target cloud's kd-tree for the nearest neighbor
+struct _NearestNeighborCorrespondenceFinder {
+    const sc3d::Geometry& targetCloud;
+    const std::vector<math::Vec3>& positions;
+    const std::vector<math::Vec3>& normals;
+    
+    _NearestNeighborCorrespondenceFinder(const sc3d::Geometry& targetCloud) :
+        targetCloud(targetCloud),
+        positions(targetCloud.getPositions()),
+        normals(targetCloud.getNormals())
+    {
+        // make sure to initialize the KD-tree. since initializing it in the multithreaded code, is asking for trouble.
+        targetCloud.getClosestVertexIndex(math::Vec3(0,0,0));
+    }
     
-    std::vector<math::Vec3>& targetVertices;
-    std::vector<math::Vec3>& targetNormals;
+    inline bool find(size_t, const math::Vec3& sourceVertex, math::Vec3& targetVertexOut, math::Vec3& targetNormalOut) const
+    {
+        size_t nearestRefVertexIndex = targetCloud.getClosestVertexIndex(sourceVertex);
+        
+        // Use the nearest neighbor
+        targetVertexOut = positions[nearestRefVertexIndex];
+        targetNormalOut = normals[nearestRefVertexIndex];
+        
+        return true;
+    }
+};
 
-    Eigen::VectorXf* squaredErrors;
-    Eigen::VectorXf* weights;
-    
-    _ICPCorrespondence(const std::vector<math::Vec3>& sourceVertices,
-                       std::vector<math::Vec3>& targetVertices,
-                       std::vector<math::Vec3>& targetNormals,
-                       Eigen::VectorXf* squaredErrors,
-                       Eigen::VectorXf* weights) :
-        sourceVertices(sourceVertices),
-        targetVertices(targetVertices),
-        targetNormals(targetNormals),
-        squaredErrors(squaredErrors),
-        weights(weights)
+// Finds correspondences by searching an incrementally updated target for the nearest neighbor
+struct _IncrementalTargetCorrespondenceFinder {
+    const ICPIncrementalTarget& target;
+    
+    _IncrementalTargetCorrespondenceFinder(const ICPIncrementalTarget& target) :
+        target(target)
     {}
     
-    float computeRMSCorrespondenceError()
+    inline bool find(size_t, const math::Vec3& sourceVertex, math::Vec3& targetVertexOut, math::Vec3& targetNormalOut) const
     {
-        size_t sourceVerticesLength = sourceVertices.size();
+        return target.findClosestPoint(sourceVertex, targetVertexOut, targetNormalOut);
+    }
+};
+
+// Finds correspondences by projecting into a rendered vertex and normal map, rejecting
+// those too far apart or facing too different a direction
+struct _ProjectiveCorrespondenceFinder {
+    const ICPProjectiveTarget& target;
+    const std::vector<math::Vec3>& sourceNormals;
+    float maxSquaredDistance;
+    float minNormalDot;
+    
+    _ProjectiveCorrespondenceFinder(const ICPProjectiveTarget& target,
+                                    const std::vector<math::Vec3>& sourceNormals,
+                                    const ICPConfiguration& config) :
+        target(target),
+        sourceNormals(sourceNormals),
+        maxSquaredDistance(config.maxProjectiveCorrespondenceDistance * config.maxProjectiveCorrespondenceDistance),
+        minNormalDot(cosf(config.maxProjectiveCorrespondenceAngle))
+    {}
+    
+    inline bool find(size_t sourceIndex, const math::Vec3& sourceVertex, math::Vec3& targetVertexOut, math::Vec3& targetNormalOut) const
+    {
+        size_t pixelIndex;
+        if (!target.pixelIndexForPosition(sourceVertex, pixelIndex) || target.isEmpty(pixelIndex)) { return false; }
         
-        double sumSquaredError = 0.0;
-        double weightSum = 0;
+        const math::Vec3& targetVertex = target.positions[pixelIndex];
+        const math::Vec3& targetNormal = target.normals[pixelIndex];
         
-        for (size_t i = 0; i < sourceVerticesLength; ++i) {
-            Vector3f correspondenceError = standard_cyborg::toVector3f(sourceVertices[i]) - standard_cyborg::toVector3f(targetVertices[i]);
-            float errorSquared = correspondenceError.squaredNorm(); // squaredNorm is the squared Euclidean distance
-            float weight = 1.0; //(*weights)(i);
-            sumSquaredError += errorSquared * weight;
-            weightSum += weight;
-        }
+        if (math::Vec3::squaredDistanceBetween(sourceVertex, targetVertex) > maxSquaredDistance) { return false; }
+        if (math::Vec3::dot(sourceNormals[sourceIndex], targetNormal) < minNormalDot) { return false; }
         
-        double variance = sumSquaredError / weightSum;
+        targetVertexOut = targetVertex;
+        targetNormalOut = targetNormal;
         
-        return (float)sqrt(variance);
+        return true;
     }
 };
 
-static inline void AddUpperTriangularOuterProductToMatrix6x6(Eigen::VectorXf& source, Eigen::MatrixXf& destination)
-{
-    destination(0, 0) += source[0] * source[0];
-    destination(0, 1) += source[0] * source[1];
-    destination(0, 2) += source[0] * source[2];
-    destination(0, 3) += source[0] * source[3];
-    destination(0, 4) += source[0] * source[4];
-    destination(0, 5) += source[0] * source[5];
-    
-    destination(1, 1) += source[1] * source[1];
-    destination(1, 2) += source[1] * source[2];
-    destination(1, 3) += source[1] * source[3];
-    destination(1, 4) += source[1] * source[4];
-    destination(1, 5) += source[1] * source[5];
-    
-    destination(2, 2) += source[2] * source[2];
-    destination(2, 3) += source[2] * source[3];
-    destination(2, 4) += source[2] * source[4];
-    destination(2, 5) += source[2] * source[5];
-    
-    destination(3, 3) += source[3] * source[3];
-    destination(3, 4) += source[3] * source[4];
-    destination(3, 5) += source[3] * source[5];
-    
-    destination(4, 4) += source[4] * source[4];
-    destination(4, 5) += source[4] * source[5];
-    
-    destination(5, 5) += source[5] * source[5];
-}
-
-static inline void FillUpperTriangularMatrixIntoLower6x6(Eigen::MatrixXf& m)
+template <typename CorrespondenceFinder>
+static ICPCorrespondenceSums _computeCorrespondencePartial(size_t rangeStart, size_t rangeEnd,
+                                                           const std::vector<math::Vec3>& sourceVertices,
+                                                           const CorrespondenceFinder& finder,
+                                                           ICPCorrespondences& correspondences)
 {
-    m(1, 0) = m(0, 1);
+    ICPCorrespondenceSums sums;
+    math::Vec3 targetVertex, targetNormal;
     
-    m(2, 0) = m(0, 2);
-    m(2, 1) = m(1, 2);
-
-    m(3, 0) = m(0, 3);
-    m(3, 1) = m(1, 3);
-    m(3, 2) = m(2, 3);
-
-    m(4, 0) = m(0, 4);
-    m(4, 1) = m(1, 4);
-    m(4, 2) = m(2, 4);
-    m(4, 3) = m(3, 4);
-
-    m(5, 0) = m(0, 5);
-    m(5, 1) = m(1, 5);
-    m(5, 2) = m(2, 5);
-    m(5, 3) = m(3, 5);
-    m(5, 4) = m(4, 5);
-}
-
-static void _computeCorrespondencePartial(off_t rangeStart, off_t rangeEnd,
-                                          const std::vector<math::Vec3>& sourceVertices,
-                                          const sc3d::Geometry& targetCloud,
-                                          std::vector<math::Vec3>& targetVertices,
-                                          std::vector<math::Vec3>& targetNormals,
-                                          Eigen::VectorXf* squaredErrors,
-                                          double* sumSquaredErrorOut,
-                                          dispatch_group_t group)
-{
-    double sumSquaredError = 0;
-    
-    const std::vector<math::Vec3>& positions = targetCloud.getPositions();
-    const std::vector<math::Vec3>& normals = targetCloud.getNormals();
-    
-    for (off_t i = rangeStart; i < rangeEnd; ++i) {
-        size_t nearestRefVertexIndex = targetCloud.getClosestVertexIndex(sourceVertices[i]);
-        
-        // Use the nearest neighbor
-        targetVertices[i] = positions[nearestRefVertexIndex];
-        targetNormals[i] = normals[nearestRefVertexIndex];
+    for (size_t i = rangeStart; i < rangeEnd; ++i) {
+        bool isMatch = finder.find(i, sourceVertices[i], targetVertex, targetNormal);
+        correspondences.set(i, sourceVertices[i], targetVertex, targetNormal, isMatch);
         
-        float nearestRefVertexDistanceSquared = math::Vec3::squaredDistanceBetween(sourceVertices[i], targetVertices[i]);
+        if (!isMatch) { continue; }
         
-        (*squaredErrors)(i) = nearestRefVertexDistanceSquared;
-        sumSquaredError += nearestRefVertexDistanceSquared;
+        sums.squaredError += correspondences.squaredErrors[i];
+        sums.matchCount++;
     }
     
-    *sumSquaredErrorOut = sumSquaredError;
+    return sums;
+}
+
+// Splits a pass over the source vertices into config.threadCount chunks on the shared scheduler.
+// The partial sums are reduced in chunk order, so results don't depend on thread timing.
+static size_t _grainSize(const ICPConfiguration& config, size_t vertexCount)
+{
+    size_t chunkCount = (size_t)std::max(config.threadCount, 1);
     
-    dispatch_group_leave(group);
+    return (vertexCount + chunkCount - 1) / chunkCount;
 }
 
-static _ICPCorrespondence _computeCorrespondence(const std::vector<math::Vec3>& sourceVertices,
-                                                 const sc3d::Geometry& targetCloud,
-                                                 const ICPConfiguration& config,
-                                                 std::vector<math::Vec3>& targetVertices,
-                                                 std::vector<math::Vec3>& targetNormals,
-                                                 Eigen::VectorXf* squaredErrors,
-                                                 Eigen::VectorXf* weights)
+template <typename CorrespondenceFinder>
+static void _computeCorrespondences(const std::vector<math::Vec3>& sourceVertices,
+                                    const CorrespondenceFinder& finder,
+                                    const ICPConfiguration& config,
+                                    ICPCorrespondences& correspondences,
+                                    std::vector<ICPCorrespondenceSums>& partials)
 {
     size_t vertexCount = sourceVertices.size();
     assert(vertexCount > 0);
     
-    // make sure to initialize the KD-tree. since initializing it in the multithreaded code, is asking for trouble.
-    targetCloud.getClosestVertexIndex(math::Vec3(0,0,0));
-    
-    // Just doing 2 threads for now, because iPhone X is 2 cores, one of which is mostly busy doing UI and other AR work anyway
-#define MULTITHREAD 1
-    static ThreadPool threadPool(config.threadCount, QOS_CLASS_USER_INTERACTIVE);
-    static dispatch_group_t group = dispatch_group_create();
-    double sumSquaredError = 0;
+    ICPCorrespondenceSums sums = util::TaskScheduler::shared().parallelReduce(
+        0, vertexCount, _grainSize(config, vertexCount), ICPCorrespondenceSums(),
+        [&](size_t rangeStart, size_t rangeEnd) {
+            return _computeCorrespondencePartial(rangeStart, rangeEnd, sourceVertices, finder, correspondences);
+        },
+        [](const ICPCorrespondenceSums& lhs, const ICPCorrespondenceSums& rhs) {
+            ICPCorrespondenceSums sum;
+            sum.squaredError = lhs.squaredError + rhs.squaredError;
+            sum.matchCount = lhs.matchCount + rhs.matchCount;
+            return sum;
+        },
+        partials);
+    
+    correspondences.matchCount = sums.matchCount;
+    correspondences.sumSquaredError = sums.squaredError;
+}
+
+// Accumulates the correspondences in [start, start + count), count <= kLaneCount, one per lane.
+// For each, it computes the outlier weight w, cn = w * (p × n, n) and r = (p - q) · n, then adds
+// the upper triangle of cn * cnᵀ and cn * r. Every loop over lanes is innermost and branch-free.
+static inline void _accumulateNormalEquationBlock(const ICPCorrespondences& c,
+                                                  size_t start,
+                                                  size_t count,
+                                                  float avgSquaredError,
+                                                  float normalizedVarianceThreshold,
+                                                  float JtJ[kUpperTriangleCount][kLaneCount],
+                                                  float Jtr[6][kLaneCount])
+{
+    float cn[6][kLaneCount] = {};
+    float r[kLaneCount] = {};
     
-#if !MULTITHREAD
-    dispatch_group_enter(group);
-    _computeCorrespondencePartial(0, vertexCount,
-                                  sourceVertices,
-                                  targetCloud,
-                                  
-                                  targetVertices,
-                                  targetNormals,
-                                  squaredErrors,
-                                  &sumSquaredError,
-                                  group);
-#else
-    double sumSquaredErrors[config.threadCount];
-    memset(&sumSquaredErrors, config.threadCount, sizeof(double));
-    
-    for (int i = 0; i < config.threadCount; ++i) {
-        size_t rangeStart = vertexCount * (i) / config.threadCount;
-        size_t rangeEnd = vertexCount * (i + 1) / config.threadCount;
+    for (size_t lane = 0; lane < count; ++lane) {
+        size_t i = start + lane;
+        
+        // Correspondences whose error is too many deviations from the mean are outliers
+        float normalizedVariance = c.squaredErrors[i] / avgSquaredError;
+        float w = normalizedVariance > normalizedVarianceThreshold ? 0.0f : c.matchMask[i];
         
-        dispatch_group_enter(group);
+        float px = c.sourceX[i], py = c.sourceY[i], pz = c.sourceZ[i];
+        float nx = c.normalX[i], ny = c.normalY[i], nz = c.normalZ[i];
         
-        threadPool.addJob(std::bind(_computeCorrespondencePartial,
-                                    rangeStart, rangeEnd,
-                                    std::cref(sourceVertices),
-                                    std::cref(targetCloud),
-                                    std::ref(targetVertices),
-                                    std::ref(targetNormals),
-                                    squaredErrors,
-                                    &sumSquaredErrors[i],
-                                    group));
+        cn[0][lane] = (py * nz - pz * ny) * w;
+        cn[1][lane] = (pz * nx - px * nz) * w;
+        cn[2][lane] = (px * ny - py * nx) * w;
+        cn[3][lane] = nx * w;
+        cn[4][lane] = ny * w;
+        cn[5][lane] = nz * w;
+        r[lane] = (px - c.targetX[i]) * nx + (py - c.targetY[i]) * ny + (pz - c.targetZ[i]) * nz;
     }
     
-    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
-    
-    for (int i = 0; i < config.threadCount; ++i) {
-        sumSquaredError += sumSquaredErrors[i];
+    int k = 0;
+    for (int row = 0; row < 6; ++row) {
+        for (int column = row; column < 6; ++column, ++k) {
+            for (size_t lane = 0; lane < kLaneCount; ++lane) {
+                JtJ[k][lane] += cn[row][lane] * cn[column][lane];
+            }
+        }
+        for (size_t lane = 0; lane < kLaneCount; ++lane) {
+            Jtr[row][lane] += cn[row][lane] * r[lane];
+        }
     }
-#endif
+}
+
+static ICPNormalEquationSums _accumulateNormalEquationsPartial(size_t rangeStart, size_t rangeEnd,
+                                                               const ICPCorrespondences& correspondences,
+                                                               float avgSquaredError,
+                                                               float normalizedVarianceThreshold)
+{
+    float JtJ[kUpperTriangleCount][kLaneCount] = {};
+    float Jtr[6][kLaneCount] = {};
     
-    float avgSquaredError = sumSquaredError / vertexCount;
-    float normalizedVarianceThreshold = config.outlierDeviationsThreshold * config.outlierDeviationsThreshold;
+    for (size_t start = rangeStart; start < rangeEnd; start += kLaneCount) {
+        size_t count = std::min(kLaneCount, rangeEnd - start);
+        _accumulateNormalEquationBlock(correspondences, start, count, avgSquaredError, normalizedVarianceThreshold, JtJ, Jtr);
+    }
     
-    for (size_t i = 0; i < vertexCount; i++) {
-        float squaredError = (*squaredErrors)(i);
-        float normalizedVariance = squaredError / avgSquaredError;
-        float weight = normalizedVariance > normalizedVarianceThreshold ? 0.0 : 1.0;
-        
-        (*weights)(i) = weight; // * sourceWeights[i];
+    ICPNormalEquationSums sums;
+    for (size_t lane = 0; lane < kLaneCount; ++lane) {
+        for (int k = 0; k < kUpperTriangleCount; ++k) { sums.JtJ[k] += JtJ[k][lane]; }
+        for (int k = 0; k < 6; ++k) { sums.Jtr[k] += Jtr[k][lane]; }
     }
     
-    return _ICPCorrespondence(sourceVertices, targetVertices, targetNormals, squaredErrors, weights);
+    return sums;
 }
 
-static Eigen::Matrix4f _computePointToPlaneTransform(_ICPCorrespondence& correspondence, ICPConfiguration config)
+static Eigen::Matrix4f _computePointToPlaneTransform(const ICPCorrespondences& correspondences,
+                                                     const ICPConfiguration& config,
+                                                     std::vector<ICPNormalEquationSums>& partials)
 {
-    const std::vector<math::Vec3>& sourceVertices = correspondence.sourceVertices;
-    std::vector<math::Vec3>& targetVertices = correspondence.targetVertices;
-    std::vector<math::Vec3>& targetNormals = correspondence.targetNormals;
-    const Eigen::VectorXf& weights = *(correspondence.weights);
-    size_t sourceVerticesLength = sourceVertices.size();
-    
-    Eigen::Vector3f p; // The source point
-    Eigen::Vector3f q; // The target point
-    Eigen::Vector3f n; // The source normal
-    Eigen::VectorXf cn(6); // A concatenation of c and n since it's so useful
-    
     // Perform linearized point-to-plane ICP, as described in:
     //    https://www.cs.princeton.edu/~smr/papers/icpstability.pdf
+    // The outlier weights, normal equations and their right hand side are all computed in one pass
+    size_t vertexCount = correspondences.squaredErrors.size();
+    float avgSquaredError = correspondences.sumSquaredError / std::max(correspondences.matchCount, (size_t)1);
+    float normalizedVarianceThreshold = config.outlierDeviationsThreshold * config.outlierDeviationsThreshold;
     
-    // A * x = b. We seek to solve for x.
-    Eigen::MatrixXf A = Eigen::MatrixXf::Zero(6, 6);
-    Eigen::VectorXf b = Eigen::VectorXf::Zero(6);
-    Eigen::VectorXf x = Eigen::VectorXf::Zero(6);
-    
-    for (off_t i = 0; i < sourceVerticesLength; i++) {
-        float w = weights(i);
-        p = standard_cyborg::toVector3f(sourceVertices[i]);
-        q = standard_cyborg::toVector3f(targetVertices[i]);
-        n = standard_cyborg::toVector3f(targetNormals[i]);
-        cn.head<3>() = p.cross(n) * w;
-        cn.tail<3>() = n * w;
-        
-        // We used to multiply A & b by w below, but it's faster to do that multiplication above
-        
-        // Another optimization: adding .noalias()
-        // A.noalias() += cn * cn.transpose();
-        // http://eigen.tuxfamily.org/dox/TopicWritingEfficientProductExpression.html
-        
-        // A third optimization: manually add the result of only the upper triangular product of cn * transpose(cn)
-        AddUpperTriangularOuterProductToMatrix6x6(cn, A);
-        b.noalias() -= cn * (p - q).dot(n);
+    ICPNormalEquationSums sums = util::TaskScheduler::shared().parallelReduce(
+        0, vertexCount, _grainSize(config, vertexCount), ICPNormalEquationSums(),
+        [&](size_t rangeStart, size_t rangeEnd) {
+            return _accumulateNormalEquationsPartial(rangeStart, rangeEnd, correspondences, avgSquaredError, normalizedVarianceThreshold);
+        },
+        [](const ICPNormalEquationSums& lhs, const ICPNormalEquationSums& rhs) {
+            return lhs + rhs;
+        },
+        partials);
+    
+    // A * x = b. We seek to solve for x. A is symmetric, so fill in its lower triangle from the upper.
+    Eigen::Matrix<float, 6, 6> A;
+    Eigen::Matrix<float, 6, 1> b;
+    int k = 0;
+    for (int row = 0; row < 6; ++row) {
+        for (int column = row; column < 6; ++column) {
+            A(row, column) = A(column, row) = sums.JtJ[k++];
+        }
+        b(row) = -sums.Jtr[row];
     }
     
-    // Fill in the lower part of the triangular matrix, which is mathematically identical
-    FillUpperTriangularMatrixIntoLower6x6(A);
-    
-    x = A.llt().solve(b);
+    Eigen::Matrix<float, 6, 1> x = A.llt().solve(b);
     
     Eigen::Matrix4f sourceTransform;
     sourceTransform.setIdentity();
@@ -282,53 +284,104 @@ bool hasNaN(const math::Mat4x4& m) {
            std::isnan(m.m30) || std::isnan(m.m31) || std::isnan(m.m32) || std::isnan(m.m33);
 }
 
-// transform all the 3D vectors in  `target`, with the specified transformation matrix. And make sure to normalize homogenous coordinates, after transforming.
-void transformVectors(const Eigen::Matrix4f& m, std::vector<math::Vec3>& target) {
+// Transforms the source vertices in [rangeStart, rangeEnd) in place, normalizing homogeneous
+// coordinates afterwards, and rotates their normals if there are any. Returns the sum of squared
+// distances from the transformed vertices to their correspondences.
+static double _transformSourcePartial(size_t rangeStart, size_t rangeEnd,
+                                      const Eigen::Matrix4f& m,
+                                      const ICPCorrespondences& correspondences,
+                                      std::vector<math::Vec3>& sourceVertices,
+                                      std::vector<math::Vec3>* sourceNormals)
+{
     const float m00 = m(0, 0), m01 = m(0, 1), m02 = m(0, 2), m03 = m(0, 3),
                 m10 = m(1, 0), m11 = m(1, 1), m12 = m(1, 2), m13 = m(1, 3),
-                m20 = m(2, 0), m21 = m(2, 1), m22 = m(2, 2), m23 = m(2, 3);
+                m20 = m(2, 0), m21 = m(2, 1), m22 = m(2, 2), m23 = m(2, 3),
+                m30 = m(3, 0), m31 = m(3, 1), m32 = m(3, 2), m33 = m(3, 3);
     
-    size_t count = target.size();
-    for (size_t i = 0; i < count; ++i) {
-        Vector3f a = standard_cyborg::toVector3f(target[i]);
-        
-        const float x = a.x(), y = a.y(), z = a.z();
-        float w = m(3, 0) * x + m(3, 1) * y + m(3, 2) * z + m(3, 3);
+    double sumSquaredError = 0;
+    
+    for (size_t i = rangeStart; i < rangeEnd; ++i) {
+        const float x = correspondences.sourceX[i], y = correspondences.sourceY[i], z = correspondences.sourceZ[i];
+        float w = m30 * x + m31 * y + m32 * z + m33;
         if (w == 0) { w = 1.0; }
         const float wInverse = 1.0 / w;
         
-        target[i].x = (m00 * x + m01 * y + m02 * z + m03) * wInverse;
-        target[i].y = (m10 * x + m11 * y + m12 * z + m13) * wInverse;
-        target[i].z = (m20 * x + m21 * y + m22 * z + m23) * wInverse;
+        math::Vec3& vertex = sourceVertices[i];
+        vertex.x = (m00 * x + m01 * y + m02 * z + m03) * wInverse;
+        vertex.y = (m10 * x + m11 * y + m12 * z + m13) * wInverse;
+        vertex.z = (m20 * x + m21 * y + m22 * z + m23) * wInverse;
+        
+        float dx = vertex.x - correspondences.targetX[i];
+        float dy = vertex.y - correspondences.targetY[i];
+        float dz = vertex.z - correspondences.targetZ[i];
+        sumSquaredError += correspondences.matchMask[i] * (dx * dx + dy * dy + dz * dz);
     }
+    
+    if (sourceNormals != nullptr) {
+        for (size_t i = rangeStart; i < rangeEnd; ++i) {
+            math::Vec3& normal = (*sourceNormals)[i];
+            const float x = normal.x, y = normal.y, z = normal.z;
+            normal.x = m00 * x + m01 * y + m02 * z;
+            normal.y = m10 * x + m11 * y + m12 * z;
+            normal.z = m20 * x + m21 * y + m22 * z;
+        }
+    }
+    
+    return sumSquaredError;
 }
 
-ICPResult ICP::run(ICPConfiguration config,
-                   sc3d::Geometry& sourceCloud,
-                   sc3d::Geometry& targetCloud,
-                   std::function<void(ICPResult)> callback)
+// Applies an ICP adjustment to the source and returns the RMS distance to the correspondences it was
+// computed from, in the same pass
+static float _transformSource(const Eigen::Matrix4f& m,
+                              const ICPCorrespondences& correspondences,
+                              const ICPConfiguration& config,
+                              std::vector<math::Vec3>& sourceVertices,
+                              std::vector<math::Vec3>* sourceNormals,
+                              std::vector<double>& partials)
 {
-    ICPResult result;
-    result.succeeded = true;
+    size_t vertexCount = sourceVertices.size();
     
-    if (sourceCloud.getPositions().size() == 0 || targetCloud.getPositions().size() == 0) {
-        result.rmsCorrespondenceError = 0;
+    double sumSquaredError = util::TaskScheduler::shared().parallelReduce(
+        0, vertexCount, _grainSize(config, vertexCount), 0.0,
+        [&](size_t rangeStart, size_t rangeEnd) {
+            return _transformSourcePartial(rangeStart, rangeEnd, m, correspondences, sourceVertices, sourceNormals);
+        },
+        [](double lhs, double rhs) {
+            return lhs + rhs;
+        },
+        partials);
+    
+    double variance = sumSquaredError / correspondences.matchCount;
+    
+    return (float)sqrt(variance);
+}
 
-        /*
-        DEBUG_LOG("WARNING: sourceCloud or targetCloud empty. sourceCloud size %ld.\ntargetCloud size %ld\n",
-                  sourceCloud.getVertices().size(),
-                  targetCloud.getVertices().size());
-        */
-        
-        return result;
-    }
+// Whether a rigid transform moves things by less than `tolerance`, in both translation and rotation angle
+static bool isSmallTransform(const Eigen::Matrix4f& m, float tolerance) {
+    float cosAngle = 0.5f * (m.topLeftCorner<3, 3>().trace() - 1.0f);
+    float angle = acosf(std::min(1.0f, std::max(-1.0f, cosAngle)));
     
-    // Although architecturally bad, we're going to abuse the knowledge that our caller
-    // is operating on a sourceCloud that will only be used here and then discarded
-    // A slower but cleaner approach is to copy the vertices to our own local version
-    std::vector<math::Vec3>& sourceVertices = const_cast< std::vector<math::Vec3>&>(sourceCloud.getPositions());
+    return m.col(3).head<3>().norm() < tolerance && angle < tolerance;
+}
 
-//    const SCVec3KdTreeAdaptor& targetCloudKdTree = targetCloud.getKdTree();
+// The ICP loop, shared between correspondence modes. If `sourceNormals` is non-null, it's kept
+// transformed along with the source vertices so that the finder can compare normals.
+//
+// With a nonzero `transformTolerance`, iteration also stops once an adjustment is smaller than it.
+// Projective correspondences shift between pixels from one iteration to the next, so their RMS
+// error wobbles by more than `config.tolerance` long after the transform has settled.
+template <typename CorrespondenceFinder>
+static ICPResult _runICP(const ICPConfiguration& config,
+                         std::vector<math::Vec3>& sourceVertices,
+                         std::vector<math::Vec3>* sourceNormals,
+                         const CorrespondenceFinder& finder,
+                         float transformTolerance,
+                         ICPCorrespondences& correspondences,
+                         ICPPartialSums& partialSums,
+                         const std::function<void(ICPResult)>& callback)
+{
+    ICPResult result;
+    result.succeeded = true;
     
     // We run multiple passes, so we aggregate the successive transforms here. *This is the main output*
     Eigen::Matrix4f sourceTransform = Eigen::Matrix4f::Identity();
@@ -337,31 +390,26 @@ ICPResult ICP::run(ICPConfiguration config,
     float relativeError = config.tolerance * 10;
     
     // Reuse these buffers between iterations
-    size_t vertexCount = sourceVertices.size();
-    
-    std::vector<math::Vec3> targetVertices(vertexCount, math::Vec3());
-    std::vector<math::Vec3> targetNormals(vertexCount, math::Vec3());
-    std::unique_ptr<Eigen::VectorXf> squaredErrors(new Eigen::VectorXf(vertexCount));
-    std::unique_ptr<Eigen::VectorXf> weights(new Eigen::VectorXf(vertexCount));
+    correspondences.resize(sourceVertices.size());
     
     static const float kTranslationLimit = 0.2;
     float squaredTranslationLimit = kTranslationLimit * kTranslationLimit;
     int iteration = 0;
     
     float previousError = 1e10;
+    bool transformConverged = false;
     
-    while (iteration++ < config.maxIterations && relativeError > config.tolerance) {
+    while (iteration++ < config.maxIterations && relativeError > config.tolerance && !transformConverged) {
         // Compute the correspondence between the points being source and the reference cloud
-        _ICPCorrespondence correspondence = _computeCorrespondence(sourceVertices,
-                                                                   targetCloud,
-                                                                   config,
-                                                                   targetVertices,
-                                                                   targetNormals,
-                                                                   squaredErrors.get(),
-                                                                   weights.get());
+        _computeCorrespondences(sourceVertices, finder, config, correspondences, partialSums.correspondences);
+        
+        if (correspondences.matchCount < kMinCorrespondenceCount) {
+            result.succeeded = false;
+            break;
+        }
         
         // Compute the transform mapping these correspondences from the source to the target vertices
-        Eigen::Matrix4f sourceTransformAdjustment = _computePointToPlaneTransform(correspondence, config);
+        Eigen::Matrix4f sourceTransformAdjustment = _computePointToPlaneTransform(correspondences, config, partialSums.normalEquations);
         
         // This check doesn't enforce overall camera movement limits, but is instead an early bailout
         // for when ICP simply diverges to infinity
@@ -370,10 +418,10 @@ ICPResult ICP::run(ICPConfiguration config,
             break;
         }
 
-        transformVectors(sourceTransformAdjustment, sourceVertices);
-        
-        // Calculate the correspondence error
-        float rmsError = correspondence.computeRMSCorrespondenceError();
+        transformConverged = transformTolerance > 0 && isSmallTransform(sourceTransformAdjustment, transformTolerance);
+
+        // Move the source and calculate the correspondence error it's left with
+        float rmsError = _transformSource(sourceTransformAdjustment, correspondences, config, sourceVertices, sourceNormals, partialSums.squaredErrors);
         
         relativeError = fabsf(rmsError - previousError) / rmsError;
         previousError = rmsError;
@@ -389,16 +437,134 @@ ICPResult ICP::run(ICPConfiguration config,
         result.iterationCount = iteration;
         
 #if DEBUG && TARGET_OS_MAC
-        result.sourceVertices = std::make_shared<std::vector<math::Vec3>>(correspondence.sourceVertices);
-        result.targetVertices = std::make_shared<std::vector<math::Vec3>>(correspondence.targetVertices);
+        result.sourceVertices = std::make_shared<std::vector<math::Vec3>>(sourceVertices);
+        result.targetVertices = correspondences.copyTargetVertices();
 #endif
         
         if (callback != nullptr) { callback(result); }
     }
     
-    if (isnan(result.rmsCorrespondenceError) || isinf(result.rmsCorrespondenceError) || hasNaN(result.sourceTransform)) {
+    if (std::isnan(result.rmsCorrespondenceError) || std::isinf(result.rmsCorrespondenceError) || hasNaN(result.sourceTransform)) {
         result.succeeded = false;
     }
     
     return result;
 }
+
+ICPResult ICP::run(ICPConfiguration config,
+                   sc3d::Geometry& sourceCloud,
+                   sc3d::Geometry& targetCloud,
+                   std::function<void(ICPResult)> callback)
+{
+    if (sourceCloud.getPositions().size() == 0 || targetCloud.getPositions().size() == 0) {
+        ICPResult result;
+        result.succeeded = true;
+        result.rmsCorrespondenceError = 0;
+
+        /*
+        DEBUG_LOG("WARNING: sourceCloud or targetCloud empty. sourceCloud size %ld.\ntargetCloud size %ld\n",
+                  sourceCloud.getVertices().size(),
+                  targetCloud.getVertices().size());
+        */
+        
+        return result;
+    }
+    
+    // Although architecturally bad, we're going to abuse the knowledge that our caller
+    // is operating on a sourceCloud that will only be used here and then discarded
+    // A slower but cleaner approach is to copy the vertices to our own local version
+    std::vector<math::Vec3>& sourceVertices = const_cast< std::vector<math::Vec3>&>(sourceCloud.getPositions());
+    
+    _NearestNeighborCorrespondenceFinder finder(targetCloud);
+    ICPCorrespondences correspondences;
+    ICPPartialSums partialSums;
+    
+    return _runICP(config, sourceVertices, nullptr, finder, 0, correspondences, partialSums, callback);
+}
+
+ICPResult ICP::run(ICPConfiguration config,
+                   sc3d::Geometry& sourceCloud,
+                   const ICPProjectiveTarget& target,
+                   std::function<void(ICPResult)> callback)
+{
+    if (sourceCloud.getPositions().size() == 0 || target.positions.size() == 0) {
+        ICPResult result;
+        result.succeeded = true;
+        result.rmsCorrespondenceError = 0;
+        
+        return result;
+    }
+    
+    assert(sourceCloud.getNormals().size() == sourceCloud.getPositions().size());
+    
+    // As above, the source cloud is only used here, so transform it in place
+    std::vector<math::Vec3>& sourceVertices = const_cast<std::vector<math::Vec3>&>(sourceCloud.getPositions());
+    std::vector<math::Vec3>& sourceNormals = const_cast<std::vector<math::Vec3>&>(sourceCloud.getNormals());
+    
+    _ProjectiveCorrespondenceFinder finder(target, sourceNormals, config);
+    ICPCorrespondences correspondences;
+    ICPPartialSums partialSums;
+    
+    return _runICP(config, sourceVertices, &sourceNormals, finder, config.projectiveTransformTolerance, correspondences, partialSums, callback);
+}
+
+ICPResult ICP::run(ICPConfiguration config,
+                   sc3d::Geometry& sourceCloud,
+                   const ICPIncrementalTarget& target,
+                   std::function<void(ICPResult)> callback)
+{
+    if (sourceCloud.getPositions().size() == 0 || target.size() == 0) {
+        ICPResult result;
+        result.succeeded = true;
+        result.rmsCorrespondenceError = 0;
+        
+        return result;
+    }
+    
+    // As above, the source cloud is only used here, so transform it in place
+    std::vector<math::Vec3>& sourceVertices = const_cast<std::vector<math::Vec3>&>(sourceCloud.getPositions());
+    
+    _IncrementalTargetCorrespondenceFinder finder(target);
+    ICPCorrespondences correspondences;
+    ICPPartialSums partialSums;
+    
+    return _runICP(config, sourceVertices, nullptr, finder, 0, correspondences, partialSums, callback);
+}
+
+ICPResult ICP::run(ICPConfiguration config,
+                   const ICPProjectiveTarget& target,
+                   AssimilationWorkspace& workspace,
+                   const ICPIterationCallback& callback)
+{
+    if (workspace.sourceVertices.size() == 0 || target.positions.size() == 0) {
+        ICPResult result;
+        result.succeeded = true;
+        result.rmsCorrespondenceError = 0;
+        
+        return result;
+    }
+    
+    assert(workspace.sourceNormals.size() == workspace.sourceVertices.size());
+    
+    _ProjectiveCorrespondenceFinder finder(target, workspace.sourceNormals, config);
+    
+    return _runICP(config, workspace.sourceVertices, &workspace.sourceNormals, finder, config.projectiveTransformTolerance, workspace.icpCorrespondences, workspace.icpPartialSums, callback);
+}
+
+ICPResult ICP::run(ICPConfiguration config,
+                   const ICPIncrementalTarget& target,
+                   AssimilationWorkspace& workspace,
+                   const ICPIterationCallback& callback)
+{
+    if (workspace.sourceVertices.size() == 0 || target.size() == 0) {
+        ICPResult result;
+        result.succeeded = true;
+        result.rmsCorrespondenceError = 0;
+        
+        return result;
+    }
+    
+    _IncrementalTargetCorrespondenceFinder finder(target);
+    
+    return _runICP(config, workspace.sourceVertices, nullptr, finder, 0, workspace.icpCorrespondences, workspace.icpPartialSums, callback);
+}
@@ -0,0 +1,245 @@
+//
+//  ICPIncrementalTarget.cpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <algorithm>
+#import <cstring>
+
+#import <standard_cyborg/util/DataUtils.hpp>
+
+#import "ICPIncrementalTarget.hpp"
+
+// Enough trees for the dynamic index to hold this many points, including removed ones
+// that haven't been compacted away yet
+static const size_t kMaxIndexedPointCount = 1 << 24;
+
+// Same leaf size as sc3d::Geometry's kd-tree
+static const size_t kLeafMaxSize = 10;
+
+// Removed points are only compacted away once there are at least this many, and more
+// than there are remaining points, so the cost of compacting is amortized over the
+// updates that removed them
+static const size_t kMinCompactionCount = 1024;
+
+// Where a surfel ends up after compaction, which shifted it down by the number of tombstones before it
+static int _compactedSurfelIndex(const SurfelIndexChanges& indexChanges, int surfelIndex)
+{
+    const std::vector<int>& compacted = indexChanges.compactedSurfelIndices;
+    return surfelIndex - (int)(std::lower_bound(compacted.begin(), compacted.end(), surfelIndex) - compacted.begin());
+}
+
+// A well mixed hash of a new surfel's position, so that sampling it is like a random draw,
+// but one that only depends on the surfel itself and not on the order surfels are visited in
+static uint32_t _surfelSampleHash(const Vector3f& position, unsigned int randomSeed)
+{
+    uint32_t hash = randomSeed;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        uint32_t bits;
+        memcpy(&bits, &position[axis], sizeof(bits));
+
+        // Combined as boost::hash_combine does, then mixed with MurmurHash3's finalizer
+        hash ^= bits + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6b;
+        hash ^= hash >> 13;
+        hash *= 0xc2b2ae35;
+        hash ^= hash >> 16;
+    }
+
+    return hash;
+}
+
+ICPIncrementalTarget::ICPIncrementalTarget(unsigned int randomSeed)
+{
+    reset(randomSeed);
+}
+
+ICPIncrementalTarget::~ICPIncrementalTarget() {}
+
+void ICPIncrementalTarget::reset(unsigned int randomSeed)
+{
+    _randomSeed = randomSeed;
+
+    _positions.clear();
+    _normals.clear();
+    _surfelIndices.clear();
+    _removedCount = 0;
+
+    _rebuildIndex();
+}
+
+void ICPIncrementalTarget::update(const SurfelStore& surfels,
+                                  const SurfelIndexChanges& indexChanges,
+                                  float sampleFraction,
+                                  float maxDrift)
+{
+    const size_t firstAppendedPoint = _positions.size();
+    const float maxSquaredDrift = maxDrift * maxDrift;
+
+    for (size_t pointIndex = 0; pointIndex < firstAppendedPoint; ++pointIndex) {
+        int surfelIndex = _surfelIndices[pointIndex];
+        if (surfelIndex < 0) continue;
+
+        if (std::binary_search(indexChanges.removedSurfelIndices.begin(), indexChanges.removedSurfelIndices.end(), surfelIndex)) {
+            _removePoint(pointIndex);
+            continue;
+        }
+
+        surfelIndex = _compactedSurfelIndex(indexChanges, surfelIndex);
+        _surfelIndices[pointIndex] = surfelIndex;
+
+        math::Vec3 position = toVec3(surfels.positions[surfelIndex]);
+
+        if (math::Vec3::squaredDistanceBetween(position, _positions[pointIndex]) > maxSquaredDrift) {
+            // Fusion has moved it far enough that the kd-tree would be misleading, so reindex it
+            _removePoint(pointIndex);
+            _appendPoint(surfels, surfelIndex);
+        } else {
+            // Normals aren't indexed, so they can always be current
+            _normals[pointIndex] = toVec3(surfels.normals[surfelIndex]);
+        }
+    }
+
+    // New surfels took over tombstones' slots, then were appended. Their indices are from
+    // before compaction, which is when the store had a slot for every compacted tombstone too.
+    uint32_t sampleThreshold = (uint32_t)(std::max(sampleFraction, 0.0f) * 1000.0f);
+    size_t uncompactedSurfelCount = surfels.size() + indexChanges.compactedSurfelIndices.size();
+
+    for (int surfelIndex : indexChanges.reusedSurfelIndices) {
+        _sampleNewSurfel(surfels, indexChanges, surfelIndex, sampleThreshold, sampleFraction >= 1);
+    }
+
+    for (size_t surfelIndex = indexChanges.firstAppendedSurfelIndex; surfelIndex < uncompactedSurfelCount; ++surfelIndex) {
+        _sampleNewSurfel(surfels, indexChanges, (int)surfelIndex, sampleThreshold, sampleFraction >= 1);
+    }
+
+    if (_positions.size() > firstAppendedPoint) {
+        _index->addPoints((uint32_t)firstAppendedPoint, (uint32_t)_positions.size() - 1);
+    }
+
+    if (_removedCount >= kMinCompactionCount && _removedCount > size()) {
+        _compact();
+    }
+}
+
+void ICPIncrementalTarget::saveState(ICPIncrementalTargetState& stateOut) const
+{
+    stateOut.positions.clear();
+    stateOut.normals.clear();
+    stateOut.surfelIndices.clear();
+    stateOut.positions.reserve(size());
+    stateOut.normals.reserve(size());
+    stateOut.surfelIndices.reserve(size());
+
+    for (size_t pointIndex = 0; pointIndex < _positions.size(); ++pointIndex) {
+        if (_surfelIndices[pointIndex] < 0) continue;
+
+        stateOut.positions.push_back(_positions[pointIndex]);
+        stateOut.normals.push_back(_normals[pointIndex]);
+        stateOut.surfelIndices.push_back(_surfelIndices[pointIndex]);
+    }
+
+    stateOut.randomSeed = _randomSeed;
+}
+
+void ICPIncrementalTarget::restoreState(const ICPIncrementalTargetState& state)
+{
+    _randomSeed = state.randomSeed;
+
+    _positions = state.positions;
+    _normals = state.normals;
+    _surfelIndices = state.surfelIndices;
+    _removedCount = 0;
+
+    _rebuildIndex();
+}
+
+size_t ICPIncrementalTarget::size() const
+{
+    return _positions.size() - _removedCount;
+}
+
+bool ICPIncrementalTarget::findClosestPoint(const math::Vec3& position, math::Vec3& positionOut, math::Vec3& normalOut) const
+{
+    if (size() == 0) { return false; }
+
+    uint32_t pointIndex;
+    float squaredDistance;
+    nanoflann::KNNResultSet<float, uint32_t> resultSet(1);
+    resultSet.init(&pointIndex, &squaredDistance);
+
+    const float query[3] = { position.x, position.y, position.z };
+    _index->findNeighbors(resultSet, query);
+
+    if (resultSet.size() == 0) { return false; }
+
+    positionOut = _positions[pointIndex];
+    normalOut = _normals[pointIndex];
+
+    return true;
+}
+
+// MARK: - Private
+
+void ICPIncrementalTarget::_removePoint(size_t pointIndex)
+{
+    _index->removePoint(pointIndex);
+    _surfelIndices[pointIndex] = -1;
+    ++_removedCount;
+}
+
+void ICPIncrementalTarget::_appendPoint(const SurfelStore& surfels, int surfelIndex)
+{
+    _positions.push_back(toVec3(surfels.positions[surfelIndex]));
+    _normals.push_back(toVec3(surfels.normals[surfelIndex]));
+    _surfelIndices.push_back(surfelIndex);
+}
+
+void ICPIncrementalTarget::_sampleNewSurfel(const SurfelStore& surfels,
+                                            const SurfelIndexChanges& indexChanges,
+                                            int surfelIndex,
+                                            uint32_t sampleThreshold,
+                                            bool sampleAll)
+{
+    // Surfels culled as soon as they were created don't count towards the sample
+    if (std::binary_search(indexChanges.removedSurfelIndices.begin(), indexChanges.removedSurfelIndices.end(), surfelIndex)) return;
+
+    int compactedSurfelIndex = _compactedSurfelIndex(indexChanges, surfelIndex);
+    if (!sampleAll && _surfelSampleHash(surfels.positions[compactedSurfelIndex], _randomSeed) % 1000 >= sampleThreshold) return;
+
+    _appendPoint(surfels, compactedSurfelIndex);
+}
+
+void ICPIncrementalTarget::_compact()
+{
+    size_t compactedCount = 0;
+
+    for (size_t pointIndex = 0; pointIndex < _positions.size(); ++pointIndex) {
+        if (_surfelIndices[pointIndex] < 0) continue;
+
+        _positions[compactedCount] = _positions[pointIndex];
+        _normals[compactedCount] = _normals[pointIndex];
+        _surfelIndices[compactedCount] = _surfelIndices[pointIndex];
+        ++compactedCount;
+    }
+
+    _positions.resize(compactedCount);
+    _normals.resize(compactedCount);
+    _surfelIndices.resize(compactedCount);
+    _removedCount = 0;
+
+    _rebuildIndex();
+}
+
+void ICPIncrementalTarget::_rebuildIndex()
+{
+    // The dynamic index indexes every point in the dataset when it's constructed
+    auto params = nanoflann::KDTreeSingleIndexAdaptorParams(kLeafMaxSize, nanoflann::KDTreeSingleIndexAdaptorFlags::None, 1);
+
+    _index.reset();
+    _index.reset(new _Index(3, *this, params, kMaxIndexedPointCount));
+}
@@ -0,0 +1,96 @@
+//
+//  ICPIncrementalTarget.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <memory>
+#import <vector>
+
+#import <nanoflann.hpp>
+#import <standard_cyborg/math/Vec3.hpp>
+
+#import "SurfelStore.hpp"
+
+using namespace standard_cyborg;
+
+/** The points in an ICPIncrementalTarget and the seed it samples new surfels with,
+ *  which is all it takes to restore it exactly, e.g. from a checkpoint */
+struct ICPIncrementalTargetState {
+    std::vector<math::Vec3> positions;
+    std::vector<math::Vec3> normals;
+    std::vector<int> surfelIndices;
+    unsigned int randomSeed = 0;
+};
+
+/** A downsampled copy of the model's surfels, with a kd-tree for ICP to find nearest
+ *  neighbor correspondences in. Rather than being rebuilt from scratch every few frames,
+ *  it's updated after each fusion: culled surfels are removed, a sample of new surfels is
+ *  inserted, and surfels that have moved too far since they were indexed are reinserted.
+ *  Whether a new surfel is sampled depends only on the seed and where it was created,
+ *  never on which slot it went into, so reusing tombstones doesn't change the target.
+ *  Insertions go into nanoflann's dynamic index, which keeps a logarithmic set of trees
+ *  and only rebuilds the small ones that an insertion merges together.
+ */
+class ICPIncrementalTarget {
+public:
+    ICPIncrementalTarget(unsigned int randomSeed = 0);
+    ~ICPIncrementalTarget();
+
+    /** Removes every point and reseeds the sampling of new surfels */
+    void reset(unsigned int randomSeed = 0);
+
+    /** Brings the target up to date with `surfels` after a fusion or cull.
+     *  @param indexChanges Where new surfels went, which surfels were culled, and how the
+     *         rest were renumbered if the tombstones were compacted
+     *  @param sampleFraction The fraction of new surfels to add to the target
+     *  @param maxDrift Surfels are reindexed once they're this far from where they were indexed
+     */
+    void update(const SurfelStore& surfels,
+                const SurfelIndexChanges& indexChanges,
+                float sampleFraction,
+                float maxDrift);
+
+    /** Copies out the points that haven't been removed */
+    void saveState(ICPIncrementalTargetState& stateOut) const;
+
+    /** Replaces the points and reindexes them */
+    void restoreState(const ICPIncrementalTargetState& state);
+
+    /** The number of points that haven't been removed */
+    size_t size() const;
+
+    /** Finds the point closest to `position`, returning false if the target is empty */
+    bool findClosestPoint(const math::Vec3& position, math::Vec3& positionOut, math::Vec3& normalOut) const;
+
+    // Dataset interface for nanoflann
+    inline size_t kdtree_get_point_count() const { return _positions.size(); }
+    inline float kdtree_get_pt(const size_t index, int dimension) const { return _positions[index][dimension]; }
+    template <class BBOX> bool kdtree_get_bbox(BBOX&) const { return false; }
+
+private:
+    typedef nanoflann::L2_Simple_Adaptor<float, ICPIncrementalTarget> _Metric;
+    typedef nanoflann::KDTreeSingleIndexDynamicAdaptor<_Metric, ICPIncrementalTarget, 3> _Index;
+
+    // Indexed by point. Removed points stay until the next compaction, with a surfel index of -1.
+    std::vector<math::Vec3> _positions;
+    std::vector<math::Vec3> _normals;
+    std::vector<int> _surfelIndices;
+
+    std::unique_ptr<_Index> _index;
+    size_t _removedCount = 0;
+    unsigned int _randomSeed = 0;
+
+    void _removePoint(size_t pointIndex);
+    void _appendPoint(const SurfelStore& surfels, int surfelIndex);
+    void _sampleNewSurfel(const SurfelStore& surfels, const SurfelIndexChanges& indexChanges, int surfelIndex, uint32_t sampleThreshold, bool sampleAll);
+    void _compact();
+    void _rebuildIndex();
+
+    // Prohibit copying and assignment
+    ICPIncrementalTarget(const ICPIncrementalTarget&) = delete;
+    ICPIncrementalTarget& operator=(const ICPIncrementalTarget&) = delete;
+};
@@ -0,0 +1,80 @@
+//
+//  ICPProjectiveTarget.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <cstdint>
+#import <vector>
+
+#import <standard_cyborg/math/Vec3.hpp>
+#import <standard_cyborg/util/IncludeEigen.hpp>
+
+#import "LensCalibration.hpp"
+
+using namespace standard_cyborg;
+
+/** A vertex and normal map of the model, rendered from a camera pose, for ICP to find
+ *  projective correspondences against. A source point's correspondence is whatever lies
+ *  under the pixel it projects to, which is an O(1) lookup instead of a kd-tree query.
+ */
+struct ICPProjectiveTarget {
+    size_t width = 0;
+    size_t height = 0;
+
+    /** Model-space position and normal for each pixel, row-major */
+    std::vector<math::Vec3> positions;
+    std::vector<math::Vec3> normals;
+
+    /** Nonzero for each pixel something was rendered into. This is a flag rather than a NaN
+     *  position because -ffast-math compiles std::isnan away. */
+    std::vector<uint8_t> coverage;
+
+    /** Maps model-space points to normalized device coordinates for the rendered pose */
+    Eigen::Matrix4f viewProjectionMatrix = Eigen::Matrix4f::Identity();
+
+    /** Applied to normalized device coordinates after projecting, as when rendering surfels */
+    LensCalibration lensCalibration;
+    bool applyLensCalibration = false;
+
+    /** Resizes the maps and marks every pixel empty */
+    void reset(size_t width, size_t height)
+    {
+        this->width = width;
+        this->height = height;
+        positions.assign(width * height, math::Vec3());
+        normals.assign(width * height, math::Vec3());
+        coverage.assign(width * height, 0);
+    }
+
+    /** Finds the pixel a model-space point projects to, returning false if it falls
+     *  outside the image or behind the camera */
+    inline bool pixelIndexForPosition(const math::Vec3& position, size_t& pixelIndexOut) const
+    {
+        Eigen::Vector4f projected = viewProjectionMatrix * Eigen::Vector4f(position.x, position.y, position.z, 1.0f);
+        if (!(projected.w() > 0)) { return false; }
+
+        float x = projected.x() / projected.w();
+        float y = projected.y() / projected.w();
+        if (applyLensCalibration) {
+            lensCalibration.apply(x, y);
+        }
+
+        // Same window coordinates as the surfel index map, with the origin at the top left
+        float column = (0.5f + 0.5f * x) * width;
+        float row = (0.5f - 0.5f * y) * height;
+        if (!(column >= 0 && column < width && row >= 0 && row < height)) { return false; }
+
+        pixelIndexOut = (size_t)row * width + (size_t)column;
+
+        return true;
+    }
+
+    inline bool isEmpty(size_t pixelIndex) const
+    {
+        return coverage[pixelIndex] == 0;
+    }
+};
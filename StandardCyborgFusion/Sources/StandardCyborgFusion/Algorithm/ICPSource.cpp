@@ -0,0 +1,111 @@
+//
+//  ICPSource.cpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <algorithm>
+#import <cmath>
+
+#import <standard_cyborg/util/DataUtils.hpp>
+
+#import "EigenHelpers.hpp"
+#import "ICPSource.hpp"
+
+using namespace Eigen;
+
+// Samples further than this in depth from their block's center aren't averaged into it
+static const float kMaxBlockDepthDifference = 0.01;
+
+void SampleICPSource(const ProcessedFrame& frame,
+                     float downsampledFraction,
+                     const SurfelFusionConfiguration& surfelFusionConfiguration,
+                     const Matrix4f& transform,
+                     FastRand& fastRNG,
+                     AssimilationWorkspace& workspace)
+{
+    std::vector<math::Vec3>& downsampledVertices = workspace.sourceVertices;
+    std::vector<math::Vec3>& downsampledNormals = workspace.sourceNormals;
+
+    downsampledVertices.clear();
+    downsampledNormals.clear();
+    downsampledNormals.reserve(frame.normals.size());
+    downsampledVertices.reserve(frame.positions.size());
+
+    Matrix3f normalTransform = NormalMatrixFromMat4(transform);
+
+    // Filter by depth
+    size_t pointCount = frame.positions.size();
+    size_t filteredCount = 0;
+    size_t maxCount = (size_t)((float)pointCount * downsampledFraction);
+
+    for (off_t i = 0; i < pointCount && filteredCount < maxCount; ++i) {
+        // Add in a factor of four because otherwise the feature and center weighting-based sampling
+        // will actually select far fewer than the requested number. To get the correct number of samples
+        // we'd need to sort and take the correct percentile so that this is a bit of a shot in the dark
+        // which will change based on the particular depth  map, but hopefully it's a reasonable guess.
+        if (downsampledFraction < 1 && fastRNG.sample(1000) > downsampledFraction * 1000.0f * 4.0) continue;
+
+        float depth = frame.rawFrame.depths[i];
+
+        if (fastRNG.sample(1000) > frame.weights[i] * 1000.0f) continue;
+        if (depth < surfelFusionConfiguration.minDepth || depth > surfelFusionConfiguration.maxDepth) continue;
+
+        downsampledVertices.push_back(standard_cyborg::toVec3(  Vec3TransformMat4( toVector3f(frame.positions[i]), transform)  ) );
+
+        downsampledNormals.push_back(standard_cyborg::toVec3(normalTransform * standard_cyborg::toVector3f(frame.normals[i])));
+
+        ++filteredCount;
+    }
+}
+
+void BuildBlockAveragedICPSource(const ProcessedFrame& frame,
+                                 int pixelStride,
+                                 const SurfelFusionConfiguration& surfelFusionConfiguration,
+                                 const Matrix4f& transform,
+                                 AssimilationWorkspace& workspace)
+{
+    std::vector<math::Vec3>& verticesOut = workspace.sourceVertices;
+    std::vector<math::Vec3>& normalsOut = workspace.sourceNormals;
+
+    const size_t width = frame.rawFrame.width;
+    const size_t height = frame.rawFrame.height;
+    const size_t stride = (size_t)std::max(pixelStride, 1);
+    const Matrix3f normalTransform = NormalMatrixFromMat4(transform);
+    const std::vector<float>& depths = frame.rawFrame.depths;
+
+    verticesOut.clear();
+    normalsOut.clear();
+    verticesOut.reserve((width / stride) * (height / stride));
+    normalsOut.reserve((width / stride) * (height / stride));
+
+    for (size_t blockY = 0; blockY + stride <= height; blockY += stride) {
+        for (size_t blockX = 0; blockX + stride <= width; blockX += stride) {
+            float centerDepth = depths[(blockY + stride / 2) * width + blockX + stride / 2];
+            if (centerDepth < surfelFusionConfiguration.minDepth || centerDepth > surfelFusionConfiguration.maxDepth) continue;
+
+            Vector3f positionSum(0, 0, 0);
+            Vector3f normalSum(0, 0, 0);
+            float weightSum = 0;
+
+            for (size_t y = blockY; y < blockY + stride; ++y) {
+                for (size_t x = blockX; x < blockX + stride; ++x) {
+                    size_t index = y * width + x;
+                    float weight = frame.weights[index];
+
+                    if (weight <= 0 || fabsf(depths[index] - centerDepth) > kMaxBlockDepthDifference) continue;
+
+                    positionSum += weight * toVector3f(frame.positions[index]);
+                    normalSum += weight * toVector3f(frame.normals[index]);
+                    weightSum += weight;
+                }
+            }
+
+            if (weightSum <= 0 || normalSum.squaredNorm() == 0) continue;
+
+            verticesOut.push_back(toVec3(Vec3TransformMat4(positionSum / weightSum, transform)));
+            normalsOut.push_back(toVec3(normalTransform * normalSum.normalized()));
+        }
+    }
+}
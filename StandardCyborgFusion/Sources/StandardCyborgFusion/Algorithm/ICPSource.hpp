@@ -0,0 +1,39 @@
+//
+//  ICPSource.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <standard_cyborg/util/IncludeEigen.hpp>
+
+#import "AssimilationWorkspace.hpp"
+#import "FastRand.hpp"
+#import "ProcessedFrame.hpp"
+#import "SurfelFusion.hpp"
+
+/** Fills the workspace's source cloud with a random sample of the frame's points, transformed
+ *  by `transform`, for the full resolution stage of ICP. Points are more likely to be picked
+ *  the higher their ICP weight, and only those within the fusion depth range are.
+ *  @param downsampledFraction Roughly the fraction of the frame's points to keep
+ */
+void SampleICPSource(const ProcessedFrame& frame,
+                     float downsampledFraction,
+                     const SurfelFusionConfiguration& surfelFusionConfiguration,
+                     const Eigen::Matrix4f& transform,
+                     FastRand& fastRNG,
+                     AssimilationWorkspace& workspace);
+
+/** Fills the workspace's source cloud with the frame's positions and normals averaged over
+ *  square blocks of the depth image, as one level of a depth pyramid for coarse ICP, and
+ *  transformed by `transform`. Samples are weighted by the frame's ICP weights, and those too
+ *  far in depth from the block's center are left out, so that blocks straddling a silhouette
+ *  don't produce points floating in between.
+ */
+void BuildBlockAveragedICPSource(const ProcessedFrame& frame,
+                                 int pixelStride,
+                                 const SurfelFusionConfiguration& surfelFusionConfiguration,
+                                 const Eigen::Matrix4f& transform,
+                                 AssimilationWorkspace& workspace);
@@ -0,0 +1,153 @@
+//
+//  OfflineBatchReconstructor.cpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <algorithm>
+#import <atomic>
+#import <chrono>
+#import <exception>
+#import <mutex>
+#import <thread>
+
+#import <standard_cyborg/util/TaskScheduler.hpp>
+
+#import "OfflineBatchReconstructor.hpp"
+
+namespace {
+
+// Joins the lane threads however the calling thread leaves the scope they were started in,
+// since destroying a joinable std::thread terminates the process
+struct LaneThreads {
+    std::vector<std::thread> threads;
+
+    ~LaneThreads()
+    {
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+    }
+};
+
+} // namespace
+
+OfflineBatchReconstructor::OfflineBatchReconstructor(DepthProcessorFactory depthProcessorFactory,
+                                                     SurfelIndexMapFactory surfelIndexMapFactory,
+                                                     int maxScansInFlight,
+                                                     PBFConfiguration pbfConfig,
+                                                     ICPConfiguration icpConfig,
+                                                     SurfelFusionConfiguration surfelFusionConfig) :
+    _depthProcessorFactory(depthProcessorFactory),
+    _surfelIndexMapFactory(surfelIndexMapFactory),
+    _maxScansInFlight(maxScansInFlight > 0
+                      ? maxScansInFlight
+                      : std::max(1, standard_cyborg::util::TaskScheduler::shared().getWorkerCount())),
+    _pbfConfig(pbfConfig),
+    _icpConfig(icpConfig),
+    _surfelFusionConfig(surfelFusionConfig)
+{
+}
+
+std::vector<OfflineBatchScanResult> OfflineBatchReconstructor::reconstruct(const std::vector<OfflineBatchScan>& scans,
+                                                                           ScanCallback scanCallback)
+{
+    std::vector<OfflineBatchScanResult> results(scans.size());
+    if (scans.empty()) { return results; }
+
+    size_t laneCount = std::min(scans.size(), (size_t)_maxScansInFlight);
+    while (_lanes.size() < laneCount) {
+        _lanes.push_back(std::make_unique<OfflineReconstructor>(_depthProcessorFactory(),
+                                                                _surfelIndexMapFactory(),
+                                                                _pbfConfig,
+                                                                _icpConfig,
+                                                                _surfelFusionConfig));
+    }
+
+    // Each lane takes the next scan as it finishes one, since scans vary a lot in length
+    std::atomic<size_t> nextScanIndex(0);
+    std::mutex callbackLock;
+    std::exception_ptr callbackException;
+    auto runLane = [&](size_t laneIndex) {
+        OfflineReconstructor& lane = *_lanes[laneIndex];
+
+        for (size_t scanIndex = nextScanIndex++; scanIndex < scans.size(); scanIndex = nextScanIndex++) {
+            // One bad scan, say an unreadable frame or running out of memory, fails only itself.
+            // The lane resets before its next scan, so whatever state it was left in is dropped.
+            try {
+                results[scanIndex] = _reconstructScan(lane, scans[scanIndex]);
+            } catch (...) {
+                results[scanIndex] = OfflineBatchScanResult();
+            }
+
+            if (scanCallback != nullptr) {
+                std::lock_guard<std::mutex> guard(callbackLock);
+                if (callbackException != nullptr) { return; }
+
+                // An exception can't escape a lane's thread, so the first one from the callback
+                // stops every lane taking more scans and is rethrown once they've all stopped
+                try {
+                    scanCallback(scanIndex, results[scanIndex]);
+                } catch (...) {
+                    callbackException = std::current_exception();
+                    nextScanIndex = scans.size();
+                    return;
+                }
+            }
+        }
+    };
+
+    // Lanes get threads of their own rather than running as scheduler tasks. A lane waiting
+    // on its scan's parallel work runs queued tasks meanwhile, and if those could be other
+    // lanes, it would take over their whole scans and the batch would drift toward serial.
+    {
+        LaneThreads laneThreads;
+        for (size_t laneIndex = 1; laneIndex < laneCount; ++laneIndex) {
+            laneThreads.threads.emplace_back(runLane, laneIndex);
+        }
+        runLane(0);
+    }
+
+    if (callbackException != nullptr) { std::rethrow_exception(callbackException); }
+
+    return results;
+}
+
+int OfflineBatchReconstructor::getMaxScansInFlight() const
+{
+    return _maxScansInFlight;
+}
+
+size_t OfflineBatchReconstructor::laneCount() const
+{
+    return _lanes.size();
+}
+
+// MARK: - Private
+
+OfflineBatchScanResult OfflineBatchReconstructor::_reconstructScan(OfflineReconstructor& lane, const OfflineBatchScan& scan)
+{
+    auto startTime = std::chrono::steady_clock::now();
+    OfflineBatchScanResult result;
+
+    // Resetting keeps the lane's buffers, so this scan starts empty without reallocating them
+    lane.reset();
+
+    result.succeeded = lane.assimilateDirectory(scan.rawFrameDirectory,
+        [&](size_t, const PBFAssimilatedFrameMetadata&, double) {
+            ++result.frameCount;
+        });
+    result.statistics = lane.finish();
+    result.surfelCount = lane.getModel().getSurfels().size();
+    result.peakSurfelCount = lane.getPeakSurfelCount();
+
+    if (result.succeeded && !scan.outputPLYPath.empty()) {
+        result.succeeded = lane.writePointCloudToPLYFile(scan.outputPLYPath);
+    }
+
+    auto endTime = std::chrono::steady_clock::now();
+    result.seconds = std::chrono::duration<double>(endTime - startTime).count();
+
+    return result;
+}
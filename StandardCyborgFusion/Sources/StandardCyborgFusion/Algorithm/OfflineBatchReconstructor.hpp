@@ -0,0 +1,101 @@
+//
+//  OfflineBatchReconstructor.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <functional>
+#import <memory>
+#import <string>
+#import <vector>
+
+#import <StandardCyborgFusion/PBFFinalStatistics.h>
+
+#import "DepthProcessor.hpp"
+#import "ICP.hpp"
+#import "OfflineReconstructor.hpp"
+#import "PBFConfiguration.hpp"
+#import "SurfelFusion.hpp"
+#import "SurfelIndexMap.hpp"
+
+struct OfflineBatchScan {
+    // The directory of raw frame PLYs to reconstruct
+    std::string rawFrameDirectory;
+    // Where to write the reconstructed point cloud, or empty to not write one
+    std::string outputPLYPath;
+};
+
+struct OfflineBatchScanResult {
+    // False if the scan had no frames or one couldn't be read, its output couldn't be written,
+    // or reconstructing it threw. The counts and statistics still cover the frames assimilated
+    // before a frame couldn't be read or the output written, but a scan that threw comes
+    // back with them all empty.
+    bool succeeded = false;
+    size_t frameCount = 0;
+    size_t surfelCount = 0;
+    size_t peakSurfelCount = 0;
+    PBFFinalStatistics statistics = {};
+    // From starting to read the scan to having written its output
+    double seconds = 0;
+};
+
+/** Reconstructs many recorded scans with OfflineReconstructor, several at a time.
+ *
+ *  Each scan in flight runs in a lane with its own reconstructor, and lanes are kept across
+ *  scans and across calls to `reconstruct`, so after the first few scans the frame pools,
+ *  surfel storage and index maps are reused rather than reallocated. Each lane runs on a
+ *  thread of its own, one of them the calling thread, while the parallel work inside every
+ *  scan goes to the shared TaskScheduler. So scans in flight fill in for each other's serial
+ *  stretches, and the pool's workers stay busy with whichever scans have work to share.
+ */
+class OfflineBatchReconstructor {
+public:
+    /** Each lane gets its own depth processor and surfel index map, since they keep state
+     *  from frame to frame */
+    typedef std::function<std::shared_ptr<DepthProcessor>()> DepthProcessorFactory;
+    typedef std::function<std::shared_ptr<SurfelIndexMap>()> SurfelIndexMapFactory;
+
+    /** Called as each scan finishes, after its output has been written. Calls are never
+     *  concurrent, but they come from whichever thread ran the scan, in no particular order. */
+    typedef std::function<void(size_t scanIndex, const OfflineBatchScanResult& result)> ScanCallback;
+
+    /** `maxScansInFlight` of 0 runs as many scans at once as the shared TaskScheduler has workers */
+    OfflineBatchReconstructor(DepthProcessorFactory depthProcessorFactory,
+                              SurfelIndexMapFactory surfelIndexMapFactory,
+                              int maxScansInFlight = 0,
+                              PBFConfiguration pbfConfig = PBFConfiguration(),
+                              ICPConfiguration icpConfig = ICPConfiguration(),
+                              SurfelFusionConfiguration surfelFusionConfig = SurfelFusionConfiguration());
+
+    /** Reconstructs every scan, returning their results in the same order. Each scan is
+     *  reconstructed exactly as a fresh OfflineReconstructor would. A scan that throws is
+     *  marked failed and the rest carry on, while an exception from `scanCallback` stops the
+     *  batch and is rethrown here once every lane has stopped. */
+    std::vector<OfflineBatchScanResult> reconstruct(const std::vector<OfflineBatchScan>& scans,
+                                                    ScanCallback scanCallback = nullptr);
+
+    int getMaxScansInFlight() const;
+
+    /** The number of lanes created so far */
+    size_t laneCount() const;
+
+private:
+    DepthProcessorFactory _depthProcessorFactory;
+    SurfelIndexMapFactory _surfelIndexMapFactory;
+    int _maxScansInFlight;
+
+    PBFConfiguration _pbfConfig;
+    ICPConfiguration _icpConfig;
+    SurfelFusionConfiguration _surfelFusionConfig;
+
+    std::vector<std::unique_ptr<OfflineReconstructor>> _lanes;
+
+    OfflineBatchScanResult _reconstructScan(OfflineReconstructor& lane, const OfflineBatchScan& scan);
+
+    // Prohibit copying and assignment
+    OfflineBatchReconstructor(const OfflineBatchReconstructor&) = delete;
+    OfflineBatchReconstructor& operator=(const OfflineBatchReconstructor&) = delete;
+};
@@ -0,0 +1,155 @@
+//
+//  OfflineReconstructor.cpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <algorithm>
+#import <chrono>
+#import <filesystem>
+
+#import <standard_cyborg/io/ply/GeometryFileIO_PLY.hpp>
+#import <standard_cyborg/io/ply/RawFrameDataIO_PLY.hpp>
+#import <standard_cyborg/sc3d/ColorImage.hpp>
+#import <standard_cyborg/sc3d/DepthImage.hpp>
+
+#import "OfflineReconstructor.hpp"
+#import "ProcessedFrame.hpp"
+
+OfflineReconstructor::OfflineReconstructor(std::shared_ptr<DepthProcessor> depthProcessor,
+                                           std::shared_ptr<SurfelIndexMap> surfelIndexMap,
+                                           PBFConfiguration pbfConfig,
+                                           ICPConfiguration icpConfig,
+                                           SurfelFusionConfiguration surfelFusionConfig) :
+    _depthProcessor(depthProcessor),
+    _surfelIndexMap(surfelIndexMap),
+    _model(new PBFModel(surfelIndexMap)),
+    _pbfConfig(pbfConfig),
+    _icpConfig(icpConfig),
+    _surfelFusionConfig(surfelFusionConfig)
+{
+}
+
+std::vector<std::string> OfflineReconstructor::findRawFramePaths(const std::string& directory)
+{
+    std::vector<std::string> paths;
+
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        std::string name = entry.path().filename().string();
+        bool isRawFrame = name.rfind("frame-", 0) == 0
+            && entry.path().extension() == ".ply";
+
+        if (isRawFrame && entry.is_regular_file()) {
+            paths.push_back(entry.path().string());
+        }
+    }
+
+    std::sort(paths.begin(), paths.end());
+
+    return paths;
+}
+
+std::unique_ptr<RawFrame> OfflineReconstructor::readRawFrame(const std::string& filename)
+{
+    sc3d::ColorImage colorImage;
+    sc3d::DepthImage depthImage;
+    sc3d::PerspectiveCamera camera;
+    io::ply::RawFrameMetadata metadata;
+
+    if (!io::ply::ReadRawFrameDataFromPLYFile(colorImage, depthImage, camera, metadata, filename)) {
+        return nullptr;
+    }
+
+    const std::vector<math::Vec4>& rgba = colorImage.getData();
+    std::vector<math::Vec3> colors(rgba.size());
+    for (size_t i = 0; i < rgba.size(); ++i) {
+        colors[i] = math::Vec3(rgba[i].x, rgba[i].y, rgba[i].z);
+    }
+
+    return std::unique_ptr<RawFrame>(new RawFrame(camera,
+                                                  depthImage.getWidth(),
+                                                  depthImage.getHeight(),
+                                                  std::move(depthImage.getData()),
+                                                  std::move(colors),
+                                                  metadata.timestamp));
+}
+
+PBFAssimilatedFrameMetadata OfflineReconstructor::assimilate(const RawFrame& rawFrame, double* processingSecondsOut)
+{
+    auto startTime = std::chrono::steady_clock::now();
+
+    return _assimilate(_framePool.acquire(rawFrame), startTime, processingSecondsOut);
+}
+
+PBFAssimilatedFrameMetadata OfflineReconstructor::_assimilate(std::unique_ptr<ProcessedFrame> processedFrame,
+                                                              std::chrono::steady_clock::time_point startTime,
+                                                              double* processingSecondsOut)
+{
+    _depthProcessor->computeFrameValues(*processedFrame, processedFrame->rawFrame);
+
+    PBFAssimilatedFrameMetadata metadata = _model->assimilate(*processedFrame,
+                                                              _pbfConfig,
+                                                              _icpConfig,
+                                                              _surfelFusionConfig,
+                                                              processedFrame->rawFrame.timestamp);
+    _framePool.recycle(std::move(processedFrame));
+
+    auto endTime = std::chrono::steady_clock::now();
+    if (processingSecondsOut != nullptr) {
+        *processingSecondsOut = std::chrono::duration<double>(endTime - startTime).count();
+    }
+
+    _peakSurfelCount = std::max(_peakSurfelCount, _model->getSurfelStore().liveCount());
+
+    return metadata;
+}
+
+bool OfflineReconstructor::assimilateDirectory(const std::string& directory, FrameCallback frameCallback)
+{
+    std::vector<std::string> paths = findRawFramePaths(directory);
+    if (paths.empty()) { return false; }
+
+    for (size_t frameIndex = 0; frameIndex < paths.size(); ++frameIndex) {
+        std::unique_ptr<RawFrame> rawFrame = readRawFrame(paths[frameIndex]);
+        if (rawFrame == nullptr) { return false; }
+
+        // The frame was just read, so the pooled frame can take its buffers instead of copying them
+        auto startTime = std::chrono::steady_clock::now();
+        double processingSeconds = 0;
+        PBFAssimilatedFrameMetadata metadata = _assimilate(_framePool.acquireSwapping(*rawFrame), startTime, &processingSeconds);
+
+        if (frameCallback != nullptr) { frameCallback(frameIndex, metadata, processingSeconds); }
+    }
+
+    return true;
+}
+
+PBFFinalStatistics OfflineReconstructor::finish()
+{
+    return _model->finishAssimilating(_surfelFusionConfig);
+}
+
+bool OfflineReconstructor::writePointCloudToPLYFile(const std::string& filename)
+{
+    std::shared_ptr<sc3d::Geometry> pointCloud = _model->buildPointCloud();
+
+    return io::ply::WriteGeometryToPLYFile(filename, *pointCloud);
+}
+
+void OfflineReconstructor::reset()
+{
+    _model->reset();
+    _peakSurfelCount = 0;
+}
+
+size_t OfflineReconstructor::getPeakSurfelCount() const
+{
+    return _peakSurfelCount;
+}
+
+PBFModel& OfflineReconstructor::getModel()
+{
+    return *_model;
+}
@@ -0,0 +1,94 @@
+//
+//  OfflineReconstructor.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <chrono>
+#import <functional>
+#import <memory>
+#import <string>
+#import <vector>
+
+#import <standard_cyborg/sc3d/Geometry.hpp>
+
+#import <StandardCyborgFusion/PBFFinalStatistics.h>
+
+#import "DepthProcessor.hpp"
+#import "ICP.hpp"
+#import "PBFAssimilatedFrameMetadata.hpp"
+#import "PBFConfiguration.hpp"
+#import "PBFModel.hpp"
+#import "ProcessedFramePool.hpp"
+#import "RawFrame.hpp"
+#import "SurfelFusion.hpp"
+#import "SurfelIndexMap.hpp"
+
+/** Runs reconstruction over recorded raw frame PLYs entirely in C++, without
+ *  SCOfflineReconstructionManager's Objective-C and Metal layers. The depth processor
+ *  and surfel index map are pluggable, so this runs headless with CpuDepthProcessor
+ *  and CpuSurfelIndexMap, or on the GPU with their Metal counterparts.
+ */
+class OfflineReconstructor {
+public:
+    /** Called after each frame is assimilated, with the time spent processing and
+     *  assimilating it. Reading the file from disk isn't included. */
+    typedef std::function<void(size_t frameIndex, const PBFAssimilatedFrameMetadata& metadata, double processingSeconds)> FrameCallback;
+
+    OfflineReconstructor(std::shared_ptr<DepthProcessor> depthProcessor,
+                         std::shared_ptr<SurfelIndexMap> surfelIndexMap,
+                         PBFConfiguration pbfConfig = PBFConfiguration(),
+                         ICPConfiguration icpConfig = ICPConfiguration(),
+                         SurfelFusionConfiguration surfelFusionConfig = SurfelFusionConfiguration());
+
+    /** The raw frame PLYs in a directory (named frame-*.ply), sorted by name */
+    static std::vector<std::string> findRawFramePaths(const std::string& directory);
+
+    /** Reads a raw frame PLY, returning nullptr if it can't be read */
+    static std::unique_ptr<RawFrame> readRawFrame(const std::string& filename);
+
+    /** Processes and assimilates a single frame */
+    PBFAssimilatedFrameMetadata assimilate(const RawFrame& rawFrame, double* processingSecondsOut = nullptr);
+
+    /** Assimilates every raw frame in a directory in order, returning false if there
+     *  were none or one couldn't be read */
+    bool assimilateDirectory(const std::string& directory, FrameCallback frameCallback = nullptr);
+
+    PBFFinalStatistics finish();
+
+    /** Writes a point cloud of the model as it is now, leaving out culled surfels, so it
+     *  can be called partway through a scan as well as after finish(). Call it on the
+     *  thread that assimilates. */
+    bool writePointCloudToPLYFile(const std::string& filename);
+
+    /** Starts over with an empty model */
+    void reset();
+
+    /** The largest surfel count seen after any frame since the last reset */
+    size_t getPeakSurfelCount() const;
+
+    PBFModel& getModel();
+
+private:
+    std::shared_ptr<DepthProcessor> _depthProcessor;
+    std::shared_ptr<SurfelIndexMap> _surfelIndexMap;
+    std::unique_ptr<PBFModel> _model;
+    ProcessedFramePool _framePool;
+
+    PBFConfiguration _pbfConfig;
+    ICPConfiguration _icpConfig;
+    SurfelFusionConfiguration _surfelFusionConfig;
+
+    size_t _peakSurfelCount = 0;
+
+    PBFAssimilatedFrameMetadata _assimilate(std::unique_ptr<ProcessedFrame> processedFrame,
+                                            std::chrono::steady_clock::time_point startTime,
+                                            double* processingSecondsOut);
+
+    // Prohibit copying and assignment
+    OfflineReconstructor(const OfflineReconstructor&) = delete;
+    OfflineReconstructor& operator=(const OfflineReconstructor&) = delete;
+};
@@ -6,11 +6,28 @@
 //
 
 #include <standard_cyborg/util/IncludeEigen.hpp>
+#include <standard_cyborg/util/TaskScheduler.hpp>
+#include <atomic>
 #include <iostream>
 
+#include "CpuSurfelIndexMap.hpp"
 #include "PBFDefinitions.h"
 #include "OfflineSurfelLandmarking.hpp"
 
+// The index of the pixel a landmark falls in
+static off_t _landmarkPixelIndex(size_t frameWidth, size_t frameHeight, const ScreenSpaceLandmark& screenSpaceLandmark)
+{
+    // Convert (x, y) in [0, 1] x [0, 1] to a raster image position (row, column)
+    off_t col = std::max(0, std::min((int)(frameWidth - 1), (int)(screenSpaceLandmark.x * frameWidth)));
+    off_t row = std::max(0, std::min((int)(frameHeight - 1), (int)(screenSpaceLandmark.y * frameHeight)));
+    
+    return frameWidth * row + col;
+}
+
+OfflineSurfelLandmarking::OfflineSurfelLandmarking() :
+    _surfelIndexMap(std::make_shared<CpuSurfelIndexMap>())
+{ }
+
 OfflineSurfelLandmarking::OfflineSurfelLandmarking(std::shared_ptr<SurfelIndexMap> surfelIndexMap) :
     _surfelIndexMap(surfelIndexMap)
 { }
@@ -45,11 +62,7 @@ void OfflineSurfelLandmarking::placeLandmarksOnSurfels(const Surfel* surfels,
     }
     
     for (auto screenSpaceLandmark : screenSpaceLandmarks) {
-        // Convert (x, y) in [0, 1] x [0, 1] to a raster image position (row, column)
-        off_t col = std::max(0, std::min((int)(frameWidth - 1), (int)(screenSpaceLandmark.x * frameWidth)));
-        off_t row = std::max(0, std::min((int)(frameHeight - 1), (int)(screenSpaceLandmark.y * frameHeight)));
-        off_t index = frameWidth * row + col;
-        uint32_t surfelIndex = _surfelIndexLookups[index];
+        uint32_t surfelIndex = _surfelIndexLookups[_landmarkPixelIndex(frameWidth, frameHeight, screenSpaceLandmark)];
         
         // If this didn't land on a surfel *as rasterized from the current camera position
         // estimate but before this frame's surfels were assimilated*, skip it. Please note
@@ -62,6 +75,68 @@ void OfflineSurfelLandmarking::placeLandmarksOnSurfels(const Surfel* surfels,
     }
 }
 
+void OfflineSurfelLandmarking::placeLandmarksOnSurfels(const Surfel* surfels,
+                                                       size_t surfelCount,
+                                                       size_t frameWidth,
+                                                       size_t frameHeight,
+                                                       const std::vector<LandmarkedFrame>& frames)
+{
+    if (frames.empty() || surfelCount == 0 || frameWidth == 0 || frameHeight == 0) { return; }
+    
+    standard_cyborg::util::TaskScheduler& scheduler = standard_cyborg::util::TaskScheduler::shared();
+    size_t drawerCount = std::min(frames.size(), (size_t)std::max(1, scheduler.getWorkerCount()));
+    
+    // Parallelism comes from drawing several frames at once, so each map draws on its drawer's
+    // thread alone. A drawer that waited on tasks of its own could pick up another drawer
+    // while it waited, and run the two one after the other.
+    while (_frameIndexMaps.size() < drawerCount) {
+        _frameIndexMaps.push_back(std::make_unique<CpuSurfelIndexMap>(1));
+    }
+    _frameIndexLookups.resize(std::max(_frameIndexLookups.size(), drawerCount));
+    
+    // The surfel under each landmark of each frame, laid out frame after frame
+    std::vector<size_t> frameLandmarkStarts(frames.size() + 1, 0);
+    for (size_t frameIndex = 0; frameIndex < frames.size(); ++frameIndex) {
+        frameLandmarkStarts[frameIndex + 1] = frameLandmarkStarts[frameIndex] + frames[frameIndex].screenSpaceLandmarks.size();
+    }
+    std::vector<uint32_t> landmarkSurfelIndices(frameLandmarkStarts.back(), EMPTY_SURFEL_INDEX);
+    
+    // Each drawer takes the next frame as it finishes one, since frames with more surfels in view take longer
+    std::atomic<size_t> nextFrameIndex(0);
+    scheduler.parallelFor(0, drawerCount, 1, [&](size_t drawerBegin, size_t drawerEnd) {
+        for (size_t drawer = drawerBegin; drawer < drawerEnd; ++drawer) {
+            CpuSurfelIndexMap& indexMap = *_frameIndexMaps[drawer];
+            std::vector<uint32_t>& indexLookups = _frameIndexLookups[drawer];
+            std::vector<uint32_t> pixelIndices;
+            
+            for (size_t frameIndex = nextFrameIndex++; frameIndex < frames.size(); frameIndex = nextFrameIndex++) {
+                const LandmarkedFrame& frame = frames[frameIndex];
+                if (frame.screenSpaceLandmarks.empty()) { continue; }
+                
+                pixelIndices.clear();
+                for (const ScreenSpaceLandmark& screenSpaceLandmark : frame.screenSpaceLandmarks) {
+                    pixelIndices.push_back((uint32_t)_landmarkPixelIndex(frameWidth, frameHeight, screenSpaceLandmark));
+                }
+                
+                // Only the tiles under the landmarks are rasterized
+                indexMap.lookUpForColor(surfels, surfelCount, frame.viewProjectionMatrix, frameWidth, frameHeight,
+                                        pixelIndices, indexLookups, landmarkSurfelIndices.data() + frameLandmarkStarts[frameIndex]);
+            }
+        }
+    });
+    
+    for (size_t frameIndex = 0; frameIndex < frames.size(); ++frameIndex) {
+        const std::vector<ScreenSpaceLandmark>& screenSpaceLandmarks = frames[frameIndex].screenSpaceLandmarks;
+        
+        for (size_t i = 0; i < screenSpaceLandmarks.size(); ++i) {
+            uint32_t surfelIndex = landmarkSurfelIndices[frameLandmarkStarts[frameIndex] + i];
+            if (surfelIndex == EMPTY_SURFEL_INDEX) continue;
+            
+            _surfelLandmarksIndex.addHit(surfelIndex, screenSpaceLandmarks[i].landmarkId);
+        }
+    }
+}
+
 std::unordered_map<int, Eigen::Vector3f> OfflineSurfelLandmarking::computeLandmarks(const Surfel* surfels)
 {
     return _surfelLandmarksIndex.computeCentroids(surfels);
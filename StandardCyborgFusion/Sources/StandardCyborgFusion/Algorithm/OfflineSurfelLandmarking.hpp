@@ -7,6 +7,7 @@
 
 #pragma once
 
+#import <memory>
 #import <unordered_map>
 #import <vector>
 
@@ -18,9 +19,20 @@
 #import "SurfelIndexMap.hpp"
 #import "ScreenSpaceLandmark.hpp"
 
+class CpuSurfelIndexMap;
+
+/** The camera for a frame and the landmarks detected in its image */
+struct LandmarkedFrame {
+    Eigen::Matrix4f viewProjectionMatrix;
+    std::vector<ScreenSpaceLandmark> screenSpaceLandmarks;
+};
+
 class OfflineSurfelLandmarking {
     
 public:
+    /** Draws the surfels with a CpuSurfelIndexMap, so it runs anywhere */
+    OfflineSurfelLandmarking();
+    
     OfflineSurfelLandmarking(std::shared_ptr<SurfelIndexMap> surfelIndexMap);
     
     ~OfflineSurfelLandmarking();
@@ -32,6 +44,16 @@ public:
                                  Eigen::Matrix4f viewProjectionMatrix,
                                  const std::vector<ScreenSpaceLandmark>& screenSpaceLandmarks);
     
+    /** Places the landmarks of a whole sequence of frames on the CPU. Frames are drawn in
+     *  parallel, each into its own index buffer, and only the tiles under a frame's landmarks
+     *  are rasterized. Hits are added in frame order, so the result is the same as placing
+     *  each frame's landmarks in turn. */
+    void placeLandmarksOnSurfels(const Surfel* surfels,
+                                 size_t surfelCount,
+                                 size_t frameWidth,
+                                 size_t frameHeight,
+                                 const std::vector<LandmarkedFrame>& frames);
+    
     std::unordered_map<int, Eigen::Vector3f> computeLandmarks(const Surfel* surfels);
     
     void reset();
@@ -42,4 +64,8 @@ private:
     std::shared_ptr<SurfelIndexMap> _surfelIndexMap;
     std::vector<uint32_t> _surfelIndexLookups;
     SparseSurfelLandmarksIndex _surfelLandmarksIndex;
+    
+    // One index map and buffer per frame being drawn at once, retained between sequences
+    std::vector<std::unique_ptr<CpuSurfelIndexMap>> _frameIndexMaps;
+    std::vector<std::vector<uint32_t>> _frameIndexLookups;
 };
@@ -6,6 +6,8 @@
 //
 
 
+#import <algorithm>
+#import <atomic>
 #import <iostream>
 #import <cmath>
 #import <standard_cyborg/util/DataUtils.hpp>
@@ -17,7 +19,8 @@
 #import "DebugLog.h"
 #import "EigenHelpers.hpp"
 #import "GeometryHelpers.hpp"
-#import "MathHelpers.h"
+#import "ICPSource.hpp"
+#import "Stopwatch.hpp"
 
 
 using namespace Eigen;
@@ -33,15 +36,64 @@ struct CameraVelocity {
 };
 
 
+// Point clouds pick one surfel at random from each stride interval. They use their own generator,
+// seeded the same way every time, so that the same surfels always give the same point cloud, and
+// building one never changes which samples assimilating takes.
+static const unsigned int kPointCloudRandomSeed = 0;
+
+template <typename SurfelAtFunction>
+static std::shared_ptr<sc3d::Geometry> _buildPointCloud(size_t surfelCount, float downsampledFraction, SurfelAtFunction surfelAt)
+{
+    assert(downsampledFraction > 0.0f);
+    assert(downsampledFraction <= 1.0f);
+    
+    size_t surfelStride = (size_t)(1.0f / downsampledFraction);
+    size_t resultCount = surfelCount / surfelStride;
+    
+    std::vector<math::Vec3> vertices;
+    vertices.reserve(resultCount);
+    
+    std::vector<math::Vec3> normals;
+    normals.reserve(resultCount);
+    
+    std::vector<math::Vec3> colors;
+    colors.reserve(resultCount);
+    
+    FastRand fastRNG(kPointCloudRandomSeed);
+    Surfel surfel;
+    for (size_t i = 0; i < resultCount; ++i) {
+        if (!surfelAt(i * surfelStride + fastRNG.sample((int)surfelStride), surfel)) { continue; }
+        
+        vertices.push_back(toVec3(surfel.position));
+        normals.push_back(toVec3(surfel.normal));
+        colors.push_back(toVec3(surfel.color));
+    }
+    
+    return std::shared_ptr<sc3d::Geometry>(new sc3d::Geometry(vertices, normals, colors));
+}
+
 PBFModel::PBFModel(std::shared_ptr<SurfelIndexMap> surfelIndexMap, unsigned int randomSeed) :
+    _ICPTarget(randomSeed),
     _surfelFusion(surfelIndexMap)
 {
     _fastRNG.seed(randomSeed);
+    
+    _publishSnapshot();
 }
 
 PBFModel::~PBFModel() {}
 
 const Surfels& PBFModel::getSurfels() const
+{
+    if (!_packedSurfelsAreCurrent) {
+        _surfels.copyTo(_packedSurfels);
+        _packedSurfelsAreCurrent = true;
+    }
+    
+    return _packedSurfels;
+}
+
+const SurfelStore& PBFModel::getSurfelStore() const
 {
     return _surfels;
 }
@@ -71,41 +123,46 @@ const std::vector<PBFAssimilatedFrameMetadata> PBFModel::getAssimilatedFrameMeta
     return _assimilatedFrameMetadatas;
 }
 
-std::shared_ptr<sc3d::Geometry> PBFModel::buildPointCloud(float downsampledFraction)
+void PBFModel::addFusionDuration(double seconds)
 {
-    assert(downsampledFraction > 0.0f);
-    assert(downsampledFraction <= 1.0f);
+    if (_assimilatedFrameMetadatas.empty()) { return; }
 
-    size_t surfelCount = _surfels.size();
-    size_t surfelStride = (size_t)(1.0f / downsampledFraction);
-    size_t resultCount = surfelCount / surfelStride;
+    _assimilatedFrameMetadatas.back().fusionDuration += seconds;
+}
 
-    std::vector<math::Vec3> vertices;
-    vertices.reserve(resultCount);
-   
-    std::vector<math::Vec3> normals;
-    normals.reserve(resultCount);
-    
-    std::vector<math::Vec3> colors;
-    colors.reserve(resultCount);
-    
-    // Randomly select an index within each stride interval
-    std::vector<off_t> indexes(resultCount);
-    for (int i = 0; i < resultCount; ++i) {
-        indexes[i] = i * surfelStride + _fastRNG.sample((int)surfelStride);
-    }
+std::shared_ptr<const PBFModelSnapshot> PBFModel::getSnapshot() const
+{
+    return std::atomic_load(&_snapshot);
+}
 
-    for (size_t i = 0; i < resultCount; ++i) {
-        off_t surfelIndex = indexes[i];
-        
-        Surfel& surfel = _surfels[surfelIndex];
+std::shared_ptr<sc3d::Geometry> PBFModel::buildPointCloud(float downsampledFraction) const
+{
+    return _buildPointCloud(_surfels.size(), downsampledFraction, [&](size_t surfelIndex, Surfel& surfelOut) {
+        if (_surfels.isRemoved(surfelIndex)) { return false; }
         
-        vertices.push_back(toVec3(surfel.position));
-        normals.push_back(toVec3(surfel.normal));
-        colors.push_back(toVec3(surfel.color));
-    }
+        surfelOut = _surfels[surfelIndex];
+        return true;
+    });
+}
 
-    return std::shared_ptr<sc3d::Geometry>(new sc3d::Geometry(vertices, normals, colors));
+std::shared_ptr<sc3d::Geometry> PBFModel::buildSnapshotPointCloud(float downsampledFraction) const
+{
+    std::shared_ptr<const PBFModelSnapshot> snapshot = getSnapshot();
+    
+    return _buildPointCloud(snapshot->surfelCount(), downsampledFraction, [&](size_t surfelIndex, Surfel& surfelOut) {
+        surfelOut = snapshot->surfelAt(surfelIndex);
+        return true;
+    });
+}
+
+int PBFModel::subscribeToSurfelDeltas(SurfelDeltaCallback callback, int frameInterval, bool compact)
+{
+    return _surfelDeltaStream.subscribe(callback, frameInterval, compact);
+}
+
+void PBFModel::unsubscribeFromSurfelDeltas(int subscriberID)
+{
+    _surfelDeltaStream.unsubscribe(subscriberID);
 }
 
 PBFAssimilatedFrameMetadata* PBFModel::_nthMostRecentValidFrameMetadata(size_t offset)
@@ -125,6 +182,13 @@ PBFAssimilatedFrameMetadata* PBFModel::_nthMostRecentValidFrameMetadata(size_t o
     return nullptr;
 }
 
+// The angle (in radians) between two unit vectors. Their dot product can round to just past
+// one for a camera that's holding still, which would make acosf return NaN.
+static float _angleBetweenUnitVectors(const Vector3f& a, const Vector3f& b)
+{
+    return acosf(std::min(1.0f, std::max(-1.0f, a.dot(b))));
+}
+
 // Return the angular velocity (in radians per second) of the x, y, and z axes of the camera
 // as well as the velocity of the camera position
 static CameraVelocity _cameraVelocity(PBFAssimilatedFrameMetadata* previousFrameMeta, PBFAssimilatedFrameMetadata* currentFrameMeta)
@@ -157,13 +221,56 @@ static CameraVelocity _cameraVelocity(PBFAssimilatedFrameMetadata* previousFrame
     
     return CameraVelocity{
         Vector3f(
-            acosf(currentX.dot(previousX)),
-            acosf(currentY.dot(previousY)),
-            acosf(currentZ.dot(previousZ)))
+            _angleBetweenUnitVectors(currentX, previousX),
+            _angleBetweenUnitVectors(currentY, previousY),
+            _angleBetweenUnitVectors(currentZ, previousZ))
             / deltaT,
         (currentP - previousP) / deltaT};
 }
 
+// Extrapolation further than this many times the span of frames it's based on is more likely
+// to be wrong than the last known pose, e.g. after tracking has been lost for a while
+static const double kMaxPosePredictionRatio = 2.0;
+
+// The angle (in radians) a rigid transform rotates by
+static float _rotationAngle(const Matrix4f& transform)
+{
+    float cosAngle = 0.5f * (transform.topLeftCorner<3, 3>().trace() - 1.0f);
+
+    return acosf(std::min(1.0f, std::max(-1.0f, cosAngle)));
+}
+
+bool PBFModel::_isRedundantFrame(const ProcessedFrame& frame,
+                                 const PBFConfiguration& pbfConfig,
+                                 const SurfelFusionConfiguration& surfelFusionConfiguration,
+                                 const PBFAssimilatedFrameMetadata& lastMergedFrameMeta)
+{
+    if (pbfConfig.redundantFrameMaxNovelty <= 0) { return false; }
+    
+    int consecutiveSkipCount = 0;
+    for (auto metadata = _assimilatedFrameMetadatas.rbegin(); metadata != _assimilatedFrameMetadatas.rend() && metadata->isSkipped; ++metadata) {
+        ++consecutiveSkipCount;
+    }
+    if (consecutiveSkipCount >= pbfConfig.redundantFrameMaxConsecutiveSkips) { return false; }
+    
+    // Compare against the last merged frame rather than the last frame, so that a slow drift
+    // through skipped frames adds up until one is merged
+    Matrix4f motion = lastMergedFrameMeta.viewMatrix.inverse() * _extrinsicMatrix;
+    
+    if (motion.col(3).head<3>().norm() > pbfConfig.redundantFrameMaxTranslation
+        || _rotationAngle(motion) > pbfConfig.redundantFrameMaxRotation)
+    {
+        return false;
+    }
+    
+    float novelty = 1;
+    if (!_surfelFusion.estimateNovelty(surfelFusionConfiguration, frame, _surfels, toMat4x4(_extrinsicMatrix), novelty)) {
+        return false;
+    }
+    
+    return novelty < pbfConfig.redundantFrameMaxNovelty;
+}
+
 PBFAssimilatedFrameMetadata PBFModel::assimilate(ProcessedFrame& frame,
                                                  PBFConfiguration pbfConfig,
                                                  ICPConfiguration icpConfig,
@@ -188,20 +295,28 @@ PBFAssimilatedFrameMetadata PBFModel::assimilate(ProcessedFrame& frame,
     frameMeta.timestamp = currentTime;
     frameMeta.icpUnusedIterationFraction = 1.0f;
     frameMeta.projectionMatrix = toMatrix4f(frame.rawFrame.camera.getProjectionViewMatrix());
+    frameMeta.depthProcessingDuration = frame.depthProcessingDuration;
 
     const RawFrame& rawFrame = frame.rawFrame;
     const size_t width = rawFrame.width;
     const size_t height = rawFrame.height;
     
-    if (_surfels.size() > 0) {
-        ICPResult icpResult = _runICP(frame, surfelFusionConfiguration, icpConfig, pbfConfig);
+    if (_surfels.liveCount() > 0) {
+        // Start ICP from where the camera is expected to be by now if there's a motion model,
+        // or else from where it was in the last merged frame
+        Matrix4f initialExtrinsicMatrix = _extrinsicMatrix;
+        frameMeta.isPosePredicted = _predictExtrinsicMatrix(pbfConfig, currentTime, initialExtrinsicMatrix);
+        
+        ICPResult icpResult = _runICP(frame, surfelFusionConfiguration, icpConfig, pbfConfig, initialExtrinsicMatrix, frameMeta);
 
-        Matrix4f extrinsicMatrixTmp = toMatrix4f(icpResult.sourceTransform) * _extrinsicMatrix;
+        Matrix4f extrinsicMatrixTmp = toMatrix4f(icpResult.sourceTransform) * initialExtrinsicMatrix;
         // Store this whether or not we end up using it since we also store information about whether
         // the frame was assimilated or not
         frameMeta.viewMatrix = extrinsicMatrixTmp;
         frameMeta.icpIterationCount = icpResult.iterationCount;
         frameMeta.correspondenceError = icpResult.rmsCorrespondenceError;
+        frameMeta.initialPoseTranslationResidual = toMatrix4f(icpResult.sourceTransform).col(3).head<3>().norm();
+        frameMeta.initialPoseRotationResidual = _rotationAngle(toMatrix4f(icpResult.sourceTransform));
         
         if (!icpResult.succeeded) {
             DEBUG_LOG("ICP rejected due to bad convergence after %d/%d iterations", icpResult.iterationCount, icpConfig.maxIterations);
@@ -232,37 +347,127 @@ PBFAssimilatedFrameMetadata PBFModel::assimilate(ProcessedFrame& frame,
         }
     }
 
+    Stopwatch stopwatch;
+    
+    if (previousFrameMeta != nullptr
+        && _surfels.liveCount() > 0
+        && _isRedundantFrame(frame, pbfConfig, surfelFusionConfiguration, *previousFrameMeta))
+    {
+        // The novelty estimate draws the surfel index map, which is timed separately
+        const SurfelFusionTimings& estimateTimings = _surfelFusion.getLastTimings();
+        frameMeta.surfelIndexMapDrawDuration = estimateTimings.surfelIndexMapDrawDuration;
+        frameMeta.fusionDuration = std::max(0.0, stopwatch.lap() - estimateTimings.surfelIndexMapDrawDuration);
+        
+        // Tracking carries on from this frame's pose, and its landmarks still count
+        _surfelFusion.addLandmarkHits(rawFrame, screenSpaceLandmarks, _surfelLandmarksIndex);
+        
+        frameMeta.isSkipped = true;
+        frameMeta.surfelCount = _surfels.liveCount();
+        _assimilatedFrameMetadatas.push_back(frameMeta);
+        return frameMeta;
+    }
+
     if (_surfels.size() == 0) {
         // Initialize the _surfels vector to a realistic eventual size
         _surfels.reserve(width * height);
     }
     
-    if (!_surfelFusion.doFusion(surfelFusionConfiguration,
-                                frame,
-                                _surfels,
-                                toMat4x4(_extrinsicMatrix),
-                                screenSpaceLandmarks,
-                                _surfelLandmarksIndex,
-                                _deletedSurfelIndicesList)
-    ) {
+    _packedSurfelsAreCurrent = false;
+    
+    bool didFuse = _surfelFusion.doFusion(surfelFusionConfiguration,
+                                          frame,
+                                          _surfels,
+                                          toMat4x4(_extrinsicMatrix),
+                                          screenSpaceLandmarks,
+                                          _surfelLandmarksIndex,
+                                          _surfelIndexChanges);
+    
+    // Fusion draws the surfel index map and culls too, which are timed separately. If the
+    // novelty estimate drew it, the time since then covers both.
+    const SurfelFusionTimings& fusionTimings = _surfelFusion.getLastTimings();
+    frameMeta.surfelIndexMapDrawDuration = fusionTimings.surfelIndexMapDrawDuration;
+    frameMeta.cullingDuration = fusionTimings.cullingDuration;
+    frameMeta.fusionDuration = std::max(0.0, stopwatch.lap() - fusionTimings.surfelIndexMapDrawDuration - fusionTimings.cullingDuration);
+    
+    if (!didFuse) {
         DEBUG_LOG("Frame couldn't be fused.");
         frameMeta.icpUnusedIterationFraction = 0;
     } else {
         frameMeta.isMerged = true;
-        frameMeta.surfelCount = _surfels.size();
+        
+        _surfelDeltaStream.recordChanges(_surfelIndexChanges, _surfels);
+        _ICPTarget.update(_surfels, _surfelIndexChanges, pbfConfig.icpDownsampleFraction, pbfConfig.icpTargetMaxDrift);
+        frameMeta.icpTargetUpdateDuration += stopwatch.lap();
+        
+        if (pbfConfig.maxSurfelCount > 0 && _surfels.liveCount() > pbfConfig.maxSurfelCount) {
+            // The extrinsic matrix takes the camera's frame of reference to the model's
+            Vector3f cameraPosition = _extrinsicMatrix.col(3).head<3>();
+            frameMeta.evictedSurfelCount = _surfelBudget.enforce(pbfConfig, cameraPosition, _surfels, _surfelLandmarksIndex, _surfelIndexChanges);
+            _surfelFusion.compactIfFragmented(surfelFusionConfiguration.maxTombstoneFraction, _surfels, _surfelLandmarksIndex, _surfelIndexChanges);
+            frameMeta.cullingDuration += stopwatch.lap();
+            
+            _surfelDeltaStream.recordChanges(_surfelIndexChanges, _surfels);
+            
+            // Nothing is sampled into the target here, since no surfels were added
+            _ICPTarget.update(_surfels, _surfelIndexChanges, 0, pbfConfig.icpTargetMaxDrift);
+            frameMeta.icpTargetUpdateDuration += stopwatch.lap();
+        }
+        
+        frameMeta.surfelCount = _surfels.liveCount();
     }
     
     _assimilatedFrameMetadatas.push_back(frameMeta);
+    
+    _compactSnapshots = pbfConfig.compactSnapshots;
+    if (pbfConfig.snapshotInterval > 0 && ++_framesSinceSnapshot >= pbfConfig.snapshotInterval) {
+        _framesSinceSnapshot = 0;
+        _publishSnapshot();
+    }
+    
+    _surfelDeltaStream.publish(_surfels, _assimilatedFrameMetadatas.size());
 
     return frameMeta;
 }
 
 
+// The value `fraction` of the way through `sortedValues`, rounding to the nearest one
+static double _percentile(const std::vector<double>& sortedValues, double fraction)
+{
+    size_t index = (size_t)(fraction * (sortedValues.size() - 1) + 0.5);
+    
+    return sortedValues[std::min(index, sortedValues.size() - 1)];
+}
+
+// Summarizes how long a stage took, over the frames it ran in
+static PBFStageTimingStatistics _stageTimingStatistics(const std::vector<PBFAssimilatedFrameMetadata>& metadatas,
+                                                       double PBFAssimilatedFrameMetadata::*duration)
+{
+    PBFStageTimingStatistics statistics = {};
+    
+    std::vector<double> durations;
+    durations.reserve(metadatas.size());
+    for (const PBFAssimilatedFrameMetadata& metadata : metadatas) {
+        if (metadata.*duration > 0) { durations.push_back(metadata.*duration); }
+    }
+    
+    if (durations.empty()) { return statistics; }
+    
+    std::sort(durations.begin(), durations.end());
+    for (double value : durations) { statistics.total += value; }
+    statistics.median = _percentile(durations, 0.50);
+    statistics.percentile90 = _percentile(durations, 0.90);
+    statistics.percentile99 = _percentile(durations, 0.99);
+    statistics.max = durations.back();
+    
+    return statistics;
+}
+
 PBFFinalStatistics PBFModel::_calcFinalStatistics()
 {
     double startTime = -1, endTime = -1;
     int mergedFrameCount = 0;
     int failedFrameCount = 0;
+    int skippedFrameCount = 0;
     int accumulatedICPIterationCount = 0;
     
     float sumCorrespondenceError = 0;
@@ -277,6 +482,8 @@ PBFFinalStatistics PBFModel::_calcFinalStatistics()
         if (meta.isMerged) {
             ++mergedFrameCount;
             sumCorrespondenceError += meta.correspondenceError;
+        } else if (meta.isSkipped) {
+            ++skippedFrameCount;
         } else {
             ++failedFrameCount;
         }
@@ -293,8 +500,17 @@ PBFFinalStatistics PBFModel::_calcFinalStatistics()
     finalStatistics.framerate = framerate;
     finalStatistics.averageICPIterations = averageICPIterations;
     finalStatistics.failedFrameCount = failedFrameCount;
+    finalStatistics.skippedFrameCount = skippedFrameCount;
     finalStatistics.averageCorrespondenceError = sumCorrespondenceError / (float)mergedFrameCount;
     
+    finalStatistics.depthProcessingTime = _stageTimingStatistics(_assimilatedFrameMetadatas, &PBFAssimilatedFrameMetadata::depthProcessingDuration);
+    finalStatistics.icpSourceDownsamplingTime = _stageTimingStatistics(_assimilatedFrameMetadatas, &PBFAssimilatedFrameMetadata::icpSourceDownsamplingDuration);
+    finalStatistics.icpTargetUpdateTime = _stageTimingStatistics(_assimilatedFrameMetadatas, &PBFAssimilatedFrameMetadata::icpTargetUpdateDuration);
+    finalStatistics.icpTime = _stageTimingStatistics(_assimilatedFrameMetadatas, &PBFAssimilatedFrameMetadata::icpDuration);
+    finalStatistics.surfelIndexMapDrawTime = _stageTimingStatistics(_assimilatedFrameMetadatas, &PBFAssimilatedFrameMetadata::surfelIndexMapDrawDuration);
+    finalStatistics.fusionTime = _stageTimingStatistics(_assimilatedFrameMetadatas, &PBFAssimilatedFrameMetadata::fusionDuration);
+    finalStatistics.cullingTime = _stageTimingStatistics(_assimilatedFrameMetadatas, &PBFAssimilatedFrameMetadata::cullingDuration);
+    
     return finalStatistics;
 }
 
@@ -302,21 +518,37 @@ PBFFinalStatistics PBFModel::finishAssimilating(SurfelFusionConfiguration surfel
 {
     PBFFinalStatistics finalStatistics = _calcFinalStatistics();
 
-    DEBUG_LOG("Finished assimilating %d frames\n\tAverage framerate: %.2f FPS\n\tAverage ICP iterations: %.2f\n\tRejected frames: %d",
+    DEBUG_LOG("Finished assimilating %d frames\n\tAverage framerate: %.2f FPS\n\tAverage ICP iterations: %.2f\n\tRejected frames: %d\n\tSkipped frames: %d",
               finalStatistics.mergedFrameCount,
               finalStatistics.framerate,
               finalStatistics.averageICPIterations,
-              finalStatistics.failedFrameCount);
+              finalStatistics.failedFrameCount,
+              finalStatistics.skippedFrameCount);
+    
+    _packedSurfelsAreCurrent = false;
     
-    if (surfelFusionConfiguration.cullLowConfidence == false) { return finalStatistics; }
-
     const int minFinalCullFrameCount = surfelFusionConfiguration.surfelLifetime * 2;
-    if (_assimilatedFrameMetadatas.size() < minFinalCullFrameCount) {
+    bool shouldCull = surfelFusionConfiguration.cullLowConfidence;
+    if (shouldCull && _assimilatedFrameMetadatas.size() < minFinalCullFrameCount) {
         DEBUG_LOG("Not applying final cull for only %ld frames", _assimilatedFrameMetadatas.size());
-        return finalStatistics;
+        shouldCull = false;
     }
 
-    _surfelFusion.finish(surfelFusionConfiguration, _surfels, _surfelLandmarksIndex, _deletedSurfelIndicesList);
+    if (shouldCull) {
+        _surfelFusion.finish(surfelFusionConfiguration, _surfels, _surfelLandmarksIndex, _surfelIndexChanges);
+    } else {
+        // Either way, leave no tombstones behind, so surfel indices match getSurfels()
+        _surfelIndexChanges.clear();
+        _surfelIndexChanges.firstAppendedSurfelIndex = _surfels.size();
+        _surfelFusion.compact(_surfels, _surfelLandmarksIndex, _surfelIndexChanges);
+    }
+    
+    // Nothing is sampled into the target here, since no surfels were added
+    _ICPTarget.update(_surfels, _surfelIndexChanges, 0, INFINITY);
+    
+    _publishSnapshot();
+    _surfelDeltaStream.recordChanges(_surfelIndexChanges, _surfels);
+    _surfelDeltaStream.publish(_surfels, _assimilatedFrameMetadatas.size(), true);
 
     return finalStatistics;
 }
@@ -332,84 +564,154 @@ void PBFModel::reset(unsigned int randomSeed)
     _surfelLandmarksIndex.removeAllHits();
     
     _surfels.clear();
+    _surfelIndexChanges.clear();
+    _packedSurfels.clear();
+    _packedSurfelsAreCurrent = true;
     _assimilatedFrameMetadatas.clear();
-    _ICPTargetCloud = nullptr;
+    _ICPTarget.reset(randomSeed);
+    
+    // The next scan counts frames to its first snapshot from its own start
+    _framesSinceSnapshot = 0;
+    _publishSnapshot();
+    _surfelDeltaStream.recordReplacement();
+    _surfelDeltaStream.publish(_surfels, 0, true);
 }
 
 // MARK: - Private
 
-ICPResult PBFModel::_runICP(ProcessedFrame& frame, SurfelFusionConfiguration surfelFusionConfiguration, ICPConfiguration icpConfig, PBFConfiguration pbfConfig)
+void PBFModel::_publishSnapshot()
 {
-    bool shouldRebuildPointCloud = false;
-    if (_assimilatedFrameMetadatas.size() < pbfConfig.kdTreeRebuildInterval / 2 || _ICPTargetCloud == nullptr) {
-        // If we've scanned fewer frames than half the rebuild interval, always rebuild the point cloud
-        shouldRebuildPointCloud = true;
-    } else if (_assimilatedFrameMetadatas.size() < 20) {
-        // If we have a few more frames worth of data to work with, slow down the rebuilds halfway
-        shouldRebuildPointCloud = _assimilatedFrameMetadatas.size() % (pbfConfig.kdTreeRebuildInterval / 2) == 0;
+    std::shared_ptr<PBFModelSnapshot>& buffer = _snapshotBuffers[_nextSnapshotBuffer];
+    
+    // Readers can only take the published snapshot, so once this buffer has been replaced,
+    // if nobody is still holding it then nobody can start to
+    if (buffer == nullptr || buffer.use_count() > 1) {
+        buffer = std::make_shared<PBFModelSnapshot>();
     } else {
-        shouldRebuildPointCloud = _assimilatedFrameMetadatas.size() % pbfConfig.kdTreeRebuildInterval == 0;
+        // Don't refill it until the last reader to let go is done with it
+        std::atomic_thread_fence(std::memory_order_acquire);
     }
     
-    if (shouldRebuildPointCloud) {
-        _ICPTargetCloud = buildPointCloud(pbfConfig.icpDownsampleFraction);
+    buffer->isCompact = _compactSnapshots;
+    if (_compactSnapshots) {
+        buffer->surfels.clear();
+        buffer->compactSurfels.encode(_surfels);
+    } else {
+        buffer->compactSurfels.clear();
+        _surfels.copyTo(buffer->surfels);
     }
+    buffer->assimilatedFrameCount = _assimilatedFrameMetadatas.size();
     
-    // Create a downsampled copy of the points for running ICP,
-    // using the transform mapping the existing points and normals into the most recent frame of reference
+    std::atomic_store(&_snapshot, std::shared_ptr<const PBFModelSnapshot>(buffer));
+    _nextSnapshotBuffer = 1 - _nextSnapshotBuffer;
+}
+
+bool PBFModel::_predictExtrinsicMatrix(const PBFConfiguration& pbfConfig, double currentTime, Matrix4f& extrinsicMatrixOut)
+{
+    if (pbfConfig.motionModelFrameCount < 2) { return false; }
+    
+    PBFAssimilatedFrameMetadata* latestFrameMeta = _nthMostRecentValidFrameMetadata(0);
+    PBFAssimilatedFrameMetadata* earliestFrameMeta = _nthMostRecentValidFrameMetadata(pbfConfig.motionModelFrameCount - 1);
     
-    std::vector<math::Vec3> downsampledVertices;
-    std::vector<math::Vec3> downsampledNormals;
-    std::vector<math::Vec3> downsampledColors;
+    if (latestFrameMeta == nullptr || earliestFrameMeta == nullptr
+        || latestFrameMeta->timestamp < 0.0 || earliestFrameMeta->timestamp < 0.0
+        || latestFrameMeta->timestamp <= earliestFrameMeta->timestamp
+        || currentTime <= latestFrameMeta->timestamp)
     {
-        downsampledColors.reserve(frame.rawFrame.colors.size());
-        downsampledNormals.reserve(frame.normals.size());
-        downsampledVertices.reserve(frame.positions.size());
+        return false;
+    }
+    
+    // How far to carry on the motion over the last N frames, as a fraction of it
+    double ratio = (currentTime - latestFrameMeta->timestamp) / (latestFrameMeta->timestamp - earliestFrameMeta->timestamp);
+    if (ratio > kMaxPosePredictionRatio) { return false; }
+    
+    const Matrix4f& latest = latestFrameMeta->viewMatrix;
+    const Matrix4f& earliest = earliestFrameMeta->viewMatrix;
+    
+    // Continue rotating about the same axis at the same rate, and moving the camera position in
+    // the same direction at the same speed
+    AngleAxisf rotation(Matrix3f(latest.topLeftCorner<3, 3>() * earliest.topLeftCorner<3, 3>().transpose()));
+    rotation.angle() *= (float)ratio;
+    Vector3f translation = (latest.col(3).head<3>() - earliest.col(3).head<3>()) * (float)ratio;
+    
+    extrinsicMatrixOut = latest;
+    extrinsicMatrixOut.topLeftCorner<3, 3>() = rotation.toRotationMatrix() * latest.topLeftCorner<3, 3>();
+    extrinsicMatrixOut.col(3).head<3>() += translation;
+    
+    return true;
+}
+
+ICPResult PBFModel::_runICP(ProcessedFrame& frame, SurfelFusionConfiguration surfelFusionConfiguration, ICPConfiguration icpConfig, PBFConfiguration pbfConfig, const Matrix4f& initialExtrinsicMatrix, PBFAssimilatedFrameMetadata& frameMetaOut)
+{
+    Stopwatch stopwatch;
+    
+    // Projective correspondences are found in a model rendered from the initial pose;
+    // otherwise they're found in _ICPTarget, which is kept up to date as surfels are fused
+    bool isProjective = icpConfig.correspondenceMode == ICPCorrespondenceMode::Projective;
+    
+    if (isProjective) {
+        bool didDraw = _surfelFusion.drawICPTarget(_surfels, toMat4x4(initialExtrinsicMatrix), frame.rawFrame, _ICPProjectiveTarget);
+        frameMetaOut.icpTargetUpdateDuration += stopwatch.lap();
         
-        float downsampledFraction = pbfConfig.icpDownsampleFraction;
+        if (!didDraw) {
+            DEBUG_LOG("Couldn't draw the projective ICP target");
+            return ICPResult();
+        }
+    }
+    
+    // Runs a stage of ICP against whichever target the correspondence mode uses,
+    // on the source cloud in _workspace
+    auto runICPStage = [&](const ICPConfiguration& stageConfig, const ICPIterationCallback& callback) {
+        if (isProjective) {
+            return ICP::run(stageConfig, _ICPProjectiveTarget, _workspace, callback);
+        } else {
+            return ICP::run(stageConfig, _ICPTarget, _workspace, callback);
+        }
+    };
+    
+    // Align coarse levels of the depth image first, each starting where the last left off,
+    // so that large motions are mostly taken up before the full resolution stage
+    Matrix4f coarseTransform = Matrix4f::Identity();
+    frameMetaOut.icpCoarseIterationCount = 0;
+    
+    for (const ICPPyramidLevel& level : icpConfig.coarseLevels) {
+        Matrix4f levelTransform = coarseTransform * initialExtrinsicMatrix;
         
-        Matrix3f normalTransform = NormalMatrixFromMat4(_extrinsicMatrix);
+        BuildBlockAveragedICPSource(frame, level.pixelStride, surfelFusionConfiguration, levelTransform, _workspace);
         
-        // Filter by depth
-        size_t pointCount = frame.positions.size();
-        size_t filteredCount = 0;
-        size_t maxCount = (size_t)((float)pointCount * downsampledFraction);
+        ICPConfiguration levelConfig = icpConfig;
+        levelConfig.maxIterations = level.maxIterations;
+        levelConfig.tolerance = level.tolerance;
+        frameMetaOut.icpSourceDownsamplingDuration += stopwatch.lap();
         
-        for (off_t i = 0; i < pointCount && filteredCount < maxCount; ++i) {
-            // Add in a factor of four because otherwise the feature and center weighting-based sampling
-            // will actually select far fewer than the requested number. To get the correct number of samples
-            // we'd need to sort and take the correct percentile so that this is a bit of a shot in the dark
-            // which will change based on the particular depth  map, but hopefully it's a reasonable guess.
-            if (downsampledFraction < 1 && _fastRNG.sample(1000) > downsampledFraction * 1000.0f * 4.0) continue;
-            
-            float depth = frame.rawFrame.depths[i];
-            
-            if (_fastRNG.sample(1000) > frame.weights[i] * 1000.0f) continue;
-            if (depth < surfelFusionConfiguration.minDepth || depth > surfelFusionConfiguration.maxDepth) continue;
-          
-            downsampledVertices.push_back(standard_cyborg::toVec3(  Vec3TransformMat4( toVector3f(frame.positions[i]), _extrinsicMatrix)  ) );
-            
-            downsampledNormals.push_back(standard_cyborg::toVec3(normalTransform * standard_cyborg::toVector3f(frame.normals[i])));
-            
-            downsampledColors.push_back(frame.rawFrame.colors[i]);
-            
-            ++filteredCount;
+        ICPResult levelResult = runICPStage(levelConfig, nullptr);
+        frameMetaOut.icpCoarseIterationCount += levelResult.iterationCount;
+        frameMetaOut.icpDuration += stopwatch.lap();
+        
+        // If a level diverges, leave the next one to start from the previous estimate
+        if (levelResult.succeeded) {
+            coarseTransform = toMatrix4f(levelResult.sourceTransform) * coarseTransform;
         }
-
     }
-
-    sc3d::Geometry downsampledSourceCloud(downsampledVertices,
-                                      downsampledNormals,
-                                      downsampledColors);
     
-    ICPResult icpResult = ICP::run(icpConfig,
-                                   downsampledSourceCloud,
-                                   *_ICPTargetCloud,
-                                   _icpCallback);
+    // Create a downsampled copy of the points for running ICP,
+    // using the transform mapping the existing points and normals into the most recent frame of reference
+    Matrix4f initialTransform = coarseTransform * initialExtrinsicMatrix;
+    
+    SampleICPSource(frame, pbfConfig.icpDownsampleFraction, surfelFusionConfiguration, initialTransform, _fastRNG, _workspace);
+    
+    frameMetaOut.icpSourceDownsamplingDuration += stopwatch.lap();
+    
+    ICPResult icpResult = runICPStage(icpConfig, _icpCallback);
+    frameMetaOut.icpDuration += stopwatch.lap();
+    
+    // Report the transform from where this frame started, including the coarse levels
+    icpResult.sourceTransform = toMat4x4(toMatrix4f(icpResult.sourceTransform) * coarseTransform);
 
 #if DETAILED_PBF_MERGE_STATS
-    DEBUG_LOG("ICP took %d iterations, resulting in RMS source-target error %f",
+    DEBUG_LOG("ICP took %d iterations (plus %d on coarse levels), resulting in RMS source-target error %f",
               icpResult.iterationCount,
+              frameMetaOut.icpCoarseIterationCount,
               icpResult.rmsCorrespondenceError);
 #endif
 
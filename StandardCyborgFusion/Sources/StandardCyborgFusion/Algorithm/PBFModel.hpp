@@ -7,6 +7,8 @@
 
 #pragma once
 
+#import <memory>
+#import <string>
 #import <vector>
 
 #import <standard_cyborg/sc3d/Geometry.hpp>
@@ -15,10 +17,16 @@
 
 #import <StandardCyborgFusion/PBFFinalStatistics.h>
 
+#import "AssimilationWorkspace.hpp"
+#import "CompactSurfels.hpp"
 #import "FastRand.hpp"
 #import "ICP.hpp"
+#import "ICPIncrementalTarget.hpp"
 #import "Surfel.hpp"
+#import "SurfelBudget.hpp"
+#import "SurfelDeltaStream.hpp"
 #import "SurfelFusion.hpp"
+#import "SurfelStore.hpp"
 #import "ScreenSpaceLandmark.hpp"
 #import "SparseSurfelLandmarksIndex.hpp"
 
@@ -28,6 +36,24 @@
 
 using namespace standard_cyborg;
 
+/** The model's surfels as of some frame. It never changes once it's published, so any
+ *  thread can read it for as long as it holds on to it. */
+struct PBFModelSnapshot {
+    /** Set if PBFConfiguration::compactSnapshots was, in which case the surfels are in
+     *  `compactSurfels`, and `surfels` is empty */
+    bool isCompact = false;
+    Surfels surfels;
+    CompactSurfels compactSurfels;
+    
+    size_t surfelCount() const { return isCompact ? compactSurfels.size() : surfels.size(); }
+    
+    /** Decodes a single surfel, whichever way they're held */
+    Surfel surfelAt(size_t index) const { return isCompact ? compactSurfels[index] : surfels[index]; }
+    
+    /** How many frames had been assimilated when it was taken */
+    size_t assimilatedFrameCount = 0;
+};
+
 class PBFModel {
 public:
     PBFModel(std::shared_ptr<SurfelIndexMap> surfelIndexMap, unsigned int randomSeed = 0);
@@ -44,11 +70,58 @@ public:
 
     PBFFinalStatistics finishAssimilating(SurfelFusionConfiguration surfelFusionConfiguration);
 
+    /** Adds time spent fusing the last assimilated frame somewhere else, such as into a
+     *  TSDFVolume, to its stored fusionDuration, so the final statistics count it too */
+    void addFusionDuration(double seconds);
+
     void reset(unsigned int randomSeed = 0);
     
-    std::shared_ptr<sc3d::Geometry> buildPointCloud(float downsampledFraction = 1.0f);
+    /** Saves everything it takes to carry on assimilating later, or in another process, to a
+     *  versioned binary file: every surfel slot including tombstones, the current pose, the
+     *  frame metadata the motion model and velocity checks run on, the landmarks index, the
+     *  ICP target and where the random sampling is up to. The file is written next to `path`
+     *  and moved into place, so an interrupted save leaves any previous checkpoint intact.
+     *  @return false if it couldn't be written
+     */
+    bool saveCheckpoint(const std::string& path) const;
+    
+    /** Replaces the model with one saved by saveCheckpoint, after which assimilating the
+     *  remaining frames gives the same result as if it had never stopped.
+     *  @return false, leaving the model as it was, if the file can't be read, is corrupt,
+     *          or was written by an incompatible version
+     */
+    bool loadCheckpoint(const std::string& path);
+    
+    /** The most recently published snapshot, which is safe to call from any thread while
+     *  another assimilates, and never waits for it. Snapshots are published every
+     *  PBFConfiguration::snapshotInterval frames, and after finishing, resetting or loading
+     *  a checkpoint. */
+    std::shared_ptr<const PBFModelSnapshot> getSnapshot() const;
+    
+    /** A point cloud of the model as it is now, leaving out culled surfels. Like the other
+     *  accessors of the live model, call it on the thread that assimilates. */
+    std::shared_ptr<sc3d::Geometry> buildPointCloud(float downsampledFraction = 1.0f) const;
+    
+    /** A point cloud of the latest snapshot, which is safe to call from any thread. It's only
+     *  as current as the last snapshot, so unless PBFConfiguration::snapshotInterval is set,
+     *  it's empty until finishing. */
+    std::shared_ptr<sc3d::Geometry> buildSnapshotPointCloud(float downsampledFraction = 1.0f) const;
+    
+    /** Calls `callback` with how the surfels changed, every `frameInterval` frames, so that a
+     *  preview can keep up by applying just the changes. Subscribe and unsubscribe on the
+     *  thread that assimilates, which is also where the callback is called. With `compact`,
+     *  the changed surfels are quantized, for sending them somewhere. See SurfelDeltaStream.
+     *  @return An identifier for unsubscribing
+     */
+    int subscribeToSurfelDeltas(SurfelDeltaCallback callback, int frameInterval = 1, bool compact = false);
+    void unsubscribeFromSurfelDeltas(int subscriberID);
     Eigen::Matrix4f getCurrentExtrinsicMatrix();
+    /** The surfels packed into records, which happens at most once per change to the model */
     const Surfels& getSurfels() const;
+    const SurfelStore& getSurfelStore() const;
+    /** The surfel index map and landmarks index refer to slots in the surfel store, which
+     *  may hold tombstones while assimilating. After finishing, those are compacted away,
+     *  so the indices also match getSurfels(). */
     const std::vector<uint32_t>& getSurfelIndexMap() const;
     const SparseSurfelLandmarksIndex& getSurfelLandmarksIndex() const;
     const std::vector<PBFAssimilatedFrameMetadata> getAssimilatedFrameMetadata() const;
@@ -58,21 +131,44 @@ private:
     std::vector<PBFAssimilatedFrameMetadata> _assimilatedFrameMetadatas;
     FastRand _fastRNG;
 
-    Surfels _surfels;
-    std::shared_ptr<sc3d::Geometry> _ICPTargetCloud;
+    SurfelStore _surfels;
+    mutable Surfels _packedSurfels;
+    mutable bool _packedSurfelsAreCurrent = true;
+    ICPIncrementalTarget _ICPTarget;
+    ICPProjectiveTarget _ICPProjectiveTarget;
     
     SparseSurfelLandmarksIndex _surfelLandmarksIndex;
-    std::vector<int> _deletedSurfelIndicesList;
+    SurfelIndexChanges _surfelIndexChanges;
     
     SurfelFusion _surfelFusion;
+    SurfelBudget _surfelBudget;
+    SurfelDeltaStream _surfelDeltaStream;
+    
+    // Keeps ICP and the source downsampling from allocating; the rest of assimilate still does
+    AssimilationWorkspace _workspace;
 
     Eigen::Matrix4f _extrinsicMatrix = Eigen::Matrix4f::Identity();
+    
+    // Only ever accessed atomically, since readers on other threads take it
+    std::shared_ptr<const PBFModelSnapshot> _snapshot;
+    // Snapshots alternate between two buffers, so one can be refilled without reallocating
+    // while readers hold on to the other
+    std::shared_ptr<PBFModelSnapshot> _snapshotBuffers[2];
+    int _nextSnapshotBuffer = 0;
+    int _framesSinceSnapshot = 0;
+    // As of the last frame assimilated, so that snapshots published outside of it match
+    bool _compactSnapshots = false;
 
     void _cullLowConfidence(bool ignoreLifetime, int minWeight, std::vector<int>* deletedSurfelList = NULL);
-    ICPResult _runICP(ProcessedFrame& frame, SurfelFusionConfiguration surfelFusionConfiguration, ICPConfiguration icpConfig, PBFConfiguration pbfConfig);
+    bool _predictExtrinsicMatrix(const PBFConfiguration& pbfConfig, double currentTime, Eigen::Matrix4f& extrinsicMatrixOut);
+    ICPResult _runICP(ProcessedFrame& frame, SurfelFusionConfiguration surfelFusionConfiguration, ICPConfiguration icpConfig, PBFConfiguration pbfConfig, const Eigen::Matrix4f& initialExtrinsicMatrix, PBFAssimilatedFrameMetadata& frameMetaOut);
+    // Whether the camera, now at _extrinsicMatrix, has barely moved since the last merged frame
+    // and fusing the frame would add too little to be worth it
+    bool _isRedundantFrame(const ProcessedFrame& frame, const PBFConfiguration& pbfConfig, const SurfelFusionConfiguration& surfelFusionConfiguration, const PBFAssimilatedFrameMetadata& lastMergedFrameMeta);
     
     PBFAssimilatedFrameMetadata* _nthMostRecentValidFrameMetadata(size_t offset = 0);
     PBFFinalStatistics _calcFinalStatistics();
+    void _publishSnapshot();
 
     // Prohibit copying and assignment
     PBFModel(const PBFModel&) = delete;
@@ -0,0 +1,377 @@
+//
+//  PBFModelCheckpoint.cpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <cstdio>
+#import <cstring>
+#import <fstream>
+
+#import <standard_cyborg/util/DataUtils.hpp>
+
+#import "PBFModel.hpp"
+#import "DebugLog.h"
+
+using namespace Eigen;
+
+// MARK: - File format
+
+// A checkpoint is a fixed-size header followed by sections, each a flat array starting at a
+// multiple of kCheckpointSectionAlignment, so the file can be read with one bulk read per
+// section or mapped into memory as is. Values are in the byte order of the machine that wrote
+// them, which the header records with a byte order mark right after the magic, so a file
+// from a machine of the other byte order is rejected rather than read as garbage.
+
+static const char kCheckpointMagic[8] = { 'S', 'C', 'P', 'B', 'F', 'C', 'K', 'P' };
+
+// Reads back as 0x04030201 on a machine of the other byte order
+static const uint32_t kCheckpointByteOrderMark = 0x01020304;
+
+// Bump this whenever the header, a record or a section changes
+static const uint32_t kCheckpointVersion = 4;
+
+static const uint64_t kCheckpointSectionAlignment = 64;
+
+enum _CheckpointSection : uint32_t {
+    _CheckpointSectionPositions,
+    _CheckpointSectionNormals,
+    _CheckpointSectionWeights,
+    _CheckpointSectionColors,
+    _CheckpointSectionLifetimes,
+    _CheckpointSectionSurfelSizes,
+    _CheckpointSectionTombstones,
+    _CheckpointSectionLandmarkHits,
+    _CheckpointSectionFrameMetadata,
+    _CheckpointSectionICPTargetPositions,
+    _CheckpointSectionICPTargetNormals,
+    _CheckpointSectionICPTargetSurfelIndices,
+    _CheckpointSectionCount
+};
+
+struct _CheckpointSectionEntry {
+    uint64_t offset;
+    uint64_t byteSize;
+};
+
+struct _CheckpointHeader {
+    char magic[8];
+    uint32_t byteOrderMark;
+    uint32_t version;
+    uint32_t headerSize;
+    float extrinsicMatrix[16];
+    uint32_t randomState;
+    uint32_t icpTargetRandomSeed;
+    _CheckpointSectionEntry sections[_CheckpointSectionCount];
+};
+
+struct _CheckpointLandmarkHit {
+    int32_t surfelIndex;
+    int32_t landmarkIndex;
+    int32_t hitCount;
+};
+
+// PBFAssimilatedFrameMetadata, with fixed-size fields
+struct _CheckpointFrameMetadata {
+    float viewMatrix[16];
+    float projectionMatrix[16];
+    double timestamp;
+    uint64_t surfelCount;
+    uint64_t evictedSurfelCount;
+    float correspondenceError;
+    float icpUnusedIterationFraction;
+    int32_t icpIterationCount;
+    int32_t icpCoarseIterationCount;
+    float initialPoseTranslationResidual;
+    float initialPoseRotationResidual;
+    uint8_t isMerged;
+    uint8_t isPosePredicted;
+    uint8_t isSkipped;
+    uint8_t padding[5];
+    double depthProcessingDuration;
+    double icpSourceDownsamplingDuration;
+    double icpTargetUpdateDuration;
+    double icpDuration;
+    double surfelIndexMapDrawDuration;
+    double fusionDuration;
+    double cullingDuration;
+};
+
+static_assert(sizeof(_CheckpointFrameMetadata) == 240, "Checkpoint records must not change size without a version bump");
+static_assert(sizeof(Vector3f) == 3 * sizeof(float), "Surfel arrays are written as packed floats");
+
+static _CheckpointFrameMetadata _checkpointFrameMetadata(const PBFAssimilatedFrameMetadata& metadata)
+{
+    _CheckpointFrameMetadata record;
+    memset(&record, 0, sizeof(record));
+
+    Map<Matrix4f>(record.viewMatrix) = metadata.viewMatrix;
+    Map<Matrix4f>(record.projectionMatrix) = metadata.projectionMatrix;
+    record.timestamp = metadata.timestamp;
+    record.surfelCount = metadata.surfelCount;
+    record.evictedSurfelCount = metadata.evictedSurfelCount;
+    record.correspondenceError = metadata.correspondenceError;
+    record.icpUnusedIterationFraction = metadata.icpUnusedIterationFraction;
+    record.icpIterationCount = metadata.icpIterationCount;
+    record.icpCoarseIterationCount = metadata.icpCoarseIterationCount;
+    record.initialPoseTranslationResidual = metadata.initialPoseTranslationResidual;
+    record.initialPoseRotationResidual = metadata.initialPoseRotationResidual;
+    record.isMerged = metadata.isMerged;
+    record.isPosePredicted = metadata.isPosePredicted;
+    record.isSkipped = metadata.isSkipped;
+    record.depthProcessingDuration = metadata.depthProcessingDuration;
+    record.icpSourceDownsamplingDuration = metadata.icpSourceDownsamplingDuration;
+    record.icpTargetUpdateDuration = metadata.icpTargetUpdateDuration;
+    record.icpDuration = metadata.icpDuration;
+    record.surfelIndexMapDrawDuration = metadata.surfelIndexMapDrawDuration;
+    record.fusionDuration = metadata.fusionDuration;
+    record.cullingDuration = metadata.cullingDuration;
+
+    return record;
+}
+
+static PBFAssimilatedFrameMetadata _frameMetadata(const _CheckpointFrameMetadata& record)
+{
+    PBFAssimilatedFrameMetadata metadata;
+
+    metadata.viewMatrix = Map<const Matrix4f>(record.viewMatrix);
+    metadata.projectionMatrix = Map<const Matrix4f>(record.projectionMatrix);
+    metadata.timestamp = record.timestamp;
+    metadata.surfelCount = (size_t)record.surfelCount;
+    metadata.evictedSurfelCount = (size_t)record.evictedSurfelCount;
+    metadata.correspondenceError = record.correspondenceError;
+    metadata.icpUnusedIterationFraction = record.icpUnusedIterationFraction;
+    metadata.icpIterationCount = record.icpIterationCount;
+    metadata.icpCoarseIterationCount = record.icpCoarseIterationCount;
+    metadata.initialPoseTranslationResidual = record.initialPoseTranslationResidual;
+    metadata.initialPoseRotationResidual = record.initialPoseRotationResidual;
+    metadata.isMerged = record.isMerged != 0;
+    metadata.isPosePredicted = record.isPosePredicted != 0;
+    metadata.isSkipped = record.isSkipped != 0;
+    metadata.depthProcessingDuration = record.depthProcessingDuration;
+    metadata.icpSourceDownsamplingDuration = record.icpSourceDownsamplingDuration;
+    metadata.icpTargetUpdateDuration = record.icpTargetUpdateDuration;
+    metadata.icpDuration = record.icpDuration;
+    metadata.surfelIndexMapDrawDuration = record.surfelIndexMapDrawDuration;
+    metadata.fusionDuration = record.fusionDuration;
+    metadata.cullingDuration = record.cullingDuration;
+
+    return metadata;
+}
+
+template <typename T>
+static void _writeSection(std::ofstream& file, _CheckpointHeader& header, _CheckpointSection section, const std::vector<T>& values)
+{
+    static const char kZeros[kCheckpointSectionAlignment] = {};
+
+    uint64_t offset = (uint64_t)file.tellp();
+    uint64_t paddedOffset = (offset + kCheckpointSectionAlignment - 1) / kCheckpointSectionAlignment * kCheckpointSectionAlignment;
+    file.write(kZeros, (std::streamsize)(paddedOffset - offset));
+
+    header.sections[section].offset = paddedOffset;
+    header.sections[section].byteSize = values.size() * sizeof(T);
+    file.write(reinterpret_cast<const char *>(values.data()), (std::streamsize)header.sections[section].byteSize);
+}
+
+template <typename T>
+static bool _readSection(std::ifstream& file, uint64_t fileSize, const _CheckpointHeader& header, _CheckpointSection section, std::vector<T>& valuesOut)
+{
+    const _CheckpointSectionEntry& entry = header.sections[section];
+    if (entry.byteSize % sizeof(T) != 0 || entry.offset > fileSize || entry.byteSize > fileSize - entry.offset) { return false; }
+
+    valuesOut.resize((size_t)(entry.byteSize / sizeof(T)));
+    file.seekg((std::streamoff)entry.offset);
+    file.read(reinterpret_cast<char *>(valuesOut.data()), (std::streamsize)entry.byteSize);
+
+    return file.good();
+}
+
+// MARK: - PBFModel
+
+bool PBFModel::saveCheckpoint(const std::string& path) const
+{
+    _CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kCheckpointMagic, sizeof(header.magic));
+    header.byteOrderMark = kCheckpointByteOrderMark;
+    header.version = kCheckpointVersion;
+    header.headerSize = sizeof(header);
+    Map<Matrix4f>(header.extrinsicMatrix) = _extrinsicMatrix;
+    header.randomState = _fastRNG.state();
+
+    std::vector<_CheckpointLandmarkHit> landmarkHits;
+    _surfelLandmarksIndex.iterateHits([&](int surfelIndex, int landmarkIndex, int hitCount) {
+        landmarkHits.push_back({ surfelIndex, landmarkIndex, hitCount });
+    });
+
+    std::vector<_CheckpointFrameMetadata> frameMetadata;
+    frameMetadata.reserve(_assimilatedFrameMetadatas.size());
+    for (const PBFAssimilatedFrameMetadata& metadata : _assimilatedFrameMetadatas) {
+        frameMetadata.push_back(_checkpointFrameMetadata(metadata));
+    }
+
+    ICPIncrementalTargetState icpTargetState;
+    _ICPTarget.saveState(icpTargetState);
+    header.icpTargetRandomSeed = icpTargetState.randomSeed;
+
+    // math::Vec3 is padded out to 16 bytes, so pack these like the surfels
+    std::vector<Vector3f> icpTargetPositions;
+    std::vector<Vector3f> icpTargetNormals;
+    icpTargetPositions.reserve(icpTargetState.positions.size());
+    icpTargetNormals.reserve(icpTargetState.normals.size());
+    for (size_t pointIndex = 0; pointIndex < icpTargetState.positions.size(); ++pointIndex) {
+        icpTargetPositions.push_back(toVector3f(icpTargetState.positions[pointIndex]));
+        icpTargetNormals.push_back(toVector3f(icpTargetState.normals[pointIndex]));
+    }
+
+    std::string temporaryPath = path + ".partial";
+    std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) { return false; }
+
+    // The section table isn't known until the sections are written, so the header goes in last
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    _writeSection(file, header, _CheckpointSectionPositions, _surfels.positions);
+    _writeSection(file, header, _CheckpointSectionNormals, _surfels.normals);
+    _writeSection(file, header, _CheckpointSectionWeights, _surfels.weights);
+    _writeSection(file, header, _CheckpointSectionColors, _surfels.colors);
+    _writeSection(file, header, _CheckpointSectionLifetimes, _surfels.lifetimes);
+    _writeSection(file, header, _CheckpointSectionSurfelSizes, _surfels.surfelSizes);
+    _writeSection(file, header, _CheckpointSectionTombstones, _surfels.tombstones);
+    _writeSection(file, header, _CheckpointSectionLandmarkHits, landmarkHits);
+    _writeSection(file, header, _CheckpointSectionFrameMetadata, frameMetadata);
+    _writeSection(file, header, _CheckpointSectionICPTargetPositions, icpTargetPositions);
+    _writeSection(file, header, _CheckpointSectionICPTargetNormals, icpTargetNormals);
+    _writeSection(file, header, _CheckpointSectionICPTargetSurfelIndices, icpTargetState.surfelIndices);
+
+    file.seekp(0);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.close();
+
+    if (file.fail() || std::rename(temporaryPath.c_str(), path.c_str()) != 0) {
+        std::remove(temporaryPath.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool PBFModel::loadCheckpoint(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file.is_open()) { return false; }
+
+    uint64_t fileSize = (uint64_t)file.tellg();
+    file.seekg(0);
+
+    _CheckpointHeader header;
+    if (fileSize < sizeof(header)) { return false; }
+
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (file.good()
+        && memcmp(header.magic, kCheckpointMagic, sizeof(header.magic)) == 0
+        && header.byteOrderMark != kCheckpointByteOrderMark)
+    {
+        DEBUG_LOG("Checkpoint was written on a machine of the other byte order: %s", path.c_str());
+        return false;
+    }
+    if (!file.good()
+        || memcmp(header.magic, kCheckpointMagic, sizeof(header.magic)) != 0
+        || header.version != kCheckpointVersion
+        || header.headerSize != sizeof(header))
+    {
+        DEBUG_LOG("Not a checkpoint this version can read: %s", path.c_str());
+        return false;
+    }
+
+    // Read everything before touching the model, so it's left alone if the file is bad
+    SurfelStore surfels;
+    std::vector<_CheckpointLandmarkHit> landmarkHits;
+    std::vector<_CheckpointFrameMetadata> frameMetadata;
+    std::vector<Vector3f> icpTargetPositions;
+    std::vector<Vector3f> icpTargetNormals;
+    ICPIncrementalTargetState icpTargetState;
+
+    bool didRead = _readSection(file, fileSize, header, _CheckpointSectionPositions, surfels.positions)
+        && _readSection(file, fileSize, header, _CheckpointSectionNormals, surfels.normals)
+        && _readSection(file, fileSize, header, _CheckpointSectionWeights, surfels.weights)
+        && _readSection(file, fileSize, header, _CheckpointSectionColors, surfels.colors)
+        && _readSection(file, fileSize, header, _CheckpointSectionLifetimes, surfels.lifetimes)
+        && _readSection(file, fileSize, header, _CheckpointSectionSurfelSizes, surfels.surfelSizes)
+        && _readSection(file, fileSize, header, _CheckpointSectionTombstones, surfels.tombstones)
+        && _readSection(file, fileSize, header, _CheckpointSectionLandmarkHits, landmarkHits)
+        && _readSection(file, fileSize, header, _CheckpointSectionFrameMetadata, frameMetadata)
+        && _readSection(file, fileSize, header, _CheckpointSectionICPTargetPositions, icpTargetPositions)
+        && _readSection(file, fileSize, header, _CheckpointSectionICPTargetNormals, icpTargetNormals)
+        && _readSection(file, fileSize, header, _CheckpointSectionICPTargetSurfelIndices, icpTargetState.surfelIndices);
+    if (!didRead) {
+        DEBUG_LOG("Checkpoint is truncated: %s", path.c_str());
+        return false;
+    }
+
+    // Everything else refers to surfels by slot, so make sure those slots exist
+    const size_t surfelCount = surfels.size();
+    bool isConsistent = surfels.normals.size() == surfelCount
+        && surfels.weights.size() == surfelCount
+        && surfels.colors.size() == surfelCount
+        && surfels.lifetimes.size() == surfelCount
+        && surfels.surfelSizes.size() == surfelCount
+        && surfels.tombstones.size() == surfelCount
+        && icpTargetNormals.size() == icpTargetPositions.size()
+        && icpTargetState.surfelIndices.size() == icpTargetPositions.size();
+
+    for (const _CheckpointLandmarkHit& landmarkHit : landmarkHits) {
+        isConsistent = isConsistent && landmarkHit.surfelIndex >= 0 && landmarkHit.surfelIndex < (int64_t)surfelCount;
+    }
+    for (int surfelIndex : icpTargetState.surfelIndices) {
+        isConsistent = isConsistent && surfelIndex >= 0 && surfelIndex < (int64_t)surfelCount;
+    }
+
+    if (!isConsistent) {
+        DEBUG_LOG("Checkpoint is corrupt: %s", path.c_str());
+        return false;
+    }
+
+    for (size_t index = 0; index < surfelCount; ++index) {
+        if (surfels.tombstones[index]) { surfels.freeSlots.push_back((int)index); }
+    }
+
+    icpTargetState.randomSeed = header.icpTargetRandomSeed;
+    icpTargetState.positions.reserve(icpTargetPositions.size());
+    icpTargetState.normals.reserve(icpTargetNormals.size());
+    for (size_t pointIndex = 0; pointIndex < icpTargetPositions.size(); ++pointIndex) {
+        icpTargetState.positions.push_back(toVec3(icpTargetPositions[pointIndex]));
+        icpTargetState.normals.push_back(toVec3(icpTargetNormals[pointIndex]));
+    }
+
+    // Now that it's all there, replace the model
+    std::swap(_surfels, surfels);
+    _surfelIndexChanges.clear();
+    _surfelIndexChanges.firstAppendedSurfelIndex = _surfels.size();
+    _packedSurfels.clear();
+    _packedSurfelsAreCurrent = false;
+
+    _extrinsicMatrix = Map<const Matrix4f>(header.extrinsicMatrix);
+    _fastRNG.seed(header.randomState);
+
+    _assimilatedFrameMetadatas.clear();
+    _assimilatedFrameMetadatas.reserve(frameMetadata.size());
+    for (const _CheckpointFrameMetadata& record : frameMetadata) {
+        _assimilatedFrameMetadatas.push_back(_frameMetadata(record));
+    }
+
+    _surfelLandmarksIndex.removeAllHits();
+    for (const _CheckpointLandmarkHit& landmarkHit : landmarkHits) {
+        _surfelLandmarksIndex.setHitCount(landmarkHit.surfelIndex, landmarkHit.landmarkIndex, landmarkHit.hitCount);
+    }
+
+    _ICPTarget.restoreState(icpTargetState);
+    
+    _framesSinceSnapshot = 0;
+    _publishSnapshot();
+    _surfelDeltaStream.recordReplacement();
+    _surfelDeltaStream.publish(_surfels, _assimilatedFrameMetadatas.size(), true);
+
+    return true;
+}
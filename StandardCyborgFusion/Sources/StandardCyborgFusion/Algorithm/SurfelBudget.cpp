@@ -0,0 +1,198 @@
+//
+//  SurfelBudget.cpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <algorithm>
+#import <cmath>
+
+#import "SurfelBudget.hpp"
+
+// Voxels are at most 2^15 times the size of the nearest ones, which fits in a key's top 4 bits
+static const int kMaxLODLevel = 15;
+
+// Each voxel coordinate gets 20 bits of a key, centered on the origin
+static const int kVoxelCoordinateBits = 20;
+static const int64_t kVoxelCoordinateOffset = 1 << (kVoxelCoordinateBits - 1);
+static const uint64_t kVoxelCoordinateMask = (1 << kVoxelCoordinateBits) - 1;
+
+// Surfels in a voxel are only merged if they face within 60 degrees of the one they're
+// merged into, so that both sides of a thin surface don't get averaged away
+static const float kMinMergeNormalDot = 0.5f;
+
+static uint64_t _packVoxelCoordinate(float coordinate)
+{
+    int64_t packed = (int64_t)std::floor(coordinate) + kVoxelCoordinateOffset;
+
+    return (uint64_t)std::max((int64_t)0, std::min(packed, (int64_t)kVoxelCoordinateMask));
+}
+
+size_t SurfelBudget::enforce(const PBFConfiguration& pbfConfig,
+                             const Vector3f& cameraPosition,
+                             SurfelStore& surfels,
+                             SparseSurfelLandmarksIndex& surfelLandmarksIndex,
+                             SurfelIndexChanges& indexChanges)
+{
+    indexChanges.clear();
+    indexChanges.firstAppendedSurfelIndex = surfels.size();
+
+    size_t liveCount = surfels.liveCount();
+    if (pbfConfig.maxSurfelCount == 0 || liveCount <= pbfConfig.maxSurfelCount) { return 0; }
+
+    size_t targetCount = (size_t)(pbfConfig.maxSurfelCount * std::max(0.0f, std::min(pbfConfig.surfelBudgetTargetFraction, 1.0f)));
+    size_t removeCount = liveCount - targetCount;
+
+    // Surfels merged away are marked right away, so that eviction doesn't pick them again
+    std::vector<int>& removedSurfelIndices = indexChanges.removedSurfelIndices;
+    size_t mergedCount = _mergeDistantSurfels(pbfConfig, cameraPosition, removeCount, surfels, surfelLandmarksIndex, indexChanges.updatedSurfelIndices);
+    removedSurfelIndices.swap(_removedSurfelIndices);
+    surfels.markRemoved(removedSurfelIndices);
+
+    if (mergedCount < removeCount) {
+        _evictLeastConfident(removeCount - mergedCount, surfels);
+        surfels.markRemoved(_removedSurfelIndices);
+
+        if (surfelLandmarksIndex.size() > 0) {
+            surfelLandmarksIndex.deleteSurfelLandmarks(_removedSurfelIndices);
+        }
+
+        size_t middle = removedSurfelIndices.size();
+        removedSurfelIndices.insert(removedSurfelIndices.end(), _removedSurfelIndices.begin(), _removedSurfelIndices.end());
+        std::inplace_merge(removedSurfelIndices.begin(), removedSurfelIndices.begin() + middle, removedSurfelIndices.end());
+    }
+
+    return removedSurfelIndices.size();
+}
+
+// MARK: - Private
+
+size_t SurfelBudget::_mergeDistantSurfels(const PBFConfiguration& pbfConfig,
+                                          const Vector3f& cameraPosition,
+                                          size_t removeCount,
+                                          SurfelStore& surfels,
+                                          SparseSurfelLandmarksIndex& surfelLandmarksIndex,
+                                          std::vector<int>& mergedIntoIndicesOut)
+{
+    const float nearDistance = pbfConfig.surfelLODNearDistance;
+    const float nearVoxelSize = pbfConfig.surfelLODVoxelSize;
+    if (nearDistance <= 0 || nearVoxelSize <= 0) { return 0; }
+
+    // Key each distant surfel by its voxel, with the level of detail in the top bits
+    _voxelEntries.clear();
+
+    for (size_t index = 0; index < surfels.size(); ++index) {
+        if (surfels.tombstones[index]) { continue; }
+
+        float distance = (surfels.positions[index] - cameraPosition).norm();
+        if (distance <= nearDistance) { continue; }
+
+        int level = std::min(kMaxLODLevel, (int)std::log2(distance / nearDistance));
+        Vector3f voxel = surfels.positions[index] / std::ldexp(nearVoxelSize, level);
+
+        uint64_t key = (uint64_t)level << (3 * kVoxelCoordinateBits);
+        key |= _packVoxelCoordinate(voxel.x()) << (2 * kVoxelCoordinateBits);
+        key |= _packVoxelCoordinate(voxel.y()) << kVoxelCoordinateBits;
+        key |= _packVoxelCoordinate(voxel.z());
+
+        _voxelEntries.push_back({ key, (int)index });
+    }
+
+    // Coarsest voxels, which are farthest from the camera, first
+    std::sort(_voxelEntries.begin(), _voxelEntries.end(), [](const _VoxelEntry& lhs, const _VoxelEntry& rhs) {
+        return lhs.key != rhs.key ? lhs.key > rhs.key : lhs.surfelIndex < rhs.surfelIndex;
+    });
+
+    _removedSurfelIndices.clear();
+
+    for (size_t begin = 0; begin < _voxelEntries.size() && _removedSurfelIndices.size() < removeCount;) {
+        size_t end = begin + 1;
+        while (end < _voxelEntries.size() && _voxelEntries[end].key == _voxelEntries[begin].key) { ++end; }
+
+        if (end - begin > 1) {
+            // Merge the voxel into its most confident surfel, weighting each by its confidence
+            int keptIndex = _voxelEntries[begin].surfelIndex;
+            for (size_t entry = begin + 1; entry < end; ++entry) {
+                int surfelIndex = _voxelEntries[entry].surfelIndex;
+                if (surfels.weights[surfelIndex] > surfels.weights[keptIndex]) { keptIndex = surfelIndex; }
+            }
+
+            const Vector3f keptNormal = surfels.normals[keptIndex];
+            float totalWeight = 0;
+            Vector3f position = Vector3f::Zero();
+            Vector3f normal = Vector3f::Zero();
+            Vector3f color = Vector3f::Zero();
+            float surfelSize = 0;
+            int32_t lifetime = (int32_t)surfels.lifetimes[keptIndex];
+
+            for (size_t entry = begin; entry < end; ++entry) {
+                int surfelIndex = _voxelEntries[entry].surfelIndex;
+                if (surfels.normals[surfelIndex].dot(keptNormal) < kMinMergeNormalDot) { continue; }
+
+                float weight = surfels.weights[surfelIndex];
+                totalWeight += weight;
+                position += weight * surfels.positions[surfelIndex];
+                normal += weight * surfels.normals[surfelIndex];
+                color += weight * surfels.colors[surfelIndex];
+                surfelSize = std::max(surfelSize, surfels.surfelSizes[surfelIndex]);
+                lifetime = std::max(lifetime, (int32_t)surfels.lifetimes[surfelIndex]);
+
+                if (surfelIndex != keptIndex) {
+                    _removedSurfelIndices.push_back(surfelIndex);
+                    if (surfelLandmarksIndex.size() > 0) { surfelLandmarksIndex.moveSurfelLandmarks(surfelIndex, keptIndex); }
+                }
+            }
+
+            surfels.positions[keptIndex] = position / totalWeight;
+            surfels.normals[keptIndex] = normal.normalized();
+            surfels.colors[keptIndex] = color / totalWeight;
+            surfels.weights[keptIndex] = totalWeight;
+            surfels.surfelSizes[keptIndex] = surfelSize;
+            surfels.lifetimes[keptIndex] = (uint32_t)lifetime;
+            mergedIntoIndicesOut.push_back(keptIndex);
+        }
+
+        begin = end;
+    }
+
+    std::sort(_removedSurfelIndices.begin(), _removedSurfelIndices.end());
+    std::sort(mergedIntoIndicesOut.begin(), mergedIntoIndicesOut.end());
+
+    return _removedSurfelIndices.size();
+}
+
+void SurfelBudget::_evictLeastConfident(size_t removeCount, SurfelStore& surfels)
+{
+    _evictionCandidates.clear();
+
+    for (size_t index = 0; index < surfels.size(); ++index) {
+        if (surfels.tombstones[index]) { continue; }
+
+        // Lifetimes count down past zero once a surfel goes unseen, so as signed values
+        // they say how long ago it was last seen
+        _evictionCandidates.push_back({ surfels.weights[index], (int32_t)surfels.lifetimes[index], (int)index });
+    }
+
+    // Surfels that haven't been seen lately go first, then the least confident, then the
+    // longest unseen. The index breaks ties so that the order is total.
+    removeCount = std::min(removeCount, _evictionCandidates.size());
+    std::nth_element(_evictionCandidates.begin(),
+                     _evictionCandidates.begin() + removeCount,
+                     _evictionCandidates.end(),
+                     [](const _EvictionCandidate& lhs, const _EvictionCandidate& rhs) {
+        bool lhsIsRecent = lhs.lifetime > 0;
+        bool rhsIsRecent = rhs.lifetime > 0;
+        if (lhsIsRecent != rhsIsRecent) { return rhsIsRecent; }
+        if (lhs.weight != rhs.weight) { return lhs.weight < rhs.weight; }
+        if (lhs.lifetime != rhs.lifetime) { return lhs.lifetime < rhs.lifetime; }
+        return lhs.surfelIndex < rhs.surfelIndex;
+    });
+
+    _removedSurfelIndices.clear();
+    for (size_t candidate = 0; candidate < removeCount; ++candidate) {
+        _removedSurfelIndices.push_back(_evictionCandidates[candidate].surfelIndex);
+    }
+
+    std::sort(_removedSurfelIndices.begin(), _removedSurfelIndices.end());
+}
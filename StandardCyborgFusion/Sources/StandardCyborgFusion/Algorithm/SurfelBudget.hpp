@@ -0,0 +1,67 @@
+//
+//  SurfelBudget.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <cstdint>
+#import <vector>
+
+#import "PBFConfiguration.hpp"
+#import "SparseSurfelLandmarksIndex.hpp"
+#import "SurfelStore.hpp"
+
+/** Keeps the model within PBFConfiguration::maxSurfelCount surfels.
+ *
+ *  Once there are more than that, it first coarsens the model far from the camera: surfels
+ *  that share a voxel, whose size grows with distance, are merged into the most confident
+ *  of them. If that isn't enough, the least confident surfels are evicted, and of those,
+ *  the ones that went unseen longest. Either way, it stops once the model is down to
+ *  PBFConfiguration::surfelBudgetTargetFraction of the budget, so the cost is amortized
+ *  over the frames it takes to grow back.
+ *
+ *  Surfels that are merged away or evicted are left as tombstones, like culled ones. The
+ *  landmark hits of merged surfels move to the surfel they were merged into, so landmarks on
+ *  distant geometry survive coarsening, while those of evicted surfels are deleted.
+ */
+class SurfelBudget {
+public:
+    /** Merges and evicts surfels if there are more than the budget allows.
+     *  @param cameraPosition Where the camera is, in the model's frame of reference
+     *  @param indexChanges Set to the surfels that were removed, and those others were merged into
+     *  @return The number of surfels removed, whether merged or evicted
+     */
+    size_t enforce(const PBFConfiguration& pbfConfig,
+                   const Vector3f& cameraPosition,
+                   SurfelStore& surfels,
+                   SparseSurfelLandmarksIndex& surfelLandmarksIndex,
+                   SurfelIndexChanges& indexChanges);
+
+private:
+    struct _VoxelEntry {
+        uint64_t key;
+        int surfelIndex;
+    };
+
+    struct _EvictionCandidate {
+        float weight;
+        int32_t lifetime;
+        int surfelIndex;
+    };
+
+    // Kept between calls to avoid reallocating
+    std::vector<_VoxelEntry> _voxelEntries;
+    std::vector<_EvictionCandidate> _evictionCandidates;
+    std::vector<int> _removedSurfelIndices;
+
+    size_t _mergeDistantSurfels(const PBFConfiguration& pbfConfig,
+                                const Vector3f& cameraPosition,
+                                size_t removeCount,
+                                SurfelStore& surfels,
+                                SparseSurfelLandmarksIndex& surfelLandmarksIndex,
+                                std::vector<int>& mergedIntoIndicesOut);
+    void _evictLeastConfident(size_t removeCount, SurfelStore& surfels);
+};
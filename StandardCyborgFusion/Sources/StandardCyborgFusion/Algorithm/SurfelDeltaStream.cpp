@@ -0,0 +1,152 @@
+//
+//  SurfelDeltaStream.cpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <algorithm>
+
+#import "SurfelDeltaStream.hpp"
+
+void SurfelDelta::applyTo(Surfels& slots) const
+{
+    if (replacesAll) {
+        if (isCompact) {
+            compactChangedSurfels.decode(slots);
+        } else {
+            slots = changedSurfels;
+        }
+        return;
+    }
+
+    slots.resize(slotCount);
+
+    for (size_t changed = 0; changed < changedSlotIndices.size(); ++changed) {
+        slots[changedSlotIndices[changed]] = isCompact ? compactChangedSurfels[changed] : changedSurfels[changed];
+    }
+
+    // Like SurfelStore::copySlotsTo, tombstones have a size of zero, which doesn't draw anything
+    for (int slot : removedSlotIndices) {
+        slots[slot].surfelSize = 0;
+    }
+}
+
+int SurfelDeltaStream::subscribe(SurfelDeltaCallback callback, int frameInterval, bool compact)
+{
+    _Subscriber subscriber;
+    subscriber.id = _nextSubscriberID++;
+    subscriber.callback = callback;
+    subscriber.frameInterval = std::max(frameInterval, 1);
+    subscriber.compact = compact;
+
+    _subscribers.push_back(std::move(subscriber));
+
+    return _subscribers.back().id;
+}
+
+void SurfelDeltaStream::unsubscribe(int subscriberID)
+{
+    _subscribers.erase(std::remove_if(_subscribers.begin(), _subscribers.end(), [subscriberID](const _Subscriber& subscriber) {
+        return subscriber.id == subscriberID;
+    }), _subscribers.end());
+}
+
+void SurfelDeltaStream::recordChanges(const SurfelIndexChanges& indexChanges, const SurfelStore& surfels)
+{
+    // Compaction renumbers the slots, which is cheaper to send again than to describe
+    if (!indexChanges.compactedSurfelIndices.empty()) {
+        recordReplacement();
+        return;
+    }
+
+    for (_Subscriber& subscriber : _subscribers) {
+        if (subscriber.replacesAll) { continue; }
+
+        if (subscriber.slotStates.size() < surfels.size()) {
+            subscriber.slotStates.resize(surfels.size(), _SlotUnchanged);
+        }
+
+        // In the order they happened, so that the latest thing to happen to a slot wins
+        for (int slot : indexChanges.updatedSurfelIndices) { _markSlot(subscriber, slot, _SlotChanged); }
+        for (int slot : indexChanges.reusedSurfelIndices) { _markSlot(subscriber, slot, _SlotChanged); }
+        for (size_t slot = indexChanges.firstAppendedSurfelIndex; slot < surfels.size(); ++slot) {
+            _markSlot(subscriber, (int)slot, _SlotChanged);
+        }
+        for (int slot : indexChanges.removedSurfelIndices) { _markSlot(subscriber, slot, _SlotRemoved); }
+    }
+}
+
+void SurfelDeltaStream::recordReplacement()
+{
+    for (_Subscriber& subscriber : _subscribers) {
+        for (int slot : subscriber.dirtySlots) { subscriber.slotStates[slot] = _SlotUnchanged; }
+        subscriber.dirtySlots.clear();
+        subscriber.replacesAll = true;
+    }
+}
+
+void SurfelDeltaStream::publish(const SurfelStore& surfels, size_t assimilatedFrameCount, bool force)
+{
+    for (_Subscriber& subscriber : _subscribers) {
+        ++subscriber.framesSincePublished;
+        if (!force && subscriber.framesSincePublished < subscriber.frameInterval) { continue; }
+
+        _publish(subscriber, surfels, assimilatedFrameCount);
+    }
+}
+
+// MARK: - Private
+
+void SurfelDeltaStream::_markSlot(_Subscriber& subscriber, int slot, _SlotState state)
+{
+    uint8_t& slotState = subscriber.slotStates[slot];
+    if (slotState == _SlotUnchanged) { subscriber.dirtySlots.push_back(slot); }
+
+    slotState = state;
+}
+
+void SurfelDeltaStream::_publish(_Subscriber& subscriber, const SurfelStore& surfels, size_t assimilatedFrameCount)
+{
+    subscriber.framesSincePublished = 0;
+
+    // Nothing to say
+    if (!subscriber.replacesAll && subscriber.dirtySlots.empty()) { return; }
+
+    _delta.replacesAll = subscriber.replacesAll;
+    _delta.slotCount = surfels.size();
+    _delta.assimilatedFrameCount = assimilatedFrameCount;
+    _delta.changedSlotIndices.clear();
+    _delta.changedSurfels.clear();
+    _delta.isCompact = subscriber.compact;
+    _delta.compactChangedSurfels.clear();
+    _delta.removedSlotIndices.clear();
+
+    if (subscriber.replacesAll) {
+        surfels.copySlotsTo(_delta.changedSurfels);
+    } else {
+        std::sort(subscriber.dirtySlots.begin(), subscriber.dirtySlots.end());
+
+        for (int slot : subscriber.dirtySlots) {
+            if (subscriber.slotStates[slot] == _SlotRemoved) {
+                _delta.removedSlotIndices.push_back(slot);
+            } else {
+                _delta.changedSlotIndices.push_back(slot);
+                _delta.changedSurfels.push_back(surfels[slot]);
+            }
+
+            subscriber.slotStates[slot] = _SlotUnchanged;
+        }
+    }
+
+    // Tombstones encode to a size of zero too
+    if (subscriber.compact) {
+        _delta.compactChangedSurfels.encode(_delta.changedSurfels);
+        _delta.changedSurfels.clear();
+    }
+
+    subscriber.dirtySlots.clear();
+    subscriber.replacesAll = false;
+
+    subscriber.callback(_delta);
+}
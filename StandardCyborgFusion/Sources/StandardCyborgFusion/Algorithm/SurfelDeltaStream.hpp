@@ -0,0 +1,122 @@
+//
+//  SurfelDeltaStream.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <cstdint>
+#import <functional>
+#import <vector>
+
+#import "CompactSurfels.hpp"
+#import "Surfel.hpp"
+#import "SurfelStore.hpp"
+
+/** How the model's surfels changed since the last delta, for keeping a copy of them up to
+ *  date without copying all of them every time.
+ *
+ *  Indices are slots in the SurfelStore, so the copy is laid out like
+ *  SurfelStore::copySlotsTo, with a size of zero for slots that hold a tombstone. Slots only
+ *  get renumbered when the store compacts, which is rare, and then the delta replaces every
+ *  slot instead.
+ *
+ *  Every surfel's lifetime counts down each frame, which deltas don't carry, so a copy's
+ *  lifetimes are as of when each slot last changed.
+ */
+struct SurfelDelta {
+    /** When set, `changedSurfels` holds every slot, and the copy should be replaced with it.
+     *  The first delta each subscriber gets always does. */
+    bool replacesAll = false;
+
+    /** The number of slots there are now */
+    size_t slotCount = 0;
+
+    /** How many frames had been assimilated when it was published */
+    size_t assimilatedFrameCount = 0;
+
+    /** Slots that were added or updated, in ascending order, and their values now. When
+     *  replacing everything, the indices are left empty, and the values are every slot. */
+    std::vector<int> changedSlotIndices;
+    Surfels changedSurfels;
+
+    /** Set for subscribers that asked for compact deltas, in which case the values of the
+     *  changed slots are quantized into `compactChangedSurfels` instead, and
+     *  `changedSurfels` is empty */
+    bool isCompact = false;
+    CompactSurfels compactChangedSurfels;
+
+    /** Slots that now hold a tombstone, in ascending order */
+    std::vector<int> removedSlotIndices;
+
+    /** Brings a copy of the slots that was up to date with the previous delta up to date */
+    void applyTo(Surfels& slots) const;
+};
+
+typedef std::function<void(const SurfelDelta& delta)> SurfelDeltaCallback;
+
+/** Collects the SurfelIndexChanges of each step of assimilation, and publishes them to
+ *  subscribers as SurfelDeltas.
+ *
+ *  Each subscriber chooses how many frames go by between its deltas. Changes in between
+ *  are coalesced, so a slot that changed many times is only sent once, with its latest
+ *  values, and the cost of a delta is proportional to the number of slots that changed
+ *  rather than to the size of the model.
+ */
+class SurfelDeltaStream {
+public:
+    /** Adds a subscriber, which is called with a delta after every `frameInterval` frames
+     *  that changed anything, on the thread that's assimilating. The delta is only valid
+     *  during the call, and the callback mustn't subscribe or unsubscribe. With `compact`,
+     *  the changed surfels are sent as CompactSurfels, for when the delta is going over a
+     *  network or to disk, and bandwidth matters more than precision.
+     *  @return An identifier for unsubscribing
+     */
+    int subscribe(SurfelDeltaCallback callback, int frameInterval = 1, bool compact = false);
+
+    void unsubscribe(int subscriberID);
+
+    bool hasSubscribers() const { return !_subscribers.empty(); }
+
+    /** Records one step's changes to `surfels`, which have already been made */
+    void recordChanges(const SurfelIndexChanges& indexChanges, const SurfelStore& surfels);
+
+    /** Records that the slots were replaced wholesale, e.g. by a reset or loading a checkpoint */
+    void recordReplacement();
+
+    /** Counts a frame, and publishes to the subscribers whose interval is up, or to all of
+     *  them if `force` is set */
+    void publish(const SurfelStore& surfels, size_t assimilatedFrameCount, bool force = false);
+
+private:
+    enum _SlotState : uint8_t {
+        _SlotUnchanged = 0,
+        _SlotChanged,
+        _SlotRemoved,
+    };
+
+    struct _Subscriber {
+        int id;
+        SurfelDeltaCallback callback;
+        int frameInterval;
+        bool compact;
+        int framesSincePublished = 0;
+        bool replacesAll = true;
+
+        // What has happened to each slot since the last delta, and the slots where
+        // something has, in no particular order
+        std::vector<uint8_t> slotStates;
+        std::vector<int> dirtySlots;
+    };
+
+    std::vector<_Subscriber> _subscribers;
+    int _nextSubscriberID = 1;
+
+    // Kept between deltas to avoid reallocating
+    SurfelDelta _delta;
+
+    static void _markSlot(_Subscriber& subscriber, int slot, _SlotState state);
+    void _publish(_Subscriber& subscriber, const SurfelStore& surfels, size_t assimilatedFrameCount);
+};
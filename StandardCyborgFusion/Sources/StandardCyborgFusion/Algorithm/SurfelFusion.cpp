@@ -7,92 +7,282 @@
 
 #import "PBFDefinitions.h"
 
+#import <algorithm>
+
 #import <standard_cyborg/util/DataUtils.hpp>
 #import <standard_cyborg/util/DebugHelpers.hpp>
 #import <standard_cyborg/util/IncludeEigen.hpp>
+#import <standard_cyborg/util/TaskScheduler.hpp>
 
 #import "EigenHelpers.hpp"
 #import "DebugLog.h"
+#import "Stopwatch.hpp"
 #import "SurfelFusion.hpp"
 
+// Rows per band when fusing a frame in parallel. New surfels are appended in band order,
+// which is the same as row-major order, so this only affects scheduling.
+static const size_t kFusionTileRows = 16;
+
+// Surfels per block when culling in parallel. The culled indices come out in ascending order
+// regardless, so this only affects scheduling.
+static const size_t kCullBlockSize = 1 << 14;
+
+struct _FusionCounts {
+    size_t assimilatedCount = 0;
+    size_t newCount = 0;
+    size_t angleOfIncidenceRejections = 0;
+    size_t maxDepthRejections = 0;
+    size_t minDepthRejections = 0;
+    size_t inputConfidenceRejections = 0;
+    size_t mergeRadiusRejections = 0;
+    size_t mergeRadiusSuccesses = 0;
+};
+
+static _FusionCounts _sumFusionCounts(_FusionCounts lhs, const _FusionCounts& rhs)
+{
+    lhs.assimilatedCount += rhs.assimilatedCount;
+    lhs.newCount += rhs.newCount;
+    lhs.angleOfIncidenceRejections += rhs.angleOfIncidenceRejections;
+    lhs.maxDepthRejections += rhs.maxDepthRejections;
+    lhs.minDepthRejections += rhs.minDepthRejections;
+    lhs.inputConfidenceRejections += rhs.inputConfidenceRejections;
+    lhs.mergeRadiusRejections += rhs.mergeRadiusRejections;
+    lhs.mergeRadiusSuccesses += rhs.mergeRadiusSuccesses;
+    return lhs;
+}
+
 const std::vector<uint32_t>& SurfelFusion::getSurfelIndexLookups() const
 {
     return _surfelIndexLookups;
 }
 
+const SurfelFusionTimings& SurfelFusion::getLastTimings() const
+{
+    return _lastTimings;
+}
+
 SurfelFusion::SurfelFusion(std::shared_ptr<SurfelIndexMap> surfelIndexMap) :
     _surfelIndexMap(surfelIndexMap)
 {
 }
 
-void SurfelFusion::cullLowConfidence(bool ignoreLifetime, int minWeight, Surfels& surfels, std::vector<int>* deletedSurfelList)
+void SurfelFusion::cullLowConfidence(bool ignoreLifetime, int minWeight, SurfelStore& surfels, std::vector<int>* deletedSurfelList)
 {
-    size_t surfelCount = surfels.size();
-    size_t compressedIndex = 0;
+    std::vector<int> localDeletedSurfelList;
+    if (deletedSurfelList == NULL) { deletedSurfelList = &localDeletedSurfelList; }
     
-    for (size_t index = 0; index < surfelCount; ++index) {
-        Surfel& surfel = surfels[index];
+    // Only lifetimes and weights decide what's culled, and culled surfels are only marked
+    // as tombstones, so nothing has to move until the tombstones are compacted away
+    const size_t surfelCount = surfels.size();
+    const size_t blockCount = (surfelCount + kCullBlockSize - 1) / kCullBlockSize;
+    
+    auto isCulled = [&](size_t index) {
+        if (surfels.tombstones[index]) { return false; }
+        if ((surfels.lifetimes[index] > 0 && !ignoreLifetime) || (surfels.weights[index] >= minWeight)) { return false; }
         
-        if ((surfel.lifetime > 0 && !ignoreLifetime) || (surfel.weight >= minWeight)) {
-            surfels[compressedIndex] = surfels[index];
+        return true;
+    };
+    
+    // Count each block's culled surfels to find where their indices go, then write them there,
+    // so the list comes out in ascending order however the blocks are scheduled
+    _culledSurfelOffsets.assign(blockCount + 1, 0);
+    
+    util::TaskScheduler::shared().parallelFor(0, blockCount, 1, [&](size_t blockBegin, size_t blockEnd) {
+        for (size_t block = blockBegin; block < blockEnd; ++block) {
+            size_t indexEnd = std::min(surfelCount, (block + 1) * kCullBlockSize);
+            size_t culledCount = 0;
             
-            ++compressedIndex;
-        } else if (deletedSurfelList != NULL) {
-            deletedSurfelList->push_back((int)index);
+            for (size_t index = block * kCullBlockSize; index < indexEnd; ++index) {
+                if (isCulled(index)) { ++culledCount; }
+            }
+            
+            _culledSurfelOffsets[block + 1] = culledCount;
         }
+    });
+    
+    _culledSurfelOffsets[0] = deletedSurfelList->size();
+    for (size_t block = 0; block < blockCount; ++block) {
+        _culledSurfelOffsets[block + 1] += _culledSurfelOffsets[block];
     }
+    deletedSurfelList->resize(_culledSurfelOffsets[blockCount]);
+    
+    util::TaskScheduler::shared().parallelFor(0, blockCount, 1, [&](size_t blockBegin, size_t blockEnd) {
+        for (size_t block = blockBegin; block < blockEnd; ++block) {
+            size_t indexEnd = std::min(surfelCount, (block + 1) * kCullBlockSize);
+            size_t culledOffset = _culledSurfelOffsets[block];
+            
+            for (size_t index = block * kCullBlockSize; index < indexEnd; ++index) {
+                if (isCulled(index)) { (*deletedSurfelList)[culledOffset++] = (int)index; }
+            }
+        }
+    });
     
-    surfels.resize(compressedIndex);
+    surfels.markRemoved(*deletedSurfelList);
 }
 
-void _addValuesAsNewSurfel(Vector3f position, Vector3f normal, Vector3f color, float weight, int surfelLifetime, float surfelSize, Surfels& surfels)
+void SurfelFusion::compactIfFragmented(float maxTombstoneFraction,
+                                       SurfelStore& surfels,
+                                       SparseSurfelLandmarksIndex& surfelLandmarksIndex,
+                                       SurfelIndexChanges& indexChanges)
 {
-    Surfel surfel;
-    surfel.position = position;
-    surfel.normal = normal;
-    surfel.surfelSize = surfelSize;
+    if (surfels.freeSlots.empty()) { return; }
+    if ((float)surfels.freeSlots.size() <= maxTombstoneFraction * (float)surfels.size()) { return; }
     
-    surfel.color = color;
-    surfel.weight = weight;
-    surfel.lifetime = surfelLifetime;
+    compact(surfels, surfelLandmarksIndex, indexChanges);
+}
+
+void SurfelFusion::compact(SurfelStore& surfels,
+                           SparseSurfelLandmarksIndex& surfelLandmarksIndex,
+                           SurfelIndexChanges& indexChanges)
+{
+    surfels.compact(indexChanges.compactedSurfelIndices);
+    
+    if (surfelLandmarksIndex.size() > 0) {
+        // Landmarks on tombstones were already deleted, so this only renumbers
+        surfelLandmarksIndex.deleteSurfelLandmarksAndRenumber(indexChanges.compactedSurfelIndices);
+    }
+}
+
+void _setValuesAsNewSurfel(size_t surfelIndex, Vector3f position, Vector3f normal, Vector3f color, float weight, int surfelLifetime, float surfelSize, SurfelStore& surfels)
+{
+    surfels.positions[surfelIndex] = position;
+    surfels.normals[surfelIndex] = normal;
+    surfels.surfelSizes[surfelIndex] = surfelSize;
     
-    surfels.push_back(surfel);
+    surfels.colors[surfelIndex] = color;
+    surfels.weights[surfelIndex] = weight;
+    surfels.lifetimes[surfelIndex] = surfelLifetime;
 }
 
-void _integrateValuesIntoExistingSurfelAtIndex(size_t surfelIndex, Vector3f incomingPosition, Vector3f incomingNormal, float incomingNormalLength, Vector3f incomingColor, float incomingSurfelSize, float weight, int surfelLifetime, Surfels& surfels)
+void _integrateValuesIntoExistingSurfelAtIndex(size_t surfelIndex, Vector3f incomingPosition, Vector3f incomingNormal, float incomingNormalLength, Vector3f incomingColor, float incomingSurfelSize, float weight, int surfelLifetime, SurfelStore& surfels)
 {
-    Surfel& surfel = surfels[surfelIndex];
-    float currentWeight = surfel.weight;
+    float currentWeight = surfels.weights[surfelIndex];
     float divTotalCount = 1.0 / (currentWeight + weight);
     
-    surfel.position = (currentWeight * surfel.position + weight * incomingPosition) * divTotalCount;
+    surfels.positions[surfelIndex] = (currentWeight * surfels.positions[surfelIndex] + weight * incomingPosition) * divTotalCount;
     
     // Compute the length of the exising surfel normal
-    Vector3f existingNormal = surfel.normal;
+    Vector3f existingNormal = surfels.normals[surfelIndex];
     
     // Average the normals to compute the new direction
     Vector3f newNormal = (currentWeight * existingNormal + weight * incomingNormal) * divTotalCount;
     newNormal.normalize();
     
-    const float existingSurfelSize = surfel.surfelSize;
+    const float existingSurfelSize = surfels.surfelSizes[surfelIndex];
     
     // If the new sample normal is larger, use the original length. Otherwise average.
     float targetSurfelSize = (incomingSurfelSize > existingSurfelSize) ? existingSurfelSize : 0.5 * (existingSurfelSize + incomingSurfelSize);
     
-    surfel.normal = newNormal;
-    surfel.color = (currentWeight * surfel.color + weight * incomingColor) * divTotalCount;
-    surfel.lifetime = surfelLifetime;
-    surfel.weight += weight;
-    surfel.surfelSize = targetSurfelSize;
+    surfels.normals[surfelIndex] = newNormal;
+    surfels.colors[surfelIndex] = (currentWeight * surfels.colors[surfelIndex] + weight * incomingColor) * divTotalCount;
+    surfels.lifetimes[surfelIndex] = surfelLifetime;
+    surfels.weights[surfelIndex] += weight;
+    surfels.surfelSizes[surfelIndex] = targetSurfelSize;
+}
+
+// Whether fusion uses a pixel: its depth is in range, it's confident enough, and it doesn't
+// face the camera at too glancing an angle. If so, returns its weight, and its position and
+// normal in the model's frame of reference.
+static inline bool _prepareIncomingPixel(const SurfelFusionConfiguration& surfelFusionConfiguration,
+                                         const ProcessedFrame& frame,
+                                         size_t index,
+                                         float cosAngleOfIncidenceThreshold,
+                                         const Eigen::Matrix4f& extrinsicMatrix,
+                                         const Eigen::Matrix3f& extrinsicNormalMatrix,
+                                         float& weightOut,
+                                         Vector3f& positionOut,
+                                         Vector3f& normalOut,
+                                         [[maybe_unused]] _FusionCounts& counts)
+{
+    float depth = frame.rawFrame.depths[index];
+
+    // If it's an invalid depth, we don't have to do anything
+    if (depth <= surfelFusionConfiguration.minDepth || depth > surfelFusionConfiguration.maxDepth) {
+#if DETAILED_PBF_MERGE_STATS
+        if (depth <= surfelFusionConfiguration.minDepth) counts.minDepthRejections++;
+        if (depth > surfelFusionConfiguration.maxDepth) counts.maxDepthRejections++;
+#endif
+        return false;
+    }
+
+    float inputConfidence = frame.inputConfidences[index];
+    if (inputConfidence < surfelFusionConfiguration.inputConfidenceThreshold) {
+#if DETAILED_PBF_MERGE_STATS
+        counts.inputConfidenceRejections++;
+#endif
+        return false;
+    }
+
+    const Vector3f incomingPosition = standard_cyborg::toVector3f(frame.positions[index]);
+    const Vector3f incomingNormal =  standard_cyborg::toVector3f(frame.normals[index]);
+    
+    // *Before transforming*, check the angle of incidence since this is much easier
+    // if we don't have to consider transforms here
+
+    // Since the camera is (by definition, at the time of the first frame) fixed at the origin,
+    // the dot product of a surfel's position with its normal defines its angle of incidence
+    // with the camera, allowing to compute the angle of incidence at which it was observed.
+    // The negative makes observed angles positive, for simplicity.
+    float cosAngleOfIncidence = -incomingPosition.dot(incomingNormal) / incomingPosition.norm();
+    
+    if (cosAngleOfIncidence < cosAngleOfIncidenceThreshold) {
+#if DETAILED_PBF_MERGE_STATS
+        counts.angleOfIncidenceRejections++;
+#endif
+        return false;
+    }
+
+    // Scale by the square of the cosine. For no particular reason than because it weights glancing angles
+    // a bit less than simply the cosine.
+    weightOut = cosAngleOfIncidence * cosAngleOfIncidence;
+
+    // Now transform the incoming position into the frame of reference of the surfels
+    // This is really just = extrinsicMatrix * incomingPosition
+    positionOut = Vec3TransformMat4(incomingPosition, extrinsicMatrix);
+    normalOut = extrinsicNormalMatrix * incomingNormal;
+    
+    return true;
+}
+
+// Whether an incoming point is too far from the surfel it landed on to merge into it
+static inline bool _isBeyondMergeRadius(const Vector3f& incomingPosition,
+                                        const Vector3f& surfelPosition,
+                                        float depth,
+                                        float surfelMergeRadiusScaleFactorSquared)
+{
+    Vector3f positionDelta = incomingPosition - surfelPosition;
+
+    // Uncertainty scales with the *square* of depth, so we normalize by the square of
+    // depth in order to get a depth-corrected merge tolerance
+    float depth4 = depth * depth;
+    depth4 *= depth4;
+    
+    float depthCorrectedMergeRadiusFactorSquared = positionDelta.squaredNorm() / depth4;
+
+    return depthCorrectedMergeRadiusFactorSquared > surfelMergeRadiusScaleFactorSquared;
+}
+
+bool SurfelFusion::_drawSurfelIndexLookups(const SurfelStore& surfels, math::Mat4x4 extrinsicMatrix, const RawFrame& rawFrame)
+{
+    const size_t pixelCount = rawFrame.width * rawFrame.height;
+    
+    if (_surfelIndexLookups.size() != pixelCount) {
+        _surfelIndexLookups = std::vector<uint32_t>(pixelCount, 0);
+    }
+    
+    std::fill(_surfelIndexLookups.begin(), _surfelIndexLookups.end(), EMPTY_SURFEL_INDEX);
+    _lookupsArePredrawn = false;
+    
+    return _surfelIndexMap->draw(surfels, toMatrix4f(extrinsicMatrix).inverse(), rawFrame, _surfelIndexLookups);
 }
 
 bool SurfelFusion::doFusion(SurfelFusionConfiguration surfelFusionConfiguration,
                             ProcessedFrame& frame,
-                            Surfels& surfels,
+                            SurfelStore& surfels,
                             math::Mat4x4 extrinsicMatrix,
                             const std::vector<ScreenSpaceLandmark>* screenSpaceLandmarks,
                             SparseSurfelLandmarksIndex& surfelLandmarksIndex,
-                            std::vector<int>& deletedSurfelIndicesList)
+                            SurfelIndexChanges& indexChanges)
 {
     const Eigen::Matrix3f extrinsicNormalMatrix = NormalMatrixFromMat4(toMatrix4f(extrinsicMatrix));
     
@@ -103,244 +293,383 @@ bool SurfelFusion::doFusion(SurfelFusionConfiguration surfelFusionConfiguration,
     // The first step is to render the existing surfel map into the perspective of
     // the incoming depth information. This will allow us to answer the question:
     // does an incoming depth sample land on top of an existing surfel?
+    // estimateNovelty may have just done so from this pose, in which case that's reused.
+    bool lookupsArePredrawn = _lookupsArePredrawn
+        && _predrawnTimestamp == rawFrame.timestamp
+        && _predrawnExtrinsicMatrix == toMatrix4f(extrinsicMatrix)
+        && _surfelIndexLookups.size() == width * height;
+    _lookupsArePredrawn = false;
     
-    if (_surfelIndexLookups.size() != width * height) {
-        _surfelIndexLookups = std::vector<uint32_t>(width * height, 0);
-    }
-    
-    for (int ii = 0; ii < _surfelIndexLookups.size(); ++ii) {
-        _surfelIndexLookups[ii] = EMPTY_SURFEL_INDEX;
-    }
-    
-    bool surfelIndexMapDrawSuccess = _surfelIndexMap->draw(surfels, toMatrix4f(extrinsicMatrix).inverse(), rawFrame, _surfelIndexLookups);
-
-    if (surfelIndexMapDrawSuccess == false) {
-        return false;
+    if (!lookupsArePredrawn) {
+        _lastTimings = SurfelFusionTimings();
+        Stopwatch drawStopwatch;
+        bool surfelIndexMapDrawSuccess = _drawSurfelIndexLookups(surfels, extrinsicMatrix, rawFrame);
+        _lastTimings.surfelIndexMapDrawDuration = drawStopwatch.elapsedSeconds();
+
+        if (surfelIndexMapDrawSuccess == false) {
+            return false;
+        }
     }
 
     // The next step is to iterate through the incoming depths and assimilate the
-    // information.
+    // information. This happens in three parallel passes, which give exactly the same
+    // result as visiting every pixel in row-major order:
     //
-    // The counter is the *next* surfel index that will be written into for new
-    // surfels. It starts at the end of the existing surfels, which means we need
-    // to compress down our representation at each frame to remove any deleted
-    // surfels. Fortunately that's a single sweep through the whole model.
-    size_t assimilatedCount = 0;
-    size_t newCount = 0;
-
-#if DETAILED_PBF_MERGE_STATS
-    size_t angleOfIncidenceRejections = 0;
-    size_t maxDepthRejections = 0;
-    size_t minDepthRejections = 0;
-    size_t inputConfidenceRejections = 0;
-    size_t mergeRadiusRejections = 0;
-    size_t mergeRadiusSuccesses = 0;
-#endif
+    // 1. Each band of rows filters its pixels and transforms them into the model's frame
+    //    of reference. Pixels that landed on an existing surfel are sorted into lists by
+    //    which range of surfel indices the surfel falls in.
+    // 2. Each range of surfels integrates the pixels that landed on it, band by band, so
+    //    every surfel sees its pixels in row-major order and no two threads touch it.
+    //    Pixels too far from their surfel are marked as new instead.
+    // 3. Each band collects its new surfels, and they're numbered in band order. The first
+    //    ones take over the slots of tombstones, in ascending order, and the rest are
+    //    appended after the existing surfels.
+    const size_t pixelCount = width * height;
+    const size_t existingSurfelCount = surfels.size();
+    const size_t tileCount = (height + kFusionTileRows - 1) / kFusionTileRows;
+    const size_t surfelRangeCount = existingSurfelCount == 0 ? 1 : (size_t)std::max(util::TaskScheduler::shared().getWorkerCount(), 1);
+    
+    _incomingPositions.resize(pixelCount);
+    _incomingNormals.resize(pixelCount);
+    _incomingWeights.resize(pixelCount);
+    _createsNewSurfel.assign(pixelCount, 0);
+    _newSurfelOffsets.assign(tileCount + 1, 0);
+    _pixelsBySurfelRange.resize(tileCount * surfelRangeCount);
+    for (std::vector<uint32_t>& pixels : _pixelsBySurfelRange) { pixels.clear(); }
+    _updatedSurfelsByRange.resize(surfelRangeCount);
 
     float cosAngleOfIncidenceThreshold = cos(surfelFusionConfiguration.maxSurfelIncidenceThreshold);
     float surfelMergeRadiusScaleFactorSquared = surfelFusionConfiguration.surfelMergeRadiusScaleFactor * surfelFusionConfiguration.surfelMergeRadiusScaleFactor;
+    const Eigen::Matrix4f extrinsicMatrix4f = toMatrix4f(extrinsicMatrix);
 
-
-    for (size_t row = 0; row < height; row++) {
-        size_t baseIndex = width * row;
-        for (size_t col = 0; col < width; col++) {
-            size_t index = baseIndex + col;
-
-            float depth = rawFrame.depths[index];
-
-            // If it's an invalid depth, we don't have to do anything
-            if (depth <= surfelFusionConfiguration.minDepth || depth > surfelFusionConfiguration.maxDepth) {
-#if DETAILED_PBF_MERGE_STATS
-                if (depth <= surfelFusionConfiguration.minDepth) minDepthRejections++;
-                if (depth > surfelFusionConfiguration.maxDepth) maxDepthRejections++;
-#endif
-                continue;
-            }
-
-            float inputConfidence = frame.inputConfidences[index];
-            if (inputConfidence < surfelFusionConfiguration.inputConfidenceThreshold) {
-#if DETAILED_PBF_MERGE_STATS
-                inputConfidenceRejections++;
-#endif
+    _FusionCounts counts = util::TaskScheduler::shared().parallelReduce(0, height, kFusionTileRows, _FusionCounts(), [&](size_t rowBegin, size_t rowEnd) {
+        _FusionCounts tileCounts;
+        size_t tile = rowBegin / kFusionTileRows;
+        
+        for (size_t index = rowBegin * width; index < rowEnd * width; ++index) {
+            if (!_prepareIncomingPixel(surfelFusionConfiguration, frame, index, cosAngleOfIncidenceThreshold,
+                                       extrinsicMatrix4f, extrinsicNormalMatrix, _incomingWeights[index],
+                                       _incomingPositions[index], _incomingNormals[index], tileCounts)) {
                 continue;
             }
 
             uint32_t surfelIndex = _surfelIndexLookups[index];
-            assert(surfelIndex < surfels.size() || surfelIndex == EMPTY_SURFEL_INDEX);
+            assert(surfelIndex < existingSurfelCount || surfelIndex == EMPTY_SURFEL_INDEX);
 
             // If there's no surfel here, add it
-            const Vector3f incomingPosition = standard_cyborg::toVector3f(frame.positions[index]);
-            const Vector3f incomingNormal =  standard_cyborg::toVector3f(frame.normals[index]);
-            const float incomingSurfelSize = frame.surfelSizes[index];
-            
-            // *Before transforming*, check the angle of incidence since this is much easier
-            // if we don't have to consider transforms here
-
-            // Since the camera is (by definition, at the time of the first frame) fixed at the origin,
-            // the dot product of a surfel's position with its normal defines its angle of incidence
-            // with the camera, allowing to compute the angle of incidence at which it was observed.
-            // The negative makes observed angles positive, for simplicity.
-            float cosAngleOfIncidence = -incomingPosition.dot(incomingNormal) / incomingPosition.norm();
-            
-            if (cosAngleOfIncidence < cosAngleOfIncidenceThreshold) {
-#if DETAILED_PBF_MERGE_STATS
-                angleOfIncidenceRejections++;
-#endif
-                continue;
+            if (surfelIndex == EMPTY_SURFEL_INDEX) {
+                _createsNewSurfel[index] = 1;
+            } else {
+                size_t surfelRange = (size_t)((uint64_t)surfelIndex * surfelRangeCount / existingSurfelCount);
+                _pixelsBySurfelRange[tile * surfelRangeCount + surfelRange].push_back((uint32_t)index);
             }
-
-            // Scale by the square of the cosine. For no particular reason than because it weights glancing angles
-            // a bit less than simply the cosine.
-            float angleWeighting = cosAngleOfIncidence * cosAngleOfIncidence;
-
-            // Now transform the incoming position into the frame of reference of the surfels
-            // This is really just = extrinsicMatrix * incomingPosition
-            Vector3f incomingPositionInModelFrame = Vec3TransformMat4(incomingPosition, toMatrix4f(extrinsicMatrix));
-            Vector3f incomingNormalInModelFrame = extrinsicNormalMatrix * incomingNormal;
-
-            // If the incoming point is too far away from the surfel it landed on, trigger a new surfel creation
-            if (surfelIndex != EMPTY_SURFEL_INDEX) {
-                Surfel& surfel = surfels[surfelIndex];
-                Vector3f positionDelta = incomingPositionInModelFrame - surfel.position;
-
-                // Uncertainty scales with the *square* of depth, so we normalize by the square of
-                // depth in order to get a depth-corrected merge tolerance
-                float depth4 = depth * depth;
-                depth4 *= depth4;
+        }
+        
+        return tileCounts;
+    }, _sumFusionCounts);
+
+    counts = _sumFusionCounts(counts, util::TaskScheduler::shared().parallelReduce(0, surfelRangeCount, 1, _FusionCounts(), [&](size_t rangeBegin, size_t) {
+        _FusionCounts rangeCounts;
+        size_t surfelRange = rangeBegin;
+        std::vector<int>& updatedSurfels = _updatedSurfelsByRange[surfelRange];
+        updatedSurfels.clear();
+        
+        for (size_t tile = 0; tile < tileCount; ++tile) {
+            for (uint32_t index : _pixelsBySurfelRange[tile * surfelRangeCount + surfelRange]) {
+                uint32_t surfelIndex = _surfelIndexLookups[index];
+                float depth = rawFrame.depths[index];
                 
-                float depthCorrectedMergeRadiusFactorSquared = positionDelta.squaredNorm() / depth4;
-
-                if (depthCorrectedMergeRadiusFactorSquared > surfelMergeRadiusScaleFactorSquared) {
+                // If the incoming point is too far away from the surfel it landed on, trigger a new surfel creation
+                if (_isBeyondMergeRadius(_incomingPositions[index], surfels.positions[surfelIndex], depth, surfelMergeRadiusScaleFactorSquared)) {
 #if DETAILED_PBF_MERGE_STATS
-                    mergeRadiusRejections++;
+                    rangeCounts.mergeRadiusRejections++;
 #endif
-                    surfelIndex = EMPTY_SURFEL_INDEX;
-                } else {
+                    _createsNewSurfel[index] = 1;
+                    continue;
+                }
 #if DETAILED_PBF_MERGE_STATS
-                    mergeRadiusSuccesses++;
+                rangeCounts.mergeRadiusSuccesses++;
 #endif
-                }
-            }
 
-            Vector3f incomingColor = standard_cyborg::toVector3f(frame.rawFrame.colors[index]);
-
-            if (surfelIndex == EMPTY_SURFEL_INDEX) {
-                _addValuesAsNewSurfel(incomingPositionInModelFrame,
-                                      incomingNormalInModelFrame,
-                                      incomingColor,
-                                      angleWeighting,
-                                      surfelFusionConfiguration.surfelLifetime,
-                                      incomingSurfelSize,
-                                      surfels);
-                newCount++;
-            } else {
                 _integrateValuesIntoExistingSurfelAtIndex(surfelIndex,
-                                                          incomingPositionInModelFrame,
-                                                          incomingNormalInModelFrame,
+                                                          _incomingPositions[index],
+                                                          _incomingNormals[index],
                                                           1.0,
-                                                          incomingColor,
-                                                          incomingSurfelSize,
-                                                          angleWeighting,
+                                                          standard_cyborg::toVector3f(frame.rawFrame.colors[index]),
+                                                          frame.surfelSizes[index],
+                                                          _incomingWeights[index],
                                                           surfelFusionConfiguration.surfelLifetime,
                                                           surfels);
-                assimilatedCount++;
+                updatedSurfels.push_back((int)surfelIndex);
+                rangeCounts.assimilatedCount++;
             }
         }
+        
+        std::sort(updatedSurfels.begin(), updatedSurfels.end());
+        updatedSurfels.erase(std::unique(updatedSurfels.begin(), updatedSurfels.end()), updatedSurfels.end());
+        
+        return rangeCounts;
+    }, _sumFusionCounts));
+
+    // Count each band's new surfels to find where they go, then write them there
+    util::TaskScheduler::shared().parallelFor(0, tileCount, 1, [&](size_t tileBegin, size_t tileEnd) {
+        for (size_t tile = tileBegin; tile < tileEnd; ++tile) {
+            size_t rowBegin = tile * kFusionTileRows;
+            size_t rowEnd = std::min(height, rowBegin + kFusionTileRows);
+            
+            _newSurfelOffsets[tile + 1] = std::count(_createsNewSurfel.begin() + rowBegin * width,
+                                                     _createsNewSurfel.begin() + rowEnd * width,
+                                                     (uint8_t)1);
+        }
+    });
+    
+    for (size_t tile = 0; tile < tileCount; ++tile) {
+        _newSurfelOffsets[tile + 1] += _newSurfelOffsets[tile];
     }
+    counts.newCount = _newSurfelOffsets[tileCount];
+    
+    // Flush the previous changes without deallocating the memory. This is just a
+    // microoptimization to avoid constantly allocating and deallocating ~4000 element
+    // vectors in favor of just storing the high-water mark and overwriting.
+    indexChanges.clear();
+    
+    // The ranges are in ascending order of surfel index, so they join up in order too
+    for (const std::vector<int>& updatedSurfels : _updatedSurfelsByRange) {
+        indexChanges.updatedSurfelIndices.insert(indexChanges.updatedSurfelIndices.end(), updatedSurfels.begin(), updatedSurfels.end());
+    }
+    
+    const size_t reusedCount = std::min(counts.newCount, surfels.freeSlots.size());
+    const std::vector<int>& freeSlots = surfels.freeSlots;
+    indexChanges.reusedSurfelIndices.assign(freeSlots.begin(), freeSlots.begin() + reusedCount);
+    indexChanges.firstAppendedSurfelIndex = existingSurfelCount;
+    
+    surfels.resize(existingSurfelCount + counts.newCount - reusedCount);
+    
+    util::TaskScheduler::shared().parallelFor(0, tileCount, 1, [&](size_t tileBegin, size_t tileEnd) {
+        for (size_t tile = tileBegin; tile < tileEnd; ++tile) {
+            size_t rowBegin = tile * kFusionTileRows;
+            size_t rowEnd = std::min(height, rowBegin + kFusionTileRows);
+            size_t newSurfelOrdinal = _newSurfelOffsets[tile];
+            
+            for (size_t index = rowBegin * width; index < rowEnd * width; ++index) {
+                if (!_createsNewSurfel[index]) { continue; }
+                
+                size_t surfelIndex = newSurfelOrdinal < reusedCount
+                    ? freeSlots[newSurfelOrdinal]
+                    : existingSurfelCount + newSurfelOrdinal - reusedCount;
+                ++newSurfelOrdinal;
+                
+                surfels.tombstones[surfelIndex] = 0;
+                _setValuesAsNewSurfel(surfelIndex,
+                                      _incomingPositions[index],
+                                      _incomingNormals[index],
+                                      standard_cyborg::toVector3f(frame.rawFrame.colors[index]),
+                                      _incomingWeights[index],
+                                      surfelFusionConfiguration.surfelLifetime,
+                                      frame.surfelSizes[index],
+                                      surfels);
+            }
+        }
+    });
+    
+    surfels.freeSlots.erase(surfels.freeSlots.begin(), surfels.freeSlots.begin() + reusedCount);
 
 
-    if (screenSpaceLandmarks != NULL) {
-        for (auto screenSpaceLandmark : *screenSpaceLandmarks) {
-            // Convert (x, y) in [0, 1] x [0, 1] to a raster image position (row, column)
-            off_t col = std::max(0, std::min((int)(width - 1), (int)(screenSpaceLandmark.x * width)));
-            off_t row = std::max(0, std::min((int)(height - 1), (int)(screenSpaceLandmark.y * height)));
-            off_t index = width * row + col;
-            uint32_t surfelIndex = _surfelIndexLookups[index];
-
-            // If this didn't land on a surfel *as rasterized from the current camera position
-            // estimate but before this frame's surfels were assimilated*, skip it. Please note
-            // this is a *major* simplifying assumption we're making so that we don't have to
-            // re-rasterize the surfels a second time for this frame, after assimilating.
-            if (surfelIndex == EMPTY_SURFEL_INDEX) continue;
-
-            surfelLandmarksIndex.addHit(surfelIndex, screenSpaceLandmark.landmarkId);
-        }
-    }
+    addLandmarkHits(rawFrame, screenSpaceLandmarks, surfelLandmarksIndex);
 
     if (surfelFusionConfiguration.cullLowConfidence) {
-        if (screenSpaceLandmarks == NULL && surfelLandmarksIndex.size() == 0) {
-            this->cullLowConfidence(surfelFusionConfiguration.ignoreLifetime, surfelFusionConfiguration.minCount, surfels);
-        } else {
-            // If there are landmarks, we have to track deleted surfels so we can renumber the
-            // landmarks index.
-
-            // Flush any previously-deleted surfels from this list without deallocating the memory.
-            // This is just a microoptimization to avoid constantly allocating and deallocating a
-            // ~4000 element vector in favor of just storing the high-water mark and overwriting.
-            deletedSurfelIndicesList.clear();
-
-            // Cull low confidence surfels and store the deleted surfels in a list for the sake
-            // of renumbering the surfel landmark index
-            this->cullLowConfidence(surfelFusionConfiguration.ignoreLifetime, surfelFusionConfiguration.minCount, surfels, &deletedSurfelIndicesList);
-
-            // Delete and renumber sparse surfel landmark storage
-            surfelLandmarksIndex.deleteSurfelLandmarksAndRenumber(deletedSurfelIndicesList);
+        Stopwatch cullStopwatch;
+        
+        // Cull low confidence surfels and store the deleted surfels in a list, so that the caller
+        // can follow surfels through the renumbering (e.g. in the ICP target)
+        this->cullLowConfidence(surfelFusionConfiguration.ignoreLifetime, surfelFusionConfiguration.minCount, surfels, &indexChanges.removedSurfelIndices);
+
+        if (surfelLandmarksIndex.size() > 0) {
+            // Tombstones keep the other surfels' indices, so landmarks only need deleting
+            surfelLandmarksIndex.deleteSurfelLandmarks(indexChanges.removedSurfelIndices);
         }
+        
+        compactIfFragmented(surfelFusionConfiguration.maxTombstoneFraction, surfels, surfelLandmarksIndex, indexChanges);
+        
+        _lastTimings.cullingDuration = cullStopwatch.elapsedSeconds();
     }
  
-    // Decay the lifetimes by one step
-    for (auto& surfel : surfels) {
-        surfel.lifetime--;
+    // Decay the lifetimes by one step. Tombstones decay too, which is harmless, since a slot's
+    // lifetime is reset when it's reused.
+    for (uint32_t& lifetime : surfels.lifetimes) {
+        lifetime--;
     }
 
     #if DETAILED_PBF_MERGE_STATS
-        std::cout << "\tsurfel count = " << surfels.size() << std::endl;
+        std::cout << "\tsurfel count = " << surfels.liveCount() << std::endl;
+        std::cout << "\ttombstone count = " << surfels.freeSlots.size() << std::endl;
         std::cout << "\tindex lookup count = " << _surfelIndexLookups.size() << std::endl;
         std::cout << "\tsurfel rejections:\n"
-                  << "\t             min depth:" << minDepthRejections << "\n"
-                  << "\t             max depth:" << maxDepthRejections << "\n"
-                  << "\t    angle of incidence:" << angleOfIncidenceRejections << "\n"
-                  << "\t      input confidence:" << inputConfidenceRejections << "\n"
-                  << "\t          merge radius:" << mergeRadiusRejections << "\n\n"
-                  << "\tmerge radius successes:" << mergeRadiusSuccesses << "\n"
-                  << "\t   assimilated surfels:" << assimilatedCount << "\n"
-                  << "\t           new surfels:" << newCount << std::endl;
+                  << "\t             min depth:" << counts.minDepthRejections << "\n"
+                  << "\t             max depth:" << counts.maxDepthRejections << "\n"
+                  << "\t    angle of incidence:" << counts.angleOfIncidenceRejections << "\n"
+                  << "\t      input confidence:" << counts.inputConfidenceRejections << "\n"
+                  << "\t          merge radius:" << counts.mergeRadiusRejections << "\n\n"
+                  << "\tmerge radius successes:" << counts.mergeRadiusSuccesses << "\n"
+                  << "\t   assimilated surfels:" << counts.assimilatedCount << "\n"
+                  << "\t           new surfels:" << counts.newCount << std::endl;
     #endif
     
     return true;
 }
 
 void SurfelFusion::finish(SurfelFusionConfiguration surfelFusionConfiguration,
-                          Surfels& surfels,
+                          SurfelStore& surfels,
                           SparseSurfelLandmarksIndex& surfelLandmarksIndex,
-                          std::vector<int>& deletedSurfelIndicesList)
+                          SurfelIndexChanges& indexChanges)
 {
-    size_t preCulledCount = surfels.size();
+    size_t preCulledCount = surfels.liveCount();
+    
+    // As in doFusion, reuse the lists' memory
+    indexChanges.clear();
+    indexChanges.firstAppendedSurfelIndex = surfels.size();
     
     if (surfelFusionConfiguration.cullLowConfidence) {
-        if (surfelLandmarksIndex.size() == 0) {
-            this->cullLowConfidence(true, surfelFusionConfiguration.minCount, surfels);
-        } else {
-            // If there are landmarks, we have to track deleted surfels so we can renumber the
-            // landmarks index.
-            
-            // Flush any previously-deleted surfels from this list without deallocating the memory.
-            // This is just a microoptimization to avoid constantly allocating and deallocating a
-            // ~4000 element vector in favor of just storing the high-water mark and overwriting.
-            deletedSurfelIndicesList.clear();
-            
-            // Cull low confidence surfels and store the deleted surfels in a list for the sake
-            // of renumbering the surfel landmark index
-            this->cullLowConfidence(true, surfelFusionConfiguration.minCount, surfels, &deletedSurfelIndicesList);
-            
-            // Delete and renumber sparse surfel landmark storage
-            surfelLandmarksIndex.deleteSurfelLandmarksAndRenumber(deletedSurfelIndicesList);
+        this->cullLowConfidence(true, surfelFusionConfiguration.minCount, surfels, &indexChanges.removedSurfelIndices);
+        
+        if (surfelLandmarksIndex.size() > 0) {
+            surfelLandmarksIndex.deleteSurfelLandmarks(indexChanges.removedSurfelIndices);
         }
     }
     
+    compact(surfels, surfelLandmarksIndex, indexChanges);
+    
     size_t postCulledCount = surfels.size();
     
     DEBUG_LOG("Culled %lu points from the last %d frames; %zu remain",
               preCulledCount - postCulledCount, surfelFusionConfiguration.surfelLifetime, postCulledCount);
     
 }
+
+bool SurfelFusion::estimateNovelty(SurfelFusionConfiguration surfelFusionConfiguration,
+                                   const ProcessedFrame& frame,
+                                   const SurfelStore& surfels,
+                                   math::Mat4x4 extrinsicMatrix,
+                                   float& noveltyOut)
+{
+    const RawFrame& rawFrame = frame.rawFrame;
+    const size_t width = rawFrame.width;
+    const size_t height = rawFrame.height;
+    
+    _lastTimings = SurfelFusionTimings();
+    Stopwatch drawStopwatch;
+    bool surfelIndexMapDrawSuccess = _drawSurfelIndexLookups(surfels, extrinsicMatrix, rawFrame);
+    _lastTimings.surfelIndexMapDrawDuration = drawStopwatch.elapsedSeconds();
+    
+    if (surfelIndexMapDrawSuccess == false) {
+        return false;
+    }
+    
+    _lookupsArePredrawn = true;
+    _predrawnTimestamp = rawFrame.timestamp;
+    _predrawnExtrinsicMatrix = toMatrix4f(extrinsicMatrix);
+    
+    // Apply the same tests as doFusion, without changing anything, and count the pixels
+    // that would merge into a surfel and the ones that would become new surfels
+    const Eigen::Matrix4f extrinsicMatrix4f = toMatrix4f(extrinsicMatrix);
+    const Eigen::Matrix3f extrinsicNormalMatrix = NormalMatrixFromMat4(extrinsicMatrix4f);
+    float cosAngleOfIncidenceThreshold = cos(surfelFusionConfiguration.maxSurfelIncidenceThreshold);
+    float surfelMergeRadiusScaleFactorSquared = surfelFusionConfiguration.surfelMergeRadiusScaleFactor * surfelFusionConfiguration.surfelMergeRadiusScaleFactor;
+    
+    _FusionCounts counts = util::TaskScheduler::shared().parallelReduce(0, height, kFusionTileRows, _FusionCounts(), [&](size_t rowBegin, size_t rowEnd) {
+        _FusionCounts tileCounts;
+        
+        for (size_t index = rowBegin * width; index < rowEnd * width; ++index) {
+            float weight;
+            Vector3f position, normal;
+            if (!_prepareIncomingPixel(surfelFusionConfiguration, frame, index, cosAngleOfIncidenceThreshold,
+                                       extrinsicMatrix4f, extrinsicNormalMatrix, weight, position, normal, tileCounts)) {
+                continue;
+            }
+            
+            uint32_t surfelIndex = _surfelIndexLookups[index];
+            
+            if (surfelIndex == EMPTY_SURFEL_INDEX
+                || _isBeyondMergeRadius(position, surfels.positions[surfelIndex], rawFrame.depths[index], surfelMergeRadiusScaleFactorSquared))
+            {
+                tileCounts.newCount++;
+            } else {
+                tileCounts.assimilatedCount++;
+            }
+        }
+        
+        return tileCounts;
+    }, _sumFusionCounts);
+    
+    size_t usableCount = counts.newCount + counts.assimilatedCount;
+    noveltyOut = usableCount == 0 ? 0 : (float)counts.newCount / usableCount;
+    
+    return true;
+}
+
+void SurfelFusion::addLandmarkHits(const RawFrame& rawFrame,
+                                   const std::vector<ScreenSpaceLandmark>* screenSpaceLandmarks,
+                                   SparseSurfelLandmarksIndex& surfelLandmarksIndex)
+{
+    if (screenSpaceLandmarks == NULL) { return; }
+    
+    const size_t width = rawFrame.width;
+    const size_t height = rawFrame.height;
+    if (_surfelIndexLookups.size() != width * height) { return; }
+    
+    for (auto screenSpaceLandmark : *screenSpaceLandmarks) {
+        // Convert (x, y) in [0, 1] x [0, 1] to a raster image position (row, column)
+        off_t col = std::max(0, std::min((int)(width - 1), (int)(screenSpaceLandmark.x * width)));
+        off_t row = std::max(0, std::min((int)(height - 1), (int)(screenSpaceLandmark.y * height)));
+        off_t index = width * row + col;
+        uint32_t surfelIndex = _surfelIndexLookups[index];
+
+        // If this didn't land on a surfel *as rasterized from the current camera position
+        // estimate but before this frame's surfels were assimilated*, skip it. Please note
+        // this is a *major* simplifying assumption we're making so that we don't have to
+        // re-rasterize the surfels a second time for this frame, after assimilating.
+        if (surfelIndex == EMPTY_SURFEL_INDEX) continue;
+
+        surfelLandmarksIndex.addHit(surfelIndex, screenSpaceLandmark.landmarkId);
+    }
+}
+
+bool SurfelFusion::drawICPTarget(const SurfelStore& surfels,
+                                 math::Mat4x4 extrinsicMatrix,
+                                 const RawFrame& rawFrame,
+                                 ICPProjectiveTarget& targetOut)
+{
+    const size_t width = rawFrame.width;
+    const size_t height = rawFrame.height;
+    
+    if (!_drawSurfelIndexLookups(surfels, extrinsicMatrix, rawFrame)) {
+        return false;
+    }
+    
+    targetOut.width = width;
+    targetOut.height = height;
+    targetOut.positions.resize(width * height);
+    targetOut.normals.resize(width * height);
+    targetOut.coverage.resize(width * height);
+    targetOut.viewProjectionMatrix = _surfelIndexMap->getViewProjectionMatrix();
+    targetOut.lensCalibration = LensCalibration::inverse(rawFrame.camera);
+    targetOut.applyLensCalibration = true;
+    
+    util::TaskScheduler::shared().parallelFor(0, height, 0, [&](size_t rowBegin, size_t rowEnd) {
+        for (size_t index = rowBegin * width; index < rowEnd * width; ++index) {
+            uint32_t surfelIndex = _surfelIndexLookups[index];
+            
+            if (surfelIndex == EMPTY_SURFEL_INDEX) {
+                targetOut.positions[index] = math::Vec3();
+                targetOut.normals[index] = math::Vec3();
+                targetOut.coverage[index] = 0;
+            } else {
+                targetOut.positions[index] = toVec3(surfels.positions[surfelIndex]);
+                targetOut.normals[index] = toVec3(surfels.normals[surfelIndex]);
+                targetOut.coverage[index] = 1;
+            }
+        }
+    });
+    
+    return true;
+}
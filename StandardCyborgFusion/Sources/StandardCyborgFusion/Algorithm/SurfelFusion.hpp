@@ -10,9 +10,11 @@
 
 #import "SurfelIndexMap.hpp"
 
+#import "ICPProjectiveTarget.hpp"
 #import "ProcessedFrame.hpp"
 #import "ScreenSpaceLandmark.hpp"
 #import "SparseSurfelLandmarksIndex.hpp"
+#import "SurfelStore.hpp"
 
 struct SurfelFusionConfiguration {
     float maxSurfelIncidenceThreshold = (70 * M_PI / 180);
@@ -24,22 +26,83 @@ struct SurfelFusionConfiguration {
     int minCount = 6;
     int surfelLifetime = 20;
     bool ignoreLifetime = false;
+    // Culled surfels are left as tombstones until they make up more than this fraction of
+    // the surfels, then compacted away all at once. Zero compacts after every cull.
+    float maxTombstoneFraction = 0.25;
+};
+
+// How long the stages of doFusion that aren't fusion itself took, in seconds
+struct SurfelFusionTimings {
+    double surfelIndexMapDrawDuration = 0;
+    double cullingDuration = 0;
 };
 
 class SurfelFusion {
 public:
     SurfelFusion(std::shared_ptr<SurfelIndexMap> surfelIndexMap);
 
-    bool doFusion(SurfelFusionConfiguration surfelFusionConfiguration, ProcessedFrame& frame, Surfels& surfels, math::Mat4x4 extrinsicMatrix, const std::vector<ScreenSpaceLandmark>* screenSpaceLandmarks, SparseSurfelLandmarksIndex& _surfelLandmarksIndex, std::vector<int>& deletedSurfelIndicesList);
+    // Fuses the frame into the surfels, then culls. New surfels fill the slots of tombstones
+    // first, in ascending order, and the rest are appended. Culled surfels become tombstones,
+    // which are compacted away once there are too many of them. indexChanges describes
+    // all of this, so that the caller can follow surfels through it.
+    bool doFusion(SurfelFusionConfiguration surfelFusionConfiguration, ProcessedFrame& frame, SurfelStore& surfels, math::Mat4x4 extrinsicMatrix, const std::vector<ScreenSpaceLandmark>* screenSpaceLandmarks, SparseSurfelLandmarksIndex& _surfelLandmarksIndex, SurfelIndexChanges& indexChanges);
     
-    void finish(SurfelFusionConfiguration surfelFusionConfiguration, Surfels& surfels, SparseSurfelLandmarksIndex& surfelLandmarksIndex, std::vector<int>& deletedSurfelIndicesList);
+    // Culls regardless of lifetime, then compacts
+    void finish(SurfelFusionConfiguration surfelFusionConfiguration, SurfelStore& surfels, SparseSurfelLandmarksIndex& surfelLandmarksIndex, SurfelIndexChanges& indexChanges);
+
+    // Compacts away any tombstones, renumbering the landmarks to match
+    void compact(SurfelStore& surfels, SparseSurfelLandmarksIndex& surfelLandmarksIndex, SurfelIndexChanges& indexChanges);
 
+    // Compacts only if tombstones make up more than maxTombstoneFraction of the surfels
+    void compactIfFragmented(float maxTombstoneFraction, SurfelStore& surfels, SparseSurfelLandmarksIndex& surfelLandmarksIndex, SurfelIndexChanges& indexChanges);
+
+    // Renders the surfels from the given camera pose into a vertex and normal map, for finding
+    // projective correspondences in ICP. This reuses the surfel index map, so the lookups are
+    // overwritten until the next call to doFusion.
+    bool drawICPTarget(const SurfelStore& surfels, math::Mat4x4 extrinsicMatrix, const RawFrame& rawFrame, ICPProjectiveTarget& targetOut);
+
+    // Estimates how much of the frame is new to the model: the fraction of the pixels doFusion
+    // would use that would create a surfel rather than merge into one, or zero if it would use
+    // none. It applies doFusion's own tests to the surfels as they are, so it only differs where
+    // a surfel that several pixels land on moves as they merge into it. If the surfels don't
+    // change in between, a doFusion of the same frame from the same pose reuses the surfel index
+    // map drawn for this.
+    bool estimateNovelty(SurfelFusionConfiguration surfelFusionConfiguration, const ProcessedFrame& frame, const SurfelStore& surfels, math::Mat4x4 extrinsicMatrix, float& noveltyOut);
+    
+    // Records which surfels the landmarks landed on, from the surfel index map drawn by the
+    // last call to doFusion or estimateNovelty. doFusion already does this for the frames it fuses.
+    void addLandmarkHits(const RawFrame& rawFrame, const std::vector<ScreenSpaceLandmark>* screenSpaceLandmarks, SparseSurfelLandmarksIndex& surfelLandmarksIndex);
+    
     const std::vector<uint32_t>& getSurfelIndexLookups()const;
     
+    // The timings of the last call to doFusion or estimateNovelty
+    const SurfelFusionTimings& getLastTimings() const;
+    
 private:
-    void cullLowConfidence(bool ignoreLifetime, int minWeight, Surfels& surfels, std::vector<int>* deletedSurfelList =NULL  );
+    void cullLowConfidence(bool ignoreLifetime, int minWeight, SurfelStore& surfels, std::vector<int>* deletedSurfelList =NULL  );
+    
+    // Clears the lookups and draws the surfels into them from the given pose
+    bool _drawSurfelIndexLookups(const SurfelStore& surfels, math::Mat4x4 extrinsicMatrix, const RawFrame& rawFrame);
     
     std::shared_ptr<SurfelIndexMap> _surfelIndexMap;
     std::vector<uint32_t> _surfelIndexLookups;
+    SurfelFusionTimings _lastTimings;
+    
+    // Whether the lookups were drawn by estimateNovelty, and for which frame and pose
+    bool _lookupsArePredrawn = false;
+    double _predrawnTimestamp = 0;
+    Eigen::Matrix4f _predrawnExtrinsicMatrix;
+    
+    // Per-pixel scratch for doFusion, kept between frames to avoid reallocating
+    std::vector<Vector3f> _incomingPositions;
+    std::vector<Vector3f> _incomingNormals;
+    std::vector<float> _incomingWeights;
+    std::vector<uint8_t> _createsNewSurfel;
+    std::vector<size_t> _newSurfelOffsets;
+    std::vector<std::vector<uint32_t>> _pixelsBySurfelRange;
+    std::vector<std::vector<int>> _updatedSurfelsByRange;
+    
+    // Where each block's culled indices go in the list, for cullLowConfidence
+    std::vector<size_t> _culledSurfelOffsets;
 };
 #endif /* SurfelFusion_hpp */
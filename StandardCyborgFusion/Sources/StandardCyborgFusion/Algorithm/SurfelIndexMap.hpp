@@ -10,6 +10,7 @@
 #import "EigenHelpers.hpp"
 #import "RawFrame.hpp"
 #import "Surfel.hpp"
+#import "SurfelStore.hpp"
 #import <vector>
 
 class SurfelIndexMap {
@@ -19,6 +20,13 @@ public:
                       const RawFrame& rawFrame,
                       std::vector<uint32_t>& indexLookups) = 0;
     
+    // Draws every slot of the store, so the indices written match its slots. Tombstones
+    // don't draw anything.
+    virtual bool draw(const SurfelStore& surfels,
+                      const Eigen::Matrix4f& modelMatrix,
+                      const RawFrame& rawFrame,
+                      std::vector<uint32_t>& indexLookups) = 0;
+    
     virtual bool drawForColor(const Surfel* surfels,
                               size_t surfelCount,
                               Eigen::Matrix4f viewProjectionMatrix,
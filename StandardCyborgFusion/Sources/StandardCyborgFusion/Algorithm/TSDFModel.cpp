@@ -0,0 +1,70 @@
+//
+//  TSDFModel.cpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import "Stopwatch.hpp"
+#import "TSDFModel.hpp"
+
+TSDFModel::TSDFModel(std::shared_ptr<SurfelIndexMap> surfelIndexMap,
+                     TSDFConfiguration tsdfConfig,
+                     unsigned int randomSeed) :
+    _trackingModel(surfelIndexMap, randomSeed),
+    _volume(tsdfConfig)
+{ }
+
+PBFAssimilatedFrameMetadata TSDFModel::assimilate(ProcessedFrame& frame,
+                                                  PBFConfiguration pbfConfig,
+                                                  ICPConfiguration icpConfig,
+                                                  SurfelFusionConfiguration surfelFusionConfiguration,
+                                                  double currentTime,
+                                                  const std::vector<ScreenSpaceLandmark>* screenSpaceLandmarks)
+{
+    PBFAssimilatedFrameMetadata frameMeta = _trackingModel.assimilate(frame,
+                                                                      pbfConfig,
+                                                                      icpConfig,
+                                                                      surfelFusionConfiguration,
+                                                                      currentTime,
+                                                                      screenSpaceLandmarks);
+    
+    if (frameMeta.isMerged) {
+        Stopwatch stopwatch;
+        // The view matrix is the pose the frame was merged with
+        _volume.integrate(frame, frameMeta.viewMatrix, surfelFusionConfiguration);
+
+        // The tracking model keeps its own copy of the metadata for the final statistics
+        double integrationDuration = stopwatch.lap();
+        frameMeta.fusionDuration += integrationDuration;
+        _trackingModel.addFusionDuration(integrationDuration);
+    }
+    
+    return frameMeta;
+}
+
+PBFFinalStatistics TSDFModel::finishAssimilating(SurfelFusionConfiguration surfelFusionConfiguration)
+{
+    return _trackingModel.finishAssimilating(surfelFusionConfiguration);
+}
+
+void TSDFModel::reset(unsigned int randomSeed)
+{
+    _trackingModel.reset(randomSeed);
+    _volume.reset();
+}
+
+std::shared_ptr<sc3d::Geometry> TSDFModel::buildMesh()
+{
+    return _volume.extractMesh();
+}
+
+const TSDFVolume& TSDFModel::getVolume() const
+{
+    return _volume;
+}
+
+const PBFModel& TSDFModel::getTrackingModel() const
+{
+    return _trackingModel;
+}
@@ -0,0 +1,72 @@
+//
+//  TSDFModel.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <memory>
+#import <vector>
+
+#import <standard_cyborg/sc3d/Geometry.hpp>
+
+#import <StandardCyborgFusion/PBFFinalStatistics.h>
+
+#import "ICP.hpp"
+#import "PBFAssimilatedFrameMetadata.hpp"
+#import "PBFConfiguration.hpp"
+#import "PBFModel.hpp"
+#import "ProcessedFrame.hpp"
+#import "ScreenSpaceLandmark.hpp"
+#import "SurfelFusion.hpp"
+#import "SurfelIndexMap.hpp"
+#import "TSDFVolume.hpp"
+
+/** Fuses frames into a TSDFVolume instead of keeping surfels as the result, so a mesh can be
+ *  extracted at any point without a separate surface reconstruction step. Takes the same
+ *  frames and configurations as PBFModel. ICP still aligns each frame against a surfel
+ *  model, which this keeps alongside the volume, and every frame that model merges is
+ *  integrated into the volume with the pose it was merged with.
+ *
+ *  So this doesn't save any work over PBFModel: the tracking model still fuses every frame
+ *  into its surfels, and integrating into the volume comes on top of that.
+ */
+class TSDFModel {
+public:
+    TSDFModel(std::shared_ptr<SurfelIndexMap> surfelIndexMap,
+              TSDFConfiguration tsdfConfig = TSDFConfiguration(),
+              unsigned int randomSeed = 0);
+
+    /** Integrating the frame into the volume is timed as part of its fusionDuration, both in
+     *  the metadata returned and in the final statistics */
+    PBFAssimilatedFrameMetadata assimilate(ProcessedFrame& frame,
+                                           PBFConfiguration pbfConfig,
+                                           ICPConfiguration icpConfig,
+                                           SurfelFusionConfiguration surfelFusionConfiguration,
+                                           double currentTime,
+                                           const std::vector<ScreenSpaceLandmark>* screenSpaceLandmarks = NULL);
+
+    PBFFinalStatistics finishAssimilating(SurfelFusionConfiguration surfelFusionConfiguration);
+
+    void reset(unsigned int randomSeed = 0);
+
+    /** A mesh of the volume so far. Only the parts that changed since the last one are
+     *  remeshed and restitched, so calling this as frames come in costs about as much as the
+     *  frames added, plus a copy of the whole mesh into the returned geometry. */
+    std::shared_ptr<sc3d::Geometry> buildMesh();
+
+    const TSDFVolume& getVolume() const;
+
+    /** The surfel model frames are aligned against */
+    const PBFModel& getTrackingModel() const;
+
+private:
+    PBFModel _trackingModel;
+    TSDFVolume _volume;
+
+    // Prohibit copying and assignment
+    TSDFModel(const TSDFModel&) = delete;
+    TSDFModel& operator=(const TSDFModel&) = delete;
+};
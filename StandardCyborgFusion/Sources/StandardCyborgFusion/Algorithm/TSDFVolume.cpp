@@ -0,0 +1,620 @@
+//
+//  TSDFVolume.cpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <algorithm>
+#import <cmath>
+
+#import <standard_cyborg/util/DataUtils.hpp>
+#import <standard_cyborg/util/TaskScheduler.hpp>
+
+#import "FiniteMath.hpp"
+#import "TSDFVolume.hpp"
+
+using namespace Eigen;
+
+namespace {
+
+// The corner, edge and triangle tables for marching cubes. Corners are numbered as
+// (0,0,0), (1,0,0), (1,1,0), (0,1,0), (0,0,1), (1,0,1), (1,1,1), (0,1,1).
+#include <igl/marching_cubes_tables.h>
+
+static const int kCornerOffsets[8][3] = {
+    { 0, 0, 0 }, { 1, 0, 0 }, { 1, 1, 0 }, { 0, 1, 0 },
+    { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 },
+};
+
+} // namespace
+
+// Each block coordinate gets 21 bits of a key, centered on the origin
+static const int kBlockCoordinateBits = 21;
+static const int64_t kBlockCoordinateOffset = 1 << (kBlockCoordinateBits - 1);
+static const uint64_t kBlockCoordinateMask = (1 << kBlockCoordinateBits) - 1;
+
+// Each voxel coordinate gets 20 bits of an edge key, with the edge's axis in the bottom two
+static const int kVoxelCoordinateBits = 20;
+static const int64_t kVoxelCoordinateOffset = 1 << (kVoxelCoordinateBits - 1);
+static const uint64_t kVoxelCoordinateMask = (1 << kVoxelCoordinateBits) - 1;
+
+// Rows of pixels per work item when finding the blocks a frame touches
+static const size_t kRowsPerBand = 8;
+
+static const int kVoxelsPerBlock = TSDFVolume::BlockSize * TSDFVolume::BlockSize * TSDFVolume::BlockSize;
+
+static inline int _voxelIndex(int i, int j, int k)
+{
+    return i + TSDFVolume::BlockSize * (j + TSDFVolume::BlockSize * k);
+}
+
+// Rounds towards negative infinity, so that negative voxel coordinates land in the right block
+static inline int _floorDivide(int numerator, int denominator)
+{
+    return numerator >= 0 ? numerator / denominator : -((-numerator + denominator - 1) / denominator);
+}
+
+static inline uint64_t _edgeKey(int i, int j, int k, int axis)
+{
+    uint64_t x = (uint64_t)(i + kVoxelCoordinateOffset) & kVoxelCoordinateMask;
+    uint64_t y = (uint64_t)(j + kVoxelCoordinateOffset) & kVoxelCoordinateMask;
+    uint64_t z = (uint64_t)(k + kVoxelCoordinateOffset) & kVoxelCoordinateMask;
+
+    return (((x << kVoxelCoordinateBits | y) << kVoxelCoordinateBits | z) << 2) | (uint64_t)axis;
+}
+
+// The same depth and confidence filtering as surfel fusion
+static inline bool _isUsablePixel(const ProcessedFrame& frame, size_t index, const SurfelFusionConfiguration& surfelFusionConfiguration)
+{
+    // NaN positions would reach the (int) casts when finding blocks, and -ffast-math may drop
+    // the depth comparisons below as a way of rejecting them
+    const math::Vec3& position = frame.positions[index];
+    if (!isFiniteFloat(position.x) || !isFiniteFloat(position.y) || !isFiniteFloat(position.z)) { return false; }
+
+    float depth = frame.rawFrame.depths[index];
+    if (!(depth > surfelFusionConfiguration.minDepth && depth <= surfelFusionConfiguration.maxDepth)) { return false; }
+
+    return frame.inputConfidences[index] >= surfelFusionConfiguration.inputConfidenceThreshold;
+}
+
+TSDFVolume::TSDFVolume(TSDFConfiguration config) :
+    _config(config)
+{ }
+
+void TSDFVolume::integrate(const ProcessedFrame& frame,
+                           const Matrix4f& extrinsicMatrix,
+                           const SurfelFusionConfiguration& surfelFusionConfiguration)
+{
+    const RawFrame& rawFrame = frame.rawFrame;
+    const size_t width = rawFrame.width;
+    const size_t height = rawFrame.height;
+    if (width == 0 || height == 0) { return; }
+
+    standard_cyborg::util::TaskScheduler& scheduler = standard_cyborg::util::TaskScheduler::shared();
+
+    const float inverseBlockLength = 1.0f / (_config.voxelSize * BlockSize);
+    const float truncationDistance = _config.truncationDistance;
+    // The camera sits at the origin of its own frame of reference
+    const Vector3f cameraPosition = extrinsicMatrix.col(3).head<3>();
+
+    // Find the blocks within the truncation distance of each point, along its ray,
+    // a band of rows at a time
+    const size_t bandCount = (height + kRowsPerBand - 1) / kRowsPerBand;
+    _bandBlockKeys.resize(bandCount);
+
+    scheduler.parallelFor(0, bandCount, 1, [&](size_t bandBegin, size_t bandEnd) {
+        for (size_t band = bandBegin; band < bandEnd; ++band) {
+            std::vector<uint64_t>& blockKeys = _bandBlockKeys[band];
+            blockKeys.clear();
+
+            size_t rowEnd = std::min(height, (band + 1) * kRowsPerBand);
+            for (size_t index = band * kRowsPerBand * width; index < rowEnd * width; ++index) {
+                if (!_isUsablePixel(frame, index, surfelFusionConfiguration)) { continue; }
+
+                const math::Vec3& position = frame.positions[index];
+                Vector3f point = (extrinsicMatrix * Vector4f(position.x, position.y, position.z, 1)).head<3>();
+                Vector3f ray = (point - cameraPosition).normalized();
+
+                _appendBlocksAlongSegment((point - truncationDistance * ray) * inverseBlockLength,
+                                          (point + truncationDistance * ray) * inverseBlockLength,
+                                          blockKeys);
+            }
+
+            std::sort(blockKeys.begin(), blockKeys.end());
+            blockKeys.erase(std::unique(blockKeys.begin(), blockKeys.end()), blockKeys.end());
+        }
+    });
+
+    // Allocate them in band order, so that blocks are numbered the same way every time
+    _frameBlockIndices.clear();
+    for (const std::vector<uint64_t>& blockKeys : _bandBlockKeys) {
+        for (uint64_t key : blockKeys) {
+            _frameBlockIndices.push_back(_findOrAllocateBlock(key));
+        }
+    }
+    std::sort(_frameBlockIndices.begin(), _frameBlockIndices.end());
+    _frameBlockIndices.erase(std::unique(_frameBlockIndices.begin(), _frameBlockIndices.end()), _frameBlockIndices.end());
+
+    // Blocks don't share voxels, so they can all be updated at once
+    Matrix4f modelMatrix = extrinsicMatrix.inverse();
+    Matrix4f projectionViewMatrix = toMatrix4f(rawFrame.camera.getProjectionViewMatrix()) * modelMatrix;
+    LensCalibration lensCalibration = LensCalibration::inverse(rawFrame.camera);
+
+    scheduler.parallelFor(0, _frameBlockIndices.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            _integrateBlock(*_blocks[_frameBlockIndices[i]], frame, projectionViewMatrix, modelMatrix, lensCalibration, surfelFusionConfiguration);
+        }
+    });
+
+    // A block's cells reach into the blocks after it along each axis, so the blocks
+    // before each updated one need remeshing too
+    for (uint32_t blockIndex : _frameBlockIndices) {
+        const Block& block = *_blocks[blockIndex];
+
+        for (int dz = -1; dz <= 0; ++dz) {
+            for (int dy = -1; dy <= 0; ++dy) {
+                for (int dx = -1; dx <= 0; ++dx) {
+                    Block* neighbor = const_cast<Block*>(_findBlock(block.x + dx, block.y + dy, block.z + dz));
+                    if (neighbor != nullptr) { neighbor->isDirty = true; }
+                }
+            }
+        }
+    }
+}
+
+std::shared_ptr<sc3d::Geometry> TSDFVolume::extractMesh()
+{
+    _blockMeshes.resize(_blocks.size());
+
+    _dirtyBlockIndices.clear();
+    for (uint32_t blockIndex = 0; blockIndex < _blocks.size(); ++blockIndex) {
+        if (_blocks[blockIndex]->isDirty) { _dirtyBlockIndices.push_back(blockIndex); }
+    }
+
+    for (uint32_t blockIndex : _dirtyBlockIndices) {
+        _unstitchBlockMesh(_blockMeshes[blockIndex]);
+    }
+
+    standard_cyborg::util::TaskScheduler::shared().parallelFor(0, _dirtyBlockIndices.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            uint32_t blockIndex = _dirtyBlockIndices[i];
+            _meshBlock(*_blocks[blockIndex], _blockMeshes[blockIndex]);
+            _blocks[blockIndex]->isDirty = false;
+        }
+    });
+
+    for (uint32_t blockIndex : _dirtyBlockIndices) {
+        _stitchBlockMesh(_blockMeshes[blockIndex]);
+    }
+
+    _updateTouchedNormals();
+
+    // Copy out the stitched vertices in the order the blocks first use them, which is the
+    // same order stitching every block from scratch would give
+    size_t vertexCount = _stitchedVertices.size() - _freeStitchedVertexIndices.size();
+    size_t faceCount = 0;
+    for (const BlockMesh& blockMesh : _blockMeshes) {
+        faceCount += blockMesh.faces.size();
+    }
+
+    std::vector<math::Vec3> positions;
+    std::vector<math::Vec3> normals;
+    std::vector<math::Vec3> colors;
+    std::vector<sc3d::Face3> faces;
+    positions.reserve(vertexCount);
+    normals.reserve(vertexCount);
+    colors.reserve(vertexCount);
+    faces.reserve(faceCount);
+
+    _outputVertexIndices.assign(_stitchedVertices.size(), -1);
+
+    for (const BlockMesh& blockMesh : _blockMeshes) {
+        _blockOutputVertexIndices.resize(blockMesh.stitchedVertexIndices.size());
+
+        for (size_t i = 0; i < blockMesh.stitchedVertexIndices.size(); ++i) {
+            uint32_t stitchedVertexIndex = blockMesh.stitchedVertexIndices[i];
+            int& outputVertexIndex = _outputVertexIndices[stitchedVertexIndex];
+
+            if (outputVertexIndex < 0) {
+                const StitchedVertex& vertex = _stitchedVertices[stitchedVertexIndex];
+                math::Vec3 normal = vertex.normalSum;
+                // Vertices only on degenerate faces are left without a normal
+                if (normal.norm() > 0) { normal.normalize(); }
+
+                outputVertexIndex = (int)positions.size();
+                positions.push_back(vertex.position);
+                normals.push_back(normal);
+                colors.push_back(vertex.color);
+            }
+            _blockOutputVertexIndices[i] = outputVertexIndex;
+        }
+
+        for (const sc3d::Face3& face : blockMesh.faces) {
+            faces.push_back(sc3d::Face3(_blockOutputVertexIndices[face[0]], _blockOutputVertexIndices[face[1]], _blockOutputVertexIndices[face[2]]));
+        }
+    }
+
+    return std::make_shared<sc3d::Geometry>(positions, normals, colors, faces);
+}
+
+void TSDFVolume::reset()
+{
+    _blockIndicesByKey.clear();
+    _blocks.clear();
+    _blockMeshes.clear();
+    _stitchedVertexIndicesByEdgeKey.clear();
+    _stitchedVertices.clear();
+    _freeStitchedVertexIndices.clear();
+    _stitchedVertexIsTouched.clear();
+    _touchedStitchedVertexIndices.clear();
+}
+
+const TSDFConfiguration& TSDFVolume::getConfiguration() const
+{
+    return _config;
+}
+
+size_t TSDFVolume::blockCount() const
+{
+    return _blocks.size();
+}
+
+const TSDFVolume::Voxel* TSDFVolume::voxelAt(int i, int j, int k) const
+{
+    int blockX = _floorDivide(i, BlockSize);
+    int blockY = _floorDivide(j, BlockSize);
+    int blockZ = _floorDivide(k, BlockSize);
+
+    const Block* block = _findBlock(blockX, blockY, blockZ);
+    if (block == nullptr) { return nullptr; }
+
+    return &block->voxels[_voxelIndex(i - blockX * BlockSize, j - blockY * BlockSize, k - blockZ * BlockSize)];
+}
+
+// MARK: - Private
+
+uint64_t TSDFVolume::_blockKey(int x, int y, int z)
+{
+    uint64_t packedX = (uint64_t)(x + kBlockCoordinateOffset) & kBlockCoordinateMask;
+    uint64_t packedY = (uint64_t)(y + kBlockCoordinateOffset) & kBlockCoordinateMask;
+    uint64_t packedZ = (uint64_t)(z + kBlockCoordinateOffset) & kBlockCoordinateMask;
+
+    return (packedX << kBlockCoordinateBits | packedY) << kBlockCoordinateBits | packedZ;
+}
+
+void TSDFVolume::_appendBlocksAlongSegment(const Vector3f& start, const Vector3f& end, std::vector<uint64_t>& blockKeys)
+{
+    int cell[3];
+    int step[3];
+    int remainingSteps[3];
+    float nextCrossing[3];
+    float crossingSpacing[3];
+
+    for (int axis = 0; axis < 3; ++axis) {
+        cell[axis] = (int)std::floor(start[axis]);
+        int endCell = (int)std::floor(end[axis]);
+        float delta = end[axis] - start[axis];
+
+        step[axis] = endCell >= cell[axis] ? 1 : -1;
+        remainingSteps[axis] = std::abs(endCell - cell[axis]);
+
+        // Both are fractions of the segment. Axes that never cross a face aren't stepped along,
+        // so their values don't matter, as long as they stay finite.
+        float distanceToFace = step[axis] > 0 ? cell[axis] + 1 - start[axis] : start[axis] - cell[axis];
+        float absoluteDelta = std::max(std::abs(delta), 1e-12f);
+        nextCrossing[axis] = distanceToFace / absoluteDelta;
+        crossingSpacing[axis] = 1.0f / absoluteDelta;
+    }
+
+    blockKeys.push_back(_blockKey(cell[0], cell[1], cell[2]));
+
+    // Counting steps rather than comparing crossings against the end keeps rounding from
+    // taking the walk past the last block
+    while (remainingSteps[0] + remainingSteps[1] + remainingSteps[2] > 0) {
+        int axis = -1;
+        for (int candidate = 0; candidate < 3; ++candidate) {
+            if (remainingSteps[candidate] == 0) { continue; }
+            if (axis < 0 || nextCrossing[candidate] < nextCrossing[axis]) { axis = candidate; }
+        }
+
+        cell[axis] += step[axis];
+        nextCrossing[axis] += crossingSpacing[axis];
+        --remainingSteps[axis];
+
+        blockKeys.push_back(_blockKey(cell[0], cell[1], cell[2]));
+    }
+}
+
+uint32_t TSDFVolume::_findOrAllocateBlock(uint64_t key)
+{
+    auto inserted = _blockIndicesByKey.emplace(key, (uint32_t)_blocks.size());
+    if (!inserted.second) { return inserted.first->second; }
+
+    std::unique_ptr<Block> block(new Block());
+    block->x = (int)((key >> (2 * kBlockCoordinateBits)) & kBlockCoordinateMask) - (int)kBlockCoordinateOffset;
+    block->y = (int)((key >> kBlockCoordinateBits) & kBlockCoordinateMask) - (int)kBlockCoordinateOffset;
+    block->z = (int)(key & kBlockCoordinateMask) - (int)kBlockCoordinateOffset;
+    _blocks.push_back(std::move(block));
+
+    return inserted.first->second;
+}
+
+const TSDFVolume::Block* TSDFVolume::_findBlock(int x, int y, int z) const
+{
+    auto found = _blockIndicesByKey.find(_blockKey(x, y, z));
+    if (found == _blockIndicesByKey.end()) { return nullptr; }
+
+    return _blocks[found->second].get();
+}
+
+void TSDFVolume::_integrateBlock(Block& block,
+                                 const ProcessedFrame& frame,
+                                 const Matrix4f& projectionViewMatrix,
+                                 const Matrix4f& modelMatrix,
+                                 const LensCalibration& lensCalibration,
+                                 const SurfelFusionConfiguration& surfelFusionConfiguration) const
+{
+    const int width = (int)frame.rawFrame.width;
+    const int height = (int)frame.rawFrame.height;
+    const float voxelSize = _config.voxelSize;
+    const float truncationDistance = _config.truncationDistance;
+    const float inverseTruncationDistance = 1.0f / truncationDistance;
+
+    for (int k = 0; k < BlockSize; ++k) {
+        for (int j = 0; j < BlockSize; ++j) {
+            for (int i = 0; i < BlockSize; ++i) {
+                Vector4f position((block.x * BlockSize + i) * voxelSize,
+                                  (block.y * BlockSize + j) * voxelSize,
+                                  (block.z * BlockSize + k) * voxelSize,
+                                  1);
+
+                // Find the pixel the voxel falls in the same way the surfel index map does
+                Vector4f projected = projectionViewMatrix * position;
+                if (!(projected.w() > 0)) { continue; }
+
+                float x = projected.x() / projected.w();
+                float y = projected.y() / projected.w();
+                lensCalibration.apply(x, y);
+
+                float column = (0.5f + 0.5f * x) * width;
+                float row = (0.5f - 0.5f * y) * height;
+                if (!(column >= 0 && column < width && row >= 0 && row < height)) { continue; }
+
+                size_t pixelIndex = (size_t)row * width + (size_t)column;
+                if (!_isUsablePixel(frame, pixelIndex, surfelFusionConfiguration)) { continue; }
+
+                // How far in front of the observed surface the voxel is, along the ray through it
+                const math::Vec3& observed = frame.positions[pixelIndex];
+                float observedDistance = std::sqrt(observed.x * observed.x + observed.y * observed.y + observed.z * observed.z);
+                float voxelDistance = (modelMatrix * position).head<3>().norm();
+                float signedDistance = observedDistance - voxelDistance;
+
+                // Anything further behind the surface than this is hidden, and left alone
+                if (signedDistance < -truncationDistance) { continue; }
+
+                Voxel& voxel = block.voxels[_voxelIndex(i, j, k)];
+                float truncatedDistance = std::min(1.0f, signedDistance * inverseTruncationDistance);
+                float weight = voxel.weight + 1;
+
+                voxel.distance = (voxel.distance * voxel.weight + truncatedDistance) / weight;
+                voxel.color = (voxel.color * voxel.weight + frame.rawFrame.colors[pixelIndex]) / weight;
+                voxel.weight = std::min(weight, _config.maxWeight);
+            }
+        }
+    }
+}
+
+void TSDFVolume::_meshBlock(const Block& block, BlockMesh& meshOut) const
+{
+    meshOut.vertexEdgeKeys.clear();
+    meshOut.positions.clear();
+    meshOut.colors.clear();
+    meshOut.faces.clear();
+
+    // The voxels at the corners of the block's cells, which include the first layer of
+    // voxels in the blocks after it along each axis
+    const int GridSize = BlockSize + 1;
+    const Voxel* grid[GridSize * GridSize * GridSize];
+
+    for (int dz = 0; dz <= 1; ++dz) {
+        for (int dy = 0; dy <= 1; ++dy) {
+            for (int dx = 0; dx <= 1; ++dx) {
+                const Block* source = (dx | dy | dz) == 0 ? &block : _findBlock(block.x + dx, block.y + dy, block.z + dz);
+
+                for (int k = dz * BlockSize; k <= (dz ? BlockSize : BlockSize - 1); ++k) {
+                    for (int j = dy * BlockSize; j <= (dy ? BlockSize : BlockSize - 1); ++j) {
+                        for (int i = dx * BlockSize; i <= (dx ? BlockSize : BlockSize - 1); ++i) {
+                            grid[i + GridSize * (j + GridSize * k)] = source == nullptr
+                                ? nullptr
+                                : &source->voxels[_voxelIndex(i - dx * BlockSize, j - dy * BlockSize, k - dz * BlockSize)];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // The block's vertex on each voxel edge, by the edge's first voxel and its axis
+    int edgeVertexIndices[GridSize * GridSize * GridSize * 3];
+    std::fill(edgeVertexIndices, edgeVertexIndices + GridSize * GridSize * GridSize * 3, -1);
+
+    const float voxelSize = _config.voxelSize;
+
+    for (int k = 0; k < BlockSize; ++k) {
+        for (int j = 0; j < BlockSize; ++j) {
+            for (int i = 0; i < BlockSize; ++i) {
+                const Voxel* corners[8];
+                int cornerFlags = 0;
+                bool isMeshable = true;
+
+                for (int c = 0; c < 8 && isMeshable; ++c) {
+                    const Voxel* voxel = grid[(i + kCornerOffsets[c][0]) + GridSize * ((j + kCornerOffsets[c][1]) + GridSize * (k + kCornerOffsets[c][2]))];
+
+                    // Only mesh cells that have been seen all the way around and are within
+                    // the truncation band, which leaves out the jump in sign behind surfaces
+                    isMeshable = voxel != nullptr && voxel->weight > 0 && std::abs(voxel->distance) < 1;
+                    corners[c] = voxel;
+                    if (isMeshable && voxel->distance > 0) { cornerFlags |= 1 << c; }
+                }
+
+                if (!isMeshable) { continue; }
+
+                int edgeFlags = aiCubeEdgeFlags[cornerFlags];
+                if (edgeFlags == 0) { continue; }
+
+                int cellVertexIndices[12];
+                for (int edge = 0; edge < 12; ++edge) {
+                    if (!(edgeFlags & (1 << edge))) { continue; }
+
+                    int a = a2eConnection[edge][0];
+                    int b = a2eConnection[edge][1];
+
+                    // Identify the edge by its first corner and the axis it runs along
+                    int first = kCornerOffsets[a][0] + kCornerOffsets[a][1] + kCornerOffsets[a][2]
+                        <= kCornerOffsets[b][0] + kCornerOffsets[b][1] + kCornerOffsets[b][2] ? a : b;
+                    int axis = kCornerOffsets[a][0] != kCornerOffsets[b][0] ? 0 : (kCornerOffsets[a][1] != kCornerOffsets[b][1] ? 1 : 2);
+                    int gridI = i + kCornerOffsets[first][0];
+                    int gridJ = j + kCornerOffsets[first][1];
+                    int gridK = k + kCornerOffsets[first][2];
+
+                    int& vertexIndex = edgeVertexIndices[(gridI + GridSize * (gridJ + GridSize * gridK)) * 3 + axis];
+                    if (vertexIndex < 0) {
+                        float distanceA = corners[a]->distance;
+                        float distanceB = corners[b]->distance;
+                        float t = distanceA / (distanceA - distanceB);
+
+                        math::Vec3 positionA((i + kCornerOffsets[a][0]) + block.x * BlockSize,
+                                             (j + kCornerOffsets[a][1]) + block.y * BlockSize,
+                                             (k + kCornerOffsets[a][2]) + block.z * BlockSize);
+                        math::Vec3 positionB((i + kCornerOffsets[b][0]) + block.x * BlockSize,
+                                             (j + kCornerOffsets[b][1]) + block.y * BlockSize,
+                                             (k + kCornerOffsets[b][2]) + block.z * BlockSize);
+
+                        vertexIndex = (int)meshOut.positions.size();
+                        meshOut.vertexEdgeKeys.push_back(_edgeKey(block.x * BlockSize + gridI,
+                                                                  block.y * BlockSize + gridJ,
+                                                                  block.z * BlockSize + gridK,
+                                                                  axis));
+                        meshOut.positions.push_back((positionA + (positionB - positionA) * t) * voxelSize);
+                        meshOut.colors.push_back(corners[a]->color + (corners[b]->color - corners[a]->color) * t);
+                    }
+
+                    cellVertexIndices[edge] = vertexIndex;
+                }
+
+                // Wound so that faces look out of the surface, towards positive distances
+                for (int f = 0; f < 5 && a2fConnectionTable[cornerFlags][3 * f] >= 0; ++f) {
+                    meshOut.faces.push_back(sc3d::Face3(cellVertexIndices[a2fConnectionTable[cornerFlags][3 * f]],
+                                                        cellVertexIndices[a2fConnectionTable[cornerFlags][3 * f + 1]],
+                                                        cellVertexIndices[a2fConnectionTable[cornerFlags][3 * f + 2]]));
+                }
+            }
+        }
+    }
+}
+
+void TSDFVolume::_unstitchBlockMesh(const BlockMesh& blockMesh)
+{
+    for (size_t i = 0; i < blockMesh.stitchedVertexIndices.size(); ++i) {
+        uint32_t stitchedVertexIndex = blockMesh.stitchedVertexIndices[i];
+        _touchStitchedVertex(stitchedVertexIndex);
+
+        if (--_stitchedVertices[stitchedVertexIndex].referenceCount == 0) {
+            _stitchedVertexIndicesByEdgeKey.erase(blockMesh.vertexEdgeKeys[i]);
+            _freeStitchedVertexIndices.push_back(stitchedVertexIndex);
+        }
+    }
+}
+
+void TSDFVolume::_stitchBlockMesh(BlockMesh& blockMesh)
+{
+    blockMesh.stitchedVertexIndices.resize(blockMesh.positions.size());
+
+    for (size_t i = 0; i < blockMesh.positions.size(); ++i) {
+        auto inserted = _stitchedVertexIndicesByEdgeKey.emplace(blockMesh.vertexEdgeKeys[i], 0);
+
+        if (inserted.second) {
+            if (_freeStitchedVertexIndices.empty()) {
+                inserted.first->second = (uint32_t)_stitchedVertices.size();
+                _stitchedVertices.emplace_back();
+            } else {
+                inserted.first->second = _freeStitchedVertexIndices.back();
+                _freeStitchedVertexIndices.pop_back();
+            }
+        }
+
+        uint32_t stitchedVertexIndex = inserted.first->second;
+        StitchedVertex& vertex = _stitchedVertices[stitchedVertexIndex];
+        vertex.position = blockMesh.positions[i];
+        vertex.color = blockMesh.colors[i];
+        ++vertex.referenceCount;
+
+        blockMesh.stitchedVertexIndices[i] = stitchedVertexIndex;
+        _touchStitchedVertex(stitchedVertexIndex);
+    }
+}
+
+void TSDFVolume::_touchStitchedVertex(uint32_t stitchedVertexIndex)
+{
+    if (stitchedVertexIndex >= _stitchedVertexIsTouched.size()) {
+        _stitchedVertexIsTouched.resize(_stitchedVertices.size(), 0);
+    }
+
+    if (_stitchedVertexIsTouched[stitchedVertexIndex]) { return; }
+
+    _stitchedVertexIsTouched[stitchedVertexIndex] = 1;
+    _touchedStitchedVertexIndices.push_back(stitchedVertexIndex);
+}
+
+void TSDFVolume::_updateTouchedNormals()
+{
+    for (uint32_t stitchedVertexIndex : _touchedStitchedVertexIndices) {
+        _stitchedVertices[stitchedVertexIndex].normalSum = math::Vec3(0, 0, 0);
+    }
+
+    // A touched vertex lies on an edge of a dirty block's cells, so only the faces of
+    // that block and the blocks around it can use it
+    _normalBlockIndices.clear();
+    for (uint32_t blockIndex : _dirtyBlockIndices) {
+        const Block& block = *_blocks[blockIndex];
+
+        for (int dz = -1; dz <= 1; ++dz) {
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    auto found = _blockIndicesByKey.find(_blockKey(block.x + dx, block.y + dy, block.z + dz));
+                    if (found != _blockIndicesByKey.end()) { _normalBlockIndices.push_back(found->second); }
+                }
+            }
+        }
+    }
+    std::sort(_normalBlockIndices.begin(), _normalBlockIndices.end());
+    _normalBlockIndices.erase(std::unique(_normalBlockIndices.begin(), _normalBlockIndices.end()), _normalBlockIndices.end());
+
+    // Sum the faces' area-weighted normals at their touched vertices
+    for (uint32_t blockIndex : _normalBlockIndices) {
+        const BlockMesh& blockMesh = _blockMeshes[blockIndex];
+
+        for (const sc3d::Face3& face : blockMesh.faces) {
+            uint32_t corners[3] = {
+                blockMesh.stitchedVertexIndices[face[0]],
+                blockMesh.stitchedVertexIndices[face[1]],
+                blockMesh.stitchedVertexIndices[face[2]],
+            };
+            if (!_stitchedVertexIsTouched[corners[0]] && !_stitchedVertexIsTouched[corners[1]] && !_stitchedVertexIsTouched[corners[2]]) { continue; }
+
+            const math::Vec3& position0 = _stitchedVertices[corners[0]].position;
+            math::Vec3 normal = math::Vec3::cross(_stitchedVertices[corners[1]].position - position0,
+                                                  _stitchedVertices[corners[2]].position - position0);
+
+            for (uint32_t corner : corners) {
+                if (_stitchedVertexIsTouched[corner]) { _stitchedVertices[corner].normalSum += normal; }
+            }
+        }
+    }
+
+    for (uint32_t stitchedVertexIndex : _touchedStitchedVertexIndices) {
+        _stitchedVertexIsTouched[stitchedVertexIndex] = 0;
+    }
+    _touchedStitchedVertexIndices.clear();
+}
@@ -0,0 +1,159 @@
+//
+//  TSDFVolume.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <cstdint>
+#import <memory>
+#import <unordered_map>
+#import <vector>
+
+#import <standard_cyborg/math/Vec3.hpp>
+#import <standard_cyborg/sc3d/Face3.hpp>
+#import <standard_cyborg/sc3d/Geometry.hpp>
+#import <standard_cyborg/util/IncludeEigen.hpp>
+
+#import "LensCalibration.hpp"
+#import "ProcessedFrame.hpp"
+#import "SurfelFusion.hpp"
+
+using namespace standard_cyborg;
+
+struct TSDFConfiguration {
+    // The spacing of the grid, in meters
+    float voxelSize = 0.0015;
+    // Signed distances are clamped to this far either side of the surface, in meters
+    float truncationDistance = 0.006;
+    // A voxel's weight stops growing here, so it can still follow the surface if it moves
+    float maxWeight = 64;
+};
+
+/** A truncated signed distance field, stored sparsely as blocks of voxels in a hash map so
+ *  that only the space near an observed surface takes up memory. Distances are positive in
+ *  front of the surface and negative behind it.
+ *
+ *  Integrating a frame allocates the blocks around its points, then updates each of those
+ *  blocks in parallel. Extracting a mesh runs marching cubes over the blocks that changed
+ *  since the last extraction, in parallel. It then stitches just those blocks into the mesh
+ *  it kept from last time, merging their vertices with their neighbors', and updates the
+ *  normals of the vertices they touch, which is serial. Copying the mesh out at the end
+ *  is the only step whose cost grows with the whole mesh rather than with what changed.
+ */
+class TSDFVolume {
+public:
+    /** Voxels along each side of a block */
+    static const int BlockSize = 8;
+
+    struct Voxel {
+        float distance = 1;
+        float weight = 0;
+        math::Vec3 color;
+    };
+
+    TSDFVolume(TSDFConfiguration config = TSDFConfiguration());
+
+    /** Fuses a frame's depths in, as seen from `extrinsicMatrix`, which takes the camera's
+     *  frame of reference to the volume's. Pixels are filtered by the same depth and input
+     *  confidence thresholds as surfel fusion. */
+    void integrate(const ProcessedFrame& frame,
+                   const Eigen::Matrix4f& extrinsicMatrix,
+                   const SurfelFusionConfiguration& surfelFusionConfiguration);
+
+    /** A mesh of the zero crossing, with a vertex per crossed voxel edge shared by all the
+     *  faces around it, area-weighted normals and interpolated colors */
+    std::shared_ptr<sc3d::Geometry> extractMesh();
+
+    void reset();
+
+    const TSDFConfiguration& getConfiguration() const;
+
+    /** The number of blocks allocated so far */
+    size_t blockCount() const;
+
+    /** The voxel at a grid coordinate, or nullptr if its block hasn't been allocated. Voxel
+     *  (i, j, k) sits at (i, j, k) * voxelSize in the volume's frame of reference. */
+    const Voxel* voxelAt(int i, int j, int k) const;
+
+private:
+    struct Block {
+        int x, y, z;
+        Voxel voxels[BlockSize * BlockSize * BlockSize];
+        // Whether the block's cells need to be remeshed
+        bool isDirty = true;
+    };
+
+    // The part of the mesh from one block's cells. Each vertex is identified by the voxel
+    // edge it lies on, so that vertices shared with neighboring blocks can be merged.
+    struct BlockMesh {
+        std::vector<uint64_t> vertexEdgeKeys;
+        std::vector<math::Vec3> positions;
+        std::vector<math::Vec3> colors;
+        std::vector<sc3d::Face3> faces;
+        // The stitched vertex each of the block's vertices was merged into
+        std::vector<uint32_t> stitchedVertexIndices;
+    };
+
+    // A vertex of the whole mesh, which every block with a vertex on the same edge shares
+    struct StitchedVertex {
+        math::Vec3 position;
+        math::Vec3 color;
+        // The sum of the area-weighted normals of the faces around it
+        math::Vec3 normalSum;
+        // How many block meshes have a vertex merged into it. Unused ones are free for reuse.
+        uint32_t referenceCount = 0;
+    };
+
+    TSDFConfiguration _config;
+
+    std::unordered_map<uint64_t, uint32_t> _blockIndicesByKey;
+    std::vector<std::unique_ptr<Block>> _blocks;
+    std::vector<BlockMesh> _blockMeshes;
+
+    // The stitched mesh, kept between extractions so that only changed blocks are restitched
+    std::unordered_map<uint64_t, uint32_t> _stitchedVertexIndicesByEdgeKey;
+    std::vector<StitchedVertex> _stitchedVertices;
+    std::vector<uint32_t> _freeStitchedVertexIndices;
+
+    // Scratch space, retained between frames to avoid reallocating every frame
+    std::vector<std::vector<uint64_t>> _bandBlockKeys;
+    std::vector<uint32_t> _frameBlockIndices;
+    std::vector<uint32_t> _dirtyBlockIndices;
+    std::vector<uint32_t> _normalBlockIndices;
+    std::vector<uint8_t> _stitchedVertexIsTouched;
+    std::vector<uint32_t> _touchedStitchedVertexIndices;
+    std::vector<int> _outputVertexIndices;
+    std::vector<int> _blockOutputVertexIndices;
+
+    static uint64_t _blockKey(int x, int y, int z);
+    // Appends the key of every block the segment from `start` to `end` passes through, with
+    // both ends in units of blocks. This walks the grid one face crossing at a time, so it
+    // doesn't matter how long the segment is compared to a block.
+    static void _appendBlocksAlongSegment(const Eigen::Vector3f& start, const Eigen::Vector3f& end, std::vector<uint64_t>& blockKeys);
+    uint32_t _findOrAllocateBlock(uint64_t key);
+    const Block* _findBlock(int x, int y, int z) const;
+
+    void _integrateBlock(Block& block,
+                         const ProcessedFrame& frame,
+                         const Eigen::Matrix4f& projectionViewMatrix,
+                         const Eigen::Matrix4f& modelMatrix,
+                         const LensCalibration& lensCalibration,
+                         const SurfelFusionConfiguration& surfelFusionConfiguration) const;
+    void _meshBlock(const Block& block, BlockMesh& meshOut) const;
+
+    // Releases a block mesh's vertices from the stitched mesh, before it's remeshed
+    void _unstitchBlockMesh(const BlockMesh& blockMesh);
+    // Merges a block mesh's vertices into the stitched mesh
+    void _stitchBlockMesh(BlockMesh& blockMesh);
+    void _touchStitchedVertex(uint32_t stitchedVertexIndex);
+    // Recomputes the normals of the stitched vertices that were touched, from the faces of the
+    // dirty blocks and their neighbors, which are the only ones that can share those vertices
+    void _updateTouchedNormals();
+
+    // Prohibit copying and assignment
+    TSDFVolume(const TSDFVolume&) = delete;
+    TSDFVolume& operator=(const TSDFVolume&) = delete;
+};
@@ -0,0 +1,286 @@
+//
+//  CompactSurfels.cpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <algorithm>
+#import <cmath>
+#import <cstring>
+#import <limits>
+
+#import <standard_cyborg/util/TaskScheduler.hpp>
+
+#import "CompactSurfels.hpp"
+
+using namespace standard_cyborg;
+
+static const float kMaxPositionStep = 65535.0f;
+static const float kMaxHalf = 65504.0f;
+static const float kMaxSnorm16 = 32767.0f;
+
+// MARK: - Half precision
+
+// Rounds to nearest even, as a hardware conversion would
+static uint16_t _floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+    uint32_t mantissa = bits & 0x7fffff;
+
+    if (((bits >> 23) & 0xff) == 0xff) {
+        return (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+    }
+
+    if (exponent >= 31) {
+        return (uint16_t)(sign | 0x7c00);
+    }
+
+    if (exponent <= 0) {
+        // Too small for a normal half, so it becomes subnormal, or zero
+        if (exponent < -10) { return (uint16_t)sign; }
+
+        mantissa |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (remainder > halfway || (remainder == halfway && (half & 1))) { ++half; }
+
+        return (uint16_t)(sign | half);
+    }
+
+    // Rounding up can carry into the exponent, which is still the right answer
+    uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t remainder = mantissa & 0x1fff;
+    if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) { ++half; }
+
+    return (uint16_t)half;
+}
+
+static float _halfToFloat(uint16_t half)
+{
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    int32_t exponent = (half >> 10) & 0x1f;
+    uint32_t mantissa = half & 0x3ff;
+    uint32_t bits;
+
+    if (exponent == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        } else {
+            // Subnormal, so normalize it
+            exponent = 1;
+            while ((mantissa & 0x400) == 0) {
+                mantissa <<= 1;
+                --exponent;
+            }
+            bits = sign | ((uint32_t)(exponent + 127 - 15) << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    } else if (exponent == 31) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else {
+        bits = sign | ((uint32_t)(exponent + 127 - 15) << 23) | (mantissa << 13);
+    }
+
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+
+    return value;
+}
+
+// MARK: - Octahedral normals
+
+static float _signNotZero(float value)
+{
+    return value < 0 ? -1.0f : 1.0f;
+}
+
+static uint16_t _encodeSnorm16(float value)
+{
+    return (uint16_t)(int16_t)std::lround(std::max(-1.0f, std::min(value, 1.0f)) * kMaxSnorm16);
+}
+
+static float _decodeSnorm16(uint16_t value)
+{
+    return std::max(-1.0f, (float)(int16_t)value / kMaxSnorm16);
+}
+
+// Projects the unit sphere onto an octahedron and unfolds it into a square
+static void _encodeNormal(const Vector3f& normal, uint16_t encodedOut[2])
+{
+    float l1Norm = std::abs(normal.x()) + std::abs(normal.y()) + std::abs(normal.z());
+    if (!(l1Norm > 0)) {
+        encodedOut[0] = encodedOut[1] = 0;
+        return;
+    }
+
+    float u = normal.x() / l1Norm;
+    float v = normal.y() / l1Norm;
+
+    if (normal.z() < 0) {
+        float foldedU = (1.0f - std::abs(v)) * _signNotZero(u);
+        float foldedV = (1.0f - std::abs(u)) * _signNotZero(v);
+        u = foldedU;
+        v = foldedV;
+    }
+
+    encodedOut[0] = _encodeSnorm16(u);
+    encodedOut[1] = _encodeSnorm16(v);
+}
+
+static Vector3f _decodeNormal(const uint16_t encoded[2])
+{
+    float u = _decodeSnorm16(encoded[0]);
+    float v = _decodeSnorm16(encoded[1]);
+    float z = 1.0f - std::abs(u) - std::abs(v);
+
+    if (z < 0) {
+        float unfoldedU = (1.0f - std::abs(v)) * _signNotZero(u);
+        float unfoldedV = (1.0f - std::abs(u)) * _signNotZero(v);
+        u = unfoldedU;
+        v = unfoldedV;
+    }
+
+    return Vector3f(u, v, z).normalized();
+}
+
+// MARK: - Encoding
+
+static CompactSurfel _encodeSurfel(const Surfel& surfel, const CompactSurfelBlock& block, const float inverseSteps[3])
+{
+    CompactSurfel compact;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        float steps = (surfel.position[axis] - block.origin[axis]) * inverseSteps[axis];
+        compact.position[axis] = (uint16_t)std::lround(std::max(0.0f, std::min(steps, kMaxPositionStep)));
+        compact.color[axis] = (uint8_t)std::lround(std::max(0.0f, std::min(surfel.color[axis], 1.0f)) * 255.0f);
+    }
+
+    _encodeNormal(surfel.normal, compact.normal);
+    compact.weight = _floatToHalf(std::min(surfel.weight, kMaxHalf));
+    compact.surfelSize = _floatToHalf(std::min(surfel.surfelSize, kMaxHalf));
+
+    // Lifetimes count down past zero, so they're really signed
+    int32_t lifetime = (int32_t)surfel.lifetime;
+    compact.lifetime = (int8_t)std::max(-128, std::min(lifetime, 127));
+
+    return compact;
+}
+
+static Surfel _decodeSurfel(const CompactSurfel& compact, const CompactSurfelBlock& block)
+{
+    Surfel surfel;
+
+    for (int axis = 0; axis < 3; ++axis) {
+        surfel.position[axis] = block.origin[axis] + compact.position[axis] * block.step[axis];
+        surfel.color[axis] = compact.color[axis] / 255.0f;
+    }
+
+    surfel.normal = _decodeNormal(compact.normal);
+    surfel.weight = _halfToFloat(compact.weight);
+    surfel.surfelSize = _halfToFloat(compact.surfelSize);
+    surfel.lifetime = (uint32_t)(int32_t)compact.lifetime;
+
+    return surfel;
+}
+
+// Encodes `count` surfels, gathered by `surfelAt`, a block at a time in parallel
+template <typename SurfelAt>
+static void _encodeSurfels(CompactSurfels& compactSurfels, size_t count, SurfelAt surfelAt)
+{
+    const size_t blockSize = CompactSurfels::BlockSize;
+    const size_t blockCount = (count + blockSize - 1) / blockSize;
+
+    compactSurfels.blocks.resize(blockCount);
+    compactSurfels.surfels.resize(count);
+
+    util::TaskScheduler::shared().parallelFor(0, blockCount, 0, [&](size_t blockBegin, size_t blockEnd) {
+        for (size_t blockIndex = blockBegin; blockIndex < blockEnd; ++blockIndex) {
+            size_t begin = blockIndex * blockSize;
+            size_t end = std::min(count, begin + blockSize);
+
+            Vector3f minPosition = Vector3f::Constant(std::numeric_limits<float>::max());
+            Vector3f maxPosition = Vector3f::Constant(std::numeric_limits<float>::lowest());
+            for (size_t index = begin; index < end; ++index) {
+                const Vector3f position = surfelAt(index).position;
+                minPosition = minPosition.cwiseMin(position);
+                maxPosition = maxPosition.cwiseMax(position);
+            }
+
+            CompactSurfelBlock& block = compactSurfels.blocks[blockIndex];
+            float inverseSteps[3];
+            for (int axis = 0; axis < 3; ++axis) {
+                float extent = maxPosition[axis] - minPosition[axis];
+                block.origin[axis] = minPosition[axis];
+                block.step[axis] = extent / kMaxPositionStep;
+                inverseSteps[axis] = extent > 0 ? kMaxPositionStep / extent : 0;
+            }
+
+            for (size_t index = begin; index < end; ++index) {
+                compactSurfels.surfels[index] = _encodeSurfel(surfelAt(index), block, inverseSteps);
+            }
+        }
+    });
+}
+
+// MARK: - CompactSurfels
+
+void CompactSurfels::clear()
+{
+    blocks.clear();
+    surfels.clear();
+}
+
+void CompactSurfels::encode(const Surfels& surfelsIn)
+{
+    _encodeSurfels(*this, surfelsIn.size(), [&](size_t index) -> const Surfel& { return surfelsIn[index]; });
+}
+
+void CompactSurfels::encode(const SurfelStore& surfelsIn)
+{
+    if (surfelsIn.freeSlots.empty()) {
+        _encodeSurfels(*this, surfelsIn.size(), [&](size_t index) { return surfelsIn[index]; });
+        return;
+    }
+
+    std::vector<int> liveIndices;
+    liveIndices.reserve(surfelsIn.liveCount());
+    for (size_t index = 0; index < surfelsIn.size(); ++index) {
+        if (!surfelsIn.tombstones[index]) { liveIndices.push_back((int)index); }
+    }
+
+    _encodeSurfels(*this, liveIndices.size(), [&](size_t index) { return surfelsIn[liveIndices[index]]; });
+}
+
+void CompactSurfels::decode(Surfels& surfelsOut) const
+{
+    surfelsOut.resize(size());
+
+    util::TaskScheduler::shared().parallelFor(0, size(), 0, [&](size_t begin, size_t end) {
+        for (size_t index = begin; index < end; ++index) {
+            surfelsOut[index] = (*this)[index];
+        }
+    });
+}
+
+void CompactSurfels::decode(SurfelStore& surfelsOut) const
+{
+    surfelsOut.clear();
+    surfelsOut.resize(size());
+
+    util::TaskScheduler::shared().parallelFor(0, size(), 0, [&](size_t begin, size_t end) {
+        for (size_t index = begin; index < end; ++index) {
+            surfelsOut.set(index, (*this)[index]);
+        }
+    });
+}
+
+Surfel CompactSurfels::operator[](size_t index) const
+{
+    return _decodeSurfel(surfels[index], blocks[index / BlockSize]);
+}
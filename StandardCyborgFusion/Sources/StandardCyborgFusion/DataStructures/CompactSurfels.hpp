@@ -0,0 +1,77 @@
+//
+//  CompactSurfels.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <cstdint>
+#import <vector>
+
+#import "Surfel.hpp"
+#import "SurfelStore.hpp"
+
+/** A surfel quantized into 18 bytes, for snapshots, checkpoints and transport, where
+ *  bandwidth matters more than precision.
+ *
+ *  - Position: 16-bit fixed point within its block's bounding box, so the error per
+ *    axis is at most half the block's step, plus float rounding. See CompactSurfels for
+ *    how big blocks get.
+ *  - Normal: octahedral encoding with 16 bits per component, within about 0.005 degrees
+ *  - Color: 8 bits per channel
+ *  - Weight and size: half precision, within 0.05% relative above 0.0001. Weights clamp
+ *    at 65504.
+ *  - Lifetime: 8 bits, clamped, which doesn't change when a surfel is culled as long as
+ *    SurfelFusionConfiguration::surfelLifetime is at most 127
+ */
+struct CompactSurfel {
+    uint16_t position[3];
+    uint16_t normal[2];
+    uint16_t weight;
+    uint16_t surfelSize;
+    uint8_t color[3];
+    int8_t lifetime;
+};
+
+static_assert(sizeof(CompactSurfel) == 18, "CompactSurfel must stay tightly packed");
+
+/** Where a block's quantized positions are relative to, and how far apart their steps are */
+struct CompactSurfelBlock {
+    float origin[3];
+    float step[3];
+};
+
+/** Surfels quantized as CompactSurfels, in blocks of `BlockSize` consecutive surfels.
+ *  They're kept in the order they were given, since snapshots and deltas refer to them by
+ *  index, so how precise positions are depends on how close together consecutive surfels
+ *  happen to be. A frame's new surfels are appended in row order and are close together,
+ *  but once the model reuses the slots of removed surfels, new ones are scattered among
+ *  old ones and a block can span the whole model. So the error per axis is at most
+ *  1/131070 of the extent of all the surfels along that axis, plus float rounding: under
+ *  4 micrometers for a scan half a meter across, and much less where blocks are tight. */
+struct CompactSurfels {
+    static const size_t BlockSize = 256;
+
+    std::vector<CompactSurfelBlock> blocks;
+    std::vector<CompactSurfel> surfels;
+
+    size_t size() const { return surfels.size(); }
+
+    /** The number of bytes it takes to store or send these */
+    size_t byteSize() const { return blocks.size() * sizeof(CompactSurfelBlock) + surfels.size() * sizeof(CompactSurfel); }
+
+    void clear();
+
+    void encode(const Surfels& surfelsIn);
+
+    /** Encodes the surfels in order, leaving out tombstones, as SurfelStore::copyTo does */
+    void encode(const SurfelStore& surfelsIn);
+
+    void decode(Surfels& surfelsOut) const;
+    void decode(SurfelStore& surfelsOut) const;
+
+    /** Decodes a single surfel */
+    Surfel operator[](size_t index) const;
+};
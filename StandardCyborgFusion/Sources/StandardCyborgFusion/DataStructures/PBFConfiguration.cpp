@@ -13,7 +13,18 @@ std::ostream& operator<<(std::ostream& os, PBFConfiguration const& config)
     os << "         icpDownsampleFraction: " << (config.icpDownsampleFraction) << "\n";
     os << "             maxCameraVelocity: " << (config.maxCameraVelocity) << "\n";
     os << "      maxCameraAngularVelocity: " << (config.maxCameraAngularVelocity) << "\n";
-    os << "         kdTreeRebuildInterval: " << (config.kdTreeRebuildInterval) << "\n";
+    os << "             icpTargetMaxDrift: " << (config.icpTargetMaxDrift) << "\n";
+    os << "         motionModelFrameCount: " << (config.motionModelFrameCount) << "\n";
+    os << "                maxSurfelCount: " << (config.maxSurfelCount) << "\n";
+    os << "    surfelBudgetTargetFraction: " << (config.surfelBudgetTargetFraction) << "\n";
+    os << "         surfelLODNearDistance: " << (config.surfelLODNearDistance) << "\n";
+    os << "            surfelLODVoxelSize: " << (config.surfelLODVoxelSize) << "\n";
+    os << "              snapshotInterval: " << (config.snapshotInterval) << "\n";
+    os << "              compactSnapshots: " << (config.compactSnapshots) << "\n";
+    os << "      redundantFrameMaxNovelty: " << (config.redundantFrameMaxNovelty) << "\n";
+    os << "  redundantFrameMaxTranslation: " << (config.redundantFrameMaxTranslation) << "\n";
+    os << "     redundantFrameMaxRotation: " << (config.redundantFrameMaxRotation) << "\n";
+    os << "redundantFrameMaxConsecutiveSkips: " << (config.redundantFrameMaxConsecutiveSkips) << "\n";
     os << "}\n";
     
     return os;
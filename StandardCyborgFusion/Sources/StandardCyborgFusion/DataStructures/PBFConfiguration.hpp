@@ -16,7 +16,43 @@ struct PBFConfiguration {
     
     float icpDownsampleFraction = 0.05;
     
-    int kdTreeRebuildInterval = 6;
+    // Surfels in the ICP target are reindexed once fusion has moved them this far (in meters)
+    float icpTargetMaxDrift = 0.001;
+    
+    // When at least 2, ICP starts from a pose extrapolated at constant velocity from this many of
+    // the most recently merged frames, instead of from the last one's pose
+    int motionModelFrameCount = 0;
+    
+    // When nonzero, the most surfels the model may hold. Past that, surfels far from the camera
+    // are merged within coarse voxels, then the least confident are evicted, until there are
+    // surfelBudgetTargetFraction of this many.
+    size_t maxSurfelCount = 0;
+    float surfelBudgetTargetFraction = 0.9;
+    
+    // When over budget, surfels farther than this from the camera (in meters) are merged within
+    // voxels of surfelLODVoxelSize, which double in size with each doubling of the distance
+    float surfelLODNearDistance = 0.5;
+    float surfelLODVoxelSize = 0.004;
+    
+    // PBFModel publishes a snapshot of its surfels for other threads to read every this many
+    // frames, or only once it's finished when zero. Each one copies every surfel, so this is
+    // off unless something reads the model while it's assimilating.
+    int snapshotInterval = 0;
+    
+    // When set, snapshots hold their surfels quantized as CompactSurfels, which is less than
+    // half as much to copy and keep around, for readers that can live with the precision
+    bool compactSnapshots = false;
+    
+    // When nonzero, a frame taken within redundantFrameMaxTranslation (in meters) and
+    // redundantFrameMaxRotation (in radians) of the last merged one is skipped instead of fused
+    // if less than this fraction of the pixels fusion would use would create new surfels. This
+    // saves fusing a camera that's holding still, but changes how confident the surfels become.
+    // At most redundantFrameMaxConsecutiveSkips frames in a row are skipped, so that the surfels
+    // still build up enough weight to survive culling.
+    float redundantFrameMaxNovelty = 0;
+    float redundantFrameMaxTranslation = 0.002;
+    float redundantFrameMaxRotation = 0.01;
+    int redundantFrameMaxConsecutiveSkips = 2;
 };
 
 std::ostream& operator<<(std::ostream& os, PBFConfiguration const& config);
@@ -23,6 +23,9 @@ struct ProcessedFrame {
     std::vector<float> surfelSizes __attribute__((aligned(METAL_REQUIRED_ALIGNMENT)));
     std::vector<float> weights __attribute__((aligned(METAL_REQUIRED_ALIGNMENT)));
     std::vector<float> inputConfidences __attribute__((aligned(METAL_REQUIRED_ALIGNMENT)));
+    
+    // How long the depth processor took to compute these, in seconds
+    double depthProcessingDuration = 0;
 
     ProcessedFrame(const RawFrame& rawFrameIn) :
         rawFrame(rawFrameIn),
@@ -42,7 +45,46 @@ struct ProcessedFrame {
         inputConfidences(width * height, 0.0f)
     { }
     
+    /** Takes on a copy of a new raw frame, reusing the storage it has when it's big enough.
+     *  The computed values are left for the depth processor to overwrite. */
+    void reset(const RawFrame& rawFrameIn)
+    {
+        _resetRawFrameHeader(rawFrameIn);
+        rawFrame.depths.assign(rawFrameIn.depths.begin(), rawFrameIn.depths.end());
+        rawFrame.colors.assign(rawFrameIn.colors.begin(), rawFrameIn.colors.end());
+        _resizeComputedValues();
+    }
+    
+    /** Takes on a new raw frame by trading buffers with it rather than copying it, so it's
+     *  left holding this frame's old depths and colors, for the caller to fill next time */
+    void swapIn(RawFrame& rawFrameIn)
+    {
+        _resetRawFrameHeader(rawFrameIn);
+        rawFrame.depths.swap(rawFrameIn.depths);
+        rawFrame.colors.swap(rawFrameIn.colors);
+        _resizeComputedValues();
+    }
+    
 private:
+    void _resetRawFrameHeader(const RawFrame& rawFrameIn)
+    {
+        rawFrame.camera = rawFrameIn.camera;
+        rawFrame.width = rawFrameIn.width;
+        rawFrame.height = rawFrameIn.height;
+        rawFrame.timestamp = rawFrameIn.timestamp;
+    }
+    
+    void _resizeComputedValues()
+    {
+        size_t pointCount = rawFrame.width * rawFrame.height;
+        positions.resize(pointCount);
+        normals.resize(pointCount);
+        surfelSizes.resize(pointCount);
+        weights.resize(pointCount);
+        inputConfidences.resize(pointCount);
+        depthProcessingDuration = 0;
+    }
+    
     // Prohibit copying and assignment
     ProcessedFrame(const ProcessedFrame&) = delete;
     ProcessedFrame& operator=(const ProcessedFrame&) = delete;
@@ -0,0 +1,79 @@
+//
+//  ProcessedFramePool.cpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import "ProcessedFramePool.hpp"
+
+ProcessedFramePool::ProcessedFramePool(size_t maxFreeCount) :
+    _maxFreeCount(maxFreeCount)
+{}
+
+std::unique_ptr<ProcessedFrame> ProcessedFramePool::acquire(const RawFrame& rawFrame)
+{
+    std::unique_ptr<ProcessedFrame> frame = _takeFreeFrame(rawFrame);
+
+    if (frame == nullptr) {
+        frame.reset(new ProcessedFrame(rawFrame));
+    } else {
+        frame->reset(rawFrame);
+    }
+
+    return frame;
+}
+
+std::unique_ptr<ProcessedFrame> ProcessedFramePool::acquireSwapping(RawFrame& rawFrame)
+{
+    std::unique_ptr<ProcessedFrame> frame = _takeFreeFrame(rawFrame);
+
+    if (frame == nullptr) {
+        frame.reset(new ProcessedFrame(rawFrame.camera, rawFrame.width, rawFrame.height));
+    }
+    frame->swapIn(rawFrame);
+
+    return frame;
+}
+
+void ProcessedFramePool::recycle(std::unique_ptr<ProcessedFrame> frame)
+{
+    if (frame == nullptr) { return; }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_freeFrames.size() < _maxFreeCount) {
+        _freeFrames.push_back(std::move(frame));
+    }
+}
+
+size_t ProcessedFramePool::freeCount()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _freeFrames.size();
+}
+
+// MARK: - Private
+
+std::unique_ptr<ProcessedFrame> ProcessedFramePool::_takeFreeFrame(const RawFrame& rawFrame)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_freeFrames.empty()) { return nullptr; }
+
+    // Frames are almost always the same size, but prefer one that is, so nothing reallocates
+    size_t pointCount = rawFrame.width * rawFrame.height;
+    size_t chosen = _freeFrames.size() - 1;
+    for (size_t index = 0; index < _freeFrames.size(); ++index) {
+        if (_freeFrames[index]->positions.capacity() >= pointCount) {
+            chosen = index;
+            break;
+        }
+    }
+
+    std::unique_ptr<ProcessedFrame> frame = std::move(_freeFrames[chosen]);
+    _freeFrames.erase(_freeFrames.begin() + chosen);
+
+    return frame;
+}
@@ -0,0 +1,50 @@
+//
+//  ProcessedFramePool.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <memory>
+#import <mutex>
+#import <vector>
+
+#import "ProcessedFrame.hpp"
+#import "RawFrame.hpp"
+
+/** Recycles ProcessedFrames, so that a stream of frames doesn't allocate, and fault in, a
+ *  fresh set of per-pixel buffers for every one. Frames can be taken and given back on
+ *  different threads, e.g. when one thread processes depth while another assimilates.
+ */
+class ProcessedFramePool {
+public:
+    /** @param maxFreeCount The most frames it holds on to while they aren't in use */
+    ProcessedFramePool(size_t maxFreeCount = 3);
+
+    /** A frame holding a copy of `rawFrame`, recycled if there's one free */
+    std::unique_ptr<ProcessedFrame> acquire(const RawFrame& rawFrame);
+
+    /** A frame that has taken `rawFrame`'s buffers instead of copying them. `rawFrame` gets
+     *  the frame's old buffers in exchange, so a caller that refills the same RawFrame for
+     *  each frame doesn't allocate either. */
+    std::unique_ptr<ProcessedFrame> acquireSwapping(RawFrame& rawFrame);
+
+    /** Gives a frame back once nothing refers to its buffers any more */
+    void recycle(std::unique_ptr<ProcessedFrame> frame);
+
+    /** The number of frames waiting to be reused */
+    size_t freeCount();
+
+private:
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<ProcessedFrame>> _freeFrames;
+    size_t _maxFreeCount;
+
+    std::unique_ptr<ProcessedFrame> _takeFreeFrame(const RawFrame& rawFrame);
+
+    // Prohibit copying and assignment
+    ProcessedFramePool(const ProcessedFramePool&) = delete;
+    ProcessedFramePool& operator=(const ProcessedFramePool&) = delete;
+};
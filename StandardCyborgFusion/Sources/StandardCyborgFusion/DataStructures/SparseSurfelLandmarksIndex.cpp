@@ -5,6 +5,8 @@
 //  Created by Ricky Reusser on 4/22/19.
 //
 
+#include <algorithm>
+
 #include "SparseSurfelLandmarksIndex.hpp"
 
 SparseSurfelLandmarksIndex::const_iterator SparseSurfelLandmarksIndex::begin() const
@@ -80,6 +82,22 @@ bool SparseSurfelLandmarksIndex::removeHit(int surfelIndex, int landmarkIndex)
     return true;
 }
 
+void SparseSurfelLandmarksIndex::setHitCount(int surfelIndex, int landmarkIndex, int hitCount)
+{
+    if (hitCount > 0) {
+        _landmarkHitCountsBySurfelIndex[surfelIndex][landmarkIndex] = hitCount;
+        return;
+    }
+
+    auto surfelIterator = _landmarkHitCountsBySurfelIndex.find(surfelIndex);
+    if (surfelIterator == _landmarkHitCountsBySurfelIndex.end()) { return; }
+
+    surfelIterator->second.erase(landmarkIndex);
+    if (surfelIterator->second.empty()) {
+        _landmarkHitCountsBySurfelIndex.erase(surfelIterator);
+    }
+}
+
 void SparseSurfelLandmarksIndex::removeAllHits()
 {
     _landmarkHitCountsBySurfelIndex.clear();
@@ -121,6 +139,34 @@ void SparseSurfelLandmarksIndex::deleteSurfelLandmarksAndRenumber(const std::vec
     }
 }
 
+void SparseSurfelLandmarksIndex::deleteSurfelLandmarks(const std::vector<int>& sortedSurfelIndicesToDelete)
+{
+    if (_landmarkHitCountsBySurfelIndex.empty()) { return; }
+    
+    // Usually only a handful of surfels have landmarks, so look each of those up in the
+    // deleted surfels rather than the other way around
+    for (auto it = _landmarkHitCountsBySurfelIndex.begin(); it != _landmarkHitCountsBySurfelIndex.end();) {
+        if (std::binary_search(sortedSurfelIndicesToDelete.begin(), sortedSurfelIndicesToDelete.end(), it->first)) {
+            it = _landmarkHitCountsBySurfelIndex.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void SparseSurfelLandmarksIndex::moveSurfelLandmarks(int fromSurfelIndex, int toSurfelIndex)
+{
+    auto from = _landmarkHitCountsBySurfelIndex.find(fromSurfelIndex);
+    if (from == _landmarkHitCountsBySurfelIndex.end() || fromSurfelIndex == toSurfelIndex) { return; }
+    
+    std::unordered_map<int, int>& countsForSurfel = _landmarkHitCountsBySurfelIndex[toSurfelIndex];
+    for (auto [landmarkIndex, hitCount] : from->second) {
+        countsForSurfel[landmarkIndex] += hitCount;
+    }
+    
+    _landmarkHitCountsBySurfelIndex.erase(from);
+}
+
 void SparseSurfelLandmarksIndex::iterateHits(const std::function<void(int surfelIndex, int landmarkIndex, int hitCount)> callback) const
 {
     for (auto& [surfelIndex, hitCountsByLandmarkIndex] : _landmarkHitCountsBySurfelIndex)
@@ -18,6 +18,8 @@ class SparseSurfelLandmarksIndex {
 public:
     void addHit(int surfelIndex, int landmarkIndex);
     bool removeHit(int surfelIndex, int landmarkIndex);
+    // Sets the count outright, e.g. when restoring a checkpoint. A count of zero removes it.
+    void setHitCount(int surfelIndex, int landmarkIndex, int hitCount);
     void removeAllHits();
     int getHitCount(int surfelIndex, int landmarkIndex) const;
     int size() const;
@@ -32,6 +34,14 @@ public:
     // confidence surfels.
     void deleteSurfelLandmarksAndRenumber(const std::vector<int>& sortedVertexIndicesToDelete);
     
+    // Deletes the landmarks of the given surfels without renumbering the rest, for surfels
+    // that were left as tombstones. The indices must be pre-sorted, as above.
+    void deleteSurfelLandmarks(const std::vector<int>& sortedSurfelIndicesToDelete);
+    
+    // Adds one surfel's hits to another's and deletes its own, for a surfel that was merged
+    // into another
+    void moveSurfelLandmarks(int fromSurfelIndex, int toSurfelIndex);
+    
     typedef std::map<int, std::unordered_map<int, int>>::const_iterator const_iterator;
     const_iterator begin() const;
     const_iterator end() const;
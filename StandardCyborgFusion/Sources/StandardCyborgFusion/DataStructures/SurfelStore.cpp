@@ -0,0 +1,238 @@
+//
+//  SurfelStore.cpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <algorithm>
+
+#import <standard_cyborg/util/TaskScheduler.hpp>
+
+#import "SurfelStore.hpp"
+
+using namespace standard_cyborg;
+
+// Shifts the elements that aren't removed down over the ones that are, one array at a time
+template <typename T>
+static void _removeSorted(std::vector<T>& values, const std::vector<int>& sortedIndices)
+{
+    if (sortedIndices.empty()) { return; }
+
+    size_t writeIndex = sortedIndices[0];
+    for (size_t i = 0; i < sortedIndices.size(); ++i) {
+        size_t runBegin = sortedIndices[i] + 1;
+        size_t runEnd = i + 1 < sortedIndices.size() ? sortedIndices[i + 1] : values.size();
+
+        std::move(values.begin() + runBegin, values.begin() + runEnd, values.begin() + writeIndex);
+        writeIndex += runEnd - runBegin;
+    }
+
+    values.resize(writeIndex);
+}
+
+void SurfelStore::clear()
+{
+    positions.clear();
+    normals.clear();
+    weights.clear();
+    colors.clear();
+    lifetimes.clear();
+    surfelSizes.clear();
+    tombstones.clear();
+    freeSlots.clear();
+}
+
+void SurfelStore::reserve(size_t count)
+{
+    positions.reserve(count);
+    normals.reserve(count);
+    weights.reserve(count);
+    colors.reserve(count);
+    lifetimes.reserve(count);
+    surfelSizes.reserve(count);
+    tombstones.reserve(count);
+}
+
+void SurfelStore::resize(size_t count)
+{
+    positions.resize(count);
+    normals.resize(count);
+    weights.resize(count);
+    colors.resize(count);
+    lifetimes.resize(count);
+    surfelSizes.resize(count);
+    tombstones.resize(count, 0);
+
+    while (!freeSlots.empty() && freeSlots.back() >= (int)count) {
+        freeSlots.pop_back();
+    }
+}
+
+Surfel SurfelStore::operator[](size_t index) const
+{
+    Surfel surfel;
+    surfel.position = positions[index];
+    surfel.normal = normals[index];
+    surfel.color = colors[index];
+    surfel.weight = weights[index];
+    surfel.lifetime = lifetimes[index];
+    surfel.surfelSize = surfelSizes[index];
+
+    return surfel;
+}
+
+void SurfelStore::set(size_t index, const Surfel& surfel)
+{
+    positions[index] = surfel.position;
+    normals[index] = surfel.normal;
+    colors[index] = surfel.color;
+    weights[index] = surfel.weight;
+    lifetimes[index] = surfel.lifetime;
+    surfelSizes[index] = surfel.surfelSize;
+}
+
+void SurfelStore::push_back(const Surfel& surfel)
+{
+    positions.push_back(surfel.position);
+    normals.push_back(surfel.normal);
+    colors.push_back(surfel.color);
+    weights.push_back(surfel.weight);
+    lifetimes.push_back(surfel.lifetime);
+    surfelSizes.push_back(surfel.surfelSize);
+    tombstones.push_back(0);
+}
+
+// Below this many elements, shifting in place is quicker than copying out in parallel
+static const size_t kParallelRemoveMinCount = 1 << 16;
+static const size_t kParallelRemoveBlockSize = 1 << 14;
+
+// Copies the elements that aren't removed into a fresh array, block by block in parallel. The
+// removed indices before a block say where its first survivor goes, so the blocks don't depend
+// on each other. Shifting in place can't be split up like this, since each run would overwrite
+// the end of the one before it before that was read.
+template <typename T>
+static void _removeSortedInParallel(std::vector<T>& values, const std::vector<int>& sortedIndices)
+{
+    if (sortedIndices.empty()) { return; }
+
+    std::vector<T> keptValues;
+    keptValues.reserve(values.capacity());
+    keptValues.resize(values.size() - sortedIndices.size());
+
+    util::TaskScheduler::shared().parallelFor(0, values.size(), kParallelRemoveBlockSize, [&](size_t blockBegin, size_t blockEnd) {
+        size_t removedIndex = std::lower_bound(sortedIndices.begin(), sortedIndices.end(), (int)blockBegin) - sortedIndices.begin();
+        size_t writeIndex = blockBegin - removedIndex;
+        size_t runBegin = blockBegin;
+
+        while (runBegin < blockEnd) {
+            size_t runEnd = removedIndex < sortedIndices.size() ? std::min((size_t)sortedIndices[removedIndex], blockEnd) : blockEnd;
+
+            std::copy(values.begin() + runBegin, values.begin() + runEnd, keptValues.begin() + writeIndex);
+            writeIndex += runEnd - runBegin;
+
+            // Step over the removed element the run stopped at, if it's in this block
+            runBegin = runEnd < blockEnd ? runEnd + 1 : blockEnd;
+            if (runEnd < blockEnd) { ++removedIndex; }
+        }
+    });
+
+    values.swap(keptValues);
+}
+
+template <typename T>
+static void _removeSortedElements(std::vector<T>& values, const std::vector<int>& sortedIndices)
+{
+    if (values.size() >= kParallelRemoveMinCount && util::TaskScheduler::shared().getWorkerCount() > 1) {
+        _removeSortedInParallel(values, sortedIndices);
+    } else {
+        _removeSorted(values, sortedIndices);
+    }
+}
+
+void SurfelStore::remove(const std::vector<int>& sortedIndices)
+{
+    _removeSortedElements(positions, sortedIndices);
+    _removeSortedElements(normals, sortedIndices);
+    _removeSortedElements(weights, sortedIndices);
+    _removeSortedElements(colors, sortedIndices);
+    _removeSortedElements(lifetimes, sortedIndices);
+    _removeSortedElements(surfelSizes, sortedIndices);
+    _removeSortedElements(tombstones, sortedIndices);
+
+    if (!freeSlots.empty()) {
+        freeSlots.clear();
+        for (size_t index = 0; index < tombstones.size(); ++index) {
+            if (tombstones[index]) { freeSlots.push_back((int)index); }
+        }
+    }
+}
+
+void SurfelStore::markRemoved(const std::vector<int>& sortedIndices)
+{
+    if (sortedIndices.empty()) { return; }
+
+    for (int index : sortedIndices) {
+        tombstones[index] = 1;
+    }
+
+    // Both lists are ascending, so merge rather than sort
+    size_t middle = freeSlots.size();
+    freeSlots.insert(freeSlots.end(), sortedIndices.begin(), sortedIndices.end());
+    std::inplace_merge(freeSlots.begin(), freeSlots.begin() + middle, freeSlots.end());
+}
+
+void SurfelStore::compact(std::vector<int>& removedIndicesOut)
+{
+    removedIndicesOut.swap(freeSlots);
+    freeSlots.clear();
+    remove(removedIndicesOut);
+}
+
+void SurfelStore::assign(const Surfels& surfels)
+{
+    tombstones.clear();
+    freeSlots.clear();
+    resize(surfels.size());
+
+    util::TaskScheduler::shared().parallelFor(0, surfels.size(), 0, [&](size_t begin, size_t end) {
+        for (size_t index = begin; index < end; ++index) {
+            set(index, surfels[index]);
+        }
+    });
+}
+
+void SurfelStore::copyTo(Surfels& surfelsOut) const
+{
+    if (!freeSlots.empty()) {
+        surfelsOut.clear();
+        surfelsOut.reserve(liveCount());
+        for (size_t index = 0; index < size(); ++index) {
+            if (!tombstones[index]) { surfelsOut.push_back((*this)[index]); }
+        }
+        return;
+    }
+
+    copySlotsTo(surfelsOut);
+}
+
+void SurfelStore::copySlotsTo(Surfels& surfelsOut) const
+{
+    surfelsOut.resize(size());
+
+    util::TaskScheduler::shared().parallelFor(0, size(), 0, [&](size_t begin, size_t end) {
+        for (size_t index = begin; index < end; ++index) {
+            surfelsOut[index] = (*this)[index];
+            if (tombstones[index]) { surfelsOut[index].surfelSize = 0; }
+        }
+    });
+}
+
+void SurfelIndexChanges::clear()
+{
+    updatedSurfelIndices.clear();
+    reusedSurfelIndices.clear();
+    firstAppendedSurfelIndex = 0;
+    removedSurfelIndices.clear();
+    compactedSurfelIndices.clear();
+}
@@ -0,0 +1,109 @@
+//
+//  SurfelStore.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <vector>
+
+#import "Surfel.hpp"
+
+/** The model's surfels, stored as a structure of arrays.
+ *
+ *  Position, normal and weight, which fusion, culling, ICP and splatting all read, each
+ *  get their own contiguous array. Color, lifetime and size are kept apart from them, so
+ *  passes over the geometry don't drag colors through the cache.
+ *
+ *  Removing a surfel leaves a tombstone in its slot rather than shifting everything after
+ *  it down. New surfels take over those slots first, and `compact` clears out whatever
+ *  tombstones are left all at once. Until then, indices of the other surfels stay put.
+ *
+ *  `Surfels`, an array of `Surfel` records, is still the format for Metal, file IO and the
+ *  public API. Convert with `assign` and `copyTo`.
+ */
+struct SurfelStore {
+    // Read by nearly every pass
+    std::vector<Vector3f> positions;
+    std::vector<Vector3f> normals;
+    std::vector<float> weights;
+
+    // Read only by fusion, culling and output
+    std::vector<Vector3f> colors;
+    std::vector<uint32_t> lifetimes;
+    std::vector<float> surfelSizes;
+
+    // Nonzero for slots that hold a tombstone
+    std::vector<uint8_t> tombstones;
+
+    // The slots that hold a tombstone, in ascending order
+    std::vector<int> freeSlots;
+
+    /** The number of slots, including tombstones */
+    size_t size() const { return positions.size(); }
+    bool empty() const { return positions.empty(); }
+
+    /** The number of surfels that aren't tombstones */
+    size_t liveCount() const { return positions.size() - freeSlots.size(); }
+
+    bool isRemoved(size_t index) const { return tombstones[index] != 0; }
+
+    void clear();
+    void reserve(size_t count);
+    void resize(size_t count);
+
+    /** Gathers the surfel at `index` into a record */
+    Surfel operator[](size_t index) const;
+
+    /** Scatters `surfel` into the arrays at `index` */
+    void set(size_t index, const Surfel& surfel);
+
+    void push_back(const Surfel& surfel);
+
+    /** Removes the surfels at the given indices, which must be in ascending order,
+     *  and shifts the rest down to fill the gaps, keeping them in order */
+    void remove(const std::vector<int>& sortedIndices);
+
+    /** Leaves tombstones at the given indices, which must be in ascending order and must not
+     *  already be tombstones. Their slots become free for new surfels. */
+    void markRemoved(const std::vector<int>& sortedIndices);
+
+    /** Removes every tombstone, shifting the surfels after them down, and sets
+     *  `removedIndicesOut` to the slots they were in, in ascending order */
+    void compact(std::vector<int>& removedIndicesOut);
+
+    /** Replaces the contents with the given surfel records */
+    void assign(const Surfels& surfels);
+
+    /** Packs the surfels into records, in order, leaving out tombstones */
+    void copyTo(Surfels& surfelsOut) const;
+
+    /** Packs every slot into a record so that indices still match, e.g. for drawing a surfel
+     *  index map. Tombstones are packed with a size of zero, which doesn't draw anything. */
+    void copySlotsTo(Surfels& surfelsOut) const;
+};
+
+/** How a fusion or cull changed which surfel is in which slot of a SurfelStore, for
+ *  anything that refers to surfels by index. The changes happen in the order listed. */
+struct SurfelIndexChanges {
+    // Existing surfels whose values were changed, e.g. by fusing samples into them, in
+    // ascending order
+    std::vector<int> updatedSurfelIndices;
+
+    // New surfels that took over the slots of tombstones, in ascending order
+    std::vector<int> reusedSurfelIndices;
+
+    // New surfels after the reused slots were used up were appended, starting here
+    size_t firstAppendedSurfelIndex = 0;
+
+    // Surfels that became tombstones, in ascending order
+    std::vector<int> removedSurfelIndices;
+
+    // If the tombstones were compacted away, the slots they were in, in ascending order.
+    // Every surfel after one of these moved down to fill the gap.
+    std::vector<int> compactedSurfelIndices;
+
+    void clear();
+};
@@ -74,6 +74,8 @@ Eigen::Matrix3f NormalMatrixFromMat4(const Eigen::Matrix4f& a) {
     return result;
 }
 
+#if defined(__APPLE__)
+
 simd_float3x3 toSimdFloat3x3(const Eigen::Matrix3f& m) {
     simd_float3x3 result;
     result.columns[0].x = m.col(0).x();
@@ -173,6 +175,8 @@ extern Eigen::Matrix4f toMatrix4f(const simd_float4x4 m) {
     return result;
 }
 
+#endif
+
 void FillEigenMatrix3XfFromRGBVector(Eigen::Matrix3Xf& matrixOut, const std::vector<uint8_t>& vector, float multiplier) {
     assert(matrixOut.cols() > 0);
     const float gammaCorrection = 1.0;
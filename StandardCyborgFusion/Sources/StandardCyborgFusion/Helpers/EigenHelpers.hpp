@@ -7,11 +7,14 @@
 
 #pragma once
 
-#import <simd/simd.h>
 #import <vector>
 #import <standard_cyborg/util/IncludeEigen.hpp>
 #import "Surfel.hpp"
 
+#if defined(__APPLE__)
+#import <simd/simd.h>
+#endif
+
 namespace Eigen {
     typedef Matrix<uint32_t, 1, Dynamic> VectorXu;
 };
@@ -19,6 +22,9 @@ namespace Eigen {
 extern Eigen::Vector3f Vec3TransformMat4(Eigen::Vector3f a, const Eigen::Matrix4f& m);
 extern Eigen::Matrix3f NormalMatrixFromMat4(const Eigen::Matrix4f& a);
 
+// The simd conversions are for the Metal side, which only builds on Apple platforms. The CPU
+// paths that include this don't use them, so they build elsewhere too.
+#if defined(__APPLE__)
 // Eigen --> simd
 extern simd_float3x3 toSimdFloat3x3(const Eigen::Matrix3f& m);
 extern simd_float4x4 toSimdFloat4x4(const Eigen::Matrix4f& m);
@@ -27,6 +33,7 @@ extern simd_float4x4 toSimdFloat4x4(const Eigen::Matrix4f& m);
 extern Eigen::Matrix3f toMatrix3f(const simd_float3x3 m);
 extern Eigen::Matrix4f toMatrix4f(const simd_float4x3 m);
 extern Eigen::Matrix4f toMatrix4f(const simd_float4x4 m);
+#endif
 
 extern void FillEigenMatrix3XfFromRGBVector(Eigen::Matrix3Xf& matrixOut, const std::vector<uint8_t>& vector, float multiplier = 1);
 
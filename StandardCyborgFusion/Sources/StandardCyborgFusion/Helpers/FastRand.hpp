@@ -18,6 +18,12 @@ public:
         _seed = seed;
     }
     
+    /** Where the sequence is up to, which `seed` carries on from */
+    unsigned int state() const
+    {
+        return _seed;
+    }
+    
     inline int sample(int range)
     {
         _seed = 214013 * _seed + 2531011;
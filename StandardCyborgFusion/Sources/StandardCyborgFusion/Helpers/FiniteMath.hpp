@@ -0,0 +1,27 @@
+//
+//  FiniteMath.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <cstdint>
+#import <cstring>
+
+/** Whether a float is neither NaN nor infinite, judged by its exponent bits.
+ *
+ *  This target builds with -ffast-math, under which the compiler may assume that no float is
+ *  ever NaN or infinite, and fold away std::isfinite, std::isnan, and comparisons that only
+ *  NaN would fail. Clang also knows this bit pattern test for what it is, so the bits pass
+ *  through an empty asm statement first, which the optimizer can't see through.
+ */
+inline bool isFiniteFloat(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    __asm__("" : "+r"(bits));
+
+    return (bits & 0x7f800000u) != 0x7f800000u;
+}
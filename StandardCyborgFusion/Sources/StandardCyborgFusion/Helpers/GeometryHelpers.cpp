@@ -36,6 +36,8 @@ float angleBetweenVectors(Eigen::Vector3f a, Eigen::Vector3f b) {
     return acosf(a.dot(b) / a.norm() / b.norm());
 }
 
+#if defined(__APPLE__)
+
 // SC --> simd
 
 simd_float2 toSimdFloat2(math::Vec2 v) {
@@ -143,6 +145,8 @@ math::Mat3x4 toMat3x4(simd_float4x4 m) {
     );
 }
 
+#endif
+
 Eigen::Matrix3f rotationFromEulerAngles(const Eigen::Vector3f& alphaBetaGamma) {
     // Beware that this is *not* a general function and carries with it a very specific
     // set of asumptions about the ordering of rotations. It is derived from the following
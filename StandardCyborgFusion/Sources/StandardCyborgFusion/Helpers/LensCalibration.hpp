@@ -0,0 +1,77 @@
+//
+//  LensCalibration.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <algorithm>
+#import <cmath>
+
+#import <standard_cyborg/sc3d/PerspectiveCamera.hpp>
+
+using namespace standard_cyborg;
+
+// CPU counterpart of ApplyLensCalibration.metal. The CPU depth processor and
+// surfel index map use this so that their output lines up with the Metal kernels.
+struct LensCalibration {
+    float constants[4] = {0, 0, 0, 0};
+    float opticalImageSize[2] = {1, 1};
+    float opticalImageCenter[2] = {0, 0};
+    float maxRadius = 1;
+
+    LensCalibration() {}
+
+    LensCalibration(const math::Vec4& lensCalibrationConstants, const sc3d::PerspectiveCamera& camera)
+    {
+        const math::Vec2 size = camera.getIntrinsicMatrixReferenceSize();
+        const math::Vec2 center = camera.getOpticalImageCenter();
+
+        constants[0] = lensCalibrationConstants.x;
+        constants[1] = lensCalibrationConstants.y;
+        constants[2] = lensCalibrationConstants.z;
+        constants[3] = lensCalibrationConstants.w;
+        opticalImageSize[0] = size.x;
+        opticalImageSize[1] = size.y;
+        opticalImageCenter[0] = center.x;
+        opticalImageCenter[1] = center.y;
+        maxRadius = camera.getOpticalImageMaxRadius();
+    }
+
+    /** Calibration which undistorts projected points, as used when rendering surfels */
+    static LensCalibration inverse(const sc3d::PerspectiveCamera& camera)
+    {
+        return LensCalibration(camera.getInverseLensDistortionCurveFit(), camera);
+    }
+
+    /** Calibration which distorts image points, as used when unprojecting depth */
+    static LensCalibration forward(const sc3d::PerspectiveCamera& camera)
+    {
+        return LensCalibration(camera.getLensDistortionCurveFit(), camera);
+    }
+
+    inline float distortionCurve(float x) const
+    {
+        return x * x * (constants[0] + x * (constants[1] + x * (constants[2] + x * constants[3])));
+    }
+
+    /** Applies the calibration in place to a point in normalized device coordinates */
+    inline void apply(float& x, float& y) const
+    {
+        // Determine the vector from the optical center to the given point.
+        float xRelative = (0.5f + 0.5f * x) * opticalImageSize[0] - opticalImageCenter[0];
+        float yRelative = (0.5f + 0.5f * y) * opticalImageSize[1] - opticalImageCenter[1];
+
+        // Determine the radius of the given point.
+        float radius = std::min(std::sqrt(xRelative * xRelative + yRelative * yRelative), maxRadius);
+
+        // Compute the magnification from a curve fit of the lookup table
+        float magnification = distortionCurve(radius / maxRadius);
+
+        // Apply the magnification
+        x = ((opticalImageCenter[0] + xRelative * (1.0f + magnification)) / opticalImageSize[0]) * 2.0f - 1.0f;
+        y = ((opticalImageCenter[1] + yRelative * (1.0f + magnification)) / opticalImageSize[1]) * 2.0f - 1.0f;
+    }
+};
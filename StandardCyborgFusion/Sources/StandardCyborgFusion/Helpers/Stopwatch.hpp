@@ -0,0 +1,39 @@
+//
+//  Stopwatch.hpp
+//  StandardCyborgFusion
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#pragma once
+
+#import <chrono>
+
+/** Times stages of the pipeline on a monotonic clock, which doesn't jump around when the
+ *  wall clock is adjusted */
+class Stopwatch {
+public:
+    Stopwatch() :
+        _startTime(std::chrono::steady_clock::now())
+    {}
+
+    /** Seconds since it was created or last lapped */
+    double elapsedSeconds() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - _startTime).count();
+    }
+
+    /** Returns the seconds since it was created or last lapped, and starts timing again from
+     *  now, for timing consecutive stages */
+    double lap()
+    {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        double seconds = std::chrono::duration<double>(now - _startTime).count();
+        _startTime = now;
+
+        return seconds;
+    }
+
+private:
+    std::chrono::steady_clock::time_point _startTime;
+};
@@ -207,7 +207,7 @@ std::unique_ptr<RawFrame> PointCloudIO::ReadRawFrameFromBPLYFile(std::string fil
     
     fclose(fileHandle);
     
-    std::unique_ptr<RawFrame> rawFrame(new RawFrame(camera, width, height, depthValues, colorValues, timestamp));
+    std::unique_ptr<RawFrame> rawFrame(new RawFrame(camera, width, height, std::move(depthValues), std::move(colorValues), timestamp));
     
     return rawFrame;
 }
@@ -20,6 +20,7 @@
 #import "ProcessedFrame.hpp"
 #import "RawFrame.hpp"
 #import "SmoothDepthKernel.h"
+#import "Stopwatch.hpp"
 
 
 MetalDepthProcessor::MetalDepthProcessor(id<MTLDevice> device, id<MTLLibrary> library, id<MTLCommandQueue> commandQueue) {
@@ -43,6 +44,7 @@ void MetalDepthProcessor::computeFrameValues(ProcessedFrame &frame,
                                              const RawFrame &rawFrame,
                                              bool smoothPoints)
 {
+    Stopwatch stopwatch;
     const sc3d::PerspectiveCamera& camera = rawFrame.camera;
     size_t width = rawFrame.width;
     size_t height = rawFrame.height;
@@ -90,4 +92,6 @@ void MetalDepthProcessor::computeFrameValues(ProcessedFrame &frame,
                              frame.inputConfidences);
     
     [_computeEngine runWithDepthProcessorData:_depthProcessorData];
+    
+    frame.depthProcessingDuration = stopwatch.elapsedSeconds();
 }
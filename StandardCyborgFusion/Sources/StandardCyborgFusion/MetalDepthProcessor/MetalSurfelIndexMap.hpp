@@ -17,6 +17,13 @@ public:
                       const RawFrame& rawFrame,
                       std::vector<uint32_t> & indexLookups);
     
+    /** Binds the store's position, normal, size and tombstone arrays as buffers of their own,
+     *  so that drawing doesn't pack the surfels into records first */
+    virtual bool draw(const SurfelStore& surfels,
+                      const Eigen::Matrix4f& modelMatrix,
+                      const RawFrame& rawFrame,
+                      std::vector<uint32_t> & indexLookups);
+    
     virtual bool drawForColor(const Surfel* surfels,
                               size_t surfelCount,
                               Eigen::Matrix4f viewProjectionMatrix,
@@ -32,6 +39,7 @@ private:
     id<MTLLibrary> _library;
     id<MTLCommandQueue> _commandQueue;
     id<MTLRenderPipelineState> _pipelineState;
+    id<MTLRenderPipelineState> _storePipelineState;
     id<MTLBuffer> _vertexBuffer;
     id<MTLBuffer> _sharedUniformsBuffer;
     simd_float4x4 _lastViewProjectionMatrix;
@@ -41,6 +49,13 @@ private:
     
     id<MTLBuffer> _createVertexBuffer();
     id<MTLBuffer> _createSurfelsBufferFromSurfels(const std::vector<Surfel>& surfels);
+    id<MTLBuffer> _bufferWithArray(const void *bytes, size_t length, NSString *label);
+    id<MTLRenderPipelineState> _createPipelineState(NSString *vertexFunctionName, NSString *label);
+    bool _drawInstances(id<MTLRenderPipelineState> pipelineState,
+                        NSArray<id<MTLBuffer>> *instanceBuffers,
+                        size_t instanceCount,
+                        const RawFrame& rawFrame,
+                        std::vector<uint32_t>& indexLookups);
     void _updateSharedUniformsBuffer(const RawFrame& frame, const Eigen::Matrix4f& modelMatrix);
     void _updateSharedUniformsBufferForColor(Eigen::Matrix4f viewProjection);
 };
@@ -7,6 +7,7 @@
 
 #import <CoreGraphics/CoreGraphics.h>
 #import <iostream>
+#import <unistd.h>
 #import <standard_cyborg/util/DataUtils.hpp>
 
 #import "crc32.hpp"
@@ -66,27 +67,9 @@ MetalSurfelIndexMap::MetalSurfelIndexMap(id<MTLDevice> device, id<MTLLibrary> li
     _library(library),
     _commandQueue(commandQueue)
 {
-    id<MTLFunction> vertexFunction = [_library newFunctionWithName:forColor ? @"SurfelIndexMapForColorVertex" : @"SurfelIndexMapVertex"];
-    id<MTLFunction> fragmentFunction = [_library newFunctionWithName:@"SurfelIndexMapFragment"];
-    
-    MTLVertexDescriptor *vertexDescriptor = [MTLVertexDescriptor vertexDescriptor];
-    vertexDescriptor.attributes[0].format = MTLVertexFormatFloat2;
-    vertexDescriptor.attributes[0].offset = 0;
-    vertexDescriptor.attributes[0].bufferIndex = 0;
-    vertexDescriptor.layouts[0].stepFunction = MTLVertexStepFunctionPerVertex;
-    vertexDescriptor.layouts[0].stride = sizeof(SurfelIndexMapVertex);
-    
-    MTLRenderPipelineDescriptor *pipelineDescriptor = [[MTLRenderPipelineDescriptor alloc] init];
-    pipelineDescriptor.vertexFunction = vertexFunction;
-    pipelineDescriptor.fragmentFunction = fragmentFunction;
-    pipelineDescriptor.vertexDescriptor = vertexDescriptor;
-    pipelineDescriptor.colorAttachments[0].pixelFormat = MTLPixelFormatR32Uint;
-    pipelineDescriptor.depthAttachmentPixelFormat = MTLPixelFormatDepth32Float;
-    pipelineDescriptor.label = @"SurfelIndexMap._pipelineState";
-    
-    NSError *error = nil;
-    _pipelineState = [_device newRenderPipelineStateWithDescriptor:pipelineDescriptor error:&error];
-    if (_pipelineState == nil) { NSLog(@"Unable to create pipeline state: %@", error); }
+    _pipelineState = this->_createPipelineState(forColor ? @"SurfelIndexMapForColorVertex" : @"SurfelIndexMapVertex",
+                                                @"SurfelIndexMap._pipelineState");
+    _storePipelineState = this->_createPipelineState(@"SurfelIndexMapStoreVertex", @"SurfelIndexMap._storePipelineState");
     
     MTLDepthStencilDescriptor *depthStencilDescriptor = [[MTLDepthStencilDescriptor alloc] init];
     depthStencilDescriptor.depthCompareFunction = MTLCompareFunctionLess;
@@ -105,121 +88,47 @@ bool MetalSurfelIndexMap::draw(const std::vector<Surfel>& surfels,
                                const RawFrame& rawFrame,
                                std::vector<uint32_t>& indexLookups)
 {
-    bool success = true;
-    
     this->_updateSharedUniformsBuffer(rawFrame, modelMatrix);
     
     size_t surfelCount = surfels.size();
-    if (surfelCount == 0) { return success; }
-    
-    if (_indexTexture == nil || _indexTexture.width != rawFrame.width) {
-        MTLTextureDescriptor *descriptor = [MTLTextureDescriptor texture2DDescriptorWithPixelFormat:MTLPixelFormatR32Uint
-                                                                                              width:rawFrame.width
-                                                                                             height:rawFrame.height
-                                                                                          mipmapped:NO];
-        
-        // On iOS devices, we write directly into indexLookups via a shared memory buffer
-        // On Mac devices, we have to copy it after the fact
-#if TARGET_OS_OSX
-        descriptor.usage = MTLResourceUsageWrite|MTLTextureUsageRenderTarget;
-        _indexTexture = [_device newTextureWithDescriptor:descriptor];
-#else
-        descriptor.usage = MTLTextureUsageRenderTarget;
-        descriptor.storageMode = MTLStorageModeShared;
-        size_t length = __roundUpToMultiple(rawFrame.width * rawFrame.height * sizeof(uint32_t), 4096);
-        id<MTLBuffer> indexTextureBuffer = [_device newBufferWithBytesNoCopy:(void *)indexLookups.data()
-                                                                      length:length
-                                                                     options:MTLResourceStorageModeShared
-                                                                 deallocator:^(void * _Nonnull pointer, NSUInteger length) {}];
-        // Create a texture backed by this buffer
-        _indexTexture = [indexTextureBuffer newTextureWithDescriptor:descriptor
-                                                              offset:0
-                                                         bytesPerRow:rawFrame.width * sizeof(uint32_t)];
-#endif
-        _indexTexture.label = @"SurfelIndexMap._indexTexture";
-    }
+    if (surfelCount == 0) { return true; }
     
-    if (_depthTexture == nil || _depthTexture.width != rawFrame.width) {
-        MTLTextureDescriptor *descriptor = [MTLTextureDescriptor texture2DDescriptorWithPixelFormat:MTLPixelFormatDepth32Float
-                                                                                              width:rawFrame.width
-                                                                                             height:rawFrame.height
-                                                                                          mipmapped:NO];
-        descriptor.usage = MTLTextureUsageRenderTarget;
-        descriptor.storageMode = MTLStorageModePrivate;
-        _depthTexture = [_device newTextureWithDescriptor:descriptor];
-        _depthTexture.label = @"SurfelIndexMap._depthTexture";
-    }
-    
-    id<MTLBuffer> surfelsBuffer = nil;
-    if (surfelCount > 0) {
-        surfelsBuffer = [_device newBufferWithBytesNoCopy:(void *)&surfels[0]
-                                                   length:roundUpToMultiple(sizeof(Surfel) * surfels.size(), 4096)
-                                                  options:0
-                                              deallocator:NULL];
-        surfelsBuffer.label = @"SurfelIndexMap.surfelsBuffer";
-    }
-    
-    MTLRenderPassDescriptor *passDescriptor = [MTLRenderPassDescriptor renderPassDescriptor];
-    passDescriptor.colorAttachments[0].texture = _indexTexture;
-    passDescriptor.colorAttachments[0].clearColor = MTLClearColorMake(EMPTY_SURFEL_INDEX, 0, 0, 0);
-    passDescriptor.colorAttachments[0].storeAction = MTLStoreActionStore;
-    passDescriptor.colorAttachments[0].loadAction = MTLLoadActionClear;
-    
-    passDescriptor.depthAttachment.texture = _depthTexture;
-    passDescriptor.depthAttachment.loadAction = MTLLoadActionClear;
-    passDescriptor.depthAttachment.storeAction = MTLStoreActionDontCare;
-    passDescriptor.depthAttachment.clearDepth = 1.0;
-    
-    id<MTLCommandBuffer> commandBuffer = [_commandQueue commandBuffer];
-    id<MTLRenderCommandEncoder> commandEncoder = [commandBuffer renderCommandEncoderWithDescriptor:passDescriptor];
-    commandBuffer.label = @"SurfelIndexMap.commandBuffer";
-    commandEncoder.label = @"SurfelIndexMap.commandEncoder";
-    
-    if (surfelCount > 0 && surfelsBuffer != nil) {
-        [commandEncoder setRenderPipelineState:_pipelineState];
-        [commandEncoder setViewport:(MTLViewport){ 0, 0, (double)rawFrame.width, (double)rawFrame.height, -1, 1 }];
-        [commandEncoder setDepthStencilState:_depthStencilState];
-        [commandEncoder setFrontFacingWinding:MTLWindingCounterClockwise];
-        [commandEncoder setCullMode:MTLCullModeBack];
-        [commandEncoder setVertexBuffer:_vertexBuffer offset:0 atIndex:0];
-        [commandEncoder setVertexBuffer:_sharedUniformsBuffer offset:0 atIndex:1];
-        [commandEncoder setVertexBuffer:surfelsBuffer offset:0 atIndex:2];
-        [commandEncoder drawPrimitives:MTLPrimitiveTypeTriangleStrip vertexStart:0 vertexCount:6 instanceCount:surfelCount];
-    }
-    
-    if (surfelCount > 0 && surfelsBuffer == nil) {
+    id<MTLBuffer> surfelsBuffer = this->_bufferWithArray(surfels.data(), sizeof(Surfel) * surfelCount, @"SurfelIndexMap.surfelsBuffer");
+    if (surfelsBuffer == nil) {
         DEBUG_LOG("Failed to render surfel cloud! %zu surfels in buffer %lx, but surfelsBuffer was nil", surfelCount, (unsigned long)&surfels);
-        success = false;
+        return false;
     }
     
-    [commandEncoder endEncoding];
+    return this->_drawInstances(_pipelineState, @[surfelsBuffer], surfelCount, rawFrame, indexLookups);
+}
+
+bool MetalSurfelIndexMap::draw(const SurfelStore& surfels,
+                               const Matrix4f& modelMatrix,
+                               const RawFrame& rawFrame,
+                               std::vector<uint32_t>& indexLookups)
+{
+    this->_updateSharedUniformsBuffer(rawFrame, modelMatrix);
     
-    // Using the blit encoder on MacOS only seems necessary for GPUs with discrete memory (e.g. ATI),
-    // and doing so on shared memory GPU architectures (e.g. Intel) breaks things.
-    // Although there's no direct "is shared memory" flag, isLowPower does the trick well enough.
-#if TARGET_OS_OSX
-    if ([_device isLowPower] == NO) {
-        id<MTLBlitCommandEncoder> blitEncoder = [commandBuffer blitCommandEncoder];
-        [blitEncoder synchronizeTexture:_indexTexture slice:0 level:0];
-        [blitEncoder endEncoding];
+    size_t surfelCount = surfels.size();
+    if (surfelCount == 0) { return true; }
+    
+    // Eigen's Vector3f is three tightly packed floats, which is what the shader reads as packed_float3
+    static_assert(sizeof(Vector3f) == 3 * sizeof(float), "Surfel positions and normals must be packed");
+    
+    id<MTLBuffer> positionsBuffer = this->_bufferWithArray(surfels.positions.data(), sizeof(Vector3f) * surfelCount, @"SurfelIndexMap.positionsBuffer");
+    id<MTLBuffer> normalsBuffer = this->_bufferWithArray(surfels.normals.data(), sizeof(Vector3f) * surfelCount, @"SurfelIndexMap.normalsBuffer");
+    id<MTLBuffer> surfelSizesBuffer = this->_bufferWithArray(surfels.surfelSizes.data(), sizeof(float) * surfelCount, @"SurfelIndexMap.surfelSizesBuffer");
+    id<MTLBuffer> tombstonesBuffer = this->_bufferWithArray(surfels.tombstones.data(), sizeof(uint8_t) * surfelCount, @"SurfelIndexMap.tombstonesBuffer");
+    if (positionsBuffer == nil || normalsBuffer == nil || surfelSizesBuffer == nil || tombstonesBuffer == nil) {
+        DEBUG_LOG("Failed to render surfel cloud! %zu surfels in store %lx, but a buffer was nil", surfelCount, (unsigned long)&surfels);
+        return false;
     }
-#endif
-    
-    [commandBuffer commit];
-    [commandBuffer waitUntilCompleted];
     
-    // On iOS devices, we've written directly into indexLookups, so no need to copy the result back out
-#if TARGET_OS_OSX
-    [_indexTexture getBytes:indexLookups.data()
-                bytesPerRow:rawFrame.width * sizeof(uint32_t)
-                 fromRegion:MTLRegionMake2D(0, 0, rawFrame.width, rawFrame.height)
-                mipmapLevel:0];
-#endif
-
-//    uint32_t checksum = crc32((void*)indexLookups.data(), indexLookups.size() * sizeof(float));
-//    std::cout << "\tsurfel index lookup checksum = " << std::hex << checksum << std::dec << std::endl;
-    
-    return success;
+    return this->_drawInstances(_storePipelineState,
+                                @[positionsBuffer, normalsBuffer, surfelSizesBuffer, tombstonesBuffer],
+                                surfelCount,
+                                rawFrame,
+                                indexLookups);
 }
 
 bool MetalSurfelIndexMap::drawForColor(const Surfel* surfels,
@@ -355,6 +264,154 @@ id<MTLBuffer> MetalSurfelIndexMap::_createVertexBuffer() {
     return [_device newBufferWithBytes:kHexVertices length:sizeof(kHexVertices) options:0];
 }
 
+id<MTLRenderPipelineState> MetalSurfelIndexMap::_createPipelineState(NSString *vertexFunctionName, NSString *label) {
+    id<MTLFunction> vertexFunction = [_library newFunctionWithName:vertexFunctionName];
+    id<MTLFunction> fragmentFunction = [_library newFunctionWithName:@"SurfelIndexMapFragment"];
+    
+    MTLVertexDescriptor *vertexDescriptor = [MTLVertexDescriptor vertexDescriptor];
+    vertexDescriptor.attributes[0].format = MTLVertexFormatFloat2;
+    vertexDescriptor.attributes[0].offset = 0;
+    vertexDescriptor.attributes[0].bufferIndex = 0;
+    vertexDescriptor.layouts[0].stepFunction = MTLVertexStepFunctionPerVertex;
+    vertexDescriptor.layouts[0].stride = sizeof(SurfelIndexMapVertex);
+    
+    MTLRenderPipelineDescriptor *pipelineDescriptor = [[MTLRenderPipelineDescriptor alloc] init];
+    pipelineDescriptor.vertexFunction = vertexFunction;
+    pipelineDescriptor.fragmentFunction = fragmentFunction;
+    pipelineDescriptor.vertexDescriptor = vertexDescriptor;
+    pipelineDescriptor.colorAttachments[0].pixelFormat = MTLPixelFormatR32Uint;
+    pipelineDescriptor.depthAttachmentPixelFormat = MTLPixelFormatDepth32Float;
+    pipelineDescriptor.label = label;
+    
+    NSError *error = nil;
+    id<MTLRenderPipelineState> pipelineState = [_device newRenderPipelineStateWithDescriptor:pipelineDescriptor error:&error];
+    if (pipelineState == nil) { NSLog(@"Unable to create pipeline state: %@", error); }
+    
+    return pipelineState;
+}
+
+id<MTLBuffer> MetalSurfelIndexMap::_bufferWithArray(const void *bytes, size_t length, NSString *label) {
+    // Wrap the array without copying it, as MetalDepthProcessorData does. Metal only allows
+    // that for page-aligned memory, which large allocations are, so copy anything else.
+    const size_t pageSize = (size_t)getpagesize();
+    id<MTLBuffer> buffer = nil;
+    if ((uintptr_t)bytes % pageSize == 0) {
+        buffer = [_device newBufferWithBytesNoCopy:(void *)bytes
+                                            length:roundUpToMultiple(length, pageSize)
+                                           options:0
+                                       deallocator:NULL];
+    }
+    if (buffer == nil) {
+        buffer = [_device newBufferWithBytes:bytes length:length options:0];
+    }
+    buffer.label = label;
+    
+    return buffer;
+}
+
+bool MetalSurfelIndexMap::_drawInstances(id<MTLRenderPipelineState> pipelineState,
+                                         NSArray<id<MTLBuffer>> *instanceBuffers,
+                                         size_t instanceCount,
+                                         const RawFrame& rawFrame,
+                                         std::vector<uint32_t>& indexLookups)
+{
+    if (_indexTexture == nil || _indexTexture.width != rawFrame.width) {
+        MTLTextureDescriptor *descriptor = [MTLTextureDescriptor texture2DDescriptorWithPixelFormat:MTLPixelFormatR32Uint
+                                                                                              width:rawFrame.width
+                                                                                             height:rawFrame.height
+                                                                                          mipmapped:NO];
+        
+        // On iOS devices, we write directly into indexLookups via a shared memory buffer
+        // On Mac devices, we have to copy it after the fact
+#if TARGET_OS_OSX
+        descriptor.usage = MTLResourceUsageWrite|MTLTextureUsageRenderTarget;
+        _indexTexture = [_device newTextureWithDescriptor:descriptor];
+#else
+        descriptor.usage = MTLTextureUsageRenderTarget;
+        descriptor.storageMode = MTLStorageModeShared;
+        size_t length = __roundUpToMultiple(rawFrame.width * rawFrame.height * sizeof(uint32_t), 4096);
+        id<MTLBuffer> indexTextureBuffer = [_device newBufferWithBytesNoCopy:(void *)indexLookups.data()
+                                                                      length:length
+                                                                     options:MTLResourceStorageModeShared
+                                                                 deallocator:^(void * _Nonnull pointer, NSUInteger length) {}];
+        // Create a texture backed by this buffer
+        _indexTexture = [indexTextureBuffer newTextureWithDescriptor:descriptor
+                                                              offset:0
+                                                         bytesPerRow:rawFrame.width * sizeof(uint32_t)];
+#endif
+        _indexTexture.label = @"SurfelIndexMap._indexTexture";
+    }
+    
+    if (_depthTexture == nil || _depthTexture.width != rawFrame.width) {
+        MTLTextureDescriptor *descriptor = [MTLTextureDescriptor texture2DDescriptorWithPixelFormat:MTLPixelFormatDepth32Float
+                                                                                              width:rawFrame.width
+                                                                                             height:rawFrame.height
+                                                                                          mipmapped:NO];
+        descriptor.usage = MTLTextureUsageRenderTarget;
+        descriptor.storageMode = MTLStorageModePrivate;
+        _depthTexture = [_device newTextureWithDescriptor:descriptor];
+        _depthTexture.label = @"SurfelIndexMap._depthTexture";
+    }
+    
+    MTLRenderPassDescriptor *passDescriptor = [MTLRenderPassDescriptor renderPassDescriptor];
+    passDescriptor.colorAttachments[0].texture = _indexTexture;
+    passDescriptor.colorAttachments[0].clearColor = MTLClearColorMake(EMPTY_SURFEL_INDEX, 0, 0, 0);
+    passDescriptor.colorAttachments[0].storeAction = MTLStoreActionStore;
+    passDescriptor.colorAttachments[0].loadAction = MTLLoadActionClear;
+    
+    passDescriptor.depthAttachment.texture = _depthTexture;
+    passDescriptor.depthAttachment.loadAction = MTLLoadActionClear;
+    passDescriptor.depthAttachment.storeAction = MTLStoreActionDontCare;
+    passDescriptor.depthAttachment.clearDepth = 1.0;
+    
+    id<MTLCommandBuffer> commandBuffer = [_commandQueue commandBuffer];
+    id<MTLRenderCommandEncoder> commandEncoder = [commandBuffer renderCommandEncoderWithDescriptor:passDescriptor];
+    commandBuffer.label = @"SurfelIndexMap.commandBuffer";
+    commandEncoder.label = @"SurfelIndexMap.commandEncoder";
+    
+    [commandEncoder setRenderPipelineState:pipelineState];
+    [commandEncoder setViewport:(MTLViewport){ 0, 0, (double)rawFrame.width, (double)rawFrame.height, -1, 1 }];
+    [commandEncoder setDepthStencilState:_depthStencilState];
+    [commandEncoder setFrontFacingWinding:MTLWindingCounterClockwise];
+    [commandEncoder setCullMode:MTLCullModeBack];
+    [commandEncoder setVertexBuffer:_vertexBuffer offset:0 atIndex:0];
+    [commandEncoder setVertexBuffer:_sharedUniformsBuffer offset:0 atIndex:1];
+    // The per-surfel buffers follow the uniforms, in the order the vertex function takes them
+    for (NSUInteger i = 0; i < instanceBuffers.count; ++i) {
+        [commandEncoder setVertexBuffer:instanceBuffers[i] offset:0 atIndex:2 + i];
+    }
+    [commandEncoder drawPrimitives:MTLPrimitiveTypeTriangleStrip vertexStart:0 vertexCount:6 instanceCount:instanceCount];
+    
+    [commandEncoder endEncoding];
+    
+    // Using the blit encoder on MacOS only seems necessary for GPUs with discrete memory (e.g. ATI),
+    // and doing so on shared memory GPU architectures (e.g. Intel) breaks things.
+    // Although there's no direct "is shared memory" flag, isLowPower does the trick well enough.
+#if TARGET_OS_OSX
+    if ([_device isLowPower] == NO) {
+        id<MTLBlitCommandEncoder> blitEncoder = [commandBuffer blitCommandEncoder];
+        [blitEncoder synchronizeTexture:_indexTexture slice:0 level:0];
+        [blitEncoder endEncoding];
+    }
+#endif
+    
+    [commandBuffer commit];
+    [commandBuffer waitUntilCompleted];
+    
+    // On iOS devices, we've written directly into indexLookups, so no need to copy the result back out
+#if TARGET_OS_OSX
+    [_indexTexture getBytes:indexLookups.data()
+                bytesPerRow:rawFrame.width * sizeof(uint32_t)
+                 fromRegion:MTLRegionMake2D(0, 0, rawFrame.width, rawFrame.height)
+                mipmapLevel:0];
+#endif
+
+//    uint32_t checksum = crc32((void*)indexLookups.data(), indexLookups.size() * sizeof(float));
+//    std::cout << "\tsurfel index lookup checksum = " << std::hex << checksum << std::dec << std::endl;
+    
+    return true;
+}
+
 void MetalSurfelIndexMap::_updateSharedUniformsBuffer(const RawFrame& frame, const Matrix4f& modelMatrix) {
     SurfelIndexMapSharedUniforms sharedUniforms(frame, modelMatrix);
     memcpy([_sharedUniformsBuffer contents], &sharedUniforms, sizeof(SurfelIndexMapSharedUniforms));
@@ -33,15 +33,14 @@ struct FragmentOutput {
     uint color0 [[color(0)]];
 };
 
-vertex ProjectedVertex SurfelIndexMapVertex(Vertex v [[stage_in]],
-                                            constant Uniforms *uniforms [[buffer(1)]],
-                                            constant Surfel *surfels [[buffer(2)]],
-                                            uint iid [[instance_id]])
+// Places a corner of the hexagon around a surfel, and projects it through the camera's lens
+static inline ProjectedVertex projectSurfelVertex(float2 corner,
+                                                  float3 position,
+                                                  float3 normal,
+                                                  float surfelSize,
+                                                  constant Uniforms *uniforms,
+                                                  uint iid)
 {
-    Surfel instance = surfels[iid];
-    
-    float3 normal = instance.normal;
-    
     // Assuming we cross the normal with the vector (0, 1, 0), we can save few
     // multiplications by zero and simply use:
     //
@@ -59,7 +58,7 @@ vertex ProjectedVertex SurfelIndexMapVertex(Vertex v [[stage_in]],
     // The bitangent is the *other* surface tangent vector.
     float3 bitangent = cross(normal, tangent);
     
-    float3 p = instance.position + (v.position.x * tangent + v.position.y * bitangent) * instance.surfelSize * uniforms->surfelAliasingSafetyFactor;
+    float3 p = position + (corner.x * tangent + corner.y * bitangent) * surfelSize * uniforms->surfelAliasingSafetyFactor;
     
     // Apply the lens calibration. This section is not currently translated into the projection matrix
     // style, but it's not *so* important that it's worth fixing up front.
@@ -73,6 +72,31 @@ vertex ProjectedVertex SurfelIndexMapVertex(Vertex v [[stage_in]],
     };
 }
 
+vertex ProjectedVertex SurfelIndexMapVertex(Vertex v [[stage_in]],
+                                            constant Uniforms *uniforms [[buffer(1)]],
+                                            constant Surfel *surfels [[buffer(2)]],
+                                            uint iid [[instance_id]])
+{
+    Surfel instance = surfels[iid];
+    
+    return projectSurfelVertex(v.position, instance.position, instance.normal, instance.surfelSize, uniforms, iid);
+}
+
+// The same, reading a SurfelStore's arrays rather than Surfel records. A tombstone gets
+// a size of zero, so its hexagon has no area and doesn't draw.
+vertex ProjectedVertex SurfelIndexMapStoreVertex(Vertex v [[stage_in]],
+                                                 constant Uniforms *uniforms [[buffer(1)]],
+                                                 constant packed_float3 *positions [[buffer(2)]],
+                                                 constant packed_float3 *normals [[buffer(3)]],
+                                                 constant float *surfelSizes [[buffer(4)]],
+                                                 constant uchar *tombstones [[buffer(5)]],
+                                                 uint iid [[instance_id]])
+{
+    float surfelSize = tombstones[iid] != 0 ? 0.0 : surfelSizes[iid];
+    
+    return projectSurfelVertex(v.position, float3(positions[iid]), float3(normals[iid]), surfelSize, uniforms, iid);
+}
+
 fragment FragmentOutput SurfelIndexMapFragment(ProjectedVertex inVertex [[stage_in]])
 {
     return FragmentOutput {
@@ -24,9 +24,12 @@ SCAssimilatedFrameMetadataFromPBFAssimilatedFrameMetadata(PBFAssimilatedFrameMet
     metadata.colorBuffer = NULL;
     metadata.depthBuffer = NULL;
     
-    if (pbfMetadata.isMerged == false && consecutiveFailedFrameCount + 1 >= kMaxConsecutiveFailedFrameCount) {
+    // A skipped frame was tracked fine, it just wasn't worth merging
+    bool isTracked = pbfMetadata.isMerged || pbfMetadata.isSkipped;
+    
+    if (isTracked == false && consecutiveFailedFrameCount + 1 >= kMaxConsecutiveFailedFrameCount) {
         metadata.result = SCAssimilatedFrameResultFailed;
-    } else if (pbfMetadata.isMerged == false) {
+    } else if (isTracked == false) {
         metadata.result = SCAssimilatedFrameResultLostTracking;
     } else if (pbfMetadata.icpUnusedIterationFraction < kPoorTrackingQualityThreshold) {
         metadata.result = SCAssimilatedFrameResultPoorTracking;
@@ -19,6 +19,7 @@
 #import "MetalSurfelIndexMap.hpp"
 #import "PBFModel.hpp"
 #import "PointCloudIO.hpp"
+#import "ProcessedFramePool.hpp"
 #import "SCAssimilatedFrameMetadata.h"
 #import "SCAssimilatedFrameMetadata_Private.h"
 #import "SCFusionBundle.h"
@@ -38,6 +39,7 @@ using namespace standard_cyborg;
     std::shared_ptr<MetalSurfelIndexMap> _surfelIndexMap;
     std::shared_ptr<PBFModel> _pbfModel;
     std::shared_ptr<RawFrame> _lastRawFrame;
+    ProcessedFramePool _framePool;
 
     GravityEstimator _gravityEstimator;
     PBFConfiguration _pbfConfig;
@@ -347,11 +349,13 @@ using namespace standard_cyborg;
 
     CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
 
-    ProcessedFrame processedFrame(rawFrame);
+    std::unique_ptr<ProcessedFrame> processedFrame = _framePool.acquire(rawFrame);
 
-    _depthProcessor->computeFrameValues(processedFrame, rawFrame);
+    _depthProcessor->computeFrameValues(*processedFrame, rawFrame);
     
-    auto pbfMetadata = _pbfModel->assimilate(processedFrame, _pbfConfig, _icpConfig, _surfelFusionConfig, rawFrame.timestamp);
+    auto pbfMetadata = _pbfModel->assimilate(*processedFrame, _pbfConfig, _icpConfig, _surfelFusionConfig, rawFrame.timestamp);
+    
+    _framePool.recycle(std::move(processedFrame));
 
     CFAbsoluteTime endTime = CFAbsoluteTimeGetCurrent();
 
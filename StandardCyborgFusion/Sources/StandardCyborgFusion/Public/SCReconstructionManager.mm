@@ -111,7 +111,6 @@ NS_ASSUME_NONNULL_BEGIN
     float _modelQueue_maxDepth;
     BOOL _userSetMaxDepth;
     BOOL _modelQueue_hasCalculatedModelConfig;
-    BOOL _finalized;
     BOOL _wroteIntrinsicsToFile;
     
     GravityEstimator _gravityEstimator;
@@ -134,6 +133,9 @@ NS_ASSUME_NONNULL_BEGIN
         std::shared_ptr<SurfelIndexMap> surfelIndexMap(new MetalSurfelIndexMap(device, library, commandQueue));
         _modelQueue_model = new PBFModel(surfelIndexMap);
         
+        // buildPointCloud may be called from any thread while scanning, and should see every frame
+        _pbfConfig.snapshotInterval = 1;
+        
         _icpConfig.maxIterations = (int)[[NSUserDefaults standardUserDefaults] integerForKey:@"icp_max_iteration_count"] ?: _icpConfig.maxIterations;
         _icpConfig.tolerance = [[NSUserDefaults standardUserDefaults] floatForKey:@"icp_tolerance"] ?: _icpConfig.tolerance;
         
@@ -407,8 +409,6 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (void)finalize:(dispatch_block_t)completion
 {
-    _finalized = YES;
-    
     dispatch_async(_inputQueue, ^{
         _inputQueue_stopped = YES;
         
@@ -428,15 +428,20 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (SCPointCloud *)buildPointCloud
 {
-    // TODO: Fix threading/queuing and run off of a copy in PBFModel
-    const Surfels& surfels = _modelQueue_model->getSurfels();
-    NSData *surfelData;
-    if (_finalized) {
-        surfelData = [NSData dataWithBytes:(void *)surfels.data() length:surfels.size() * sizeof(Surfel)];
+    std::shared_ptr<const PBFModelSnapshot> snapshot = _modelQueue_model->getSnapshot();
+    NSData *surfelData = nil;
+    if (snapshot->isCompact) {
+        Surfels surfels;
+        snapshot->compactSurfels.decode(surfels);
+        surfelData = [NSData dataWithBytes:surfels.data() length:surfels.size() * sizeof(Surfel)];
     } else {
-        // While scanning, for the sake of performance, avoid copying the whole surfels data structure and return it directly
-        // This is an obvious thread safety issue, but we tend to get away with it 99+% of the time, so it's acceptable for now
-        surfelData = [NSData dataWithBytesNoCopy:(void *)surfels.data() length:surfels.size() * sizeof(Surfel) freeWhenDone:NO];
+        // The snapshot never changes, so wrap it without copying, and keep it alive for as long as the data is
+        const Surfels& surfels = snapshot->surfels;
+        surfelData = [[NSData alloc] initWithBytesNoCopy:(void *)surfels.data()
+                                                  length:surfels.size() * sizeof(Surfel)
+                                             deallocator:^(void *bytes, NSUInteger length) {
+            (void)snapshot;
+        }];
     }
     
     simd_float3 gravity = [self gravity];
@@ -446,8 +451,6 @@ NS_ASSUME_NONNULL_BEGIN
 
 - (void)reset
 {
-    _finalized = NO;
-    
     dispatch_sync(_inputQueue, ^{
         _inputQueue_incomingFrameData = nil;
         _inputQueue_incomingFrameSequence = 0;
@@ -10,7 +10,10 @@
 #pragma once
 
 #import <standard_cyborg/util/IncludeEigen.hpp>
+
+#if defined(__APPLE__)
 #import <simd/simd.h>
+#endif
 
 namespace standard_cyborg {
 
@@ -34,6 +37,8 @@ extern Eigen::Matrix4f perspectiveMatrixFromIntrinsics(Eigen::Matrix3f& intrinsi
 
 extern Eigen::Matrix3f rotationFromEulerAngles(const Eigen::Vector3f& alphaBetaGamma);
 
+// The simd conversions are for the Metal side, which only builds on Apple platforms
+#if defined(__APPLE__)
 // SC --> simd
 extern simd_float3x3 toSimdFloat3x3(const standard_cyborg::math::Mat3x3& m);
 extern simd_float4x4 toSimdFloat4x4(const standard_cyborg::math::Mat3x4& m);
@@ -47,6 +52,7 @@ extern standard_cyborg::math::Mat3x3 toMat3x3(simd_float3x3 m);
 extern standard_cyborg::math::Mat3x4 toMat3x4(simd_float3x3 m);
 extern standard_cyborg::math::Mat3x4 toMat3x4(simd_float4x4 m);
 extern standard_cyborg::math::Mat3x4 toMat3x4(simd_float4x3 m);
+#endif
 
 // Not really geometry, but close enough
 static const float kGammaCorrection = 1.0/2.2;
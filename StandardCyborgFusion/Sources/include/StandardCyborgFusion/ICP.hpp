@@ -9,22 +9,51 @@
 
 #pragma once
 
+#import <cmath>
+
 #import <standard_cyborg/math/Mat4x4.hpp>
 #import <standard_cyborg/math/Vec3.hpp>
 #import <standard_cyborg/sc3d/Geometry.hpp>
 
-#import <TargetConditionals.h>
-#if DEBUG
 #import <vector>
+
+#if defined(__APPLE__)
+#import <TargetConditionals.h>
 #endif
 
 using namespace standard_cyborg;
 
+enum class ICPCorrespondenceMode {
+    // Match each source point to its nearest neighbor in the target point cloud, using its kd-tree
+    // (PBFModel keeps an incrementally updated one of these for its surfels)
+    NearestNeighbor,
+    
+    // Match each source point to whatever lies under the pixel it projects to in a vertex and
+    // normal map of the model, rendered from the previous camera pose
+    Projective,
+};
+
+struct ICPPyramidLevel {
+    int pixelStride; // the depth image is averaged over square blocks this many pixels on a side
+    int maxIterations; // maximum number of iterations to run at this level
+    float tolerance; // the level is done once the relative correspondence error changes by less than this
+};
+
 struct ICPConfiguration {
     float tolerance = 1e-4; // if the relative correspondence error is below this tolerance value, then the ICP is done.
     int maxIterations = 18; // maximum number of iterations to run ICP.
     float outlierDeviationsThreshold = 1.0; // threshold value, used for filtering out outlier points.
-    int threadCount = 1; // number of threads allowed to use, for the correspondence search of ICP. 
+    int threadCount = 1; // number of parallel chunks each pass of ICP (correspondence search, normal equations, transform) is split into, on the shared TaskScheduler
+    
+    ICPCorrespondenceMode correspondenceMode = ICPCorrespondenceMode::NearestNeighbor; // how source points are matched to the target
+    float maxProjectiveCorrespondenceDistance = 0.01; // in projective mode, matches further apart than this (in meters) are rejected
+    float maxProjectiveCorrespondenceAngle = 30 * M_PI / 180; // in projective mode, matches whose normals differ by more than this (in radians) are rejected
+    float projectiveTransformTolerance = 1e-4; // in projective mode, ICP is also done once an iteration moves the source by less than this, in meters of translation and radians of rotation
+    
+    // Coarse depth pyramid levels that PBFModel aligns before the main ICP stage, coarsest first. Each starts
+    // from where the previous one left off, so large motions converge in a few cheap iterations and the
+    // main stage (which uses maxIterations and tolerance above) only has to refine. Empty by default.
+    std::vector<ICPPyramidLevel> coarseLevels;
 };
 
 struct ICPResult {
@@ -50,12 +79,43 @@ struct ICPResult {
 
 typedef std::function<void(ICPResult)> ICPIterationCallback;
 
+struct AssimilationWorkspace;
+class ICPIncrementalTarget;
+struct ICPProjectiveTarget;
+
 class ICP {
 public:
     static ICPResult run(ICPConfiguration config,
                          sc3d::Geometry& sourceCloud,
                          sc3d::Geometry& targetCloud,
                          ICPIterationCallback callback = nullptr);
+    
+    // Runs ICP with projective data association against a rendered vertex and normal map,
+    // rather than nearest neighbors in a point cloud. `sourceCloud` must have normals.
+    static ICPResult run(ICPConfiguration config,
+                         sc3d::Geometry& sourceCloud,
+                         const ICPProjectiveTarget& target,
+                         ICPIterationCallback callback = nullptr);
+    
+    // Runs ICP with nearest neighbor correspondences in a target that's updated incrementally
+    // as the model changes, rather than a point cloud whose kd-tree is built from scratch
+    static ICPResult run(ICPConfiguration config,
+                         sc3d::Geometry& sourceCloud,
+                         const ICPIncrementalTarget& target,
+                         ICPIterationCallback callback = nullptr);
+    
+    // Like the two above, but the source is the workspace's source vertices (and normals, which
+    // projective correspondences need), and ICP's scratch buffers come from the workspace, so
+    // that running it again with a source no larger than before doesn't allocate
+    static ICPResult run(ICPConfiguration config,
+                         const ICPProjectiveTarget& target,
+                         AssimilationWorkspace& workspace,
+                         const ICPIterationCallback& callback = nullptr);
+    
+    static ICPResult run(ICPConfiguration config,
+                         const ICPIncrementalTarget& target,
+                         AssimilationWorkspace& workspace,
+                         const ICPIterationCallback& callback = nullptr);
 };
 
 #endif
@@ -30,15 +30,53 @@ struct PBFAssimilatedFrameMetadata {
      */
     bool isMerged = false;
     
+    /**
+     @brief True if this frame was tracked but not merged, since it was taken from nearly the same pose as the last merged frame and would have added too little. See PBFConfiguration's redundantFrameMaxNovelty.
+     */
+    bool isSkipped = false;
+    
     /**
      @brief Total surfel count after this frame was merged
      */
     size_t surfelCount = 0;
     
+    /**
+     @brief Surfels merged into a neighbor or evicted after this frame was merged, to keep within PBFConfiguration's surfel budget
+     */
+    size_t evictedSurfelCount = 0;
+    
     float correspondenceError = 0.0f;
     
     float icpUnusedIterationFraction = 0.0;
     int icpIterationCount = 0;
+    
+    /**
+     @brief Iterations spent on coarse pyramid levels before the main ICP stage, which icpIterationCount doesn't include
+     */
+    int icpCoarseIterationCount = 0;
+    
+    /**
+     @brief True if ICP started from a pose predicted by PBFConfiguration's motion model, rather than the previous merged frame's
+     */
+    bool isPosePredicted = false;
+    
+    /**
+     @brief How far ICP moved the camera from the pose it started from, in meters and radians. With a motion model, this is its prediction error.
+     */
+    float initialPoseTranslationResidual = 0;
+    float initialPoseRotationResidual = 0;
+    
+    /**
+     @brief Seconds spent on each stage of processing this frame, on a monotonic clock. Stages that didn't run, like fusion for a rejected frame, are zero.
+     @discussion Depth processing is timed by the depth processor. Updating the ICP target means updating its kd-tree for nearest neighbor correspondences, or drawing the model for projective ones. Culling includes enforcing the surfel budget.
+     */
+    double depthProcessingDuration = 0;
+    double icpSourceDownsamplingDuration = 0;
+    double icpTargetUpdateDuration = 0;
+    double icpDuration = 0;
+    double surfelIndexMapDrawDuration = 0;
+    double fusionDuration = 0;
+    double cullingDuration = 0;
 };
 
 #endif
@@ -5,10 +5,29 @@
 //  Created by eric on 2019-10-24.
 //
 
+/** How long a stage of assimilation took per frame, in seconds, over the frames it ran in */
+typedef struct {
+    double total;
+    double median;
+    double percentile90;
+    double percentile99;
+    double max;
+} PBFStageTimingStatistics;
+
 typedef struct {
     int mergedFrameCount;
     double framerate;
     double averageICPIterations;
     int failedFrameCount;
+    int skippedFrameCount;
     float averageCorrespondenceError;
+    
+    // Where the time went, stage by stage; see PBFAssimilatedFrameMetadata
+    PBFStageTimingStatistics depthProcessingTime;
+    PBFStageTimingStatistics icpSourceDownsamplingTime;
+    PBFStageTimingStatistics icpTargetUpdateTime;
+    PBFStageTimingStatistics icpTime;
+    PBFStageTimingStatistics surfelIndexMapDrawTime;
+    PBFStageTimingStatistics fusionTime;
+    PBFStageTimingStatistics cullingTime;
 } PBFFinalStatistics;
@@ -41,6 +41,16 @@ struct RawFrame {
         timestamp(timestampIn)
     { }
     
+    // Takes over the buffers instead of copying them
+    RawFrame(sc3d::PerspectiveCamera cameraIn, size_t widthIn, size_t heightIn, std::vector<float>&& depthsIn, std::vector<math::Vec3>&& colorsIn, double timestampIn) :
+        camera(cameraIn),
+        width(widthIn),
+        height(heightIn),
+        depths(std::move(depthsIn)),
+        colors(std::move(colorsIn)),
+        timestamp(timestampIn)
+    { }
+    
 private:
     // Prohibit copying and assignment
     // But actually allow the copy constructor because it's needed for SCOfflineReconstructionManager
@@ -0,0 +1,255 @@
+//
+//  AssimilationWorkspaceTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <algorithm>
+#import <atomic>
+#import <cmath>
+#import <cstddef>
+#import <cstdlib>
+#import <new>
+#import <vector>
+
+#import <standard_cyborg/sc3d/Geometry.hpp>
+#import <standard_cyborg/util/DataUtils.hpp>
+
+#import "AssimilationWorkspace.hpp"
+#import "CpuDepthProcessor.hpp"
+#import "EigenHelpers.hpp"
+#import "GeometryHelpers.hpp"
+#import "ICP.hpp"
+#import "ICPIncrementalTarget.hpp"
+#import "ICPSource.hpp"
+#import "OfflineReconstructor.hpp"
+
+#import "Helpers/PathHelpers.h"
+
+using namespace standard_cyborg;
+
+// Counts heap allocations while armed. Replacing the global operators new and delete applies to
+// the whole test bundle, but it only counts between arming and disarming it. Every replaceable
+// form of new is counted: single objects and arrays, throwing and nothrow, and over-aligned,
+// which is how C++17 allocates types like Eigen's fixed-size vectors. Every form of delete is
+// replaced to match, since they all have to free what these return.
+static std::atomic<bool> _countingAllocations(false);
+static std::atomic<size_t> _allocationCount(0);
+
+static void *_countedAllocate(size_t size, size_t alignment = 0)
+{
+    if (_countingAllocations) { ++_allocationCount; }
+
+    if (size == 0) { size = 1; }
+    if (alignment <= alignof(std::max_align_t)) { return malloc(size); }
+
+    void *pointer = nullptr;
+    if (posix_memalign(&pointer, std::max(alignment, sizeof(void *)), size) != 0) { return nullptr; }
+
+    return pointer;
+}
+
+static void *_countedAllocateOrThrow(size_t size, size_t alignment = 0)
+{
+    void *pointer = _countedAllocate(size, alignment);
+    if (pointer == nullptr) { throw std::bad_alloc(); }
+
+    return pointer;
+}
+
+void *operator new(size_t size) { return _countedAllocateOrThrow(size); }
+void *operator new[](size_t size) { return _countedAllocateOrThrow(size); }
+void *operator new(size_t size, const std::nothrow_t&) noexcept { return _countedAllocate(size); }
+void *operator new[](size_t size, const std::nothrow_t&) noexcept { return _countedAllocate(size); }
+void *operator new(size_t size, std::align_val_t alignment) { return _countedAllocateOrThrow(size, (size_t)alignment); }
+void *operator new[](size_t size, std::align_val_t alignment) { return _countedAllocateOrThrow(size, (size_t)alignment); }
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return _countedAllocate(size, (size_t)alignment); }
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return _countedAllocate(size, (size_t)alignment); }
+
+void operator delete(void *pointer) noexcept { free(pointer); }
+void operator delete[](void *pointer) noexcept { free(pointer); }
+void operator delete(void *pointer, const std::nothrow_t&) noexcept { free(pointer); }
+void operator delete[](void *pointer, const std::nothrow_t&) noexcept { free(pointer); }
+void operator delete(void *pointer, size_t) noexcept { free(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { free(pointer); }
+void operator delete(void *pointer, std::align_val_t) noexcept { free(pointer); }
+void operator delete[](void *pointer, std::align_val_t) noexcept { free(pointer); }
+void operator delete(void *pointer, std::align_val_t, const std::nothrow_t&) noexcept { free(pointer); }
+void operator delete[](void *pointer, std::align_val_t, const std::nothrow_t&) noexcept { free(pointer); }
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept { free(pointer); }
+void operator delete[](void *pointer, size_t, std::align_val_t) noexcept { free(pointer); }
+
+@interface AssimilationWorkspaceTests : XCTestCase
+
+@end
+
+@implementation AssimilationWorkspaceTests
+
+// A bumpy patch of surface, so that ICP is constrained in every direction
+static SurfelStore _bumpySurfels()
+{
+    SurfelStore surfels;
+    for (int yIndex = -25; yIndex <= 25; ++yIndex) {
+        for (int xIndex = -25; xIndex <= 25; ++xIndex) {
+            float x = 0.002f * xIndex;
+            float y = 0.002f * yIndex;
+
+            Surfel surfel;
+            surfel.position = Vector3f(x, y, 0.3f + 0.01f * sinf(40 * x) * cosf(40 * y));
+            surfel.normal = Vector3f(-0.4f * cosf(40 * x) * cosf(40 * y), 0.4f * sinf(40 * x) * sinf(40 * y), 1).normalized();
+            surfel.color = Vector3f(1, 1, 1);
+            surfel.weight = 1;
+            surfel.lifetime = 0;
+            surfel.surfelSize = 0.001;
+            surfels.push_back(surfel);
+        }
+    }
+
+    return surfels;
+}
+
+// Every third surfel, moved slightly
+static void _fillSource(const SurfelStore& surfels, std::vector<math::Vec3>& verticesOut, std::vector<math::Vec3>& normalsOut)
+{
+    Eigen::Matrix4f offset = Eigen::Matrix4f::Identity();
+    offset.topLeftCorner<3, 3>() = Eigen::AngleAxisf(0.005, Eigen::Vector3f(0, 1, 0)).toRotationMatrix();
+    offset.col(3).head<3>() = Eigen::Vector3f(0.001, -0.0005, 0.0007);
+
+    verticesOut.clear();
+    normalsOut.clear();
+    for (size_t i = 0; i < surfels.size(); i += 3) {
+        verticesOut.push_back(toVec3(Vec3TransformMat4(surfels.positions[i], offset)));
+        normalsOut.push_back(toVec3(offset.topLeftCorner<3, 3>() * surfels.normals[i]));
+    }
+}
+
+- (void)testICPDoesNotAllocateOnceTheWorkspaceHasGrown
+{
+    SurfelStore surfels = _bumpySurfels();
+    ICPIncrementalTarget target;
+    SurfelIndexChanges indexChanges;
+    target.update(surfels, indexChanges, 1, INFINITY);
+
+    // With more than one thread, the passes are reduced through tasks on the shared scheduler,
+    // as they are in the reconstruction managers
+    for (int threadCount : { 1, 4 }) {
+        ICPConfiguration icpConfig;
+        icpConfig.threadCount = threadCount;
+        AssimilationWorkspace workspace;
+
+        // The first run grows the workspace
+        _fillSource(surfels, workspace.sourceVertices, workspace.sourceNormals);
+        ICPResult firstResult = ICP::run(icpConfig, target, workspace);
+        XCTAssertTrue(firstResult.succeeded);
+
+        // After which the same work doesn't allocate at all
+        _fillSource(surfels, workspace.sourceVertices, workspace.sourceNormals);
+        _allocationCount = 0;
+        _countingAllocations = true;
+        ICPResult secondResult = ICP::run(icpConfig, target, workspace);
+        _countingAllocations = false;
+
+        XCTAssertEqual(_allocationCount, 0, @"with %d threads", threadCount);
+        XCTAssertTrue(secondResult.succeeded);
+        XCTAssertEqual(secondResult.iterationCount, firstResult.iterationCount);
+        XCTAssertEqual(secondResult.rmsCorrespondenceError, firstResult.rmsCorrespondenceError);
+    }
+}
+
+- (void)testSourceSamplingDoesNotAllocateOnceTheWorkspaceHasGrown
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    NSString *framePath = [testCasePath stringByAppendingPathComponent:@"DepthFrames/frame-000.ply"];
+    std::unique_ptr<RawFrame> rawFrame = OfflineReconstructor::readRawFrame([framePath UTF8String]);
+    XCTAssertTrue(rawFrame != nullptr);
+    if (rawFrame == nullptr) { return; }
+
+    ProcessedFrame frame(*rawFrame);
+    CpuDepthProcessor().computeFrameValues(frame, *rawFrame);
+
+    // The target is every fourth of the frame's points, and the source starts slightly off
+    SurfelStore surfels;
+    for (size_t i = 0; i < frame.positions.size(); i += 4) {
+        if (frame.weights[i] <= 0) { continue; }
+
+        Surfel surfel;
+        surfel.position = toVector3f(frame.positions[i]);
+        surfel.normal = toVector3f(frame.normals[i]);
+        surfel.color = Vector3f(1, 1, 1);
+        surfel.weight = 1;
+        surfel.lifetime = 0;
+        surfel.surfelSize = 0.001;
+        surfels.push_back(surfel);
+    }
+    ICPIncrementalTarget target;
+    target.update(surfels, SurfelIndexChanges(), 1, INFINITY);
+
+    Eigen::Matrix4f offset = Eigen::Matrix4f::Identity();
+    offset.topLeftCorner<3, 3>() = Eigen::AngleAxisf(0.005, Eigen::Vector3f(0, 1, 0)).toRotationMatrix();
+    offset.col(3).head<3>() = Eigen::Vector3f(0.001, -0.0005, 0.0007);
+
+    SurfelFusionConfiguration surfelFusionConfig;
+    PBFConfiguration pbfConfig;
+
+    for (int threadCount : { 1, 4 }) {
+        ICPConfiguration icpConfig;
+        icpConfig.threadCount = threadCount;
+        AssimilationWorkspace workspace;
+
+        // What PBFModel does for each frame with a pyramid: ICP on two block-averaged levels,
+        // then on a random sample at full resolution
+        auto alignFrame = [&]() {
+            FastRand fastRNG;
+            for (int pixelStride : { 16, 8 }) {
+                BuildBlockAveragedICPSource(frame, pixelStride, surfelFusionConfig, offset, workspace);
+                ICP::run(icpConfig, target, workspace);
+            }
+
+            SampleICPSource(frame, pbfConfig.icpDownsampleFraction, surfelFusionConfig, offset, fastRNG, workspace);
+            return ICP::run(icpConfig, target, workspace);
+        };
+
+        // The first frame grows the workspace
+        ICPResult firstResult = alignFrame();
+        XCTAssertTrue(firstResult.succeeded);
+        XCTAssertGreaterThan(workspace.sourceVertices.size(), 0);
+
+        // After which aligning the same frame again doesn't allocate at all
+        _allocationCount = 0;
+        _countingAllocations = true;
+        ICPResult secondResult = alignFrame();
+        _countingAllocations = false;
+
+        XCTAssertEqual(_allocationCount, 0, @"with %d threads", threadCount);
+        XCTAssertTrue(secondResult.succeeded);
+        XCTAssertEqual(secondResult.iterationCount, firstResult.iterationCount);
+    }
+}
+
+- (void)testWorkspaceGivesTheSameResultAsAGeometry
+{
+    SurfelStore surfels = _bumpySurfels();
+    ICPIncrementalTarget target;
+    SurfelIndexChanges indexChanges;
+    target.update(surfels, indexChanges, 1, INFINITY);
+
+    ICPConfiguration icpConfig;
+    AssimilationWorkspace workspace;
+
+    // Leave the workspace bigger than the source, as a larger previous frame would
+    workspace.icpCorrespondences.resize(10000);
+    _fillSource(surfels, workspace.sourceVertices, workspace.sourceNormals);
+    sc3d::Geometry sourceCloud(workspace.sourceVertices, workspace.sourceNormals);
+
+    ICPResult workspaceResult = ICP::run(icpConfig, target, workspace);
+    ICPResult geometryResult = ICP::run(icpConfig, sourceCloud, target);
+
+    XCTAssertTrue(workspaceResult.succeeded);
+    XCTAssertEqual(workspaceResult.iterationCount, geometryResult.iterationCount);
+    XCTAssertEqual(workspaceResult.rmsCorrespondenceError, geometryResult.rmsCorrespondenceError);
+    XCTAssertTrue(toMatrix4f(workspaceResult.sourceTransform) == toMatrix4f(geometryResult.sourceTransform));
+}
+
+@end
@@ -0,0 +1,148 @@
+//
+//  CompactSurfelsTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <cmath>
+#import <random>
+
+#import "CompactSurfels.hpp"
+
+@interface CompactSurfelsTests : XCTestCase
+
+@end
+
+@implementation CompactSurfelsTests
+
+static Surfels _randomSurfels(size_t count)
+{
+    std::mt19937 generator(17);
+    std::uniform_real_distribution<float> unit(0, 1);
+    std::uniform_real_distribution<float> signedUnit(-1, 1);
+
+    Surfels surfels(count);
+    for (size_t index = 0; index < count; ++index) {
+        Surfel& surfel = surfels[index];
+        // Consecutive surfels are close together, like rows of a depth frame
+        surfel.position = Vector3f(0.0005f * (index % 400), 0.0005f * (index / 400), 0.3f + 0.01f * unit(generator));
+        surfel.normal = Vector3f(signedUnit(generator), signedUnit(generator), signedUnit(generator)).normalized();
+        surfel.color = Vector3f(unit(generator), unit(generator), unit(generator));
+        surfel.weight = 0.1f + 50 * unit(generator);
+        surfel.surfelSize = 0.0005f + 0.002f * unit(generator);
+        surfel.lifetime = (uint32_t)((int32_t)(index % 61) - 30);
+    }
+
+    return surfels;
+}
+
+- (void)testRoundTripIsWithinQuantizationError
+{
+    Surfels surfels = _randomSurfels(10000);
+
+    CompactSurfels compactSurfels;
+    compactSurfels.encode(surfels);
+    XCTAssertEqual(compactSurfels.size(), surfels.size());
+    XCTAssertEqual(compactSurfels.blocks.size(), (surfels.size() + CompactSurfels::BlockSize - 1) / CompactSurfels::BlockSize);
+
+    Surfels decoded;
+    compactSurfels.decode(decoded);
+    XCTAssertEqual(decoded.size(), surfels.size());
+
+    for (size_t index = 0; index < surfels.size(); ++index) {
+        const Surfel& surfel = surfels[index];
+        const Surfel& roundTripped = decoded[index];
+        const CompactSurfelBlock& block = compactSurfels.blocks[index / CompactSurfels::BlockSize];
+
+        for (int axis = 0; axis < 3; ++axis) {
+            XCTAssertLessThanOrEqual(std::abs(roundTripped.position[axis] - surfel.position[axis]), 0.75f * block.step[axis] + 1e-7f);
+            XCTAssertLessThanOrEqual(std::abs(roundTripped.color[axis] - surfel.color[axis]), 0.5f / 255.0f + 1e-6f);
+        }
+
+        XCTAssertLessThan(roundTripped.normal.cross(surfel.normal).norm(), 1e-4);
+        XCTAssertGreaterThan(roundTripped.normal.dot(surfel.normal), 0);
+        XCTAssertEqualWithAccuracy(roundTripped.weight, surfel.weight, 1e-3 * surfel.weight);
+        XCTAssertEqualWithAccuracy(roundTripped.surfelSize, surfel.surfelSize, 1e-3 * surfel.surfelSize);
+        XCTAssertEqual((int32_t)roundTripped.lifetime, (int32_t)surfel.lifetime);
+
+        // Random access decodes the same surfel
+        XCTAssertTrue(compactSurfels[index].position == roundTripped.position);
+    }
+}
+
+- (void)testScatteredSurfelsAreWithinTheModelsQuantizationError
+{
+    // Surfels in reused slots come in no spatial order, so every block spans the whole model
+    std::mt19937 generator(23);
+    std::uniform_real_distribution<float> unit(0, 1);
+    const Vector3f extent(0.5f, 0.4f, 0.3f);
+
+    Surfels surfels = _randomSurfels(2000);
+    for (Surfel& surfel : surfels) {
+        surfel.position = Vector3f(unit(generator), unit(generator), unit(generator)).cwiseProduct(extent) - Vector3f(0.25f, 0.2f, 0.5f);
+    }
+
+    CompactSurfels compactSurfels;
+    compactSurfels.encode(surfels);
+
+    for (size_t index = 0; index < surfels.size(); ++index) {
+        Surfel roundTripped = compactSurfels[index];
+
+        for (int axis = 0; axis < 3; ++axis) {
+            XCTAssertLessThanOrEqual(std::abs(roundTripped.position[axis] - surfels[index].position[axis]), extent[axis] / 131070.0f + 1e-7f);
+        }
+    }
+}
+
+- (void)testEncodingIsCompact
+{
+    XCTAssertEqual(sizeof(CompactSurfel), 18);
+
+    Surfels surfels = _randomSurfels(10000);
+    CompactSurfels compactSurfels;
+    compactSurfels.encode(surfels);
+
+    XCTAssertLessThan(compactSurfels.byteSize() * 2.5, surfels.size() * sizeof(Surfel));
+}
+
+- (void)testOutOfRangeValuesAreClamped
+{
+    Surfels surfels = _randomSurfels(2);
+    surfels[0].normal = Vector3f(0, 0, -1);
+    surfels[0].weight = 1e6;
+    surfels[0].lifetime = (uint32_t)-1000;
+    surfels[1].normal = Vector3f(1, 0, 0);
+    surfels[1].lifetime = 1000;
+
+    CompactSurfels compactSurfels;
+    compactSurfels.encode(surfels);
+
+    XCTAssertTrue(compactSurfels[0].normal == Vector3f(0, 0, -1));
+    XCTAssertEqual(compactSurfels[0].weight, 65504);
+    XCTAssertEqual((int32_t)compactSurfels[0].lifetime, -128);
+    XCTAssertTrue(compactSurfels[1].normal == Vector3f(1, 0, 0));
+    XCTAssertEqual(compactSurfels[1].lifetime, 127);
+}
+
+- (void)testStoreEncodingLeavesOutTombstones
+{
+    Surfels surfels = _randomSurfels(1000);
+    SurfelStore store;
+    store.assign(surfels);
+    store.markRemoved({ 10, 500 });
+
+    CompactSurfels compactSurfels;
+    compactSurfels.encode(store);
+    XCTAssertEqual(compactSurfels.size(), 998);
+
+    SurfelStore decoded;
+    compactSurfels.decode(decoded);
+    XCTAssertEqual(decoded.size(), 998);
+    XCTAssertEqual(decoded.liveCount(), 998);
+    XCTAssertEqualWithAccuracy(decoded.weights[10], surfels[11].weight, 1e-3 * surfels[11].weight);
+    XCTAssertEqualWithAccuracy(decoded.weights[499], surfels[501].weight, 1e-3 * surfels[501].weight);
+}
+
+@end
@@ -0,0 +1,148 @@
+//
+//  CpuDepthProcessorTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <cmath>
+#import <vector>
+
+#import <standard_cyborg/math/Vec3.hpp>
+
+#import "CpuDepthProcessor.hpp"
+#import "MetalDepthProcessor.hpp"
+#import "PointCloudIO.hpp"
+
+#import "Helpers/PathHelpers.h"
+
+using namespace standard_cyborg;
+
+@interface CpuDepthProcessorTests : XCTestCase
+
+@end
+
+@implementation CpuDepthProcessorTests
+
+- (void)testParityWithMetalDepthProcessor
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    NSString *depthFramesDir = [testCasePath stringByAppendingPathComponent:@"DepthFrames"];
+
+    id<MTLDevice> device = MTLCreateSystemDefaultDevice();
+    id<MTLCommandQueue> commandQueue = [device newCommandQueue];
+    id<MTLLibrary> library = [device newDefaultLibraryWithBundle:[PathHelpers scFusionBundle] error:NULL];
+    MetalDepthProcessor metalDepthProcessor(device, library, commandQueue);
+    CpuDepthProcessor cpuDepthProcessor;
+
+    for (int frameIndex : { 0, 45, 89 }) {
+        NSString *filePath = [depthFramesDir stringByAppendingFormat:@"/frame-%03d.ply", frameIndex];
+        std::unique_ptr<RawFrame> rawFrame = PointCloudIO::ReadRawFrameFromBPLYFile([filePath UTF8String]);
+        const int width = (int)rawFrame->width;
+        const int height = (int)rawFrame->height;
+
+        for (bool smoothPoints : { false, true }) {
+            ProcessedFrame metalFrame(*rawFrame);
+            ProcessedFrame cpuFrame(*rawFrame);
+            metalDepthProcessor.computeFrameValues(metalFrame, *rawFrame, smoothPoints);
+            cpuDepthProcessor.computeFrameValues(cpuFrame, *rawFrame, smoothPoints);
+
+            // Skip a margin wide enough for the border handling of every pass to fall off
+            const int margin = 16;
+            size_t comparedCount = 0;
+            size_t mismatchCount = 0;
+
+            for (int y = margin; y < height - margin; ++y) {
+                for (int x = margin; x < width - margin; ++x) {
+                    size_t i = y * width + x;
+                    if (!std::isfinite(metalFrame.normals[i].x) || !std::isfinite(cpuFrame.normals[i].x)) { continue; }
+
+                    ++comparedCount;
+                    bool matches = math::Vec3::distanceBetween(metalFrame.positions[i], cpuFrame.positions[i]) < 1e-4
+                        && math::Vec3::distanceBetween(metalFrame.normals[i], cpuFrame.normals[i]) < 1e-2
+                        && std::abs(metalFrame.surfelSizes[i] - cpuFrame.surfelSizes[i]) < 1e-4
+                        && std::abs(metalFrame.weights[i] - cpuFrame.weights[i]) < 1e-2
+                        && std::abs(metalFrame.inputConfidences[i] - cpuFrame.inputConfidences[i]) < 1e-2;
+                    if (!matches) { ++mismatchCount; }
+                }
+            }
+
+            // GPU fast math can tip threshold comparisons along depth discontinuities
+            XCTAssertGreaterThan(comparedCount, 0);
+            XCTAssertLessThan((float)mismatchCount / comparedCount, 0.01);
+        }
+    }
+}
+
+- (void)testBandCountDoesNotChangeOutput
+{
+    sc3d::PerspectiveCamera camera;
+    camera.setNominalIntrinsicMatrix(math::Mat3x3(200, 0, 80,
+                                                  0, 200, 120,
+                                                  0, 0, 1));
+    camera.setIntrinsicMatrixReferenceSize(math::Vec2(160, 240));
+
+    const size_t width = 160;
+    const size_t height = 240;
+    std::vector<float> depths(width * height);
+    std::vector<math::Vec3> colors(width * height, math::Vec3());
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            // A gently curved surface with a hole, so smoothing and bleeding both kick in
+            bool inHole = x > 60 && x < 80 && y > 100 && y < 130;
+            depths[y * width + x] = inHole ? 0.0f : 0.3f + 0.002f * std::sin(0.1f * x) * std::cos(0.05f * y);
+        }
+    }
+    RawFrame rawFrame(camera, width, height, depths, colors, 0.0);
+
+    CpuDepthProcessor singleBandProcessor(1);
+    CpuDepthProcessor multiBandProcessor(5);
+    ProcessedFrame singleBandFrame(rawFrame);
+    ProcessedFrame multiBandFrame(rawFrame);
+    singleBandProcessor.computeFrameValues(singleBandFrame, rawFrame, true);
+    multiBandProcessor.computeFrameValues(multiBandFrame, rawFrame, true);
+
+    for (size_t i = 0; i < width * height; ++i) {
+        XCTAssertEqual(singleBandFrame.positions[i].x, multiBandFrame.positions[i].x);
+        XCTAssertEqual(singleBandFrame.positions[i].z, multiBandFrame.positions[i].z);
+        XCTAssertEqual(singleBandFrame.inputConfidences[i], multiBandFrame.inputConfidences[i]);
+        XCTAssertEqual(singleBandFrame.surfelSizes[i], multiBandFrame.surfelSizes[i]);
+    }
+
+    size_t middlePixelIndex = (height / 2) * width + width / 4;
+    XCTAssertGreaterThan(singleBandFrame.inputConfidences[middlePixelIndex], 0.95);
+    XCTAssertEqualWithAccuracy(singleBandFrame.normals[middlePixelIndex].z, 1, 0.01);
+}
+
+- (void)testNaNDepthsHaveNoConfidence
+{
+    sc3d::PerspectiveCamera camera;
+    camera.setNominalIntrinsicMatrix(math::Mat3x3(200, 0, 40,
+                                                  0, 200, 30,
+                                                  0, 0, 1));
+    camera.setIntrinsicMatrixReferenceSize(math::Vec2(80, 60));
+
+    const size_t width = 80;
+    const size_t height = 60;
+    std::vector<float> depths(width * height, 0.3f);
+    std::vector<math::Vec3> colors(width * height, math::Vec3());
+    const size_t nanPixelIndex = 30 * width + 40;
+    depths[nanPixelIndex] = NAN;
+    RawFrame rawFrame(camera, width, height, depths, colors, 0.0);
+
+    CpuDepthProcessor processor;
+    ProcessedFrame frame(rawFrame);
+    processor.computeFrameValues(frame, rawFrame, false);
+
+    // The NaN doesn't spread to its neighbors' confidences when they're smoothed
+    XCTAssertEqual(frame.inputConfidences[nanPixelIndex], 0);
+    size_t nonFiniteCount = 0;
+    for (float confidence : frame.inputConfidences) {
+        if (!std::isfinite(confidence)) { ++nonFiniteCount; }
+    }
+    XCTAssertEqual(nonFiniteCount, 0);
+    XCTAssertGreaterThan(frame.inputConfidences[10 * width + 10], 0.95);
+}
+
+@end
@@ -0,0 +1,216 @@
+//
+//  CpuSurfelIndexMapTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <algorithm>
+#import <vector>
+
+#import <standard_cyborg/sc3d/PerspectiveCamera.hpp>
+#import <standard_cyborg/util/DataUtils.hpp>
+
+#import "CpuSurfelIndexMap.hpp"
+#import "MetalSurfelIndexMap.hpp"
+#import "PBFDefinitions.h"
+#import "PBFModel.hpp"
+#import "PointCloudIO.hpp"
+#import "SurfelStore.hpp"
+
+#import "Helpers/PathHelpers.h"
+#import "Helpers/ReconstructionHelpers.hpp"
+
+using namespace standard_cyborg;
+
+@interface CpuSurfelIndexMapTests : XCTestCase
+
+@end
+
+@implementation CpuSurfelIndexMapTests
+
+- (Surfel)_surfelAt:(Vector3f)position
+{
+    Surfel surfel;
+    surfel.position = position;
+    surfel.normal = Vector3f(0, 0, 1);
+    surfel.color = Vector3f(1, 1, 1);
+    surfel.weight = 1;
+    surfel.lifetime = 0;
+    surfel.surfelSize = 0.01;
+
+    return surfel;
+}
+
+- (void)testDepthTest
+{
+    const size_t width = 64;
+    const size_t height = 48;
+
+    sc3d::PerspectiveCamera camera;
+    camera.setNominalIntrinsicMatrix(math::Mat3x3(100, 0, 32,
+                                                  0, 100, 24,
+                                                  0, 0, 1));
+    camera.setIntrinsicMatrixReferenceSize(math::Vec2(width, height));
+    Matrix4f projection = toMatrix4f(camera.getPerspectiveMatrix());
+    const size_t centerPixel = (height / 2) * width + width / 2;
+
+    std::vector<Surfel> surfels {
+        [self _surfelAt:Vector3f(0, 0, -0.3)],
+        [self _surfelAt:Vector3f(0, 0, -0.2)],
+        [self _surfelAt:Vector3f(0, 0, -0.4)],
+    };
+
+    std::vector<uint32_t> indexLookups(width * height);
+    CpuSurfelIndexMap indexMap(2);
+    indexMap.drawForColor(surfels.data(), surfels.size(), projection, width, height, indexLookups);
+
+    // The nearest surfel wins regardless of draw order
+    XCTAssertEqual(indexLookups[centerPixel], 1);
+    XCTAssertEqual(indexLookups[0], EMPTY_SURFEL_INDEX);
+
+    // Back-facing surfels are culled
+    for (Surfel& surfel : surfels) { surfel.normal = Vector3f(0, 0, -1); }
+    indexMap.drawForColor(surfels.data(), surfels.size(), projection, width, height, indexLookups);
+    XCTAssertEqual(indexLookups[centerPixel], EMPTY_SURFEL_INDEX);
+}
+
+- (void)testSurfelsThatCantBeProjectedAreSkipped
+{
+    const size_t width = 64;
+    const size_t height = 48;
+
+    sc3d::PerspectiveCamera camera;
+    camera.setNominalIntrinsicMatrix(math::Mat3x3(100, 0, 32,
+                                                  0, 100, 24,
+                                                  0, 0, 1));
+    camera.setIntrinsicMatrixReferenceSize(math::Vec2(width, height));
+    Matrix4f projection = toMatrix4f(camera.getPerspectiveMatrix());
+
+    // Only the last one can be drawn: the rest are NaN, behind the camera, or across the eye plane
+    std::vector<Surfel> surfels {
+        [self _surfelAt:Vector3f(NAN, 0, -0.3)],
+        [self _surfelAt:Vector3f(0, 0, 0.3)],
+        [self _surfelAt:Vector3f(0, 0, 0)],
+        [self _surfelAt:Vector3f(0.01, 0, -0.3)],
+    };
+    surfels[1].normal = Vector3f(0, 0, -1);
+    surfels[2].normal = Vector3f(0, 1, 0);
+    surfels[2].surfelSize = 1;
+
+    std::vector<uint32_t> indexLookups(width * height);
+    CpuSurfelIndexMap indexMap(2);
+    indexMap.drawForColor(surfels.data(), surfels.size(), projection, width, height, indexLookups);
+
+    std::vector<uint32_t> expectedLookups(width * height);
+    indexMap.drawForColor(surfels.data() + 3, 1, projection, width, height, expectedLookups);
+    for (uint32_t& index : expectedLookups) {
+        if (index != EMPTY_SURFEL_INDEX) { index += 3; }
+    }
+
+    XCTAssertTrue(indexLookups == expectedLookups);
+    XCTAssertGreaterThan(std::count(indexLookups.begin(), indexLookups.end(), 3), 0);
+}
+
+- (void)testParityWithMetalSurfelIndexMap
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    NSString *depthFramesDir = [testCasePath stringByAppendingPathComponent:@"DepthFrames"];
+
+    ICPConfiguration icpConfig;
+    PBFConfiguration pbfConfig;
+    SurfelFusionConfiguration surfelFusionConfig;
+    surfelFusionConfig.maxDepth = 0.75;
+    pbfConfig.icpDownsampleFraction = 0.2f;
+
+    std::unique_ptr<PBFModel> pbf(assimilatePointCloud(depthFramesDir, icpConfig, pbfConfig, surfelFusionConfig));
+    const Surfels& surfels = pbf->getSurfels();
+    const std::vector<PBFAssimilatedFrameMetadata> metadatas = pbf->getAssimilatedFrameMetadata();
+    XCTAssertGreaterThan(surfels.size(), 0);
+
+    id<MTLDevice> device = MTLCreateSystemDefaultDevice();
+    id<MTLCommandQueue> commandQueue = [device newCommandQueue];
+    id<MTLLibrary> library = [device newDefaultLibraryWithBundle:[PathHelpers scFusionBundle] error:NULL];
+    MetalSurfelIndexMap metalIndexMap(device, library, commandQueue);
+    CpuSurfelIndexMap cpuIndexMap;
+
+    for (int frameIndex : { 0, 30, 60, 89 }) {
+        NSString *filePath = [depthFramesDir stringByAppendingFormat:@"/frame-%03d.ply", frameIndex];
+        std::unique_ptr<RawFrame> rawFrame = PointCloudIO::ReadRawFrameFromBPLYFile([filePath UTF8String]);
+        Matrix4f modelMatrix = metadatas[frameIndex].viewMatrix.inverse();
+
+        size_t pixelCount = rawFrame->width * rawFrame->height;
+        std::vector<uint32_t> metalLookups(pixelCount, EMPTY_SURFEL_INDEX);
+        std::vector<uint32_t> cpuLookups(pixelCount, EMPTY_SURFEL_INDEX);
+
+        metalIndexMap.draw(surfels, modelMatrix, *rawFrame, metalLookups);
+        cpuIndexMap.draw(surfels, modelMatrix, *rawFrame, cpuLookups);
+
+        XCTAssertTrue(metalIndexMap.getViewProjectionMatrix().isApprox(cpuIndexMap.getViewProjectionMatrix()));
+
+        size_t coveredPixelCount = 0;
+        size_t matchingPixelCount = 0;
+        for (size_t i = 0; i < pixelCount; ++i) {
+            if (metalLookups[i] == EMPTY_SURFEL_INDEX && cpuLookups[i] == EMPTY_SURFEL_INDEX) { continue; }
+
+            ++coveredPixelCount;
+            if (metalLookups[i] == cpuLookups[i]) { ++matchingPixelCount; }
+        }
+
+        // Rasterization rules and depth precision can differ along splat edges,
+        // so allow a small fraction of pixels to disagree
+        float matchingFraction = (float)matchingPixelCount / std::max(coveredPixelCount, (size_t)1);
+        NSLog(@"Frame %d: %zu covered pixels, %.4f match", frameIndex, coveredPixelCount, matchingFraction);
+        XCTAssertGreaterThan(coveredPixelCount, pixelCount / 10);
+        XCTAssertGreaterThan(matchingFraction, 0.97);
+    }
+}
+
+- (void)testMetalDrawsSurfelStoreLikeItsPackedSlots
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    NSString *depthFramesDir = [testCasePath stringByAppendingPathComponent:@"DepthFrames"];
+
+    ICPConfiguration icpConfig;
+    PBFConfiguration pbfConfig;
+    SurfelFusionConfiguration surfelFusionConfig;
+    surfelFusionConfig.maxDepth = 0.75;
+    pbfConfig.icpDownsampleFraction = 0.2f;
+
+    std::unique_ptr<PBFModel> pbf(assimilatePointCloud(depthFramesDir, icpConfig, pbfConfig, surfelFusionConfig));
+    const std::vector<PBFAssimilatedFrameMetadata> metadatas = pbf->getAssimilatedFrameMetadata();
+
+    // Tombstone every third surfel, so the store has to skip them while the rest keep their slots
+    SurfelStore store;
+    store.assign(pbf->getSurfels());
+    std::vector<int> removedIndices;
+    for (int i = 0; i < (int)store.size(); i += 3) { removedIndices.push_back(i); }
+    store.markRemoved(removedIndices);
+
+    Surfels packedSlots;
+    store.copySlotsTo(packedSlots);
+
+    id<MTLDevice> device = MTLCreateSystemDefaultDevice();
+    id<MTLCommandQueue> commandQueue = [device newCommandQueue];
+    id<MTLLibrary> library = [device newDefaultLibraryWithBundle:[PathHelpers scFusionBundle] error:NULL];
+    MetalSurfelIndexMap metalIndexMap(device, library, commandQueue);
+
+    NSString *filePath = [depthFramesDir stringByAppendingString:@"/frame-030.ply"];
+    std::unique_ptr<RawFrame> rawFrame = PointCloudIO::ReadRawFrameFromBPLYFile([filePath UTF8String]);
+    Matrix4f modelMatrix = metadatas[30].viewMatrix.inverse();
+
+    size_t pixelCount = rawFrame->width * rawFrame->height;
+    std::vector<uint32_t> storeLookups(pixelCount, EMPTY_SURFEL_INDEX);
+    std::vector<uint32_t> packedLookups(pixelCount, EMPTY_SURFEL_INDEX);
+
+    XCTAssertTrue(metalIndexMap.draw(store, modelMatrix, *rawFrame, storeLookups));
+    XCTAssertTrue(metalIndexMap.draw(packedSlots, modelMatrix, *rawFrame, packedLookups));
+
+    XCTAssertTrue(storeLookups == packedLookups);
+    for (uint32_t index : storeLookups) {
+        if (index != EMPTY_SURFEL_INDEX) { XCTAssertFalse(store.isRemoved(index)); }
+    }
+}
+
+@end
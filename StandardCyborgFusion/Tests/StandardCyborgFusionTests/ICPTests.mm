@@ -0,0 +1,476 @@
+//
+//  ICPTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <algorithm>
+#import <vector>
+
+#import <standard_cyborg/sc3d/Geometry.hpp>
+#import <standard_cyborg/util/DataUtils.hpp>
+
+#import "CpuDepthProcessor.hpp"
+#import "CpuSurfelIndexMap.hpp"
+#import "GeometryHelpers.hpp"
+#import "ICP.hpp"
+#import "ICPIncrementalTarget.hpp"
+#import "ICPProjectiveTarget.hpp"
+#import "OfflineReconstructor.hpp"
+#import "SurfelFusion.hpp"
+
+#import "Helpers/PathHelpers.h"
+
+using namespace standard_cyborg;
+
+static Surfel _surfelAt(float x, float y, float z)
+{
+    Surfel surfel;
+    surfel.position = Vector3f(x, y, z);
+    surfel.normal = Vector3f(0, 0, 1);
+    surfel.color = Vector3f(1, 1, 1);
+    surfel.weight = 1;
+    surfel.lifetime = 0;
+    surfel.surfelSize = 0.001;
+
+    return surfel;
+}
+
+// Which surfels and pixels ICP samples is random, and moves how many frames of a scan merge by
+// a few either way. Tests that compare ICP settings by merged frames add them up over this many
+// random seeds, so that they compare the settings rather than one seed's luck.
+static const unsigned int kComparedRandomSeedCount = 5;
+
+@interface ICPTests : XCTestCase
+
+@end
+
+@implementation ICPTests
+
+- (NSString *)_depthFramesDir
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    return [testCasePath stringByAppendingPathComponent:@"DepthFrames"];
+}
+
+// Fuses the first frame, renders it back into a projective target from the same pose,
+// and returns every seventh valid point of the frame, moved by `offset`
+- (sc3d::Geometry)_sourceCloudWithOffset:(Eigen::Matrix4f)offset target:(ICPProjectiveTarget&)target
+{
+    NSString *filePath = [[self _depthFramesDir] stringByAppendingPathComponent:@"frame-000.ply"];
+    std::unique_ptr<RawFrame> rawFrame = OfflineReconstructor::readRawFrame([filePath UTF8String]);
+
+    CpuDepthProcessor depthProcessor;
+    ProcessedFrame frame(*rawFrame);
+    depthProcessor.computeFrameValues(frame, *rawFrame);
+
+    SurfelFusionConfiguration surfelFusionConfig;
+    surfelFusionConfig.cullLowConfidence = false;
+
+    SurfelFusion surfelFusion(std::make_shared<CpuSurfelIndexMap>());
+    SurfelStore surfels;
+    SparseSurfelLandmarksIndex landmarksIndex;
+    SurfelIndexChanges indexChanges;
+    surfelFusion.doFusion(surfelFusionConfig, frame, surfels, math::Mat4x4(), NULL, landmarksIndex, indexChanges);
+    XCTAssertTrue(surfelFusion.drawICPTarget(surfels, math::Mat4x4(), *rawFrame, target));
+
+    std::vector<math::Vec3> positions;
+    std::vector<math::Vec3> normals;
+    for (size_t i = 0; i < frame.positions.size(); i += 7) {
+        float depth = rawFrame->depths[i];
+        if (depth <= 0 || depth > surfelFusionConfig.maxDepth) { continue; }
+
+        positions.push_back(toVec3(Vec3TransformMat4(toVector3f(frame.positions[i]), offset)));
+        normals.push_back(toVec3(offset.topLeftCorner<3, 3>() * toVector3f(frame.normals[i])));
+    }
+
+    return sc3d::Geometry(positions, normals);
+}
+
+- (void)testProjectiveICPRecoversOffset
+{
+    Eigen::Matrix4f offset = Eigen::Matrix4f::Identity();
+    offset.topLeftCorner<3, 3>() = Eigen::AngleAxisf(0.01, Eigen::Vector3f(0, 1, 0)).toRotationMatrix();
+    offset.col(3).head<3>() = Eigen::Vector3f(0.002, -0.001, 0.001);
+
+    ICPProjectiveTarget target;
+    sc3d::Geometry sourceCloud = [self _sourceCloudWithOffset:offset target:target];
+
+    ICPConfiguration icpConfig;
+    icpConfig.correspondenceMode = ICPCorrespondenceMode::Projective;
+    ICPResult result = ICP::run(icpConfig, sourceCloud, target);
+
+    XCTAssertTrue(result.succeeded);
+    XCTAssertLessThan(result.iterationCount, icpConfig.maxIterations);
+
+    // The result should undo the offset
+    Eigen::Matrix4f residual = toMatrix4f(result.sourceTransform) * offset;
+    XCTAssertLessThan(residual.col(3).head<3>().norm(), 2e-4);
+    XCTAssertLessThan((residual.topLeftCorner<3, 3>() - Eigen::Matrix3f::Identity()).norm(), 2e-3);
+}
+
+- (void)testProjectiveICPRejectsDistantCorrespondences
+{
+    // Much further than maxProjectiveCorrespondenceDistance, so nothing matches
+    Eigen::Matrix4f offset = Eigen::Matrix4f::Identity();
+    offset.col(3).head<3>() = Eigen::Vector3f(0, 0, 0.05);
+
+    ICPProjectiveTarget target;
+    sc3d::Geometry sourceCloud = [self _sourceCloudWithOffset:offset target:target];
+
+    ICPConfiguration icpConfig;
+    icpConfig.correspondenceMode = ICPCorrespondenceMode::Projective;
+    ICPResult result = ICP::run(icpConfig, sourceCloud, target);
+
+    XCTAssertFalse(result.succeeded);
+}
+
+- (void)testProjectiveICPRejectsEmptyPixelsWithAnyAngle
+{
+    ICPProjectiveTarget target;
+    sc3d::Geometry sourceCloud = [self _sourceCloudWithOffset:Eigen::Matrix4f::Identity() target:target];
+
+    // Nothing rendered anywhere, so even with every normal allowed there's nothing to match
+    std::fill(target.coverage.begin(), target.coverage.end(), 0);
+    XCTAssertTrue(target.isEmpty(target.width * target.height / 2));
+
+    ICPConfiguration icpConfig;
+    icpConfig.correspondenceMode = ICPCorrespondenceMode::Projective;
+    icpConfig.maxProjectiveCorrespondenceAngle = M_PI;
+    ICPResult result = ICP::run(icpConfig, sourceCloud, target);
+
+    XCTAssertFalse(result.succeeded);
+}
+
+- (void)testNearestNeighborICPRecoversOffsetWithAnyThreadCount
+{
+    Eigen::Matrix4f offset = Eigen::Matrix4f::Identity();
+    offset.topLeftCorner<3, 3>() = Eigen::AngleAxisf(0.01, Eigen::Vector3f(1, 0, 0)).toRotationMatrix();
+    offset.col(3).head<3>() = Eigen::Vector3f(-0.001, 0.002, 0.001);
+
+    ICPProjectiveTarget projectiveTarget;
+    sc3d::Geometry sourceCloud = [self _sourceCloudWithOffset:offset target:projectiveTarget];
+
+    std::vector<math::Vec3> positions;
+    std::vector<math::Vec3> normals;
+    for (size_t i = 0; i < projectiveTarget.positions.size(); ++i) {
+        if (projectiveTarget.isEmpty(i)) { continue; }
+
+        positions.push_back(projectiveTarget.positions[i]);
+        normals.push_back(projectiveTarget.normals[i]);
+    }
+    sc3d::Geometry targetCloud(positions, normals);
+
+    ICPResult singleThreadResult;
+    for (int threadCount : { 1, 3, 8 }) {
+        // The source is transformed in place, so each run needs its own copy
+        sc3d::Geometry source(sourceCloud.getPositions(), sourceCloud.getNormals());
+
+        ICPConfiguration icpConfig;
+        icpConfig.threadCount = threadCount;
+        ICPResult result = ICP::run(icpConfig, source, targetCloud);
+        XCTAssertTrue(result.succeeded);
+
+        Eigen::Matrix4f residual = toMatrix4f(result.sourceTransform) * offset;
+        XCTAssertLessThan(residual.col(3).head<3>().norm(), 5e-4);
+
+        // Splitting the normal equations into chunks only changes the order of float sums
+        if (threadCount == 1) {
+            singleThreadResult = result;
+        } else {
+            XCTAssertEqual(result.iterationCount, singleThreadResult.iterationCount);
+            XCTAssertEqualWithAccuracy(result.rmsCorrespondenceError, singleThreadResult.rmsCorrespondenceError, 1e-6);
+        }
+    }
+}
+
+- (void)testProjectiveReconstructionMatchesNearestNeighbor
+{
+    std::string depthFramesDir = [[self _depthFramesDir] UTF8String];
+    std::vector<Eigen::Matrix4f> nearestNeighborPoses;
+
+    ICPConfiguration nearestNeighborConfig;
+    OfflineReconstructor nearestNeighbor(std::make_shared<CpuDepthProcessor>(),
+                                         std::make_shared<CpuSurfelIndexMap>(),
+                                         PBFConfiguration(),
+                                         nearestNeighborConfig);
+    nearestNeighbor.assimilateDirectory(depthFramesDir, [&](size_t, const PBFAssimilatedFrameMetadata&, double) {
+        nearestNeighborPoses.push_back(nearestNeighbor.getModel().getCurrentExtrinsicMatrix());
+    });
+
+    ICPConfiguration projectiveConfig;
+    projectiveConfig.correspondenceMode = ICPCorrespondenceMode::Projective;
+    OfflineReconstructor projective(std::make_shared<CpuDepthProcessor>(),
+                                    std::make_shared<CpuSurfelIndexMap>(),
+                                    PBFConfiguration(),
+                                    projectiveConfig);
+
+    size_t mergedFrameCount = 0;
+    double sumPositionDifference = 0;
+    projective.assimilateDirectory(depthFramesDir, [&](size_t frameIndex, const PBFAssimilatedFrameMetadata& metadata, double) {
+        if (metadata.isMerged) { ++mergedFrameCount; }
+
+        Eigen::Matrix4f pose = projective.getModel().getCurrentExtrinsicMatrix();
+        sumPositionDifference += (pose.col(3) - nearestNeighborPoses[frameIndex].col(3)).norm();
+    });
+
+    double meanPositionDifference = sumPositionDifference / nearestNeighborPoses.size();
+    NSLog(@"Projective ICP merged %zu frames, mean camera position difference %f", mergedFrameCount, meanPositionDifference);
+
+    XCTAssertGreaterThanOrEqual(mergedFrameCount, 85);
+    XCTAssertLessThan(meanPositionDifference, 0.005);
+}
+
+- (void)testCoarseLevelsReduceMainStageIterations
+{
+    std::string depthFramesDir = [[self _depthFramesDir] UTF8String];
+
+    auto reconstruct = [&](ICPConfiguration icpConfig, size_t& mergedFrameCountOut, double& averageIterationsOut) {
+        size_t frameCount = 0;
+        size_t iterationCount = 0;
+        mergedFrameCountOut = 0;
+
+        for (unsigned int randomSeed = 0; randomSeed < kComparedRandomSeedCount; ++randomSeed) {
+            OfflineReconstructor reconstructor(std::make_shared<CpuDepthProcessor>(),
+                                               std::make_shared<CpuSurfelIndexMap>(),
+                                               PBFConfiguration(),
+                                               icpConfig);
+            reconstructor.getModel().reset(randomSeed);
+
+            reconstructor.assimilateDirectory(depthFramesDir, [&](size_t, const PBFAssimilatedFrameMetadata& metadata, double) {
+                ++frameCount;
+                iterationCount += metadata.icpIterationCount;
+                if (metadata.isMerged) { ++mergedFrameCountOut; }
+            });
+        }
+
+        averageIterationsOut = (double)iterationCount / std::max(frameCount, (size_t)1);
+    };
+
+    ICPConfiguration singleLevelConfig;
+    ICPConfiguration pyramidConfig;
+    pyramidConfig.coarseLevels = {
+        { 16, 4, 1e-3 },
+        { 8, 3, 1e-3 },
+    };
+
+    size_t singleLevelMergedCount, pyramidMergedCount;
+    double singleLevelIterations, pyramidIterations;
+    reconstruct(singleLevelConfig, singleLevelMergedCount, singleLevelIterations);
+    reconstruct(pyramidConfig, pyramidMergedCount, pyramidIterations);
+
+    NSLog(@"Single level: %zu merged, %f iterations; pyramid: %zu merged, %f full resolution iterations",
+          singleLevelMergedCount, singleLevelIterations, pyramidMergedCount, pyramidIterations);
+
+    XCTAssertGreaterThanOrEqual(pyramidMergedCount, singleLevelMergedCount);
+    XCTAssertLessThan(pyramidIterations, singleLevelIterations);
+}
+
+- (void)testIncrementalTargetFollowsFusionAndCulling
+{
+    ICPIncrementalTarget target;
+    math::Vec3 position, normal;
+    XCTAssertFalse(target.findClosestPoint(math::Vec3(0, 0, 0), position, normal));
+
+    // A row of surfels 1 cm apart, all of which are sampled into the target
+    SurfelStore surfels;
+    for (int i = 0; i < 10; ++i) { surfels.push_back(_surfelAt(0.01f * i, 0, 0)); }
+    SurfelIndexChanges indexChanges;
+    target.update(surfels, indexChanges, 1, INFINITY);
+    XCTAssertEqual(target.size(), 10);
+
+    // Append two more, then cull surfels 2 and 5 and compact, as doFusion would
+    surfels.push_back(_surfelAt(0.1, 0, 0));
+    surfels.push_back(_surfelAt(0.11, 0, 0));
+    surfels.markRemoved({ 2, 5 });
+    surfels.compact(indexChanges.compactedSurfelIndices);
+    indexChanges.firstAppendedSurfelIndex = 10;
+    indexChanges.removedSurfelIndices = { 2, 5 };
+
+    // Move one of the survivors slightly, and another far enough to be reindexed
+    surfels.positions[0].y() = 0.0001;
+    surfels.normals[0] = Vector3f(0, 1, 0);
+    surfels.positions[6].y() = 0.005;
+
+    target.update(surfels, indexChanges, 1, 0.001);
+    XCTAssertEqual(target.size(), 10);
+
+    // Culled surfels are gone, so the nearest point to them is a neighbor
+    XCTAssertTrue(target.findClosestPoint(math::Vec3(0.02, 0, 0), position, normal));
+    XCTAssertEqualWithAccuracy(std::abs(position.x - 0.02), 0.01, 1e-6);
+    XCTAssertTrue(target.findClosestPoint(math::Vec3(0.05, 0, 0), position, normal));
+    XCTAssertEqualWithAccuracy(std::abs(position.x - 0.05), 0.01, 1e-6);
+
+    // Small moves keep the indexed position but pick up the new normal
+    XCTAssertTrue(target.findClosestPoint(math::Vec3(0, 0, 0), position, normal));
+    XCTAssertEqual(position.y, 0);
+    XCTAssertEqual(normal.y, 1);
+
+    // Large moves are reindexed at the surfel's new position
+    XCTAssertTrue(target.findClosestPoint(math::Vec3(0.08, 0.005, 0), position, normal));
+    XCTAssertEqualWithAccuracy(position.y, 0.005, 1e-6);
+
+    // New surfels are added
+    XCTAssertTrue(target.findClosestPoint(math::Vec3(0.112, 0, 0), position, normal));
+    XCTAssertEqualWithAccuracy(position.x, 0.11, 1e-6);
+
+    // Culling everything empties it
+    indexChanges.clear();
+    indexChanges.firstAppendedSurfelIndex = surfels.size();
+    for (int i = 0; i < (int)surfels.size(); ++i) { indexChanges.removedSurfelIndices.push_back(i); }
+    indexChanges.compactedSurfelIndices = indexChanges.removedSurfelIndices;
+    target.update(SurfelStore(), indexChanges, 1, INFINITY);
+    XCTAssertEqual(target.size(), 0);
+    XCTAssertFalse(target.findClosestPoint(math::Vec3(0, 0, 0), position, normal));
+}
+
+- (void)testIncrementalTargetFollowsReusedTombstones
+{
+    ICPIncrementalTarget target;
+    math::Vec3 position, normal;
+
+    SurfelStore surfels;
+    for (int i = 0; i < 10; ++i) { surfels.push_back(_surfelAt(0.01f * i, 0, 0)); }
+    SurfelIndexChanges indexChanges;
+    target.update(surfels, indexChanges, 1, INFINITY);
+
+    // Cull surfel 3 without compacting
+    surfels.markRemoved({ 3 });
+    indexChanges.firstAppendedSurfelIndex = surfels.size();
+    indexChanges.removedSurfelIndices = { 3 };
+    target.update(surfels, indexChanges, 1, INFINITY);
+    XCTAssertEqual(target.size(), 9);
+
+    // A new surfel takes over its slot, somewhere else entirely
+    surfels.set(3, _surfelAt(0.2, 0, 0));
+    surfels.tombstones[3] = 0;
+    surfels.freeSlots.clear();
+    indexChanges.clear();
+    indexChanges.reusedSurfelIndices = { 3 };
+    indexChanges.firstAppendedSurfelIndex = surfels.size();
+    target.update(surfels, indexChanges, 1, INFINITY);
+    XCTAssertEqual(target.size(), 10);
+
+    XCTAssertTrue(target.findClosestPoint(math::Vec3(0.03, 0, 0), position, normal));
+    XCTAssertEqualWithAccuracy(std::abs(position.x - 0.03), 0.01, 1e-6);
+    XCTAssertTrue(target.findClosestPoint(math::Vec3(0.19, 0, 0), position, normal));
+    XCTAssertEqualWithAccuracy(position.x, 0.2, 1e-6);
+}
+
+- (void)testIncrementalTargetSamplingIgnoresSurfelNumbering
+{
+    // The same surfels, numbered in opposite orders
+    SurfelStore surfels, reversedSurfels;
+    for (int i = 0; i < 1000; ++i) {
+        surfels.push_back(_surfelAt(0.001f * i, 0, 0));
+        reversedSurfels.push_back(_surfelAt(0.001f * (999 - i), 0, 0));
+    }
+
+    ICPIncrementalTarget target, reversedTarget;
+    target.update(surfels, SurfelIndexChanges(), 0.5, INFINITY);
+    reversedTarget.update(reversedSurfels, SurfelIndexChanges(), 0.5, INFINITY);
+
+    ICPIncrementalTargetState state, reversedState;
+    target.saveState(state);
+    reversedTarget.saveState(reversedState);
+
+    auto byX = [](const math::Vec3& a, const math::Vec3& b) { return a.x < b.x; };
+    std::sort(state.positions.begin(), state.positions.end(), byX);
+    std::sort(reversedState.positions.begin(), reversedState.positions.end(), byX);
+
+    XCTAssertGreaterThan(state.positions.size(), 400);
+    XCTAssertLessThan(state.positions.size(), 600);
+    XCTAssertEqual(state.positions.size(), reversedState.positions.size());
+    XCTAssertTrue(state.positions == reversedState.positions);
+}
+
+- (void)testIncrementalTargetMatchesRebuiltPointCloud
+{
+    Eigen::Matrix4f offset = Eigen::Matrix4f::Identity();
+    offset.topLeftCorner<3, 3>() = Eigen::AngleAxisf(0.01, Eigen::Vector3f(0, 1, 0)).toRotationMatrix();
+    offset.col(3).head<3>() = Eigen::Vector3f(0.002, -0.001, 0.001);
+
+    ICPProjectiveTarget projectiveTarget;
+    sc3d::Geometry sourceCloud = [self _sourceCloudWithOffset:offset target:projectiveTarget];
+    sc3d::Geometry sourceCloudCopy(sourceCloud.getPositions(), sourceCloud.getNormals());
+
+    // Use every valid pixel of the rendered model as the target for both
+    std::vector<math::Vec3> positions;
+    std::vector<math::Vec3> normals;
+    SurfelStore surfels;
+    for (size_t i = 0; i < projectiveTarget.positions.size(); ++i) {
+        if (projectiveTarget.isEmpty(i)) { continue; }
+
+        const math::Vec3& p = projectiveTarget.positions[i];
+        const math::Vec3& n = projectiveTarget.normals[i];
+        positions.push_back(p);
+        normals.push_back(n);
+
+        Surfel surfel = _surfelAt(p.x, p.y, p.z);
+        surfel.normal = Vector3f(n.x, n.y, n.z);
+        surfels.push_back(surfel);
+    }
+    sc3d::Geometry targetCloud(positions, normals);
+
+    ICPIncrementalTarget incrementalTarget;
+    incrementalTarget.update(surfels, SurfelIndexChanges(), 1, INFINITY);
+
+    ICPConfiguration icpConfig;
+    ICPResult rebuiltResult = ICP::run(icpConfig, sourceCloud, targetCloud);
+    ICPResult incrementalResult = ICP::run(icpConfig, sourceCloudCopy, incrementalTarget);
+
+    XCTAssertTrue(incrementalResult.succeeded);
+    XCTAssertEqual(incrementalResult.iterationCount, rebuiltResult.iterationCount);
+    XCTAssertEqualWithAccuracy(incrementalResult.rmsCorrespondenceError, rebuiltResult.rmsCorrespondenceError, 1e-6);
+}
+
+- (void)testMotionModelPredictsPose
+{
+    std::string depthFramesDir = [[self _depthFramesDir] UTF8String];
+
+    auto reconstruct = [&](int motionModelFrameCount, size_t& mergedFrameCountOut, size_t& predictedFrameCountOut, double& averageTranslationResidualOut) {
+        PBFConfiguration pbfConfig;
+        pbfConfig.motionModelFrameCount = motionModelFrameCount;
+
+        double sumTranslationResidual = 0;
+        mergedFrameCountOut = 0;
+        predictedFrameCountOut = 0;
+
+        for (unsigned int randomSeed = 0; randomSeed < kComparedRandomSeedCount; ++randomSeed) {
+            OfflineReconstructor reconstructor(std::make_shared<CpuDepthProcessor>(),
+                                               std::make_shared<CpuSurfelIndexMap>(),
+                                               pbfConfig,
+                                               ICPConfiguration());
+            reconstructor.getModel().reset(randomSeed);
+
+            reconstructor.assimilateDirectory(depthFramesDir, [&](size_t, const PBFAssimilatedFrameMetadata& metadata, double) {
+                if (!metadata.isMerged) { return; }
+
+                ++mergedFrameCountOut;
+                sumTranslationResidual += metadata.initialPoseTranslationResidual;
+                if (metadata.isPosePredicted) { ++predictedFrameCountOut; }
+            });
+        }
+
+        averageTranslationResidualOut = sumTranslationResidual / std::max(mergedFrameCountOut, (size_t)1);
+    };
+
+    size_t mergedCount, predictedMergedCount, predictedCount, unusedPredictedCount;
+    double residual, predictedResidual;
+    reconstruct(0, mergedCount, unusedPredictedCount, residual);
+    reconstruct(2, predictedMergedCount, predictedCount, predictedResidual);
+
+    NSLog(@"Without motion model: %zu merged, %f m residual; with: %zu merged (%zu predicted), %f m residual",
+          mergedCount, residual, predictedMergedCount, predictedCount, predictedResidual);
+
+    XCTAssertEqual(unusedPredictedCount, 0);
+    XCTAssertGreaterThan(predictedCount, predictedMergedCount / 2);
+    XCTAssertGreaterThanOrEqual(predictedMergedCount + 2 * kComparedRandomSeedCount, mergedCount);
+
+    // The scan moves smoothly, so the prediction should be closer than the previous pose
+    XCTAssertLessThan(predictedResidual, residual);
+}
+
+@end
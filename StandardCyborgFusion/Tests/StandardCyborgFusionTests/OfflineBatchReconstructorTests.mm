@@ -0,0 +1,225 @@
+//
+//  OfflineBatchReconstructorTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <filesystem>
+#import <fstream>
+#import <set>
+#import <stdexcept>
+#import <string>
+#import <vector>
+
+#import <standard_cyborg/io/ply/GeometryFileIO_PLY.hpp>
+#import <standard_cyborg/sc3d/Geometry.hpp>
+
+#import "CpuDepthProcessor.hpp"
+#import "CpuSurfelIndexMap.hpp"
+#import "OfflineBatchReconstructor.hpp"
+
+#import "Helpers/PathHelpers.h"
+
+using namespace standard_cyborg;
+
+// Throws on the frame with the given timestamp, as a frame too big to allocate might
+class ThrowingDepthProcessor : public CpuDepthProcessor {
+public:
+    ThrowingDepthProcessor(double throwingTimestamp) : _throwingTimestamp(throwingTimestamp) {}
+
+    virtual void computeFrameValues(ProcessedFrame &frameOut,
+                                    const RawFrame &rawFrame,
+                                    bool smoothPoints = false)
+    {
+        if (rawFrame.timestamp == _throwingTimestamp) { throw std::runtime_error("Can't process this frame"); }
+
+        CpuDepthProcessor::computeFrameValues(frameOut, rawFrame, smoothPoints);
+    }
+
+private:
+    double _throwingTimestamp;
+};
+
+@interface OfflineBatchReconstructorTests : XCTestCase
+
+@end
+
+@implementation OfflineBatchReconstructorTests
+
+- (void)testBatchMatchesReconstructingEachScanAlone
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    std::string depthFramesDir = [[testCasePath stringByAppendingPathComponent:@"DepthFrames"] UTF8String];
+    std::filesystem::path outputDir = std::filesystem::path([NSTemporaryDirectory() UTF8String]) / "OfflineBatchReconstructorTests";
+
+    // A shorter scan made from the first few frames, so lanes go between scans of different lengths
+    std::filesystem::path shortScanDir = outputDir / "ShortScan";
+    std::filesystem::remove_all(outputDir);
+    std::filesystem::create_directories(shortScanDir);
+    std::vector<std::string> framePaths = OfflineReconstructor::findRawFramePaths(depthFramesDir);
+    for (size_t frameIndex = 0; frameIndex < 30; ++frameIndex) {
+        std::filesystem::path framePath(framePaths[frameIndex]);
+        std::filesystem::copy_file(framePath, shortScanDir / framePath.filename());
+    }
+
+    std::vector<OfflineBatchScan> scans = {
+        { depthFramesDir, (outputDir / "scan-0.ply").string() },
+        { shortScanDir.string(), (outputDir / "scan-1.ply").string() },
+        { (outputDir / "Missing").string(), (outputDir / "scan-2.ply").string() },
+        { shortScanDir.string(), "" },
+        { depthFramesDir, (outputDir / "scan-4.ply").string() },
+    };
+
+    OfflineBatchReconstructor batch([]() { return std::make_shared<CpuDepthProcessor>(); },
+                                    []() { return std::make_shared<CpuSurfelIndexMap>(); },
+                                    2);
+    XCTAssertEqual(batch.getMaxScansInFlight(), 2);
+
+    std::set<size_t> finishedScanIndices;
+    std::vector<OfflineBatchScanResult> results = batch.reconstruct(scans, [&](size_t scanIndex, const OfflineBatchScanResult& result) {
+        XCTAssertTrue(finishedScanIndices.insert(scanIndex).second);
+        XCTAssertEqual(std::filesystem::exists(scans[scanIndex].outputPLYPath), result.succeeded && !scans[scanIndex].outputPLYPath.empty());
+    });
+    XCTAssertEqual(results.size(), scans.size());
+    XCTAssertEqual(finishedScanIndices.size(), scans.size());
+    XCTAssertEqual(batch.laneCount(), 2);
+
+    XCTAssertFalse(results[2].succeeded);
+    XCTAssertEqual(results[2].frameCount, 0);
+    XCTAssertEqual(results[0].frameCount, 90);
+    XCTAssertEqual(results[1].frameCount, 30);
+
+    for (size_t scanIndex : { 0, 1, 3, 4 }) {
+        OfflineReconstructor alone(std::make_shared<CpuDepthProcessor>(),
+                                   std::make_shared<CpuSurfelIndexMap>());
+        XCTAssertTrue(alone.assimilateDirectory(scans[scanIndex].rawFrameDirectory));
+        PBFFinalStatistics statistics = alone.finish();
+
+        const OfflineBatchScanResult& result = results[scanIndex];
+        XCTAssertTrue(result.succeeded);
+        XCTAssertGreaterThan(result.seconds, 0);
+        XCTAssertEqual(result.statistics.mergedFrameCount, statistics.mergedFrameCount);
+        XCTAssertEqual(result.statistics.averageICPIterations, statistics.averageICPIterations);
+        XCTAssertEqual(result.statistics.averageCorrespondenceError, statistics.averageCorrespondenceError);
+        XCTAssertEqual(result.surfelCount, alone.getModel().getSurfels().size());
+        XCTAssertEqual(result.peakSurfelCount, alone.getPeakSurfelCount());
+
+        if (!scans[scanIndex].outputPLYPath.empty()) {
+            sc3d::Geometry written;
+            XCTAssertTrue(io::ply::ReadGeometryFromPLYFile(written, scans[scanIndex].outputPLYPath));
+            XCTAssertEqual((size_t)written.vertexCount(), result.surfelCount);
+        }
+    }
+
+    // Another batch reuses the lanes it already has
+    std::vector<OfflineBatchScanResult> rerunResults = batch.reconstruct({ scans[1] });
+    XCTAssertEqual(batch.laneCount(), 2);
+    XCTAssertEqual(rerunResults[0].surfelCount, results[1].surfelCount);
+    XCTAssertEqual(rerunResults[0].statistics.averageICPIterations, results[1].statistics.averageICPIterations);
+
+    std::filesystem::remove_all(outputDir);
+}
+
+- (void)testScanThatThrowsFailsWithoutStoppingTheOthers
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    std::string depthFramesDir = [[testCasePath stringByAppendingPathComponent:@"DepthFrames"] UTF8String];
+    std::filesystem::path outputDir = std::filesystem::path([NSTemporaryDirectory() UTF8String]) / "OfflineBatchReconstructorThrowTests";
+
+    std::filesystem::path shortScanDir = outputDir / "ShortScan";
+    std::filesystem::remove_all(outputDir);
+    std::filesystem::create_directories(shortScanDir);
+    std::vector<std::string> framePaths = OfflineReconstructor::findRawFramePaths(depthFramesDir);
+    for (size_t frameIndex = 0; frameIndex < 30; ++frameIndex) {
+        std::filesystem::path framePath(framePaths[frameIndex]);
+        std::filesystem::copy_file(framePath, shortScanDir / framePath.filename());
+    }
+
+    // Only the full scan reaches this frame
+    double throwingTimestamp = OfflineReconstructor::readRawFrame(framePaths[40])->timestamp;
+
+    std::vector<OfflineBatchScan> scans = {
+        { shortScanDir.string(), "" },
+        { depthFramesDir, (outputDir / "scan-1.ply").string() },
+        { shortScanDir.string(), "" },
+        { shortScanDir.string(), "" },
+    };
+
+    // With one lane the scan throws on the calling thread, and with two it may on a lane's own thread
+    for (int maxScansInFlight : { 1, 2 }) {
+        OfflineBatchReconstructor batch([=]() { return std::make_shared<ThrowingDepthProcessor>(throwingTimestamp); },
+                                        []() { return std::make_shared<CpuSurfelIndexMap>(); },
+                                        maxScansInFlight);
+
+        size_t callbackCount = 0;
+        std::vector<OfflineBatchScanResult> results = batch.reconstruct(scans, [&](size_t, const OfflineBatchScanResult&) {
+            ++callbackCount;
+        });
+        XCTAssertEqual(callbackCount, scans.size());
+
+        XCTAssertFalse(results[1].succeeded);
+        XCTAssertFalse(std::filesystem::exists(scans[1].outputPLYPath));
+
+        // The lane that ran the failed scan goes on to reconstruct the next ones as usual
+        for (size_t scanIndex : { 0, 2, 3 }) {
+            XCTAssertTrue(results[scanIndex].succeeded);
+            XCTAssertEqual(results[scanIndex].frameCount, 30);
+            XCTAssertEqual(results[scanIndex].surfelCount, results[0].surfelCount);
+            XCTAssertEqual(results[scanIndex].statistics.averageICPIterations, results[0].statistics.averageICPIterations);
+        }
+    }
+
+    // A frame that reads as a PLY but not as a raw frame fails the scan after the frames
+    // before it, while one the PLY reader throws on comes back empty
+    std::filesystem::path unreadableScanDir = outputDir / "UnreadableScan";
+    std::filesystem::path throwingScanDir = outputDir / "ThrowingScan";
+    std::filesystem::create_directories(unreadableScanDir);
+    std::filesystem::create_directories(throwingScanDir);
+    for (size_t frameIndex = 0; frameIndex < 10; ++frameIndex) {
+        std::filesystem::path framePath(framePaths[frameIndex]);
+        std::filesystem::copy_file(framePath, unreadableScanDir / framePath.filename());
+        std::filesystem::copy_file(framePath, throwingScanDir / framePath.filename());
+    }
+    std::ofstream((unreadableScanDir / "frame-999.ply").string()) << "ply\nformat ascii 1.0\nelement vertex 0\nend_header\n";
+    std::ofstream((throwingScanDir / "frame-999.ply").string()) << "Not a PLY";
+
+    OfflineBatchReconstructor unreadableBatch([]() { return std::make_shared<CpuDepthProcessor>(); },
+                                              []() { return std::make_shared<CpuSurfelIndexMap>(); },
+                                              1);
+    std::vector<OfflineBatchScanResult> unreadableResults = unreadableBatch.reconstruct({
+        { unreadableScanDir.string(), (outputDir / "unreadable.ply").string() },
+        { throwingScanDir.string(), (outputDir / "throwing.ply").string() },
+    });
+
+    XCTAssertFalse(unreadableResults[0].succeeded);
+    XCTAssertEqual(unreadableResults[0].frameCount, 10);
+    XCTAssertGreaterThan(unreadableResults[0].surfelCount, 0);
+    XCTAssertGreaterThanOrEqual(unreadableResults[0].peakSurfelCount, unreadableResults[0].surfelCount);
+    XCTAssertFalse(std::filesystem::exists(outputDir / "unreadable.ply"));
+
+    XCTAssertFalse(unreadableResults[1].succeeded);
+    XCTAssertEqual(unreadableResults[1].frameCount, 0);
+    XCTAssertEqual(unreadableResults[1].surfelCount, 0);
+    XCTAssertEqual(unreadableResults[1].statistics.mergedFrameCount, 0);
+    XCTAssertFalse(std::filesystem::exists(outputDir / "throwing.ply"));
+
+    // An exception from the callback stops the batch, and comes out once the lanes have stopped
+    OfflineBatchReconstructor batch([]() { return std::make_shared<CpuDepthProcessor>(); },
+                                    []() { return std::make_shared<CpuSurfelIndexMap>(); },
+                                    2);
+    bool threw = false;
+    try {
+        batch.reconstruct({ scans[0], scans[2], scans[3] }, [](size_t, const OfflineBatchScanResult&) {
+            throw std::runtime_error("Stop");
+        });
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    XCTAssertTrue(threw);
+
+    std::filesystem::remove_all(outputDir);
+}
+
+@end
@@ -0,0 +1,372 @@
+//
+//  OfflineReconstructorTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <atomic>
+#import <cstring>
+#import <string>
+#import <thread>
+#import <vector>
+
+#import <standard_cyborg/io/ply/GeometryFileIO_PLY.hpp>
+#import <standard_cyborg/sc3d/Geometry.hpp>
+
+#import "CpuDepthProcessor.hpp"
+#import "CpuSurfelIndexMap.hpp"
+#import "OfflineReconstructor.hpp"
+
+#import "Helpers/PathHelpers.h"
+
+using namespace standard_cyborg;
+
+@interface OfflineReconstructorTests : XCTestCase
+
+@end
+
+@implementation OfflineReconstructorTests
+
+- (void)testReconstructsDirectoryHeadless
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    NSString *depthFramesDir = [testCasePath stringByAppendingPathComponent:@"DepthFrames"];
+
+    std::vector<std::string> framePaths = OfflineReconstructor::findRawFramePaths([depthFramesDir UTF8String]);
+    XCTAssertEqual(framePaths.size(), 90);
+
+    OfflineReconstructor reconstructor(std::make_shared<CpuDepthProcessor>(),
+                                       std::make_shared<CpuSurfelIndexMap>());
+
+    size_t frameCount = 0;
+    size_t mergedFrameCount = 0;
+    bool succeeded = reconstructor.assimilateDirectory([depthFramesDir UTF8String],
+        [&](size_t frameIndex, const PBFAssimilatedFrameMetadata& metadata, double processingSeconds) {
+            XCTAssertEqual(frameIndex, frameCount);
+            XCTAssertGreaterThan(processingSeconds, 0);
+            ++frameCount;
+            if (metadata.isMerged) { ++mergedFrameCount; }
+        });
+    PBFFinalStatistics statistics = reconstructor.finish();
+
+    XCTAssertTrue(succeeded);
+    XCTAssertEqual(frameCount, framePaths.size());
+    XCTAssertGreaterThan(mergedFrameCount, 80);
+    XCTAssertEqual((size_t)statistics.mergedFrameCount, mergedFrameCount);
+    XCTAssertGreaterThanOrEqual(reconstructor.getPeakSurfelCount(), reconstructor.getModel().getSurfels().size());
+
+    NSString *outputPath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"OfflineReconstructorTests.ply"];
+    XCTAssertTrue(reconstructor.writePointCloudToPLYFile([outputPath UTF8String]));
+
+    sc3d::Geometry readBack;
+    XCTAssertTrue(io::ply::ReadGeometryFromPLYFile(readBack, [outputPath UTF8String]));
+    XCTAssertEqual((size_t)readBack.vertexCount(), reconstructor.getModel().getSurfels().size());
+
+    reconstructor.reset();
+    XCTAssertEqual(reconstructor.getModel().getSurfels().size(), 0);
+    XCTAssertEqual(reconstructor.getPeakSurfelCount(), 0);
+}
+
+- (void)testWritesThePointCloudMidScan
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    NSString *depthFramesDir = [testCasePath stringByAppendingPathComponent:@"DepthFrames"];
+    std::vector<std::string> framePaths = OfflineReconstructor::findRawFramePaths([depthFramesDir UTF8String]);
+
+    // With the default configuration, no snapshot is published before finishing
+    OfflineReconstructor reconstructor(std::make_shared<CpuDepthProcessor>(),
+                                       std::make_shared<CpuSurfelIndexMap>());
+    for (size_t frameIndex = 0; frameIndex < 10; ++frameIndex) {
+        reconstructor.assimilate(*OfflineReconstructor::readRawFrame(framePaths[frameIndex]));
+    }
+
+    const PBFModel& model = reconstructor.getModel();
+    size_t liveCount = model.getSurfelStore().liveCount();
+    XCTAssertGreaterThan(liveCount, 0);
+    XCTAssertEqual(model.buildSnapshotPointCloud()->vertexCount(), 0);
+    XCTAssertEqual((size_t)model.buildPointCloud()->vertexCount(), liveCount);
+
+    NSString *outputPath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"OfflineReconstructorMidScanTests.ply"];
+    XCTAssertTrue(reconstructor.writePointCloudToPLYFile([outputPath UTF8String]));
+
+    sc3d::Geometry readBack;
+    XCTAssertTrue(io::ply::ReadGeometryFromPLYFile(readBack, [outputPath UTF8String]));
+    XCTAssertEqual((size_t)readBack.vertexCount(), liveCount);
+}
+
+- (void)testTimesEachStage
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    NSString *depthFramesDir = [testCasePath stringByAppendingPathComponent:@"DepthFrames"];
+
+    OfflineReconstructor reconstructor(std::make_shared<CpuDepthProcessor>(),
+                                       std::make_shared<CpuSurfelIndexMap>());
+
+    double totalStageSeconds = 0;
+    double totalProcessingSeconds = 0;
+    reconstructor.assimilateDirectory([depthFramesDir UTF8String],
+        [&](size_t frameIndex, const PBFAssimilatedFrameMetadata& metadata, double processingSeconds) {
+            XCTAssertGreaterThan(metadata.depthProcessingDuration, 0);
+            if (metadata.isMerged) {
+                XCTAssertGreaterThan(metadata.surfelIndexMapDrawDuration, 0);
+                XCTAssertGreaterThan(metadata.fusionDuration, 0);
+                XCTAssertGreaterThan(metadata.icpTargetUpdateDuration, 0);
+            }
+            if (frameIndex > 0) {
+                XCTAssertGreaterThan(metadata.icpDuration, 0);
+            }
+
+            totalStageSeconds += metadata.depthProcessingDuration
+                + metadata.icpSourceDownsamplingDuration
+                + metadata.icpTargetUpdateDuration
+                + metadata.icpDuration
+                + metadata.surfelIndexMapDrawDuration
+                + metadata.fusionDuration
+                + metadata.cullingDuration;
+            totalProcessingSeconds += processingSeconds;
+        });
+    PBFFinalStatistics statistics = reconstructor.finish();
+
+    // The stages don't overlap, and they're most of what a frame takes
+    XCTAssertLessThanOrEqual(totalStageSeconds, totalProcessingSeconds);
+    XCTAssertGreaterThan(totalStageSeconds, 0.5 * totalProcessingSeconds);
+
+    const PBFStageTimingStatistics stageTimes[] = {
+        statistics.depthProcessingTime,
+        statistics.icpSourceDownsamplingTime,
+        statistics.icpTargetUpdateTime,
+        statistics.icpTime,
+        statistics.surfelIndexMapDrawTime,
+        statistics.fusionTime,
+        statistics.cullingTime,
+    };
+
+    double totalStatisticsSeconds = 0;
+    for (const PBFStageTimingStatistics& stageTime : stageTimes) {
+        XCTAssertGreaterThan(stageTime.total, 0);
+        XCTAssertLessThanOrEqual(stageTime.median, stageTime.percentile90);
+        XCTAssertLessThanOrEqual(stageTime.percentile90, stageTime.percentile99);
+        XCTAssertLessThanOrEqual(stageTime.percentile99, stageTime.max);
+        XCTAssertLessThanOrEqual(stageTime.max, stageTime.total);
+        totalStatisticsSeconds += stageTime.total;
+    }
+    XCTAssertEqualWithAccuracy(totalStatisticsSeconds, totalStageSeconds, 1e-6);
+}
+
+- (void)testSnapshotsCanBeReadWhileAssimilating
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    NSString *depthFramesDir = [testCasePath stringByAppendingPathComponent:@"DepthFrames"];
+
+    PBFConfiguration pbfConfig;
+    pbfConfig.snapshotInterval = 2;
+    OfflineReconstructor reconstructor(std::make_shared<CpuDepthProcessor>(),
+                                       std::make_shared<CpuSurfelIndexMap>(),
+                                       pbfConfig);
+    PBFModel& model = reconstructor.getModel();
+    XCTAssertEqual(model.getSnapshot()->surfels.size(), 0);
+
+    // Read snapshots and build point clouds from them as fast as possible while assimilating
+    std::atomic<bool> finishedAssimilating(false);
+    size_t readCount = 0;
+    size_t frameCountWentBackwards = 0;
+    std::shared_ptr<const PBFModelSnapshot> heldSnapshot;
+    Surfels heldSurfels;
+    std::thread reader([&]() {
+        size_t lastFrameCount = 0;
+        while (!finishedAssimilating) {
+            std::shared_ptr<const PBFModelSnapshot> snapshot = model.getSnapshot();
+            model.buildSnapshotPointCloud(0.25f);
+
+            if (snapshot->assimilatedFrameCount < lastFrameCount) { ++frameCountWentBackwards; }
+            if (heldSnapshot == nullptr && snapshot->surfels.size() > 0) {
+                heldSnapshot = snapshot;
+                heldSurfels = snapshot->surfels;
+            }
+
+            lastFrameCount = snapshot->assimilatedFrameCount;
+            ++readCount;
+        }
+    });
+
+    XCTAssertTrue(reconstructor.assimilateDirectory([depthFramesDir UTF8String]));
+    finishedAssimilating = true;
+    reader.join();
+
+    XCTAssertGreaterThan(readCount, 0);
+    XCTAssertEqual(frameCountWentBackwards, 0);
+
+    // A snapshot someone held on to wasn't touched by any that were published after it
+    XCTAssertTrue(heldSnapshot != nullptr);
+    if (heldSnapshot != nullptr) {
+        XCTAssertLessThan(heldSnapshot->assimilatedFrameCount, 90);
+        XCTAssertEqual(heldSnapshot->surfels.size(), heldSurfels.size());
+        XCTAssertTrue(memcmp(heldSnapshot->surfels.data(), heldSurfels.data(), heldSurfels.size() * sizeof(Surfel)) == 0);
+    }
+
+    reconstructor.finish();
+
+    std::shared_ptr<const PBFModelSnapshot> finalSnapshot = model.getSnapshot();
+    const Surfels& surfels = model.getSurfels();
+    XCTAssertEqual(finalSnapshot->assimilatedFrameCount, 90);
+    XCTAssertEqual(finalSnapshot->surfels.size(), surfels.size());
+    XCTAssertTrue(memcmp(finalSnapshot->surfels.data(), surfels.data(), surfels.size() * sizeof(Surfel)) == 0);
+}
+
+- (void)testResetRestartsTheSnapshotCount
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    NSString *depthFramesDir = [testCasePath stringByAppendingPathComponent:@"DepthFrames"];
+    std::vector<std::string> framePaths = OfflineReconstructor::findRawFramePaths([depthFramesDir UTF8String]);
+
+    PBFConfiguration pbfConfig;
+    pbfConfig.snapshotInterval = 4;
+    OfflineReconstructor reconstructor(std::make_shared<CpuDepthProcessor>(),
+                                       std::make_shared<CpuSurfelIndexMap>(),
+                                       pbfConfig);
+    PBFModel& model = reconstructor.getModel();
+    auto assimilateFrames = [&](size_t begin, size_t end) {
+        for (size_t frameIndex = begin; frameIndex < end; ++frameIndex) {
+            reconstructor.assimilate(*OfflineReconstructor::readRawFrame(framePaths[frameIndex]));
+        }
+    };
+
+    // Stop partway to the next snapshot, then start over
+    assimilateFrames(0, 6);
+    XCTAssertGreaterThan(model.getSnapshot()->assimilatedFrameCount, 0);
+    reconstructor.reset();
+    XCTAssertEqual(model.getSnapshot()->assimilatedFrameCount, 0);
+
+    // The new scan waits a whole interval for its first snapshot
+    assimilateFrames(0, 3);
+    XCTAssertEqual(model.getSnapshot()->assimilatedFrameCount, 0);
+    assimilateFrames(3, 10);
+    XCTAssertGreaterThan(model.getSnapshot()->assimilatedFrameCount, 3);
+}
+
+- (void)testSurfelDeltasKeepAPreviewUpToDate
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    NSString *depthFramesDir = [testCasePath stringByAppendingPathComponent:@"DepthFrames"];
+
+    OfflineReconstructor reconstructor(std::make_shared<CpuDepthProcessor>(),
+                                       std::make_shared<CpuSurfelIndexMap>());
+    PBFModel& model = reconstructor.getModel();
+
+    // One preview keeps up with every frame, and the other only every few
+    Surfels everyFramePreview, everyFewFramesPreview;
+    size_t everyFrameDeltaCount = 0, changedSlotCount = 0;
+    model.subscribeToSurfelDeltas([&](const SurfelDelta& delta) {
+        delta.applyTo(everyFramePreview);
+        ++everyFrameDeltaCount;
+        changedSlotCount += delta.changedSlotIndices.size();
+    });
+    model.subscribeToSurfelDeltas([&](const SurfelDelta& delta) {
+        delta.applyTo(everyFewFramesPreview);
+    }, 4);
+
+    // And another gets them quantized, as it would to send them elsewhere
+    Surfels compactPreview;
+    size_t compactByteCount = 0, compactSurfelCount = 0;
+    model.subscribeToSurfelDeltas([&](const SurfelDelta& delta) {
+        XCTAssertTrue(delta.isCompact);
+        XCTAssertEqual(delta.changedSurfels.size(), 0);
+        delta.applyTo(compactPreview);
+        compactByteCount += delta.compactChangedSurfels.byteSize();
+        compactSurfelCount += delta.compactChangedSurfels.size();
+    }, 1, true);
+
+    auto expectPreviewMatches = [&](const Surfels& preview) {
+        Surfels expected;
+        model.getSurfelStore().copySlotsTo(expected);
+        XCTAssertEqual(preview.size(), expected.size());
+
+        size_t mismatchCount = 0;
+        for (size_t index = 0; index < std::min(preview.size(), expected.size()); ++index) {
+            if (expected[index].surfelSize == 0) {
+                if (preview[index].surfelSize != 0) { ++mismatchCount; }
+            } else if (preview[index].position != expected[index].position
+                       || preview[index].normal != expected[index].normal
+                       || preview[index].color != expected[index].color
+                       || preview[index].weight != expected[index].weight
+                       || preview[index].surfelSize != expected[index].surfelSize) {
+                ++mismatchCount;
+            }
+        }
+        XCTAssertEqual(mismatchCount, 0);
+    };
+
+    XCTAssertTrue(reconstructor.assimilateDirectory([depthFramesDir UTF8String]));
+    expectPreviewMatches(everyFramePreview);
+    XCTAssertGreaterThan(everyFrameDeltaCount, 1);
+    XCTAssertLessThan(changedSlotCount / everyFrameDeltaCount, everyFramePreview.size());
+
+    reconstructor.finish();
+    expectPreviewMatches(everyFramePreview);
+    expectPreviewMatches(everyFewFramesPreview);
+
+    // The compact preview has the same slots, within quantization error
+    XCTAssertEqual(compactPreview.size(), everyFramePreview.size());
+    size_t compactMismatchCount = 0;
+    for (size_t index = 0; index < std::min(compactPreview.size(), everyFramePreview.size()); ++index) {
+        const Surfel& expected = everyFramePreview[index];
+        const Surfel& quantized = compactPreview[index];
+        if (expected.surfelSize == 0) {
+            if (quantized.surfelSize != 0) { ++compactMismatchCount; }
+        } else if ((quantized.position - expected.position).norm() > 1e-4
+                   || quantized.normal.dot(expected.normal) < 0.999
+                   || (quantized.color - expected.color).norm() > 0.01
+                   || std::abs(quantized.surfelSize - expected.surfelSize) > 1e-3 * expected.surfelSize) {
+            ++compactMismatchCount;
+        }
+    }
+    XCTAssertEqual(compactMismatchCount, 0);
+    XCTAssertLessThan(compactByteCount * 2, compactSurfelCount * sizeof(Surfel));
+}
+
+- (void)testCompactSnapshotsDecodeToTheModel
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    NSString *depthFramesDir = [testCasePath stringByAppendingPathComponent:@"DepthFrames"];
+
+    PBFConfiguration pbfConfig;
+    pbfConfig.snapshotInterval = 10;
+    pbfConfig.compactSnapshots = true;
+    OfflineReconstructor reconstructor(std::make_shared<CpuDepthProcessor>(),
+                                       std::make_shared<CpuSurfelIndexMap>(),
+                                       pbfConfig);
+    PBFModel& model = reconstructor.getModel();
+
+    XCTAssertTrue(reconstructor.assimilateDirectory([depthFramesDir UTF8String]));
+    std::shared_ptr<const PBFModelSnapshot> snapshot = model.getSnapshot();
+    XCTAssertTrue(snapshot->isCompact);
+    XCTAssertGreaterThan(snapshot->assimilatedFrameCount, 0);
+    XCTAssertEqual(snapshot->surfels.size(), 0);
+    XCTAssertGreaterThan(snapshot->surfelCount(), 0);
+
+    // Finishing publishes a compact snapshot too
+    reconstructor.finish();
+    snapshot = model.getSnapshot();
+    const Surfels& surfels = model.getSurfels();
+    XCTAssertTrue(snapshot->isCompact);
+    XCTAssertEqual(snapshot->assimilatedFrameCount, 90);
+    XCTAssertEqual(snapshot->surfelCount(), surfels.size());
+
+    Surfels decoded;
+    snapshot->compactSurfels.decode(decoded);
+    size_t mismatchCount = 0;
+    for (size_t index = 0; index < std::min(decoded.size(), surfels.size()); ++index) {
+        if ((decoded[index].position - surfels[index].position).norm() > 1e-4
+            || decoded[index].normal.dot(surfels[index].normal) < 0.999) {
+            ++mismatchCount;
+        }
+    }
+    XCTAssertEqual(mismatchCount, 0);
+    XCTAssertLessThan(snapshot->compactSurfels.byteSize() * 2, surfels.size() * sizeof(Surfel));
+
+    XCTAssertEqual(model.buildPointCloud()->getPositions().size(), surfels.size());
+}
+
+@end
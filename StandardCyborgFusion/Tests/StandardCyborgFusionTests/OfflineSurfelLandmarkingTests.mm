@@ -0,0 +1,117 @@
+//
+//  OfflineSurfelLandmarkingTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <unordered_map>
+#import <vector>
+
+#import <standard_cyborg/sc3d/PerspectiveCamera.hpp>
+#import <standard_cyborg/util/DataUtils.hpp>
+
+#import "EigenHelpers.hpp"
+#import "OfflineSurfelLandmarking.hpp"
+
+using namespace standard_cyborg;
+
+@interface OfflineSurfelLandmarkingTests : XCTestCase
+
+@end
+
+@implementation OfflineSurfelLandmarkingTests
+
+static const size_t _width = 64;
+static const size_t _height = 48;
+
+// A flat sheet of surfels facing the camera, 0.3 m in front of it
+static std::vector<Surfel> _sheetOfSurfels()
+{
+    std::vector<Surfel> surfels;
+    for (int yIndex = -40; yIndex <= 40; ++yIndex) {
+        for (int xIndex = -40; xIndex <= 40; ++xIndex) {
+            Surfel surfel;
+            surfel.position = Vector3f(0.003f * xIndex, 0.003f * yIndex, -0.3f);
+            surfel.normal = Vector3f(0, 0, 1);
+            surfel.color = Vector3f(1, 1, 1);
+            surfel.weight = 1;
+            surfel.lifetime = 0;
+            surfel.surfelSize = 0.003;
+            surfels.push_back(surfel);
+        }
+    }
+
+    return surfels;
+}
+
+// A camera panning sideways across the sheet, with two landmarks in every frame
+static std::vector<LandmarkedFrame> _panningFrames()
+{
+    sc3d::PerspectiveCamera camera;
+    camera.setNominalIntrinsicMatrix(math::Mat3x3(100, 0, 32,
+                                                  0, 100, 24,
+                                                  0, 0, 1));
+    camera.setIntrinsicMatrixReferenceSize(math::Vec2(_width, _height));
+    Eigen::Matrix4f projection = toMatrix4f(camera.getPerspectiveMatrix());
+
+    std::vector<LandmarkedFrame> frames;
+    for (int frameIndex = 0; frameIndex < 12; ++frameIndex) {
+        Eigen::Matrix4f view = Eigen::Matrix4f::Identity();
+        view(0, 3) = 0.005f * (frameIndex - 6);
+
+        LandmarkedFrame frame;
+        frame.viewProjectionMatrix = projection * view;
+        frame.screenSpaceLandmarks = {
+            { 0.5f, 0.5f, 1 },
+            { 0.2f + 0.05f * frameIndex, 0.3f, 2 },
+        };
+
+        // One frame sees nothing at all, and one has no landmarks
+        if (frameIndex == 4) { frame.viewProjectionMatrix = projection * Eigen::Affine3f(Eigen::Translation3f(0, 0, 1)).matrix(); }
+        if (frameIndex == 7) { frame.screenSpaceLandmarks.clear(); }
+
+        frames.push_back(frame);
+    }
+
+    return frames;
+}
+
+- (void)testSequenceMatchesPlacingFrameByFrame
+{
+    std::vector<Surfel> surfels = _sheetOfSurfels();
+    std::vector<LandmarkedFrame> frames = _panningFrames();
+
+    OfflineSurfelLandmarking frameByFrame;
+    for (const LandmarkedFrame& frame : frames) {
+        frameByFrame.placeLandmarksOnSurfels(surfels.data(), surfels.size(), _width, _height,
+                                             frame.viewProjectionMatrix, frame.screenSpaceLandmarks);
+    }
+
+    OfflineSurfelLandmarking sequence;
+    sequence.placeLandmarksOnSurfels(surfels.data(), surfels.size(), _width, _height, frames);
+
+    std::unordered_map<int, Vector3f> expected = frameByFrame.computeLandmarks(surfels.data());
+    std::unordered_map<int, Vector3f> landmarks = sequence.computeLandmarks(surfels.data());
+    XCTAssertEqual(landmarks.size(), 2);
+    XCTAssertEqual(expected.size(), 2);
+
+    for (int landmarkId : { 1, 2 }) {
+        XCTAssertTrue(landmarks[landmarkId] == expected[landmarkId]);
+    }
+
+    // The landmark at the center of the image follows the camera across the sheet
+    XCTAssertEqualWithAccuracy(landmarks[1].x(), 0.0f, 0.003);
+    XCTAssertEqualWithAccuracy(landmarks[1].y(), 0.0f, 0.003);
+    XCTAssertEqualWithAccuracy(landmarks[1].z(), -0.3f, 1e-6);
+
+    // Placing another sequence adds to the hits so far, and reset clears them
+    sequence.placeLandmarksOnSurfels(surfels.data(), surfels.size(), _width, _height, frames);
+    XCTAssertTrue(sequence.computeLandmarks(surfels.data())[2] == expected[2]);
+
+    sequence.reset();
+    XCTAssertEqual(sequence.computeLandmarks(surfels.data()).size(), 0);
+}
+
+@end
@@ -0,0 +1,145 @@
+//
+//  PBFCheckpointTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <algorithm>
+#import <cstring>
+#import <fstream>
+
+#import "MetalDepthProcessor.hpp"
+#import "MetalSurfelIndexMap.hpp"
+#import "PBFModel.hpp"
+#import "PointCloudIO.hpp"
+
+#import "Helpers/PathHelpers.h"
+
+@interface PBFCheckpointTests : XCTestCase
+
+@end
+
+@implementation PBFCheckpointTests {
+    id<MTLDevice> _device;
+    id<MTLCommandQueue> _commandQueue;
+    id<MTLLibrary> _library;
+    NSString *_depthFramesDir;
+    NSString *_checkpointPath;
+}
+
+- (void)setUp
+{
+    _device = MTLCreateSystemDefaultDevice();
+    _commandQueue = [_device newCommandQueue];
+    _library = [_device newDefaultLibraryWithBundle:[PathHelpers scFusionBundle] error:NULL];
+
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    _depthFramesDir = [testCasePath stringByAppendingPathComponent:@"DepthFrames"];
+    _checkpointPath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"PBFCheckpointTests.checkpoint"];
+}
+
+- (void)tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtPath:_checkpointPath error:NULL];
+}
+
+- (std::unique_ptr<PBFModel>)_newModel
+{
+    std::shared_ptr<MetalSurfelIndexMap> surfelIndexMap(new MetalSurfelIndexMap(_device, _library, _commandQueue));
+    std::unique_ptr<PBFModel> pbf(new PBFModel(surfelIndexMap));
+    pbf->reset();
+
+    return pbf;
+}
+
+// Assimilates frames [firstFrame, endFrame), stopping early if the frames run out
+- (void)_assimilateFrames:(int)firstFrame to:(int)endFrame into:(PBFModel&)pbf
+{
+    MetalDepthProcessor depthProcessor(_device, _library, _commandQueue);
+    ICPConfiguration icpConfig;
+    PBFConfiguration pbfConfig;
+    SurfelFusionConfiguration surfelFusionConfig;
+
+    for (int iFrame = firstFrame; iFrame < endFrame; ++iFrame) {
+        NSString *filePath = [_depthFramesDir stringByAppendingFormat:@"/frame-%03d.ply", iFrame];
+        if ([[NSFileManager defaultManager] fileExistsAtPath:filePath] == NO) { break; }
+
+        std::unique_ptr<RawFrame> rawFrame = PointCloudIO::ReadRawFrameFromBPLYFile([filePath UTF8String]);
+        ProcessedFrame processedFrame(*rawFrame);
+        depthProcessor.computeFrameValues(processedFrame, *rawFrame, false);
+
+        pbf.assimilate(processedFrame, pbfConfig, icpConfig, surfelFusionConfig, rawFrame->timestamp);
+    }
+}
+
+- (void)testResumingMatchesAnUninterruptedScan
+{
+    const int splitFrame = 20;
+
+    std::unique_ptr<PBFModel> uninterrupted = [self _newModel];
+    [self _assimilateFrames:0 to:INT_MAX into:*uninterrupted];
+
+    std::unique_ptr<PBFModel> interrupted = [self _newModel];
+    [self _assimilateFrames:0 to:splitFrame into:*interrupted];
+    XCTAssertTrue(interrupted->saveCheckpoint([_checkpointPath UTF8String]));
+
+    // Resume in a model that has nothing in common with the first, not even its random seed
+    std::shared_ptr<MetalSurfelIndexMap> surfelIndexMap(new MetalSurfelIndexMap(_device, _library, _commandQueue));
+    std::unique_ptr<PBFModel> resumed(new PBFModel(surfelIndexMap, 1234));
+    XCTAssertTrue(resumed->loadCheckpoint([_checkpointPath UTF8String]));
+    XCTAssertEqual(resumed->getSurfelStore().size(), interrupted->getSurfelStore().size());
+    XCTAssertEqual(resumed->getAssimilatedFrameMetadata().size(), splitFrame);
+    XCTAssertTrue(resumed->getCurrentExtrinsicMatrix() == interrupted->getCurrentExtrinsicMatrix());
+
+    [self _assimilateFrames:splitFrame to:INT_MAX into:*resumed];
+
+    SurfelFusionConfiguration surfelFusionConfig;
+    uninterrupted->finishAssimilating(surfelFusionConfig);
+    resumed->finishAssimilating(surfelFusionConfig);
+
+    const Surfels& expected = uninterrupted->getSurfels();
+    const Surfels& actual = resumed->getSurfels();
+    XCTAssertEqual(actual.size(), expected.size());
+    XCTAssertTrue(memcmp(actual.data(), expected.data(), std::min(actual.size(), expected.size()) * sizeof(Surfel)) == 0);
+    XCTAssertTrue(resumed->getCurrentExtrinsicMatrix() == uninterrupted->getCurrentExtrinsicMatrix());
+}
+
+- (void)testBadCheckpointsLeaveTheModelAlone
+{
+    std::unique_ptr<PBFModel> pbf = [self _newModel];
+    [self _assimilateFrames:0 to:5 into:*pbf];
+    size_t surfelCount = pbf->getSurfels().size();
+    XCTAssertGreaterThan(surfelCount, 0);
+
+    XCTAssertFalse(pbf->loadCheckpoint([[_checkpointPath stringByAppendingString:@".missing"] UTF8String]));
+
+    // Truncated partway through the surfels
+    XCTAssertTrue(pbf->saveCheckpoint([_checkpointPath UTF8String]));
+    NSFileHandle *fileHandle = [NSFileHandle fileHandleForWritingAtPath:_checkpointPath];
+    [fileHandle truncateFileAtOffset:[fileHandle seekToEndOfFile] / 2];
+    [fileHandle closeFile];
+    XCTAssertFalse(pbf->loadCheckpoint([_checkpointPath UTF8String]));
+
+    // Written on a machine of the other byte order, whose byte order mark follows the magic
+    XCTAssertTrue(pbf->saveCheckpoint([_checkpointPath UTF8String]));
+    {
+        std::fstream file([_checkpointPath UTF8String], std::ios::in | std::ios::out | std::ios::binary);
+        char byteOrderMark[4];
+        file.seekg(8);
+        file.read(byteOrderMark, sizeof(byteOrderMark));
+        std::reverse(byteOrderMark, byteOrderMark + sizeof(byteOrderMark));
+        file.seekp(8);
+        file.write(byteOrderMark, sizeof(byteOrderMark));
+    }
+    XCTAssertFalse(pbf->loadCheckpoint([_checkpointPath UTF8String]));
+
+    // Not a checkpoint at all
+    std::ofstream([_checkpointPath UTF8String], std::ios::trunc) << "ply\nformat ascii 1.0\n";
+    XCTAssertFalse(pbf->loadCheckpoint([_checkpointPath UTF8String]));
+
+    XCTAssertEqual(pbf->getSurfels().size(), surfelCount);
+}
+
+@end
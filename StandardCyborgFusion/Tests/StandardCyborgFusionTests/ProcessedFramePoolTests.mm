@@ -0,0 +1,121 @@
+//
+//  ProcessedFramePoolTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <cmath>
+#import <cstring>
+#import <memory>
+#import <vector>
+
+#import "CpuDepthProcessor.hpp"
+#import "ProcessedFramePool.hpp"
+
+using namespace standard_cyborg;
+
+@interface ProcessedFramePoolTests : XCTestCase
+
+@end
+
+@implementation ProcessedFramePoolTests
+
+static const size_t _width = 160;
+static const size_t _height = 240;
+
+static std::unique_ptr<RawFrame> _makeRawFrame(float depthOffset)
+{
+    sc3d::PerspectiveCamera camera;
+    camera.setNominalIntrinsicMatrix(math::Mat3x3(200, 0, 80,
+                                                  0, 200, 120,
+                                                  0, 0, 1));
+    camera.setIntrinsicMatrixReferenceSize(math::Vec2(_width, _height));
+
+    std::vector<float> depths(_width * _height);
+    std::vector<math::Vec3> colors(_width * _height, math::Vec3(0.5, 0.5, 0.5));
+    for (size_t y = 0; y < _height; ++y) {
+        for (size_t x = 0; x < _width; ++x) {
+            bool inHole = x > 60 && x < 80 && y > 100 && y < 130;
+            depths[y * _width + x] = inHole ? 0.0f : depthOffset + 0.002f * std::sin(0.1f * x) * std::cos(0.05f * y);
+        }
+    }
+
+    return std::unique_ptr<RawFrame>(new RawFrame(camera, _width, _height, std::move(depths), std::move(colors), depthOffset));
+}
+
+- (void)testRecycledFramesMatchFreshOnes
+{
+    CpuDepthProcessor depthProcessor;
+    ProcessedFramePool pool;
+    std::unique_ptr<RawFrame> firstRawFrame = _makeRawFrame(0.3);
+    std::unique_ptr<RawFrame> secondRawFrame = _makeRawFrame(0.35);
+
+    std::unique_ptr<ProcessedFrame> frame = pool.acquire(*firstRawFrame);
+    depthProcessor.computeFrameValues(*frame, frame->rawFrame, true);
+    const math::Vec3 *positionsData = frame->positions.data();
+    const float *depthsData = frame->rawFrame.depths.data();
+    pool.recycle(std::move(frame));
+    XCTAssertEqual(pool.freeCount(), 1);
+
+    // The second frame gets the first one's storage, and nothing left over from it shows through
+    frame = pool.acquire(*secondRawFrame);
+    XCTAssertEqual(pool.freeCount(), 0);
+    XCTAssertEqual(frame->positions.data(), positionsData);
+    XCTAssertEqual(frame->rawFrame.depths.data(), depthsData);
+    XCTAssertEqual(frame->rawFrame.timestamp, secondRawFrame->timestamp);
+    depthProcessor.computeFrameValues(*frame, frame->rawFrame, true);
+
+    ProcessedFrame freshFrame(*secondRawFrame);
+    depthProcessor.computeFrameValues(freshFrame, freshFrame.rawFrame, true);
+
+    // Bit for bit, since pixels without a valid depth come out as NaN
+    size_t pointCount = _width * _height;
+    XCTAssertEqual(memcmp(frame->positions.data(), freshFrame.positions.data(), pointCount * sizeof(math::Vec3)), 0);
+    XCTAssertEqual(memcmp(frame->normals.data(), freshFrame.normals.data(), pointCount * sizeof(math::Vec3)), 0);
+    XCTAssertEqual(memcmp(frame->surfelSizes.data(), freshFrame.surfelSizes.data(), pointCount * sizeof(float)), 0);
+    XCTAssertEqual(memcmp(frame->weights.data(), freshFrame.weights.data(), pointCount * sizeof(float)), 0);
+    XCTAssertEqual(memcmp(frame->inputConfidences.data(), freshFrame.inputConfidences.data(), pointCount * sizeof(float)), 0);
+}
+
+- (void)testSwappingTradesBuffersWithTheRawFrame
+{
+    ProcessedFramePool pool;
+    std::unique_ptr<RawFrame> rawFrame = _makeRawFrame(0.3);
+    const float *firstDepthsData = rawFrame->depths.data();
+
+    std::unique_ptr<ProcessedFrame> frame = pool.acquireSwapping(*rawFrame);
+    XCTAssertEqual(frame->rawFrame.depths.data(), firstDepthsData);
+    XCTAssertEqual(frame->rawFrame.depths[0], 0.3f);
+    XCTAssertEqual(frame->positions.size(), _width * _height);
+
+    // The raw frame is left with the frame's old buffers, ready to be refilled
+    const float *secondDepthsData = rawFrame->depths.data();
+    XCTAssertNotEqual(secondDepthsData, firstDepthsData);
+    XCTAssertEqual(rawFrame->depths.size(), _width * _height);
+    pool.recycle(std::move(frame));
+
+    rawFrame->depths[0] = 0.4f;
+    frame = pool.acquireSwapping(*rawFrame);
+    XCTAssertEqual(frame->rawFrame.depths.data(), secondDepthsData);
+    XCTAssertEqual(frame->rawFrame.depths[0], 0.4f);
+    XCTAssertEqual(rawFrame->depths.data(), firstDepthsData);
+}
+
+- (void)testHoldsOnToAtMostMaxFreeCountFrames
+{
+    ProcessedFramePool pool(2);
+    std::unique_ptr<RawFrame> rawFrame = _makeRawFrame(0.3);
+
+    std::vector<std::unique_ptr<ProcessedFrame>> frames;
+    for (int i = 0; i < 4; ++i) { frames.push_back(pool.acquire(*rawFrame)); }
+    for (std::unique_ptr<ProcessedFrame>& frame : frames) { pool.recycle(std::move(frame)); }
+
+    XCTAssertEqual(pool.freeCount(), 2);
+
+    pool.recycle(nullptr);
+    XCTAssertEqual(pool.freeCount(), 2);
+}
+
+@end
@@ -0,0 +1,95 @@
+//
+//  RedundantFrameTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <memory>
+#import <vector>
+
+#import "CpuDepthProcessor.hpp"
+#import "CpuSurfelIndexMap.hpp"
+#import "OfflineReconstructor.hpp"
+#import "PBFModel.hpp"
+
+#import "Helpers/PathHelpers.h"
+
+using namespace standard_cyborg;
+
+@interface RedundantFrameTests : XCTestCase
+
+@end
+
+@implementation RedundantFrameTests
+
+// Assimilates the same frame over and over, as if the camera were holding perfectly still
+- (std::vector<PBFAssimilatedFrameMetadata>)_assimilateStillFrames:(int)frameCount
+                                                        withConfig:(PBFConfiguration)pbfConfig
+                                                        surfelCounts:(std::vector<size_t>&)surfelCountsOut
+                                                        statistics:(PBFFinalStatistics&)statisticsOut
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    NSString *framePath = [testCasePath stringByAppendingPathComponent:@"DepthFrames/frame-000.ply"];
+    std::unique_ptr<RawFrame> rawFrame = OfflineReconstructor::readRawFrame([framePath UTF8String]);
+
+    CpuDepthProcessor depthProcessor;
+    ICPConfiguration icpConfig;
+    SurfelFusionConfiguration surfelFusionConfig;
+    PBFModel pbf(std::make_shared<CpuSurfelIndexMap>());
+    pbf.reset();
+
+    std::vector<PBFAssimilatedFrameMetadata> metadatas;
+    surfelCountsOut.clear();
+    for (int frameIndex = 0; frameIndex < frameCount; ++frameIndex) {
+        rawFrame->timestamp = frameIndex / 30.0;
+        ProcessedFrame frame(*rawFrame);
+        depthProcessor.computeFrameValues(frame, *rawFrame);
+
+        metadatas.push_back(pbf.assimilate(frame, pbfConfig, icpConfig, surfelFusionConfig, rawFrame->timestamp));
+        surfelCountsOut.push_back(pbf.getSurfelStore().liveCount());
+    }
+    statisticsOut = pbf.finishAssimilating(surfelFusionConfig);
+
+    return metadatas;
+}
+
+- (void)testStillFramesAreSkippedOnlyWhenEnabled
+{
+    const int frameCount = 7;
+    std::vector<size_t> surfelCounts;
+    PBFFinalStatistics statistics;
+
+    // Off by default, so every frame is fused
+    PBFConfiguration pbfConfig;
+    std::vector<PBFAssimilatedFrameMetadata> metadatas = [self _assimilateStillFrames:frameCount withConfig:pbfConfig surfelCounts:surfelCounts statistics:statistics];
+    for (const PBFAssimilatedFrameMetadata& metadata : metadatas) {
+        XCTAssertTrue(metadata.isMerged);
+        XCTAssertFalse(metadata.isSkipped);
+    }
+    XCTAssertEqual(statistics.skippedFrameCount, 0);
+
+    // Enabled, frames are skipped until too many in a row have been
+    pbfConfig.redundantFrameMaxNovelty = 0.05;
+    pbfConfig.redundantFrameMaxConsecutiveSkips = 2;
+    metadatas = [self _assimilateStillFrames:frameCount withConfig:pbfConfig surfelCounts:surfelCounts statistics:statistics];
+    for (int frameIndex = 0; frameIndex < frameCount; ++frameIndex) {
+        const PBFAssimilatedFrameMetadata& metadata = metadatas[frameIndex];
+        bool isSkipped = frameIndex % 3 != 0;
+
+        XCTAssertEqual(metadata.isSkipped, isSkipped);
+        XCTAssertEqual(metadata.isMerged, !isSkipped);
+        if (isSkipped) {
+            // Nothing is fused, but the frame is still tracked
+            XCTAssertEqual(surfelCounts[frameIndex], surfelCounts[frameIndex - 1]);
+            XCTAssertEqual(metadata.surfelCount, surfelCounts[frameIndex]);
+            XCTAssertGreaterThan(metadata.icpUnusedIterationFraction, 0);
+        }
+    }
+    XCTAssertEqual(statistics.skippedFrameCount, 4);
+    XCTAssertEqual(statistics.failedFrameCount, 0);
+    XCTAssertEqual(statistics.mergedFrameCount, 3);
+}
+
+@end
@@ -0,0 +1,141 @@
+//
+//  SurfelBudgetTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <algorithm>
+#import <vector>
+
+#import "SurfelBudget.hpp"
+
+#import "Helpers/PathHelpers.h"
+#import "Helpers/ReconstructionHelpers.hpp"
+
+@interface SurfelBudgetTests : XCTestCase
+
+@end
+
+@implementation SurfelBudgetTests
+
+static Surfel _surfelAt(float x, float y, float z, float weight, int32_t lifetime)
+{
+    Surfel surfel;
+    surfel.position = Vector3f(x, y, z);
+    surfel.normal = Vector3f(0, 0, -1);
+    surfel.color = Vector3f(0.5, 0.5, 0.5);
+    surfel.weight = weight;
+    surfel.lifetime = (uint32_t)lifetime;
+    surfel.surfelSize = 0.001;
+
+    return surfel;
+}
+
+- (void)testDistantSurfelsAreMergedFirst
+{
+    // Two patches of 1 mm spaced surfels, one near the camera and one far from it
+    SurfelStore surfels;
+    for (int i = 0; i < 40; ++i) {
+        for (int j = 0; j < 40; ++j) {
+            surfels.push_back(_surfelAt(0.001f * i, 0.001f * j, 0.3, 1, 10));
+            surfels.push_back(_surfelAt(0.001f * i, 0.001f * j, 2.0, 1, 10));
+        }
+    }
+
+    PBFConfiguration pbfConfig;
+    pbfConfig.maxSurfelCount = 2800;
+
+    // A landmark seen on every far surfel, and another on a near one
+    SurfelBudget surfelBudget;
+    SparseSurfelLandmarksIndex landmarksIndex;
+    for (int index = 1; index < (int)surfels.size(); index += 2) { landmarksIndex.addHit(index, 0); }
+    landmarksIndex.addHit(0, 1);
+    SurfelIndexChanges indexChanges;
+    size_t removedCount = surfelBudget.enforce(pbfConfig, Vector3f(0, 0, 0), surfels, landmarksIndex, indexChanges);
+
+    XCTAssertGreaterThan(removedCount, 0);
+    XCTAssertEqual(removedCount, indexChanges.removedSurfelIndices.size());
+    XCTAssertLessThanOrEqual(surfels.liveCount(), (size_t)(pbfConfig.maxSurfelCount * pbfConfig.surfelBudgetTargetFraction));
+    XCTAssertTrue(std::is_sorted(indexChanges.removedSurfelIndices.begin(), indexChanges.removedSurfelIndices.end()));
+    XCTAssertFalse(indexChanges.updatedSurfelIndices.empty());
+    XCTAssertTrue(std::is_sorted(indexChanges.updatedSurfelIndices.begin(), indexChanges.updatedSurfelIndices.end()));
+
+    // Only the far patch was coarsened, and merging kept its total confidence
+    float farWeight = 0;
+    for (size_t index = 0; index < surfels.size(); ++index) {
+        bool isNear = index % 2 == 0;
+        if (isNear) { XCTAssertFalse(surfels.isRemoved(index)); }
+        if (!isNear && !surfels.isRemoved(index)) { farWeight += surfels.weights[index]; }
+    }
+    XCTAssertEqualWithAccuracy(farWeight, 1600, 1e-2);
+
+    // Merged surfels' landmark hits moved onto the surfels they were merged into
+    int farHitCount = 0;
+    landmarksIndex.iterateHits([&](int surfelIndex, int landmarkIndex, int hitCount) {
+        XCTAssertFalse(surfels.isRemoved(surfelIndex));
+        if (landmarkIndex == 0) { farHitCount += hitCount; }
+    });
+    XCTAssertEqual(farHitCount, 1600);
+    XCTAssertEqual(landmarksIndex.getHitCount(0, 1), 1);
+
+    // Under budget, nothing happens
+    XCTAssertEqual(surfelBudget.enforce(pbfConfig, Vector3f(0, 0, 0), surfels, landmarksIndex, indexChanges), 0);
+    XCTAssertTrue(indexChanges.removedSurfelIndices.empty());
+}
+
+- (void)testLeastConfidentSurfelsAreEvicted
+{
+    // All near the camera, so nothing is merged. Half have gone unseen for a while.
+    SurfelStore surfels;
+    for (int i = 0; i < 100; ++i) {
+        surfels.push_back(_surfelAt(0.01f * i, 0, 0.3, 1 + i % 10, i < 50 ? 10 : -5));
+    }
+
+    PBFConfiguration pbfConfig;
+    pbfConfig.maxSurfelCount = 50;
+    pbfConfig.surfelBudgetTargetFraction = 0.8;
+
+    SurfelBudget surfelBudget;
+    SparseSurfelLandmarksIndex landmarksIndex;
+    landmarksIndex.addHit(60, 0);
+    landmarksIndex.addHit(10, 0);
+    SurfelIndexChanges indexChanges;
+    XCTAssertEqual(surfelBudget.enforce(pbfConfig, Vector3f(0, 0, 0), surfels, landmarksIndex, indexChanges), 60);
+    XCTAssertEqual(surfels.liveCount(), 40);
+
+    // The unseen ones go first, then the least confident of the rest
+    for (int i = 50; i < 100; ++i) { XCTAssertTrue(surfels.isRemoved(i)); }
+    for (int i = 0; i < 50; ++i) { XCTAssertEqual(surfels.isRemoved(i), i % 10 <= 1); }
+
+    // Landmarks on evicted surfels go with them
+    XCTAssertEqual(landmarksIndex.getHitCount(60, 0), 0);
+    XCTAssertEqual(landmarksIndex.getHitCount(10, 0), 0);
+}
+
+- (void)testModelStaysWithinBudget
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    NSString *depthFramesDir = [testCasePath stringByAppendingPathComponent:@"DepthFrames"];
+
+    ICPConfiguration icpConfig;
+    PBFConfiguration pbfConfig;
+    pbfConfig.maxSurfelCount = 20000;
+    SurfelFusionConfiguration surfelFusionConfig;
+
+    std::unique_ptr<PBFModel> pbf(assimilatePointCloud(depthFramesDir, icpConfig, pbfConfig, surfelFusionConfig));
+
+    size_t evictedSurfelCount = 0;
+    for (const PBFAssimilatedFrameMetadata& metadata : pbf->getAssimilatedFrameMetadata()) {
+        if (!metadata.isMerged) { continue; }
+
+        XCTAssertLessThanOrEqual(metadata.surfelCount, pbfConfig.maxSurfelCount);
+        evictedSurfelCount += metadata.evictedSurfelCount;
+    }
+
+    XCTAssertGreaterThan(evictedSurfelCount, 0);
+    XCTAssertLessThanOrEqual(pbf->getSurfels().size(), pbfConfig.maxSurfelCount);
+}
+
+@end
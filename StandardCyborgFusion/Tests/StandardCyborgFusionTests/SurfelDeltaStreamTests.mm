@@ -0,0 +1,137 @@
+//
+//  SurfelDeltaStreamTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <vector>
+
+#import "SurfelDeltaStream.hpp"
+
+@interface SurfelDeltaStreamTests : XCTestCase
+
+@end
+
+@implementation SurfelDeltaStreamTests
+
+static Surfel _surfelAt(float x)
+{
+    Surfel surfel;
+    surfel.position = Vector3f(x, 0, 0.3);
+    surfel.normal = Vector3f(0, 0, -1);
+    surfel.color = Vector3f(0.5, 0.5, 0.5);
+    surfel.weight = 1;
+    surfel.lifetime = 10;
+    surfel.surfelSize = 0.001;
+
+    return surfel;
+}
+
+- (void)testFirstDeltaReplacesEverything
+{
+    SurfelStore surfels;
+    for (int i = 0; i < 10; ++i) { surfels.push_back(_surfelAt(i)); }
+    surfels.markRemoved({ 3 });
+
+    SurfelDeltaStream deltaStream;
+    std::vector<SurfelDelta> deltas;
+    deltaStream.subscribe([&](const SurfelDelta& delta) { deltas.push_back(delta); });
+
+    deltaStream.publish(surfels, 1);
+    XCTAssertEqual(deltas.size(), 1);
+    XCTAssertTrue(deltas[0].replacesAll);
+    XCTAssertEqual(deltas[0].slotCount, 10);
+    XCTAssertEqual(deltas[0].changedSurfels.size(), 10);
+    XCTAssertEqual(deltas[0].changedSurfels[3].surfelSize, 0);
+
+    // Nothing changed since, so there's nothing to send
+    deltaStream.publish(surfels, 2);
+    XCTAssertEqual(deltas.size(), 1);
+}
+
+- (void)testChangesAreCoalescedUntilTheIntervalIsUp
+{
+    SurfelStore surfels;
+    for (int i = 0; i < 10; ++i) { surfels.push_back(_surfelAt(i)); }
+
+    SurfelDeltaStream deltaStream;
+    Surfels copy;
+    std::vector<SurfelDelta> deltas;
+    deltaStream.subscribe([&](const SurfelDelta& delta) {
+        delta.applyTo(copy);
+        deltas.push_back(delta);
+    }, 3);
+    deltaStream.publish(surfels, 0, true);
+    deltas.clear();
+
+    // Slot 2 is updated twice, 5 is removed, and 7 is removed then taken over by a new surfel
+    SurfelIndexChanges indexChanges;
+    surfels.positions[2].x() = 20;
+    surfels.markRemoved({ 5, 7 });
+    indexChanges.updatedSurfelIndices = { 2 };
+    indexChanges.firstAppendedSurfelIndex = surfels.size();
+    indexChanges.removedSurfelIndices = { 5, 7 };
+    deltaStream.recordChanges(indexChanges, surfels);
+    deltaStream.publish(surfels, 1);
+
+    indexChanges.clear();
+    surfels.positions[2].x() = 21;
+    surfels.set(7, _surfelAt(70));
+    surfels.tombstones[7] = 0;
+    surfels.freeSlots = { 5 };
+    surfels.push_back(_surfelAt(100));
+    indexChanges.updatedSurfelIndices = { 2 };
+    indexChanges.reusedSurfelIndices = { 7 };
+    indexChanges.firstAppendedSurfelIndex = 10;
+    deltaStream.recordChanges(indexChanges, surfels);
+    deltaStream.publish(surfels, 2);
+    XCTAssertEqual(deltas.size(), 0);
+
+    deltaStream.publish(surfels, 3);
+    XCTAssertEqual(deltas.size(), 1);
+    XCTAssertFalse(deltas[0].replacesAll);
+    XCTAssertEqual(deltas[0].slotCount, 11);
+    XCTAssertEqual(deltas[0].assimilatedFrameCount, 3);
+    XCTAssertTrue(deltas[0].changedSlotIndices == std::vector<int>({ 2, 7, 10 }));
+    XCTAssertTrue(deltas[0].removedSlotIndices == std::vector<int>({ 5 }));
+    XCTAssertEqual(deltas[0].changedSurfels[0].position.x(), 21);
+
+    // The copy matches the store, slot for slot
+    Surfels expected;
+    surfels.copySlotsTo(expected);
+    XCTAssertEqual(copy.size(), expected.size());
+    for (size_t index = 0; index < std::min(copy.size(), expected.size()); ++index) {
+        XCTAssertTrue(copy[index].position == expected[index].position);
+        XCTAssertEqual(copy[index].surfelSize, expected[index].surfelSize);
+    }
+}
+
+- (void)testCompactingReplacesEverything
+{
+    SurfelStore surfels;
+    for (int i = 0; i < 10; ++i) { surfels.push_back(_surfelAt(i)); }
+
+    SurfelDeltaStream deltaStream;
+    std::vector<SurfelDelta> deltas;
+    int subscriberID = deltaStream.subscribe([&](const SurfelDelta& delta) { deltas.push_back(delta); });
+    deltaStream.publish(surfels, 0);
+
+    SurfelIndexChanges indexChanges;
+    indexChanges.removedSurfelIndices = { 0, 1 };
+    surfels.markRemoved(indexChanges.removedSurfelIndices);
+    surfels.compact(indexChanges.compactedSurfelIndices);
+    deltaStream.recordChanges(indexChanges, surfels);
+    deltaStream.publish(surfels, 1);
+
+    XCTAssertEqual(deltas.size(), 2);
+    XCTAssertTrue(deltas[1].replacesAll);
+    XCTAssertEqual(deltas[1].changedSurfels.size(), 8);
+    XCTAssertEqual(deltas[1].changedSurfels[0].position.x(), 2);
+
+    deltaStream.unsubscribe(subscriberID);
+    XCTAssertFalse(deltaStream.hasSubscribers());
+}
+
+@end
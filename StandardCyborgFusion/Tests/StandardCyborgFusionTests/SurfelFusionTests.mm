@@ -0,0 +1,265 @@
+//
+//  SurfelFusionTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <algorithm>
+#import <cstring>
+#import <vector>
+
+#import <standard_cyborg/util/DataUtils.hpp>
+
+#import "CpuDepthProcessor.hpp"
+#import "CpuSurfelIndexMap.hpp"
+#import "OfflineReconstructor.hpp"
+#import "SurfelFusion.hpp"
+
+#import "Helpers/PathHelpers.h"
+
+using namespace standard_cyborg;
+
+@interface SurfelFusionTests : XCTestCase
+
+@end
+
+@implementation SurfelFusionTests
+
+- (NSString *)_depthFramePath:(int)frameIndex
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    return [testCasePath stringByAppendingFormat:@"/DepthFrames/frame-%03d.ply", frameIndex];
+}
+
+- (void)testNewSurfelsAreAppendedInPixelOrder
+{
+    std::unique_ptr<RawFrame> rawFrame = OfflineReconstructor::readRawFrame([[self _depthFramePath:0] UTF8String]);
+    CpuDepthProcessor depthProcessor;
+    ProcessedFrame frame(*rawFrame);
+    depthProcessor.computeFrameValues(frame, *rawFrame);
+
+    SurfelFusionConfiguration surfelFusionConfig;
+    surfelFusionConfig.cullLowConfidence = false;
+
+    SurfelFusion surfelFusion(std::make_shared<CpuSurfelIndexMap>());
+    SurfelStore surfels;
+    SparseSurfelLandmarksIndex landmarksIndex;
+    SurfelIndexChanges indexChanges;
+    XCTAssertTrue(surfelFusion.doFusion(surfelFusionConfig, frame, surfels, math::Mat4x4(), NULL, landmarksIndex, indexChanges));
+
+    // Into an empty model, every pixel that passes the filters becomes a surfel, in row-major order
+    float cosAngleOfIncidenceThreshold = cos(surfelFusionConfig.maxSurfelIncidenceThreshold);
+    size_t surfelIndex = 0;
+    for (size_t i = 0; i < frame.positions.size(); ++i) {
+        float depth = rawFrame->depths[i];
+        if (depth <= surfelFusionConfig.minDepth || depth > surfelFusionConfig.maxDepth) { continue; }
+        if (frame.inputConfidences[i] < surfelFusionConfig.inputConfidenceThreshold) { continue; }
+
+        Vector3f position = toVector3f(frame.positions[i]);
+        if (-position.dot(toVector3f(frame.normals[i])) / position.norm() < cosAngleOfIncidenceThreshold) { continue; }
+
+        XCTAssertLessThan(surfelIndex, surfels.size());
+        if (surfelIndex >= surfels.size()) { break; }
+        XCTAssertTrue(surfels.positions[surfelIndex].isApprox(position));
+        ++surfelIndex;
+    }
+    XCTAssertGreaterThan(surfelIndex, 0);
+    XCTAssertEqual(surfelIndex, surfels.size());
+}
+
+- (void)testFusionIsDeterministic
+{
+    SurfelFusionConfiguration surfelFusionConfig;
+    surfelFusionConfig.maxDepth = 0.75;
+
+    // Fuse the same frames twice, at slightly different poses, so that both new and existing
+    // surfels are exercised. Scheduling must not change a single bit of the result.
+    std::vector<Surfels> results;
+    for (int run = 0; run < 2; ++run) {
+        SurfelFusion surfelFusion(std::make_shared<CpuSurfelIndexMap>());
+        CpuDepthProcessor depthProcessor;
+        SurfelStore surfels;
+        SparseSurfelLandmarksIndex landmarksIndex;
+        SurfelIndexChanges indexChanges;
+
+        for (int frameIndex = 0; frameIndex < 10; ++frameIndex) {
+            std::unique_ptr<RawFrame> rawFrame = OfflineReconstructor::readRawFrame([[self _depthFramePath:frameIndex] UTF8String]);
+            ProcessedFrame frame(*rawFrame);
+            depthProcessor.computeFrameValues(frame, *rawFrame);
+
+            math::Mat4x4 extrinsicMatrix;
+            extrinsicMatrix.m03 = 0.0005f * frameIndex;
+            XCTAssertTrue(surfelFusion.doFusion(surfelFusionConfig, frame, surfels, extrinsicMatrix, NULL, landmarksIndex, indexChanges));
+        }
+
+        results.push_back(Surfels());
+        surfels.copyTo(results.back());
+    }
+
+    XCTAssertGreaterThan(results[0].size(), 0);
+    XCTAssertEqual(results[0].size(), results[1].size());
+    XCTAssertEqual(memcmp(results[0].data(), results[1].data(), results[0].size() * sizeof(Surfel)), 0);
+}
+
+// The pixels doFusion would use, whether to merge into a surfel or to create one
+static size_t _usablePixelCount(const ProcessedFrame& frame, const SurfelFusionConfiguration& surfelFusionConfig)
+{
+    float cosAngleOfIncidenceThreshold = cos(surfelFusionConfig.maxSurfelIncidenceThreshold);
+    size_t usableCount = 0;
+    for (size_t i = 0; i < frame.positions.size(); ++i) {
+        float depth = frame.rawFrame.depths[i];
+        if (depth <= surfelFusionConfig.minDepth || depth > surfelFusionConfig.maxDepth) { continue; }
+        if (frame.inputConfidences[i] < surfelFusionConfig.inputConfidenceThreshold) { continue; }
+
+        Vector3f position = toVector3f(frame.positions[i]);
+        if (-position.dot(toVector3f(frame.normals[i])) / position.norm() < cosAngleOfIncidenceThreshold) { continue; }
+
+        ++usableCount;
+    }
+
+    return usableCount;
+}
+
+- (void)testNoveltyEstimateMatchesFusion
+{
+    SurfelFusionConfiguration surfelFusionConfig;
+    surfelFusionConfig.maxDepth = 0.75;
+    surfelFusionConfig.cullLowConfidence = false;
+
+    // Estimating first lets fusion reuse the estimate's surfel index map, which mustn't make
+    // any difference to the result
+    std::vector<Surfels> results;
+    for (int run = 0; run < 2; ++run) {
+        bool estimatesNovelty = run == 1;
+        SurfelFusion surfelFusion(std::make_shared<CpuSurfelIndexMap>());
+        CpuDepthProcessor depthProcessor;
+        SurfelStore surfels;
+        SparseSurfelLandmarksIndex landmarksIndex;
+        SurfelIndexChanges indexChanges;
+
+        for (int frameIndex = 0; frameIndex < 10; ++frameIndex) {
+            std::unique_ptr<RawFrame> rawFrame = OfflineReconstructor::readRawFrame([[self _depthFramePath:frameIndex] UTF8String]);
+            ProcessedFrame frame(*rawFrame);
+            depthProcessor.computeFrameValues(frame, *rawFrame);
+
+            math::Mat4x4 extrinsicMatrix;
+            extrinsicMatrix.m03 = 0.0005f * frameIndex;
+
+            float novelty = -1;
+            if (estimatesNovelty) {
+                XCTAssertTrue(surfelFusion.estimateNovelty(surfelFusionConfig, frame, surfels, extrinsicMatrix, novelty));
+            }
+
+            size_t surfelCount = surfels.size();
+            XCTAssertTrue(surfelFusion.doFusion(surfelFusionConfig, frame, surfels, extrinsicMatrix, NULL, landmarksIndex, indexChanges));
+
+            // Without culling, every surfel fusion creates is appended. The estimate is only off
+            // where pixels merging into a surfel move it closer to or farther from the next ones.
+            if (estimatesNovelty) {
+                size_t newCount = surfels.size() - surfelCount;
+                size_t usableCount = _usablePixelCount(frame, surfelFusionConfig);
+                XCTAssertGreaterThan(usableCount, 0);
+                XCTAssertEqualWithAccuracy(novelty, (float)newCount / usableCount, 0.01);
+                if (frameIndex == 0) { XCTAssertEqual(novelty, 1); }
+            }
+        }
+
+        results.push_back(Surfels());
+        surfels.copyTo(results.back());
+    }
+
+    XCTAssertGreaterThan(results[0].size(), 0);
+    XCTAssertEqual(results[0].size(), results[1].size());
+    XCTAssertEqual(memcmp(results[0].data(), results[1].data(), results[0].size() * sizeof(Surfel)), 0);
+}
+
+- (void)testFinishingALargeModelCullsInOrder
+{
+    // Enough surfels to be culled in many blocks, some of them tombstones already
+    const int count = 300000;
+    SurfelStore surfels;
+    for (int i = 0; i < count; ++i) {
+        Surfel surfel;
+        surfel.position = Vector3f(i, 0, 0.3);
+        surfel.normal = Vector3f(0, 0, -1);
+        surfel.color = Vector3f(0.5, 0.5, 0.5);
+        surfel.weight = (i * 7) % 12;
+        surfel.lifetime = i % 20;
+        surfel.surfelSize = 0.001;
+        surfels.push_back(surfel);
+    }
+
+    std::vector<int> tombstoneIndices;
+    for (int i = 0; i < count; i += 11) { tombstoneIndices.push_back(i); }
+    surfels.markRemoved(tombstoneIndices);
+
+    SurfelFusionConfiguration surfelFusionConfig;
+    std::vector<int> expectedRemoved;
+    std::vector<int> expectedKept;
+    for (int i = 0; i < count; ++i) {
+        if (surfels.isRemoved(i)) { continue; }
+        (surfels.weights[i] < surfelFusionConfig.minCount ? expectedRemoved : expectedKept).push_back(i);
+    }
+
+    SurfelFusion surfelFusion(std::make_shared<CpuSurfelIndexMap>());
+    SparseSurfelLandmarksIndex landmarksIndex;
+    SurfelIndexChanges indexChanges;
+    surfelFusion.finish(surfelFusionConfig, surfels, landmarksIndex, indexChanges);
+
+    // Finishing ignores lifetimes, and lists what it culled in ascending order
+    XCTAssertTrue(indexChanges.removedSurfelIndices == expectedRemoved);
+    XCTAssertEqual(indexChanges.compactedSurfelIndices.size(), tombstoneIndices.size() + expectedRemoved.size());
+    XCTAssertTrue(std::is_sorted(indexChanges.compactedSurfelIndices.begin(), indexChanges.compactedSurfelIndices.end()));
+
+    XCTAssertEqual(surfels.size(), expectedKept.size());
+    XCTAssertTrue(surfels.freeSlots.empty());
+    for (size_t i = 0; i < std::min(surfels.size(), expectedKept.size()); ++i) {
+        if (surfels.positions[i].x() != expectedKept[i]) {
+            XCTFail(@"Surfel %zu should be %d", i, expectedKept[i]);
+            break;
+        }
+    }
+}
+
+- (void)testCulledSlotsAreReusedBeforeCompacting
+{
+    SurfelFusionConfiguration surfelFusionConfig;
+    surfelFusionConfig.maxDepth = 0.75;
+    surfelFusionConfig.maxTombstoneFraction = 1;
+
+    SurfelFusion surfelFusion(std::make_shared<CpuSurfelIndexMap>());
+    CpuDepthProcessor depthProcessor;
+    SurfelStore surfels;
+    SparseSurfelLandmarksIndex landmarksIndex;
+    SurfelIndexChanges indexChanges;
+    size_t reusedCount = 0;
+
+    for (int frameIndex = 0; frameIndex < 30; ++frameIndex) {
+        std::unique_ptr<RawFrame> rawFrame = OfflineReconstructor::readRawFrame([[self _depthFramePath:frameIndex] UTF8String]);
+        ProcessedFrame frame(*rawFrame);
+        depthProcessor.computeFrameValues(frame, *rawFrame);
+
+        std::vector<int> freeSlotsBefore = surfels.freeSlots;
+        XCTAssertTrue(surfelFusion.doFusion(surfelFusionConfig, frame, surfels, math::Mat4x4(), NULL, landmarksIndex, indexChanges));
+
+        // With compaction off, nothing moves and new surfels fill the lowest free slots first
+        XCTAssertTrue(indexChanges.compactedSurfelIndices.empty());
+        XCTAssertTrue(std::equal(indexChanges.reusedSurfelIndices.begin(), indexChanges.reusedSurfelIndices.end(), freeSlotsBefore.begin()));
+        for (int surfelIndex : indexChanges.removedSurfelIndices) { XCTAssertTrue(surfels.isRemoved(surfelIndex)); }
+        reusedCount += indexChanges.reusedSurfelIndices.size();
+    }
+
+    XCTAssertGreaterThan(reusedCount, 0);
+    XCTAssertGreaterThan(surfels.freeSlots.size(), 0);
+
+    // Finishing always compacts
+    size_t liveCount = surfels.liveCount();
+    surfelFusion.finish(surfelFusionConfig, surfels, landmarksIndex, indexChanges);
+    XCTAssertLessThanOrEqual(surfels.size(), liveCount);
+    XCTAssertTrue(surfels.freeSlots.empty());
+    XCTAssertTrue(std::none_of(surfels.tombstones.begin(), surfels.tombstones.end(), [](uint8_t tombstone) { return tombstone != 0; }));
+}
+
+@end
@@ -0,0 +1,137 @@
+//
+//  SurfelStoreTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <algorithm>
+#import <cstring>
+#import <vector>
+
+#import "SurfelStore.hpp"
+
+@interface SurfelStoreTests : XCTestCase
+
+@end
+
+@implementation SurfelStoreTests
+
+- (Surfel)_surfelWithIndex:(int)index
+{
+    Surfel surfel;
+    surfel.position = Vector3f(index, 0, 0);
+    surfel.normal = Vector3f(0, 0, 1);
+    surfel.color = Vector3f(0, index, 0);
+    surfel.weight = index;
+    surfel.lifetime = index;
+    surfel.surfelSize = 0.001 * index;
+
+    return surfel;
+}
+
+- (void)testRoundTripsSurfelRecords
+{
+    Surfels records;
+    for (int i = 0; i < 100; ++i) { records.push_back([self _surfelWithIndex:i]); }
+
+    SurfelStore store;
+    store.assign(records);
+    XCTAssertEqual(store.size(), records.size());
+    XCTAssertEqual(store.colors[42].y(), 42);
+    XCTAssertEqual(store.lifetimes[42], 42);
+
+    Surfels packed;
+    store.copyTo(packed);
+    XCTAssertEqual(packed.size(), records.size());
+    XCTAssertEqual(memcmp(packed.data(), records.data(), records.size() * sizeof(Surfel)), 0);
+}
+
+- (void)testRemoveKeepsOrder
+{
+    SurfelStore store;
+    for (int i = 0; i < 10; ++i) { store.push_back([self _surfelWithIndex:i]); }
+
+    store.remove({ 0, 3, 4, 9 });
+
+    std::vector<int> expected { 1, 2, 5, 6, 7, 8 };
+    XCTAssertEqual(store.size(), expected.size());
+    for (size_t i = 0; i < expected.size(); ++i) {
+        Surfel surfel = store[i];
+        XCTAssertEqual(surfel.position.x(), expected[i]);
+        XCTAssertEqual(surfel.color.y(), expected[i]);
+        XCTAssertEqual(surfel.weight, expected[i]);
+        XCTAssertEqual(surfel.lifetime, expected[i]);
+        XCTAssertEqual(surfel.surfelSize, 0.001f * expected[i]);
+    }
+
+    store.remove({});
+    XCTAssertEqual(store.size(), expected.size());
+}
+
+- (void)testRemovingFromALargeStoreKeepsOrder
+{
+    // Big enough to be split into blocks, with removed runs straddling their boundaries
+    const int count = 200000;
+    SurfelStore store;
+    for (int i = 0; i < count; ++i) { store.push_back([self _surfelWithIndex:i]); }
+
+    std::vector<int> removed;
+    std::vector<int> expected;
+    for (int i = 0; i < count; ++i) {
+        bool isRemoved = i % 3 == 0 || (i >= 16380 && i < 16400) || i >= count - 5;
+        (isRemoved ? removed : expected).push_back(i);
+    }
+
+    store.remove(removed);
+
+    XCTAssertEqual(store.size(), expected.size());
+    XCTAssertEqual(store.tombstones.size(), expected.size());
+    for (size_t i = 0; i < std::min(store.size(), expected.size()); ++i) {
+        if (store.positions[i].x() != expected[i] || store.lifetimes[i] != (uint32_t)expected[i] || store.weights[i] != expected[i]) {
+            XCTFail(@"Surfel %zu should be %d", i, expected[i]);
+            break;
+        }
+    }
+}
+
+- (void)testTombstonesKeepIndicesUntilCompacted
+{
+    SurfelStore store;
+    for (int i = 0; i < 10; ++i) { store.push_back([self _surfelWithIndex:i]); }
+
+    store.markRemoved({ 4, 7 });
+    store.markRemoved({ 1 });
+    XCTAssertEqual(store.size(), 10);
+    XCTAssertEqual(store.liveCount(), 7);
+    XCTAssertTrue(store.isRemoved(4));
+    XCTAssertFalse(store.isRemoved(5));
+    XCTAssertEqual(store.freeSlots, std::vector<int>({ 1, 4, 7 }));
+    XCTAssertEqual(store.positions[5].x(), 5);
+
+    // Packing leaves out tombstones, unless every slot is asked for
+    Surfels packed;
+    store.copyTo(packed);
+    XCTAssertEqual(packed.size(), 7);
+    XCTAssertEqual(packed[1].position.x(), 2);
+    store.copySlotsTo(packed);
+    XCTAssertEqual(packed.size(), 10);
+    XCTAssertEqual(packed[4].surfelSize, 0);
+    XCTAssertEqual(packed[5].surfelSize, 0.005f);
+
+    std::vector<int> compacted;
+    store.compact(compacted);
+    XCTAssertEqual(compacted, std::vector<int>({ 1, 4, 7 }));
+    XCTAssertEqual(store.size(), 7);
+    XCTAssertEqual(store.liveCount(), 7);
+    XCTAssertTrue(store.freeSlots.empty());
+
+    std::vector<int> expected { 0, 2, 3, 5, 6, 8, 9 };
+    for (size_t i = 0; i < expected.size(); ++i) {
+        XCTAssertFalse(store.isRemoved(i));
+        XCTAssertEqual(store[i].weight, expected[i]);
+    }
+}
+
+@end
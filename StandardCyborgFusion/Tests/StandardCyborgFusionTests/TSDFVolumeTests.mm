@@ -0,0 +1,222 @@
+//
+//  TSDFVolumeTests.mm
+//  StandardCyborgFusionTests
+//
+//  Created by Standard Cyborg on 10/16/26.
+//
+
+#import <XCTest/XCTest.h>
+#import <algorithm>
+#import <cmath>
+#import <memory>
+#import <vector>
+
+#import <standard_cyborg/util/DataUtils.hpp>
+
+#import "CpuDepthProcessor.hpp"
+#import "CpuSurfelIndexMap.hpp"
+#import "OfflineReconstructor.hpp"
+#import "TSDFModel.hpp"
+#import "TSDFVolume.hpp"
+
+#import "Helpers/PathHelpers.h"
+
+using namespace standard_cyborg;
+
+@interface TSDFVolumeTests : XCTestCase
+
+@end
+
+@implementation TSDFVolumeTests
+
+static const size_t _width = 160;
+static const size_t _height = 120;
+
+// A gently rippled wall about `depth` meters in front of the camera, with some depths missing
+// as NaNs if `withNaNs` is set
+static std::unique_ptr<ProcessedFrame> _makeWallFrame(float depth, bool withNaNs = false)
+{
+    sc3d::PerspectiveCamera camera;
+    camera.setNominalIntrinsicMatrix(math::Mat3x3(150, 0, 80,
+                                                  0, 150, 60,
+                                                  0, 0, 1));
+    camera.setIntrinsicMatrixReferenceSize(math::Vec2(_width, _height));
+
+    std::vector<float> depths(_width * _height);
+    std::vector<math::Vec3> colors(_width * _height, math::Vec3(0.2, 0.4, 0.6));
+    for (size_t y = 0; y < _height; ++y) {
+        for (size_t x = 0; x < _width; ++x) {
+            depths[y * _width + x] = depth + 0.002f * std::sin(0.1f * x) * std::cos(0.08f * y);
+            if (withNaNs && (x + 3 * y) % 17 == 0) { depths[y * _width + x] = NAN; }
+        }
+    }
+
+    RawFrame rawFrame(camera, _width, _height, std::move(depths), std::move(colors), 0);
+    std::unique_ptr<ProcessedFrame> frame(new ProcessedFrame(rawFrame));
+
+    CpuDepthProcessor depthProcessor;
+    depthProcessor.computeFrameValues(*frame, frame->rawFrame, true);
+
+    return frame;
+}
+
+- (void)testWallMeshFacesTheCamera
+{
+    std::unique_ptr<ProcessedFrame> frame = _makeWallFrame(0.3);
+    SurfelFusionConfiguration surfelFusionConfig;
+    TSDFVolume volume;
+    volume.integrate(*frame, Eigen::Matrix4f::Identity(), surfelFusionConfig);
+
+    std::shared_ptr<sc3d::Geometry> mesh = volume.extractMesh();
+    const std::vector<math::Vec3>& positions = mesh->getPositions();
+    const std::vector<math::Vec3>& normals = mesh->getNormals();
+    XCTAssertGreaterThan(mesh->getFaces().size(), 1000);
+
+    // Neighboring faces share their vertices rather than each having their own
+    XCTAssertLessThan(positions.size(), mesh->getFaces().size());
+
+    // The camera is at the origin, looking down -z at the wall
+    size_t facingCount = 0;
+    for (size_t i = 0; i < positions.size(); ++i) {
+        XCTAssertEqualWithAccuracy(positions[i].z, -0.3, 0.003);
+        if (math::Vec3::dot(normals[i], positions[i]) < -0.8 * positions[i].norm()) { ++facingCount; }
+    }
+    XCTAssertGreaterThan(facingCount, positions.size() * 0.95);
+    XCTAssertEqualWithAccuracy(mesh->getColors()[0].y, 0.4, 1e-5);
+}
+
+- (void)testTruncationBandWiderThanABlockIsCovered
+{
+    std::unique_ptr<ProcessedFrame> frame = _makeWallFrame(0.3);
+    SurfelFusionConfiguration surfelFusionConfig;
+    TSDFConfiguration config;
+    config.truncationDistance = 0.02;
+    XCTAssertGreaterThan(2 * config.truncationDistance, 2 * config.voxelSize * TSDFVolume::BlockSize);
+
+    TSDFVolume volume(config);
+    volume.integrate(*frame, Eigen::Matrix4f::Identity(), surfelFusionConfig);
+
+    // Every voxel along the central ray within the band was allocated and updated
+    int nearestK = (int)std::round((-0.3 + 0.9 * config.truncationDistance) / config.voxelSize);
+    int farthestK = (int)std::round((-0.3 - 0.9 * config.truncationDistance) / config.voxelSize);
+    for (int k = farthestK; k <= nearestK; ++k) {
+        const TSDFVolume::Voxel* voxel = volume.voxelAt(0, 0, k);
+        XCTAssertTrue(voxel != nullptr);
+        if (voxel != nullptr) { XCTAssertGreaterThan(voxel->weight, 0); }
+    }
+}
+
+- (void)testNaNDepthsAreSkipped
+{
+    std::unique_ptr<ProcessedFrame> frame = _makeWallFrame(0.3, true);
+    SurfelFusionConfiguration surfelFusionConfig;
+    // Let every pixel through on confidence, so only the finiteness check stands in the way
+    surfelFusionConfig.inputConfidenceThreshold = 0;
+    TSDFVolume volume;
+    volume.integrate(*frame, Eigen::Matrix4f::Identity(), surfelFusionConfig);
+
+    std::shared_ptr<sc3d::Geometry> mesh = volume.extractMesh();
+    XCTAssertGreaterThan(mesh->getFaces().size(), 1000);
+    for (const math::Vec3& position : mesh->getPositions()) {
+        XCTAssertEqualWithAccuracy(position.z, -0.3, 0.003);
+    }
+}
+
+- (void)testRemeshingOnlyWhatChangedMatchesMeshingEverything
+{
+    std::unique_ptr<ProcessedFrame> nearFrame = _makeWallFrame(0.3);
+    std::unique_ptr<ProcessedFrame> farFrame = _makeWallFrame(0.31);
+    SurfelFusionConfiguration surfelFusionConfig;
+
+    // The second frame is seen from a little to the side, so it reaches blocks the first didn't
+    Eigen::Matrix4f sideways = Eigen::Matrix4f::Identity();
+    sideways(0, 3) = 0.02;
+
+    TSDFVolume incremental;
+    incremental.integrate(*nearFrame, Eigen::Matrix4f::Identity(), surfelFusionConfig);
+    incremental.extractMesh();
+    size_t firstBlockCount = incremental.blockCount();
+    incremental.integrate(*farFrame, sideways, surfelFusionConfig);
+    std::shared_ptr<sc3d::Geometry> incrementalMesh = incremental.extractMesh();
+    XCTAssertGreaterThan(incremental.blockCount(), firstBlockCount);
+
+    TSDFVolume full;
+    full.integrate(*nearFrame, Eigen::Matrix4f::Identity(), surfelFusionConfig);
+    full.integrate(*farFrame, sideways, surfelFusionConfig);
+    std::shared_ptr<sc3d::Geometry> fullMesh = full.extractMesh();
+
+    XCTAssertEqual(incrementalMesh->getPositions().size(), fullMesh->getPositions().size());
+    XCTAssertEqual(incrementalMesh->getFaces().size(), fullMesh->getFaces().size());
+    XCTAssertTrue(incrementalMesh->getPositions() == fullMesh->getPositions());
+    XCTAssertTrue(incrementalMesh->getFaces() == fullMesh->getFaces());
+    for (size_t i = 0; i < std::min(incrementalMesh->getNormals().size(), fullMesh->getNormals().size()); ++i) {
+        XCTAssertLessThan((incrementalMesh->getNormals()[i] - fullMesh->getNormals()[i]).norm(), 1e-4);
+    }
+
+    // And with nothing new, extracting again gives the same mesh
+    std::shared_ptr<sc3d::Geometry> repeatedMesh = incremental.extractMesh();
+    XCTAssertTrue(repeatedMesh->getFaces() == incrementalMesh->getFaces());
+
+    // Restitching the changed blocks into the kept mesh keeps matching as frames keep coming
+    std::unique_ptr<ProcessedFrame> thirdFrame = _makeWallFrame(0.305, true);
+    Eigen::Matrix4f lower = Eigen::Matrix4f::Identity();
+    lower(1, 3) = -0.03;
+    incremental.integrate(*thirdFrame, lower, surfelFusionConfig);
+    full.integrate(*thirdFrame, lower, surfelFusionConfig);
+    XCTAssertTrue(incremental.extractMesh()->getFaces() == full.extractMesh()->getFaces());
+
+    incremental.reset();
+    XCTAssertEqual(incremental.blockCount(), 0);
+    XCTAssertEqual(incremental.extractMesh()->getFaces().size(), 0);
+}
+
+- (void)testModelMeshesTrackedFrames
+{
+    NSString *testCasePath = [[PathHelpers testCasesPath] stringByAppendingPathComponent:@"sven-ear-to-ear-lo-res"];
+    NSString *depthFramesDir = [testCasePath stringByAppendingPathComponent:@"DepthFrames"];
+    std::vector<std::string> framePaths = OfflineReconstructor::findRawFramePaths([depthFramesDir UTF8String]);
+    XCTAssertGreaterThan(framePaths.size(), 10);
+
+    CpuDepthProcessor depthProcessor;
+    PBFConfiguration pbfConfig;
+    ICPConfiguration icpConfig;
+    SurfelFusionConfiguration surfelFusionConfig;
+    TSDFModel model(std::make_shared<CpuSurfelIndexMap>());
+
+    int mergedFrameCount = 0;
+    double fusionSeconds = 0;
+    for (size_t frameIndex = 0; frameIndex < 10; ++frameIndex) {
+        std::unique_ptr<RawFrame> rawFrame = OfflineReconstructor::readRawFrame(framePaths[frameIndex]);
+        ProcessedFrame frame(*rawFrame);
+        depthProcessor.computeFrameValues(frame, *rawFrame);
+
+        PBFAssimilatedFrameMetadata metadata = model.assimilate(frame, pbfConfig, icpConfig, surfelFusionConfig, rawFrame->timestamp);
+        if (metadata.isMerged) { ++mergedFrameCount; }
+        fusionSeconds += metadata.fusionDuration;
+    }
+    PBFFinalStatistics statistics = model.finishAssimilating(surfelFusionConfig);
+    XCTAssertEqual(statistics.mergedFrameCount, mergedFrameCount);
+
+    // The final statistics count integrating into the volume, as each frame's metadata did
+    XCTAssertEqualWithAccuracy(statistics.fusionTime.total, fusionSeconds, 1e-9);
+
+    std::shared_ptr<sc3d::Geometry> mesh = model.buildMesh();
+    XCTAssertGreaterThan(mesh->getFaces().size(), 10000);
+
+    // The mesh lies on the surface the surfels describe
+    const Surfels& surfels = model.getTrackingModel().getSurfels();
+    const std::vector<math::Vec3>& positions = mesh->getPositions();
+    size_t nearCount = 0;
+    size_t sampleCount = 0;
+    for (size_t i = 0; i < positions.size(); i += positions.size() / 200 + 1) {
+        float closestSquaredDistance = INFINITY;
+        for (const Surfel& surfel : surfels) {
+            closestSquaredDistance = std::min(closestSquaredDistance, (surfel.position - toVector3f(positions[i])).squaredNorm());
+        }
+        if (closestSquaredDistance < 0.003f * 0.003f) { ++nearCount; }
+        ++sampleCount;
+    }
+    XCTAssertGreaterThan(nearCount, sampleCount * 0.9);
+}
+
+@end
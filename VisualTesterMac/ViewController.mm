@@ -182,6 +182,7 @@ static SCNVector3 SurfelsBoundingBoxCenter(const Surfels& surfels);
         for (const PBFAssimilatedFrameMetadata& datum : metadata) {
             nlohmann::json pose;
             pose["merged"] = datum.isMerged;
+            pose["skipped"] = datum.isSkipped;
             pose["timestamp"] = datum.timestamp;
 
             std::vector<std::vector<float>> rows;
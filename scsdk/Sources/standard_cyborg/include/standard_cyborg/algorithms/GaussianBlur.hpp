@@ -16,6 +16,7 @@ limitations under the License.
 #pragma once
 
 #include <standard_cyborg/util/AssertHelper.hpp>
+#include <standard_cyborg/util/TaskScheduler.hpp>
 
 #include <vector>
 #include <algorithm>
@@ -55,32 +56,38 @@ void GaussianBlur(std::vector<T>& output, const std::vector<T>& input, int width
 
     std::vector<T> tmpData (dataSize);
 
-    // Guassian blur is a separable convolution filter, so we blur first along rows, then along columns
-    for (int row = 0; row < height; row++) {
-        for (int col = 0; col < width; col++) {
-            int index = row * width + col;
-            T sum = kernel[0] * input[index];
-            for (int iRow = 1; iRow < iRadius; iRow++) {
-                int iRowM1 = std::max(0, row - iRow);
-                int iRowP1 = std::min(height - 1, row + iRow);
-                sum += kernel[iRow] * (input[iRowM1 * width + col] + input[iRowP1 * width + col]);
+    // Guassian blur is a separable convolution filter, so we blur first along rows, then along columns.
+    // Every output pixel is independent within a pass, so each pass is split up by rows.
+    util::TaskScheduler& scheduler = util::TaskScheduler::shared();
+    scheduler.parallelFor(0, height, 0, [&](size_t rowBegin, size_t rowEnd) {
+        for (int row = (int)rowBegin; row < (int)rowEnd; row++) {
+            for (int col = 0; col < width; col++) {
+                int index = row * width + col;
+                T sum = kernel[0] * input[index];
+                for (int iRow = 1; iRow < iRadius; iRow++) {
+                    int iRowM1 = std::max(0, row - iRow);
+                    int iRowP1 = std::min(height - 1, row + iRow);
+                    sum += kernel[iRow] * (input[iRowM1 * width + col] + input[iRowP1 * width + col]);
+                }
+                tmpData[index] = sum;
             }
-            tmpData[index] = sum;
         }
-    }
+    });
     
-    for (int row = 0; row < height; row++) {
-        for (int col = 0; col < width; col++) {
-            int index = row * width + col;
-            T sum = kernel[0] * tmpData[index];
-            for (int iCol = 1; iCol < iRadius; iCol++) {
-                int iColM1 = std::max(0, col - iCol);
-                int iColP1 = std::min(width - 1, col + iCol);
-                sum += kernel[iCol] * (tmpData[row * width + iColM1] + tmpData[row * width + iColP1]);
+    scheduler.parallelFor(0, height, 0, [&](size_t rowBegin, size_t rowEnd) {
+        for (int row = (int)rowBegin; row < (int)rowEnd; row++) {
+            for (int col = 0; col < width; col++) {
+                int index = row * width + col;
+                T sum = kernel[0] * tmpData[index];
+                for (int iCol = 1; iCol < iRadius; iCol++) {
+                    int iColM1 = std::max(0, col - iCol);
+                    int iColP1 = std::min(width - 1, col + iCol);
+                    sum += kernel[iCol] * (tmpData[row * width + iColM1] + tmpData[row * width + iColP1]);
+                }
+                output[index] = sum;
             }
-            output[index] = sum;
         }
-    }
+    });
 }
 
 }
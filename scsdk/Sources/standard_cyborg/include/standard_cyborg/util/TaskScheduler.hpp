@@ -0,0 +1,245 @@
+/*
+Copyright 2020 Standard Cyborg
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace standard_cyborg {
+
+namespace util {
+
+class TaskScheduler;
+
+/* A handle on a set of tasks submitted to a TaskScheduler. Waiting on a group
+ * runs queued tasks on the waiting thread until every task in the group has
+ * finished, so groups may be waited on from inside other tasks. If any task
+ * threw, waiting rethrows the first exception once they've all finished. The
+ * destructor waits for any outstanding tasks, but doesn't rethrow. */
+class TaskGroup {
+public:
+    explicit TaskGroup(TaskScheduler& scheduler);
+    ~TaskGroup();
+
+    /* Queue a task to run on the scheduler */
+    void run(std::function<void()> task);
+
+    /* Block until every task queued so far has finished */
+    void wait();
+
+private:
+    friend class TaskScheduler;
+
+    TaskScheduler& _scheduler;
+    std::atomic<size_t> _pendingCount;
+    std::mutex _lock;
+    std::condition_variable _finished;
+    std::exception_ptr _exception;
+
+    void _waitForTasks();
+    void _finishTask(std::exception_ptr exception);
+
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+};
+
+/* A work-stealing thread pool. Each worker pushes and pops tasks at the back of
+ * its own deque and, when that runs dry, steals from the front of the others'.
+ * Tasks submitted from outside the pool go to a shared injection queue.
+ *
+ * Most code should use the process-wide instance from `shared()` rather than
+ * creating its own pool, so that concurrent users don't oversubscribe the cores. */
+class TaskScheduler {
+public:
+    /* Creates a pool with `workerCount` threads. Threads waiting on a TaskGroup
+     * also run tasks, so a pool with zero workers runs everything inline. */
+    explicit TaskScheduler(int workerCount = defaultWorkerCount());
+    ~TaskScheduler();
+
+    /* The shared instance, with one worker per hardware thread unless
+     * `setSharedWorkerCount` was called first */
+    static TaskScheduler& shared();
+
+    /* Sets the number of workers the shared instance is created with. This only
+     * works before the first call to `shared()`, and returns false afterwards. */
+    static bool setSharedWorkerCount(int workerCount);
+
+    static int defaultWorkerCount();
+
+    int getWorkerCount() const;
+
+    /* Calls `body(rangeBegin, rangeEnd)` over subranges of [begin, end) no longer
+     * than `grainSize` elements, in parallel, and returns once they're all done.
+     * A `grainSize` of 0 picks one based on the number of workers. If `body`
+     * throws, the first exception is rethrown once every subrange has finished. */
+    void parallelFor(size_t begin,
+                     size_t end,
+                     size_t grainSize,
+                     const std::function<void(size_t rangeBegin, size_t rangeEnd)>& body);
+
+    /* Maps each `grainSize` chunk of [begin, end) to a value with `map(rangeBegin, rangeEnd)`
+     * in parallel, then folds the results with `reduce(lhs, rhs)` starting from `identity`.
+     * The chunks depend only on the range and grain size, and are reduced in order,
+     * so floating point results don't depend on scheduling. */
+    template <typename T, typename MapFunction, typename ReduceFunction>
+    T parallelReduce(size_t begin,
+                     size_t end,
+                     size_t grainSize,
+                     const T& identity,
+                     const MapFunction& map,
+                     const ReduceFunction& reduce);
+
+    /* The same, but keeping the chunks' results in `partials`, which keeps its capacity
+     * from one call to the next. Once it's big enough, neither this nor the parallelFor
+     * under it allocate, which lets callers run reductions in steady-state loops without
+     * touching the heap. */
+    template <typename T, typename MapFunction, typename ReduceFunction>
+    T parallelReduce(size_t begin,
+                     size_t end,
+                     size_t grainSize,
+                     const T& identity,
+                     const MapFunction& map,
+                     const ReduceFunction& reduce,
+                     std::vector<T>& partials);
+
+private:
+    friend class TaskGroup;
+
+    /* Either a function to call or, when `rangeBody` is set, a subrange of a parallelFor
+     * to keep splitting. Subranges are queued as plain fields rather than wrapped up in a
+     * std::function, which would allocate for each one. */
+    struct Task {
+        std::function<void()> function;
+        TaskGroup* group = nullptr;
+
+        const std::function<void(size_t, size_t)>* rangeBody = nullptr;
+        size_t rangeBegin = 0;
+        size_t rangeEnd = 0;
+        size_t grainSize = 0;
+    };
+
+    /* A double-ended queue of tasks in a ring buffer. It grows as needed and never
+     * shrinks, so unlike std::deque, queueing and taking tasks doesn't allocate once
+     * it's held as many tasks at once as it ever will. */
+    class TaskRing {
+    public:
+        bool empty() const { return _count == 0; }
+        void pushBack(Task task);
+        Task popBack();
+        Task popFront();
+
+    private:
+        std::vector<Task> _tasks;
+        size_t _front = 0;
+        size_t _count = 0;
+    };
+
+    struct WorkQueue {
+        std::mutex lock;
+        TaskRing tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> _workerQueues;
+    WorkQueue _injectionQueue;
+    std::vector<std::thread> _threads;
+
+    std::mutex _sleepLock;
+    std::condition_variable _wakeCondition;
+    std::atomic<size_t> _queuedTaskCount;
+    bool _shutdown = false;
+
+    void _threadMain(int workerIndex);
+    int _currentWorkerIndex() const;
+    size_t _defaultGrainSize(size_t count) const;
+
+    void _submit(Task task);
+    bool _tryTakeTask(int workerIndex, Task& taskOut);
+    void _runTask(Task& task);
+
+    void _splitRange(TaskGroup& group,
+                     size_t begin,
+                     size_t end,
+                     size_t grainSize,
+                     const std::function<void(size_t, size_t)>& body);
+
+    TaskScheduler(const TaskScheduler&) = delete;
+    TaskScheduler& operator=(const TaskScheduler&) = delete;
+};
+
+template <typename T, typename MapFunction, typename ReduceFunction>
+T TaskScheduler::parallelReduce(size_t begin,
+                                size_t end,
+                                size_t grainSize,
+                                const T& identity,
+                                const MapFunction& map,
+                                const ReduceFunction& reduce)
+{
+    std::vector<T> partials;
+
+    return parallelReduce(begin, end, grainSize, identity, map, reduce, partials);
+}
+
+template <typename T, typename MapFunction, typename ReduceFunction>
+T TaskScheduler::parallelReduce(size_t begin,
+                                size_t end,
+                                size_t grainSize,
+                                const T& identity,
+                                const MapFunction& map,
+                                const ReduceFunction& reduce,
+                                std::vector<T>& partials)
+{
+    if (begin >= end) { return identity; }
+
+    size_t count = end - begin;
+    if (grainSize == 0) { grainSize = _defaultGrainSize(count); }
+    size_t chunkCount = (count + grainSize - 1) / grainSize;
+
+    // A single chunk runs inline, without allocating anything
+    if (chunkCount == 1) { return reduce(identity, map(begin, end)); }
+
+    partials.assign(chunkCount, identity);
+    auto mapChunks = [&](size_t chunkBegin, size_t chunkEnd) {
+        for (size_t chunk = chunkBegin; chunk < chunkEnd; ++chunk) {
+            size_t rangeBegin = begin + chunk * grainSize;
+            size_t rangeEnd = std::min(end, rangeBegin + grainSize);
+            partials[chunk] = map(rangeBegin, rangeEnd);
+        }
+    };
+
+    // Capturing only a reference keeps the body small enough for std::function to store inline
+    parallelFor(0, chunkCount, 1, [&mapChunks](size_t chunkBegin, size_t chunkEnd) {
+        mapChunks(chunkBegin, chunkEnd);
+    });
+
+    T result = identity;
+    for (const T& partial : partials) {
+        result = reduce(result, partial);
+    }
+
+    return result;
+}
+
+} // namespace util
+
+} // namespace standard_cyborg
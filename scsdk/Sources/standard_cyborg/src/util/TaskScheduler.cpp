@@ -0,0 +1,366 @@
+/*
+Copyright 2020 Standard Cyborg
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include <standard_cyborg/util/TaskScheduler.hpp>
+
+#include <algorithm>
+#include <chrono>
+
+#if defined(__APPLE__)
+#include <pthread/qos.h>
+#endif
+
+namespace standard_cyborg {
+
+namespace util {
+
+// The scheduler and worker index of the current thread, if it's a worker
+static thread_local const TaskScheduler* tCurrentScheduler = nullptr;
+static thread_local int tCurrentWorkerIndex = -1;
+
+// The shared scheduler's worker count, or -1 for the default, and whether it's been created yet
+static std::mutex sSharedConfigurationLock;
+static int sSharedWorkerCount = -1;
+static bool sSharedSchedulerIsCreated = false;
+
+// MARK: - TaskGroup
+
+TaskGroup::TaskGroup(TaskScheduler& scheduler) :
+    _scheduler(scheduler),
+    _pendingCount(0)
+{}
+
+TaskGroup::~TaskGroup()
+{
+    _waitForTasks();
+}
+
+void TaskGroup::run(std::function<void()> task)
+{
+    _pendingCount++;
+
+    TaskScheduler::Task scheduledTask;
+    scheduledTask.function = std::move(task);
+    scheduledTask.group = this;
+
+    _scheduler._submit(std::move(scheduledTask));
+}
+
+void TaskGroup::wait()
+{
+    _waitForTasks();
+
+    // Hand the exception to whoever waits, once, so the group can be reused
+    std::exception_ptr exception;
+    std::swap(exception, _exception);
+    if (exception != nullptr) { std::rethrow_exception(exception); }
+}
+
+void TaskGroup::_waitForTasks()
+{
+    int workerIndex = _scheduler._currentWorkerIndex();
+
+    while (_pendingCount.load() > 0) {
+        // Help out rather than block, which also keeps nested waits from deadlocking
+        TaskScheduler::Task task;
+        if (_scheduler._tryTakeTask(workerIndex, task)) {
+            _scheduler._runTask(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_lock);
+        _finished.wait_for(lock, std::chrono::microseconds(200), [this] { return _pendingCount.load() == 0; });
+    }
+
+    // The last task to finish may still be holding the lock, so wait for it to let go
+    std::lock_guard<std::mutex> lock(_lock);
+}
+
+void TaskGroup::_finishTask(std::exception_ptr exception)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+
+    if (exception != nullptr && _exception == nullptr) { _exception = exception; }
+
+    if (--_pendingCount == 0) {
+        _finished.notify_all();
+    }
+}
+
+// MARK: - TaskScheduler
+
+TaskScheduler::TaskScheduler(int workerCount) :
+    _queuedTaskCount(0)
+{
+    workerCount = std::max(workerCount, 0);
+
+    for (int i = 0; i < workerCount; ++i) {
+        _workerQueues.emplace_back(new WorkQueue());
+    }
+
+    for (int i = 0; i < workerCount; ++i) {
+        _threads.emplace_back(&TaskScheduler::_threadMain, this, i);
+    }
+}
+
+TaskScheduler::~TaskScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(_sleepLock);
+        _shutdown = true;
+    }
+    _wakeCondition.notify_all();
+
+    for (std::thread& thread : _threads) {
+        thread.join();
+    }
+}
+
+TaskScheduler& TaskScheduler::shared()
+{
+    static TaskScheduler sharedScheduler([] {
+        std::lock_guard<std::mutex> lock(sSharedConfigurationLock);
+        sSharedSchedulerIsCreated = true;
+
+        return sSharedWorkerCount >= 0 ? sSharedWorkerCount : defaultWorkerCount();
+    }());
+
+    return sharedScheduler;
+}
+
+bool TaskScheduler::setSharedWorkerCount(int workerCount)
+{
+    std::lock_guard<std::mutex> lock(sSharedConfigurationLock);
+    if (sSharedSchedulerIsCreated) { return false; }
+
+    sSharedWorkerCount = std::max(workerCount, 0);
+
+    return true;
+}
+
+int TaskScheduler::defaultWorkerCount()
+{
+    return std::max((int)std::thread::hardware_concurrency(), 1);
+}
+
+int TaskScheduler::getWorkerCount() const
+{
+    return (int)_workerQueues.size();
+}
+
+void TaskScheduler::parallelFor(size_t begin,
+                                size_t end,
+                                size_t grainSize,
+                                const std::function<void(size_t, size_t)>& body)
+{
+    if (begin >= end) { return; }
+
+    if (grainSize == 0) { grainSize = _defaultGrainSize(end - begin); }
+
+    if (end - begin <= grainSize) {
+        body(begin, end);
+        return;
+    }
+
+    TaskGroup group(*this);
+    _splitRange(group, begin, end, grainSize, body);
+    group.wait();
+}
+
+// MARK: - TaskRing
+
+void TaskScheduler::TaskRing::pushBack(Task task)
+{
+    if (_count == _tasks.size()) {
+        // Unroll the ring into a bigger one, with the front back at the start
+        std::vector<Task> grown(std::max(2 * _tasks.size(), (size_t)16));
+        for (size_t i = 0; i < _count; ++i) {
+            grown[i] = std::move(_tasks[(_front + i) % _tasks.size()]);
+        }
+        _tasks.swap(grown);
+        _front = 0;
+    }
+
+    _tasks[(_front + _count) % _tasks.size()] = std::move(task);
+    _count++;
+}
+
+TaskScheduler::Task TaskScheduler::TaskRing::popBack()
+{
+    _count--;
+
+    return std::move(_tasks[(_front + _count) % _tasks.size()]);
+}
+
+TaskScheduler::Task TaskScheduler::TaskRing::popFront()
+{
+    Task task = std::move(_tasks[_front]);
+    _front = (_front + 1) % _tasks.size();
+    _count--;
+
+    return task;
+}
+
+// MARK: - Private
+
+void TaskScheduler::_threadMain(int workerIndex)
+{
+    tCurrentScheduler = this;
+    tCurrentWorkerIndex = workerIndex;
+
+#if defined(__APPLE__)
+    pthread_set_qos_class_self_np(QOS_CLASS_USER_INTERACTIVE, 0);
+#endif
+
+    while (true) {
+        Task task;
+        if (_tryTakeTask(workerIndex, task)) {
+            _runTask(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(_sleepLock);
+        _wakeCondition.wait(lock, [this] { return _shutdown || _queuedTaskCount.load() > 0; });
+
+        if (_shutdown && _queuedTaskCount.load() == 0) { return; }
+    }
+}
+
+int TaskScheduler::_currentWorkerIndex() const
+{
+    return tCurrentScheduler == this ? tCurrentWorkerIndex : -1;
+}
+
+size_t TaskScheduler::_defaultGrainSize(size_t count) const
+{
+    // A few chunks per thread (counting the caller) leaves room for stealing to balance the load
+    size_t chunkCount = 4 * (_workerQueues.size() + 1);
+
+    return std::max((size_t)1, (count + chunkCount - 1) / chunkCount);
+}
+
+void TaskScheduler::_submit(Task task)
+{
+    // Count the task before it becomes visible, so that the count never goes negative
+    {
+        std::lock_guard<std::mutex> lock(_sleepLock);
+        _queuedTaskCount++;
+    }
+
+    int workerIndex = _currentWorkerIndex();
+    WorkQueue& queue = workerIndex >= 0 ? *_workerQueues[workerIndex] : _injectionQueue;
+    {
+        std::lock_guard<std::mutex> lock(queue.lock);
+        queue.tasks.pushBack(std::move(task));
+    }
+
+    _wakeCondition.notify_one();
+}
+
+bool TaskScheduler::_tryTakeTask(int workerIndex, Task& taskOut)
+{
+    auto popBack = [&](WorkQueue& queue) {
+        std::lock_guard<std::mutex> lock(queue.lock);
+        if (queue.tasks.empty()) { return false; }
+
+        taskOut = queue.tasks.popBack();
+        return true;
+    };
+
+    auto popFront = [&](WorkQueue& queue) {
+        std::lock_guard<std::mutex> lock(queue.lock);
+        if (queue.tasks.empty()) { return false; }
+
+        taskOut = queue.tasks.popFront();
+        return true;
+    };
+
+    bool found = false;
+
+    // Newest work from our own queue is the most likely to still be in cache
+    if (workerIndex >= 0) {
+        found = popBack(*_workerQueues[workerIndex]);
+    }
+
+    if (!found) {
+        found = popFront(_injectionQueue);
+    }
+
+    // Steal the oldest, and generally largest, task from someone else
+    int queueCount = (int)_workerQueues.size();
+    int firstVictim = workerIndex >= 0 ? workerIndex + 1 : 0;
+    for (int i = 0; i < queueCount && !found; ++i) {
+        int victim = (firstVictim + i) % queueCount;
+        if (victim == workerIndex) { continue; }
+
+        found = popFront(*_workerQueues[victim]);
+    }
+
+    if (found) { _queuedTaskCount--; }
+
+    return found;
+}
+
+void TaskScheduler::_runTask(Task& task)
+{
+    // An exception can't escape a worker thread, and the group must still count the task
+    // as finished or its waiters would never return, so it's handed to the group instead
+    std::exception_ptr exception;
+    try {
+        if (task.rangeBody != nullptr) {
+            _splitRange(*task.group, task.rangeBegin, task.rangeEnd, task.grainSize, *task.rangeBody);
+        } else {
+            task.function();
+        }
+    } catch (...) {
+        exception = std::current_exception();
+    }
+
+    TaskGroup* group = task.group;
+    task = Task();
+
+    if (group != nullptr) { group->_finishTask(exception); }
+}
+
+void TaskScheduler::_splitRange(TaskGroup& group,
+                                size_t begin,
+                                size_t end,
+                                size_t grainSize,
+                                const std::function<void(size_t, size_t)>& body)
+{
+    // Hand off the upper half and keep splitting the lower, so thieves take the big pieces
+    while (end - begin > grainSize) {
+        size_t middle = begin + (end - begin) / 2;
+
+        Task task;
+        task.group = &group;
+        task.rangeBody = &body;
+        task.rangeBegin = middle;
+        task.rangeEnd = end;
+        task.grainSize = grainSize;
+
+        group._pendingCount++;
+        _submit(std::move(task));
+
+        end = middle;
+    }
+
+    body(begin, end);
+}
+
+} // namespace util
+
+} // namespace standard_cyborg
@@ -0,0 +1,61 @@
+/*
+ Copyright 2020 Standard Cyborg
+ 
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+
+#include <doctest/doctest.h>
+
+#include <standard_cyborg/algorithms/GaussianBlur.hpp>
+
+#include <vector>
+
+using standard_cyborg::algorithms::GaussianBlur;
+
+TEST_CASE("GaussianBlurTests.testBlurSpreadsAnImpulseEvenly") {
+    // Large enough to be split across threads
+    const int width = 301;
+    const int height = 257;
+    std::vector<float> input(width * height, 0.0f);
+    std::vector<float> output(width * height, -1.0f);
+    input[128 * width + 150] = 1.0f;
+
+    GaussianBlur(output, input, width, height, 2.0f);
+
+    auto at = [&](int row, int col) { return output[row * width + col]; };
+
+    float sum = 0.0f;
+    for (float value : output) { sum += value; }
+    CHECK(sum == doctest::Approx(1.0f).epsilon(1e-4));
+
+    CHECK(at(128, 150) > at(128, 151));
+    CHECK(at(128, 151) == doctest::Approx(at(128, 149)));
+    CHECK(at(127, 150) == doctest::Approx(at(129, 150)));
+    CHECK(at(127, 150) == doctest::Approx(at(128, 151)));
+    CHECK(at(0, 0) == 0.0f);
+    CHECK(at(height - 1, width - 1) == 0.0f);
+}
+
+TEST_CASE("GaussianBlurTests.testBlurKeepsAConstantImage") {
+    const int width = 97;
+    const int height = 211;
+    std::vector<float> input(width * height, 0.25f);
+    std::vector<float> output(width * height, 0.0f);
+
+    GaussianBlur(output, input, width, height, 3.0f);
+
+    for (float value : output) {
+        CHECK(value == doctest::Approx(0.25f));
+    }
+}
@@ -0,0 +1,211 @@
+/*
+ Copyright 2020 Standard Cyborg
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ */
+
+#include <doctest/doctest.h>
+
+#include <atomic>
+#include <chrono>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <standard_cyborg/util/TaskScheduler.hpp>
+
+using standard_cyborg::util::TaskGroup;
+using standard_cyborg::util::TaskScheduler;
+
+
+TEST_CASE("TaskSchedulerTests.testParallelForVisitsEveryIndexOnce") {
+    TaskScheduler scheduler(3);
+    std::vector<std::atomic<int>> visits(10007);
+    for (auto& visit : visits) { visit = 0; }
+
+    scheduler.parallelFor(0, visits.size(), 0, [&](size_t begin, size_t end) {
+        CHECK(begin < end);
+        for (size_t i = begin; i < end; ++i) { visits[i]++; }
+    });
+
+    for (auto& visit : visits) {
+        CHECK(visit.load() == 1);
+    }
+}
+
+TEST_CASE("TaskSchedulerTests.testParallelForRespectsGrainSize") {
+    TaskScheduler scheduler(2);
+    std::atomic<size_t> largestRange(0);
+
+    scheduler.parallelFor(5, 1005, 64, [&](size_t begin, size_t end) {
+        size_t size = end - begin;
+        size_t largest = largestRange.load();
+        while (size > largest && !largestRange.compare_exchange_weak(largest, size)) {}
+    });
+
+    CHECK(largestRange.load() <= 64);
+}
+
+TEST_CASE("TaskSchedulerTests.testParallelReduceIsDeterministic") {
+    std::vector<double> values(100000);
+    for (size_t i = 0; i < values.size(); ++i) { values[i] = 1.0 / (double)(i + 1); }
+
+    auto sum = [&](TaskScheduler& scheduler) {
+        return scheduler.parallelReduce(0, values.size(), 1000, 0.0,
+                                        [&](size_t begin, size_t end) {
+                                            return std::accumulate(values.begin() + begin, values.begin() + end, 0.0);
+                                        },
+                                        [](double lhs, double rhs) { return lhs + rhs; });
+    };
+
+    TaskScheduler singleWorker(1);
+    TaskScheduler manyWorkers(4);
+    double expected = sum(singleWorker);
+
+    CHECK(expected > 12.0);
+    for (int i = 0; i < 10; ++i) {
+        CHECK(sum(manyWorkers) == expected);
+    }
+}
+
+TEST_CASE("TaskSchedulerTests.testParallelReduceReusesPartials") {
+    TaskScheduler scheduler(3);
+    std::vector<size_t> partials;
+
+    auto countRange = [&](size_t end) {
+        return scheduler.parallelReduce(0, end, 10, (size_t)0,
+                                        [](size_t begin, size_t end) { return end - begin; },
+                                        [](size_t lhs, size_t rhs) { return lhs + rhs; },
+                                        partials);
+    };
+
+    CHECK(countRange(1000) == 1000);
+    CHECK(partials.size() == 100);
+
+    // A smaller reduction fits in the storage the first one left behind
+    const size_t* storage = partials.data();
+    CHECK(countRange(505) == 505);
+    CHECK(partials.size() == 51);
+    CHECK(partials.data() == storage);
+}
+
+TEST_CASE("TaskSchedulerTests.testEmptyRanges") {
+    TaskScheduler scheduler(2);
+    bool called = false;
+
+    scheduler.parallelFor(10, 10, 0, [&](size_t, size_t) { called = true; });
+    int result = scheduler.parallelReduce(3, 3, 0, 7,
+                                          [](size_t, size_t) { return 1; },
+                                          [](int lhs, int rhs) { return lhs + rhs; });
+
+    CHECK_FALSE(called);
+    CHECK(result == 7);
+}
+
+TEST_CASE("TaskSchedulerTests.testZeroWorkersRunsInline") {
+    TaskScheduler scheduler(0);
+    std::atomic<int> count(0);
+
+    TaskGroup group(scheduler);
+    for (int i = 0; i < 100; ++i) {
+        group.run([&] { count++; });
+    }
+    group.wait();
+
+    CHECK(scheduler.getWorkerCount() == 0);
+    CHECK(count.load() == 100);
+}
+
+TEST_CASE("TaskSchedulerTests.testNestedParallelism") {
+    // Waiting inside a task helps run other tasks, so this must not deadlock
+    // even when there are more outer tasks than workers
+    TaskScheduler scheduler(2);
+    std::atomic<size_t> total(0);
+
+    scheduler.parallelFor(0, 16, 1, [&](size_t outerBegin, size_t outerEnd) {
+        for (size_t outer = outerBegin; outer < outerEnd; ++outer) {
+            size_t innerSum = scheduler.parallelReduce(0, 1000, 10, (size_t)0,
+                                                       [](size_t begin, size_t end) { return end - begin; },
+                                                       [](size_t lhs, size_t rhs) { return lhs + rhs; });
+            total += innerSum;
+        }
+    });
+
+    CHECK(total.load() == 16 * 1000);
+}
+
+TEST_CASE("TaskSchedulerTests.testTaskGroupWaitsForAllTasks") {
+    std::atomic<int> finishedCount(0);
+
+    {
+        TaskGroup group(TaskScheduler::shared());
+        for (int i = 0; i < 64; ++i) {
+            group.run([&finishedCount] {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                finishedCount++;
+            });
+        }
+
+        // The destructor waits as well, but make sure an explicit wait is enough
+        group.wait();
+        CHECK(finishedCount.load() == 64);
+    }
+
+    CHECK(TaskScheduler::shared().getWorkerCount() >= 1);
+}
+
+TEST_CASE("TaskSchedulerTests.testExceptionsReachTheWaiter") {
+    TaskScheduler scheduler(2);
+    std::atomic<size_t> visitedCount(0);
+
+    // Thrown from a task on a worker as well as from the piece run on the calling thread
+    for (size_t throwingIndex : { (size_t)0, (size_t)999 }) {
+        visitedCount = 0;
+        CHECK_THROWS_AS(scheduler.parallelFor(0, 1000, 10, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                if (i == throwingIndex) { throw std::runtime_error("failed"); }
+                visitedCount++;
+            }
+        }), std::runtime_error);
+
+        // Only the rest of the throwing piece was skipped, and the scheduler is still usable afterwards
+        CHECK(visitedCount.load() < 1000);
+        CHECK(visitedCount.load() >= 1000 - 10);
+    }
+
+    CHECK_THROWS_AS(scheduler.parallelReduce(0, 1000, 10, 0,
+                                             [](size_t begin, size_t end) -> int {
+                                                 if (begin >= 500) { throw std::out_of_range("failed"); }
+                                                 return (int)(end - begin);
+                                             },
+                                             [](int lhs, int rhs) { return lhs + rhs; }),
+                    std::out_of_range);
+
+    TaskGroup group(scheduler);
+    for (int i = 0; i < 8; ++i) {
+        group.run([i] { if (i % 2 == 1) { throw std::runtime_error("failed"); } });
+    }
+    CHECK_THROWS_AS(group.wait(), std::runtime_error);
+
+    // Each exception is only rethrown once
+    group.run([] {});
+    CHECK_NOTHROW(group.wait());
+}
+
+TEST_CASE("TaskSchedulerTests.testSharedWorkerCountIsFixedOnceCreated") {
+    int workerCount = TaskScheduler::shared().getWorkerCount();
+
+    CHECK_FALSE(TaskScheduler::setSharedWorkerCount(workerCount + 1));
+    CHECK(TaskScheduler::shared().getWorkerCount() == workerCount);
+}